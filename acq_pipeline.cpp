@@ -0,0 +1,71 @@
+#include "acq_pipeline.h"
+#include "ae_pipeline.hpp"
+#include "trace.h"
+
+namespace {
+
+struct OnStats {
+    void operator()(const block_stats_t &r) const { acq_on_stats(&r); }
+};
+
+struct OnHit {
+    void operator()(const ae::Hit &h) const
+    {
+        acq_hit_t c = {h.t_us, h.start, h.duration, h.peak, h.counts};
+        TRACE(TR_HIT, h.peak);
+        acq_on_hit(&c);
+    }
+};
+
+struct OnOnset {
+    void operator()(const ae::Onset &o) const
+    {
+        acq_onset_t c = {o.t_us, o.at_q8, o.trigger, o.refined};
+        const uint64_t cand = o.trigger << ONSET_FRAC_BITS;
+        TRACE(TR_ONSET, (uint16_t)(cand > o.at_q8 ? (cand - o.at_q8) >> ONSET_FRAC_BITS : 0));
+        acq_on_onset(&c);
+    }
+};
+
+using AcqBlock = ae::AdcBlock<ACQ_BLOCK_SAMPLES, ACQ_SAMPLE_RATE>;
+
+using AcqPipeline = ae::Pipeline<
+    ae::Linearize<ACQ_BLOCK_SAMPLES>,
+    ae::BlockStats<ACQ_BLOCK_SAMPLES, OnStats>,
+    ae::DcBlock<ACQ_BLOCK_SAMPLES>,
+    ae::OnsetPicker<ACQ_BLOCK_SAMPLES, ACQ_ONSET_WINDOW, ACQ_ONSET_POST, OnOnset>,
+    ae::HitDetector<ACQ_HIT_DEFINITION_US, OnHit>,
+    ae::Discard>;
+
+// Static storage: the DcBlock scratch buffer lives in .bss
+AcqPipeline pipeline;
+uint32_t seq;
+
+} // namespace
+
+extern "C" void acq_pipeline_reset(void)
+{
+    pipeline.stage<3>().set_refine(ACQ_ONSET_AIC);
+    pipeline.reset();
+    pipeline.stage<4>().set_threshold(ACQ_HIT_THRESHOLD);
+    seq = 0;
+}
+
+extern "C" void acq_pipeline_set_cal(const uint16_t *lut)
+{
+    pipeline.stage<0>().set_table(lut);
+}
+
+extern "C" void acq_pipeline_push(const uint16_t *buf, uint64_t t_us)
+{
+    acq_pipeline_push_rate(buf, t_us, ACQ_SAMPLE_RATE, 0, ACQ_SAMPLE_RATE);
+}
+
+extern "C" void acq_pipeline_push_rate(const uint16_t *buf, uint64_t t_us, uint32_t rate,
+                                       uint16_t lead, uint32_t lead_rate)
+{
+    TRACE_BEGIN(TR_PIPELINE, seq);
+    pipeline.push(AcqBlock{buf, t_us, seq, rate, lead, lead_rate});
+    TRACE_END(TR_PIPELINE, seq);
+    seq++;
+}
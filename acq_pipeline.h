@@ -0,0 +1,84 @@
+#ifndef ACQ_PIPELINE_H
+#define ACQ_PIPELINE_H
+
+#include <stdint.h>
+
+#include "block_stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The firmware's per-buffer processing, composed from ae_pipeline.hpp
+ * stages in acq_pipeline.cpp:
+ *
+ *   DMA buffer -> Linearize -> BlockStats -> DcBlock -> OnsetPicker -> HitDetector
+ *
+ * Linearize maps codes through the board's ADC calibration table, if one
+ * is set; the raw codes still go to aXXXX.bin. BlockStats produces the
+ * aXXXX.sum record, OnsetPicker the arrival times (onset.h), HitDetector
+ * the AE hits. All are handed back to the application through the
+ * callbacks below, so this file builds unchanged for the host
+ * (tools/pipeline_bench).
+ */
+
+#ifndef ACQ_SAMPLE_RATE
+#define ACQ_SAMPLE_RATE       4000   // Hz; external ADC builds set their own
+#endif
+#ifndef ACQ_ADC_BITS
+#define ACQ_ADC_BITS          12     // code width; external ADC builds set their own
+#endif
+#define ACQ_BLOCK_SAMPLES     1024   // samples per DMA buffer
+#ifndef ACQ_HIT_THRESHOLD
+#define ACQ_HIT_THRESHOLD     (200 << (ACQ_ADC_BITS - 12))  // counts from the running DC level
+#endif
+#define ACQ_HIT_DEFINITION_US 2000   // quiet time that closes a hit
+#define ACQ_ONSET_WINDOW      256    // AIC window, samples
+#define ACQ_ONSET_POST        64     // of which after the STA/LTA candidate
+#ifndef ACQ_ONSET_AIC
+#define ACQ_ONSET_AIC         1      // 0: candidates only, refined on the host (ae_onset)
+#endif
+
+typedef struct {
+    uint64_t t_us;          // time of the first sample over threshold
+    uint64_t start;         // sample index in the recording
+    uint32_t duration;      // samples
+    uint16_t peak;          // counts from DC
+    uint16_t counts;        // threshold crossings
+} acq_hit_t;
+
+typedef struct {
+    uint64_t t_us;          // arrival, from the time_us_64() stamp of the block it was picked in
+    uint64_t at_q8;         // arrival, sample index in the recording x 256
+    uint64_t trigger;       // sample index of the STA/LTA candidate
+    uint8_t refined;        // by AIC; otherwise at_q8 is the candidate
+} acq_onset_t;
+
+// Start of a recording: stats and detector state back to defaults.
+void acq_pipeline_reset(void);
+
+// ADC calibration table (adc_cal.h) for the stats and the detector, NULL
+// for raw codes. Kept across resets.
+void acq_pipeline_set_cal(const uint16_t *lut);
+
+// One ACQ_BLOCK_SAMPLES buffer; t_us is when the DMA completed it.
+void acq_pipeline_push(const uint16_t *buf, uint64_t t_us);
+
+// Same, for a buffer taken at `rate` instead of ACQ_SAMPLE_RATE (burst
+// mode), whose first `lead` samples were still taken at lead_rate. Hit and
+// onset times follow the rate; durations, positions and the STA/LTA and
+// AIC windows stay in samples.
+void acq_pipeline_push_rate(const uint16_t *buf, uint64_t t_us, uint32_t rate, uint16_t lead,
+                            uint32_t lead_rate);
+
+// Implemented by the application
+void acq_on_stats(const block_stats_t *r);
+void acq_on_hit(const acq_hit_t *h);
+void acq_on_onset(const acq_onset_t *o);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,14 +1,67 @@
+import os
+import shutil
+import subprocess
+import sys
+
 import numpy as np
 import matplotlib.pyplot as plt
 
-# read raw uint16 data
-data = np.fromfile("data_plot/adc_log.bin", dtype=np.uint16)
+# Recordings longer than this are drawn from the ae_lod min/max cache
+# (tools/ae_lod) instead of plotting every sample.
+DIRECT_LIMIT = 200_000
+COLUMNS = 2000
+
+path = sys.argv[1] if len(sys.argv) > 1 else "data_plot/adc_log.bin"
+ae_lod = shutil.which("ae_lod") or os.path.join(
+    os.path.dirname(__file__), "..", "build-host", "ae_lod")
+
+samples = os.path.getsize(path) // 2
+print("Samples:", samples)
+print("First 10 samples:", np.fromfile(path, dtype=np.uint16, count=10))
+
+fig, ax = plt.subplots()
+ax.set_xlabel("Sample index")
+ax.set_ylabel("ADC value")
+
+if samples <= DIRECT_LIMIT or not os.path.exists(ae_lod):
+    # read raw uint16 data
+    ax.plot(np.fromfile(path, dtype=np.uint16))
+    plt.show()
+    sys.exit()
+
+
+def envelope(first, last):
+    """Min/max of [first, last) in COLUMNS columns, from the LOD cache."""
+    out = subprocess.run(
+        [ae_lod, "query", "--binary", path, str(first), str(last), str(COLUMNS)],
+        check=True, capture_output=True).stdout
+    mm = np.frombuffer(out, dtype=np.uint16).reshape(-1, 2)
+    x = np.linspace(first, last, len(mm), endpoint=False)
+    return x, mm[:, 0], mm[:, 1]
+
+
+x, lo, hi = envelope(0, samples)
+band = ax.fill_between(x, lo, hi, step="post", linewidth=0.5)
+ax.set_xlim(0, samples)
+busy = False
+
+
+def on_xlim(axes):
+    """Redraw the envelope for the visible range after pan/zoom."""
+    global band, busy
+    if busy:
+        return
+    busy = True
+    a, b = axes.get_xlim()
+    first = max(0, int(a))
+    last = min(samples, int(b) + 1)
+    if last > first:
+        x, lo, hi = envelope(first, last)
+        band.remove()
+        band = axes.fill_between(x, lo, hi, step="post", linewidth=0.5)
+        axes.figure.canvas.draw_idle()
+    busy = False
 
-print("Samples:", len(data))
-print("First 10 samples:", data[:10])
 
-# plot
-plt.plot(data)
-plt.xlabel("Sample index")
-plt.ylabel("ADC value")
+ax.callbacks.connect("xlim_changed", on_xlim)
 plt.show()
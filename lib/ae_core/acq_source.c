@@ -0,0 +1,11 @@
+#include "acq_source.h"
+
+#include <string.h>
+
+void acq_ring_init(acq_ring_t *r, uint16_t *buf, uint32_t blocks, uint32_t block_samples)
+{
+    memset((void *)r, 0, sizeof(*r));
+    r->buf = buf;
+    r->blocks = blocks;
+    r->block_samples = block_samples;
+}
@@ -0,0 +1,88 @@
+#ifndef ACQ_SOURCE_H
+#define ACQ_SOURCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Where a recording's samples come from, and the block ring they go into.
+ *
+ * A source fills ring blocks at the head: by DMA, completing them from its
+ * interrupt handler (the internal ADC, an external ADC clocked by PIO), or
+ * from poll() in the logger task (replay of a file or a generator). The
+ * logger takes blocks from the tail. Either side only ever writes its own
+ * index, so neither needs a lock.
+ *
+ * With the ring full, acq_ring_publish() counts an overrun and leaves the
+ * head where it is: the source refills the same block, and the blocks the
+ * logger has not written yet stay intact.
+ */
+
+#define ACQ_RING_MAX_BLOCKS 16
+
+typedef struct {
+    uint16_t *buf;
+    uint32_t blocks;                    // power of two, <= ACQ_RING_MAX_BLOCKS
+    uint32_t block_samples;
+    volatile uint32_t head;             // blocks completed (free-running)
+    volatile uint32_t tail;             // blocks taken by the consumer
+    volatile uint64_t time_us[ACQ_RING_MAX_BLOCKS];    // when each block completed
+    volatile uint32_t overruns;         // blocks completed with the ring full
+} acq_ring_t;
+
+void acq_ring_init(acq_ring_t *r, uint16_t *buf, uint32_t blocks, uint32_t block_samples);
+
+static inline uint16_t *acq_ring_block(const acq_ring_t *r, uint32_t i)
+{
+    return r->buf + (i & (r->blocks - 1)) * r->block_samples;
+}
+
+static inline uint64_t acq_ring_time(const acq_ring_t *r, uint32_t i)
+{
+    return r->time_us[i & (r->blocks - 1)];
+}
+
+static inline uint32_t acq_ring_backlog(const acq_ring_t *r)
+{
+    return r->head - r->tail;
+}
+
+// The block at the head is full. Returns false, and counts an overrun, if
+// the ring had no room for it. The next block to fill is
+// acq_ring_block(r, r->head) either way.
+static inline bool acq_ring_publish(acq_ring_t *r, uint64_t t_us)
+{
+    uint32_t head = r->head;
+    if (head + 1 - r->tail >= r->blocks) {
+        r->overruns++;
+        return false;
+    }
+    r->time_us[head & (r->blocks - 1)] = t_us;
+    r->head = head + 1;
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    bool reads_card;    // takes its input from the card: starts after the mount, no CMD25 stream
+
+    // Start filling ring blocks from the head. false if the source isn't there.
+    bool (*start)(void *ctx, acq_ring_t *ring);
+    void (*stop)(void *ctx);
+
+    // Sources without a DMA interrupt complete their blocks here, called
+    // from the logger task. Returns false at the end of the input. NULL for
+    // DMA sources.
+    bool (*poll)(void *ctx, acq_ring_t *ring);
+    void *ctx;
+} acq_source_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
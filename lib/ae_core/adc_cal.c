@@ -0,0 +1,127 @@
+#include "adc_cal.h"
+
+#include <string.h>
+
+// Codes 1..ADC_CAL_LAST take part in the fit; 0 and 4095 are the rails
+#define ADC_CAL_LAST (ADC_CAL_CODES - 2)
+
+void adc_hist_reset(adc_hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void adc_hist_add(adc_hist_t *h, const uint16_t *v, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+        h->count[v[i] & (ADC_CAL_CODES - 1)]++;
+    h->total += n;
+}
+
+static uint64_t inner_total(const adc_hist_t *h)
+{
+    uint64_t t = 0;
+    for (uint32_t k = 1; k <= ADC_CAL_LAST; k++)
+        t += h->count[k];
+    return t;
+}
+
+void adc_cal_quality(const adc_hist_t *h, adc_cal_quality_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    uint64_t t = inner_total(h);
+    if (t == 0)
+        return;
+
+    uint64_t below = 0;
+    for (uint32_t k = 1; k <= ADC_CAL_LAST; k++) {
+        uint64_t c = h->count[k];
+        if (c == 0)
+            q->missing++;
+
+        int32_t dnl = (int32_t)((int64_t)(c * ADC_CAL_LAST * 1000) / (int64_t)t) - 1000;
+        // Bin centre minus k, in 0.001 LSB
+        int64_t centre2t = (int64_t)t + (int64_t)ADC_CAL_LAST * (int64_t)(2 * below + c);
+        int32_t inl = (int32_t)((centre2t * 1000 - (int64_t)k * 2000 * (int64_t)t) / (2 * (int64_t)t));
+
+        if ((dnl < 0 ? -dnl : dnl) > q->dnl_max_mlsb) {
+            q->dnl_max_mlsb = dnl < 0 ? -dnl : dnl;
+            q->dnl_code = (uint16_t)k;
+        }
+        if ((inl < 0 ? -inl : inl) > q->inl_max_mlsb) {
+            q->inl_max_mlsb = inl < 0 ? -inl : inl;
+            q->inl_code = (uint16_t)k;
+        }
+        below += c;
+    }
+}
+
+int adc_cal_build(const adc_hist_t *h, uint16_t *lut)
+{
+    uint64_t t = inner_total(h);
+    if (t == 0)
+        return -1;
+
+    lut[0] = 0;
+    uint64_t below = 0;
+    for (uint32_t k = 1; k <= ADC_CAL_LAST; k++) {
+        uint64_t c = h->count[k];
+        // 16 * (0.5 + LAST * (below + c/2) / t), rounded
+        uint64_t num = 8 * (t + (uint64_t)ADC_CAL_LAST * (2 * below + c));
+        lut[k] = (uint16_t)((num + t / 2) / t);
+        below += c;
+    }
+    lut[ADC_CAL_CODES - 1] = (uint16_t)((ADC_CAL_CODES - 1) * ADC_CAL_ONE);
+    return 0;
+}
+
+void adc_cal_identity(uint16_t *lut)
+{
+    for (uint32_t k = 0; k < ADC_CAL_CODES; k++)
+        lut[k] = (uint16_t)(k * ADC_CAL_ONE);
+}
+
+// CRC-32 (IEEE 802.3) of the table as little-endian bytes
+uint32_t adc_cal_crc(const uint16_t *lut)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint32_t k = 0; k < ADC_CAL_CODES; k++) {
+        uint8_t b[2] = { (uint8_t)lut[k], (uint8_t)(lut[k] >> 8) };
+        for (int i = 0; i < 2; i++) {
+            crc ^= b[i];
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+void adc_cal_header(adc_cal_header_t *hdr, const uint16_t *lut, const adc_hist_t *h)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = ADC_CAL_MAGIC;
+    hdr->version = ADC_CAL_VERSION;
+    hdr->codes = ADC_CAL_CODES;
+    hdr->frac_bits = ADC_CAL_FRAC_BITS;
+    hdr->crc = adc_cal_crc(lut);
+    if (h) {
+        adc_cal_quality_t q;
+        adc_cal_quality(h, &q);
+        hdr->samples = h->total;
+        hdr->dnl_max_mlsb = (int16_t)(q.dnl_max_mlsb > INT16_MAX ? INT16_MAX : q.dnl_max_mlsb);
+        hdr->inl_max_mlsb = (int16_t)(q.inl_max_mlsb > INT16_MAX ? INT16_MAX : q.inl_max_mlsb);
+    }
+}
+
+int adc_cal_check(const adc_cal_header_t *hdr, const uint16_t *lut)
+{
+    if (hdr->magic != ADC_CAL_MAGIC || hdr->version != ADC_CAL_VERSION ||
+        hdr->codes != ADC_CAL_CODES || hdr->frac_bits != ADC_CAL_FRAC_BITS)
+        return -1;
+    return adc_cal_crc(lut) == hdr->crc ? 0 : -1;
+}
+
+void adc_cal_apply(const uint16_t *lut, const uint16_t *in, uint16_t *out, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+        out[i] = (uint16_t)((lut[in[i] & (ADC_CAL_CODES - 1)] + ADC_CAL_ONE / 2) >> ADC_CAL_FRAC_BITS);
+}
@@ -0,0 +1,96 @@
+#ifndef ADC_CAL_H
+#define ADC_CAL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ADC linearity calibration by code density.
+ *
+ * A slow ramp (or triangle) that runs past both rails hits every code in
+ * proportion to its width, so the histogram of a long capture measures the
+ * transition levels: code k spans the cumulative share of codes 1..k-1 up
+ * to that of 1..k, scaled onto the ideal 0.5 .. 4094.5 LSB range. The
+ * rail codes 0 and 4095 collect the overrange and are left out; the ends
+ * are fixed, so the table corrects INL and DNL but not gain or offset.
+ *
+ * The RP2040/RP2350 ADC has wide codes around 512, 1536, 2560 and 3584
+ * (DNL up to about +1 LSB, with narrow neighbours); they show up as spikes
+ * in amplitude histograms and bias peak-based AE parameters.
+ *
+ * The table maps every code to the centre of its measured bin in Q4
+ * (counts * 16), so a host reader keeps the sub-LSB position and the
+ * firmware rounds back to 12 bits. adccal.bin on the card:
+ *
+ *   adc_cal_header_t          32 bytes
+ *   uint16_t lut[4096]        Q4, little endian
+ *
+ * Integer-only; the host tool tools/ae_adccal builds the same table from a
+ * recorded ramp.
+ */
+
+#define ADC_CAL_CODES     4096
+#define ADC_CAL_FRAC_BITS 4
+#define ADC_CAL_ONE       (1u << ADC_CAL_FRAC_BITS)
+#define ADC_CAL_MAGIC     0x4C414341u   // "ACAL"
+#define ADC_CAL_VERSION   1
+#define ADC_CAL_FILE      "adccal.bin"
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t codes;                 // ADC_CAL_CODES
+    uint8_t frac_bits;              // ADC_CAL_FRAC_BITS
+    uint8_t reserved0[3];
+    uint32_t crc;                   // adc_cal_crc() of the table
+    uint64_t samples;               // histogram size the table was built from
+    int16_t dnl_max_mlsb;           // before correction, 0.001 LSB
+    int16_t inl_max_mlsb;
+    uint8_t reserved[4];
+} adc_cal_header_t;
+
+typedef struct {
+    uint32_t count[ADC_CAL_CODES];
+    uint64_t total;
+} adc_hist_t;
+
+typedef struct {
+    int32_t dnl_max_mlsb;           // largest |DNL|, 0.001 LSB
+    int32_t inl_max_mlsb;           // largest |INL|
+    uint16_t dnl_code;              // where
+    uint16_t inl_code;
+    uint16_t missing;               // codes 1..4094 never seen
+} adc_cal_quality_t;
+
+void adc_hist_reset(adc_hist_t *h);
+void adc_hist_add(adc_hist_t *h, const uint16_t *v, uint32_t n);
+
+// Linearity of the histogram, end-point fit over codes 1..4094.
+void adc_cal_quality(const adc_hist_t *h, adc_cal_quality_t *q);
+
+// Table from the histogram; needs at least one sample in codes 1..4094.
+// Returns 0, or -1 if there is nothing to build from.
+int adc_cal_build(const adc_hist_t *h, uint16_t *lut);
+
+// Identity table: lut[c] = c in Q4.
+void adc_cal_identity(uint16_t *lut);
+
+uint32_t adc_cal_crc(const uint16_t *lut);
+
+void adc_cal_header(adc_cal_header_t *hdr, const uint16_t *lut, const adc_hist_t *h);
+
+// Returns 0 if hdr and lut belong together.
+int adc_cal_check(const adc_cal_header_t *hdr, const uint16_t *lut);
+
+// The firmware pass: codes through the table, rounded back to 12 bits.
+// in and out may be the same buffer.
+void adc_cal_apply(const uint16_t *lut, const uint16_t *in, uint16_t *out, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+#include "block_stats.h"
+
+_Static_assert(sizeof(block_stats_t) == 32, "sidecar record layout");
+_Static_assert(sizeof(summary_header_t) == 32, "sidecar header layout");
+
+void block_stats_compute(block_stats_t *st, const uint16_t *p, uint32_t n,
+                         uint16_t center, uint8_t *above)
+{
+    uint32_t mn = 0xFFFF, mx = 0;
+    uint32_t sum = 0, clipped = 0, zc = 0;
+    uint64_t sumsq = 0;
+    uint32_t prev = *above;
+
+    if (prev == BLOCK_STATS_ABOVE_UNKNOWN)
+        prev = n ? p[0] >= center : 0;
+
+    // Branch-free body: compiles to min/max/select on the M33 and
+    // vectorises on the host.
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t v = p[i];
+        mn = v < mn ? v : mn;
+        mx = v > mx ? v : mx;
+        sum += v;
+        sumsq += v * v;
+        clipped += (v <= BLOCK_STATS_CLIP_LO) | (v >= BLOCK_STATS_CLIP_HI);
+        uint32_t a = v >= center;
+        zc += a ^ prev;
+        prev = a;
+    }
+
+    st->min = (uint16_t)mn;
+    st->max = (uint16_t)mx;
+    st->sum = sum;
+    st->sumsq = sumsq;
+    st->clipped = (uint16_t)clipped;
+    st->zero_cross = (uint16_t)zc;
+    *above = (uint8_t)prev;
+}
+
+uint16_t block_stats_mean(const block_stats_t *st, uint32_t n)
+{
+    return n ? (uint16_t)((st->sum + n / 2) / n) : 0;
+}
+
+uint16_t block_stats_center(const uint16_t *p, uint32_t n)
+{
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+        sum += p[i];
+    return n ? (uint16_t)((sum + n / 2) / n) : 0;
+}
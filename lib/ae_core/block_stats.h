@@ -0,0 +1,68 @@
+#ifndef BLOCK_STATS_H
+#define BLOCK_STATS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-block summary of one DMA buffer, written to aXXXX.sum next to the
+ * raw aXXXX.bin. One 32-byte record per 1024-sample block, so a host tool
+ * reads ~1.6 % of the recording to find the interesting parts.
+ *
+ * aXXXX.sum layout (little endian):
+ *   summary_header_t   32 bytes
+ *   block_stats_t      32 bytes each, in block order
+ */
+
+#define BLOCK_STATS_CLIP_LO 0
+#ifndef BLOCK_STATS_CLIP_HI
+#define BLOCK_STATS_CLIP_HI 4095     // 12-bit full scale
+#endif
+
+#define BLOCK_STATS_ABOVE_UNKNOWN 0xFF
+
+#define SUMMARY_MAGIC   0x4D534541u  // "AESM"
+#define SUMMARY_VERSION 1
+
+typedef struct {
+    uint64_t t_us;          // time_us_64() when the block completed
+    uint64_t sumsq;         // sum of v*v
+    uint32_t seq;           // block number in the .bin
+    uint32_t sum;           // sum of v
+    uint16_t min;
+    uint16_t max;
+    uint16_t clipped;       // samples at or beyond the ADC rails
+    uint16_t zero_cross;    // crossings of the previous block's mean
+} block_stats_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;   // sizeof(block_stats_t)
+    uint32_t block_samples;
+    uint32_t sample_rate;
+    uint32_t cal_crc;       // ADC table the stats went through (adc_cal_crc), 0 = raw codes
+    uint8_t reserved[12];
+} summary_header_t;
+
+// Single pass over n samples. Zero crossings are counted around `center`;
+// *above carries the sign of the last sample into the next block; start
+// with *above = BLOCK_STATS_ABOVE_UNKNOWN.
+void block_stats_compute(block_stats_t *st, const uint16_t *p, uint32_t n,
+                         uint16_t center, uint8_t *above);
+
+// Mean of the block, rounded: the next block's crossing reference.
+uint16_t block_stats_mean(const block_stats_t *st, uint32_t n);
+
+// Rounded mean of the samples themselves: the centre for the first block
+// of a recording, which has no previous block to take it from.
+uint16_t block_stats_center(const uint16_t *p, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#include "boot_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define BOOT_BAR_COLS 40
+
+int boot_begin(boot_log_t *b, const char *name, uint64_t now_us)
+{
+    if (b->n >= BOOT_MAX_PHASES)
+        return -1;
+    boot_phase_t *p = &b->phase[b->n];
+    p->name = name;
+    p->start_us = (uint32_t)now_us;
+    p->end_us = BOOT_OPEN;
+    return b->n++;
+}
+
+void boot_end(boot_log_t *b, int id, uint64_t now_us)
+{
+    if (id >= 0 && id < b->n)
+        b->phase[id].end_us = (uint32_t)now_us;
+}
+
+void boot_mark(boot_log_t *b, const char *name, uint64_t now_us)
+{
+    boot_end(b, boot_begin(b, name, now_us), now_us);
+}
+
+const boot_phase_t *boot_find(const boot_log_t *b, const char *name)
+{
+    for (int i = 0; i < b->n; i++)
+        if (strcmp(b->phase[i].name, name) == 0)
+            return &b->phase[i];
+    return NULL;
+}
+
+void boot_log_print(const boot_log_t *b)
+{
+    uint32_t last = 1;
+    for (int i = 0; i < b->n; i++) {
+        const boot_phase_t *p = &b->phase[i];
+        uint32_t end = p->end_us == BOOT_OPEN ? p->start_us : p->end_us;
+        if (end > last)
+            last = end;
+    }
+
+    printf("%-16s %9s %9s %9s\n", "phase", "start_ms", "end_ms", "dur_ms");
+    for (int i = 0; i < b->n; i++) {
+        const boot_phase_t *p = &b->phase[i];
+        char bar[BOOT_BAR_COLS + 1];
+        uint32_t c0 = (uint32_t)((uint64_t)p->start_us * BOOT_BAR_COLS / last);
+        uint32_t c1 = p->end_us == BOOT_OPEN ? c0 : (uint32_t)((uint64_t)p->end_us * BOOT_BAR_COLS / last);
+        if (c0 >= BOOT_BAR_COLS)
+            c0 = BOOT_BAR_COLS - 1;
+        if (c1 <= c0)
+            c1 = c0 + 1;
+        if (c1 > BOOT_BAR_COLS)
+            c1 = BOOT_BAR_COLS;
+        memset(bar, ' ', c0);
+        memset(bar + c0, p->end_us == p->start_us ? '|' : '#', c1 - c0);
+        bar[c1] = 0;
+
+        if (p->end_us == BOOT_OPEN)
+            printf("%-16s %9.2f %9s %9s  %s\n", p->name, p->start_us / 1000.0, "-", "-", bar);
+        else
+            printf("%-16s %9.2f %9.2f %9.2f  %s\n", p->name, p->start_us / 1000.0,
+                   p->end_us / 1000.0, (p->end_us - p->start_us) / 1000.0, bar);
+    }
+}
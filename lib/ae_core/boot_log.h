@@ -0,0 +1,55 @@
+#ifndef BOOT_LOG_H
+#define BOOT_LOG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-phase boot timing.
+ *
+ * Boot steps overlap (the ADC samples into RAM while the card mounts, the
+ * LCD's reset time runs during the mount), so every phase has its own
+ * start and end on the caller's clock. On target that is time_us_64(),
+ * which counts from reset, so the first phase can start at 0. Marks are
+ * phases with no duration (first sample, first block on the card).
+ *
+ * boot_log_print() draws the phases on a common time axis:
+ *
+ *   phase            start_ms  end_ms    dur_ms
+ *   runtime              0.00    3.10     3.10  ###
+ *   adc                  3.10    3.16     0.06     #
+ *   card                 3.40   92.70    89.30     ####################
+ */
+
+#define BOOT_MAX_PHASES 16
+#define BOOT_OPEN       UINT32_MAX
+
+typedef struct {
+    const char *name;
+    uint32_t start_us;
+    uint32_t end_us;        // BOOT_OPEN until boot_end()
+} boot_phase_t;
+
+typedef struct {
+    boot_phase_t phase[BOOT_MAX_PHASES];
+    uint8_t n;
+} boot_log_t;
+
+// Returns the phase id for boot_end(), or -1 if the table is full.
+int boot_begin(boot_log_t *b, const char *name, uint64_t now_us);
+void boot_end(boot_log_t *b, int id, uint64_t now_us);
+void boot_mark(boot_log_t *b, const char *name, uint64_t now_us);
+
+// Phase/mark by name, NULL if there is none
+const boot_phase_t *boot_find(const boot_log_t *b, const char *name);
+
+void boot_log_print(const boot_log_t *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,332 @@
+#include "clk_tune.h"
+
+#include <string.h>
+
+_Static_assert(sizeof(clk_tune_entry_t) == 32, "sdclk.bin entry layout");
+_Static_assert(sizeof(clk_tune_header_t) == 32, "sdclk.bin header layout");
+
+#define NCR_MAX        8            // bytes to wait for R1 / data response
+#define TOKEN_MAX      4096         // bytes to wait for a read's data token
+#define WAIT_MAX       65536        // bytes to wait for the card to go ready
+#define TOKEN_START    0xFE
+
+void clk_tune_config_default(clk_tune_config_t *cfg)
+{
+    static const uint32_t ladder[] = {
+        4000000, 8000000, 12000000, 16000000, 20000000, 25000000,
+    };
+    memset(cfg, 0, sizeof(*cfg));
+    memcpy(cfg->ladder, ladder, sizeof(ladder));
+    cfg->steps = sizeof(ladder) / sizeof(ladder[0]);
+    cfg->climb_rounds = 4;
+    cfg->confirm_rounds = 32;
+    cfg->window_ops = 1024;
+    cfg->max_errors = 1;
+}
+
+void clk_tune_init(clk_tune_t *t, const clk_tune_config_t *cfg, uint32_t hz)
+{
+    memset(t, 0, sizeof(*t));
+    t->cfg = *cfg;
+    t->state = CLK_TUNE_PROBE;
+    t->top = (uint8_t)(cfg->steps - 1);
+    if (hz) {
+        while (t->step < t->top && cfg->ladder[t->step + 1] <= hz)
+            t->step++;
+        t->top = t->step;
+        t->confirming = true;
+    }
+}
+
+clk_tune_state_t clk_tune_next(const clk_tune_t *t, uint32_t *hz, uint32_t *rounds)
+{
+    *hz = t->cfg.ladder[t->step];
+    *rounds = t->confirming ? t->cfg.confirm_rounds : t->cfg.climb_rounds;
+    return (clk_tune_state_t)t->state;
+}
+
+void clk_tune_result(clk_tune_t *t, uint32_t errors)
+{
+    if (t->state != CLK_TUNE_PROBE)
+        return;
+    t->probes++;
+    t->rounds += t->confirming ? t->cfg.confirm_rounds : t->cfg.climb_rounds;
+    t->probe_errors += errors;
+
+    if (!errors) {
+        if (t->confirming)
+            t->state = CLK_TUNE_DONE;
+        else if (t->step < t->top)
+            t->step++;
+        else
+            t->confirming = true;      // the top of the ladder passed the climb
+        return;
+    }
+
+    // Back off: the step below is the highest that may still work
+    if (t->step == 0) {
+        t->state = CLK_TUNE_FAILED;
+        return;
+    }
+    t->step--;
+    t->top = t->step;
+    t->confirming = true;
+}
+
+uint32_t clk_tune_hz(const clk_tune_t *t)
+{
+    return t->cfg.ladder[t->state == CLK_TUNE_FAILED ? 0 : t->step];
+}
+
+uint32_t clk_tune_note(clk_tune_t *t, bool ok)
+{
+    t->ops++;
+    if (!ok) {
+        t->errors++;
+        t->write_errors++;
+    }
+
+    uint32_t hz = 0;
+    if (t->errors > t->cfg.max_errors) {
+        if (t->step > 0) {
+            t->step--;
+            t->downshifts++;
+            hz = t->cfg.ladder[t->step];
+        }
+        t->ops = t->errors = 0;
+    } else if (t->ops >= t->cfg.window_ops) {
+        t->ops = t->errors = 0;
+    }
+    return hz;
+}
+
+// ---- Probe ----
+
+static void xfer(const sd_transport_t *t, const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    t->xfer_start(t->ctx, tx, rx, len, false);
+    while (t->xfer_busy(t->ctx)) {
+    }
+}
+
+static uint8_t rx_byte(const sd_transport_t *t)
+{
+    uint8_t b;
+    xfer(t, NULL, &b, 1);
+    return b;
+}
+
+// The card holds MISO low while busy
+static bool wait_ready(const sd_transport_t *t)
+{
+    uint8_t b[8];
+    for (uint32_t n = 0; n < WAIT_MAX; n += sizeof(b)) {
+        xfer(t, NULL, b, sizeof(b));
+        if (b[sizeof(b) - 1] == 0xFF)
+            return true;
+    }
+    return false;
+}
+
+// Selects the card and sends the command: its R1, 0xFF if none came
+static uint8_t command(const sd_transport_t *t, uint8_t cmd, uint32_t arg)
+{
+    uint8_t c[6] = {
+        (uint8_t)(0x40 | cmd), (uint8_t)(arg >> 24), (uint8_t)(arg >> 16),
+        (uint8_t)(arg >> 8), (uint8_t)arg, 0,
+    };
+    c[5] = (uint8_t)(sd_crc7(c, 5) << 1) | 1;
+
+    t->select(t->ctx, true);
+    if (!wait_ready(t))
+        return 0xFF;
+    xfer(t, c, NULL, sizeof(c));
+    for (int i = 0; i < NCR_MAX; i++) {
+        uint8_t r = rx_byte(t);
+        if (!(r & 0x80))
+            return r;
+    }
+    return 0xFF;
+}
+
+// One more byte after CS goes high, so the card lets go of MISO
+static void release(const sd_transport_t *t)
+{
+    t->select(t->ctx, false);
+    rx_byte(t);
+}
+
+// Data token, len bytes and their CRC16, after a command that reads
+static bool read_data(const sd_transport_t *t, uint8_t *buf, uint32_t len)
+{
+    uint8_t b = 0xFF;
+    for (int i = 0; i < TOKEN_MAX && b == 0xFF; i++)
+        b = rx_byte(t);
+    if (b != TOKEN_START)
+        return false;
+    uint8_t c[2];
+    xfer(t, NULL, buf, len);
+    xfer(t, NULL, c, sizeof(c));
+    return sd_crc16(0, buf, len) == (uint16_t)(c[0] << 8 | c[1]);
+}
+
+static bool read_block(const sd_transport_t *t, uint32_t addr, uint8_t *buf)
+{
+    bool ok = command(t, 17, addr) == 0x00 && read_data(t, buf, SD_BLOCK_SIZE);
+    release(t);
+    return ok;
+}
+
+static bool write_block(const sd_transport_t *t, uint32_t addr, const uint8_t *buf)
+{
+    bool ok = command(t, 24, addr) == 0x00;
+    if (ok) {
+        const uint16_t crc = sd_crc16(0, buf, SD_BLOCK_SIZE);
+        const uint8_t hdr[2] = { 0xFF, TOKEN_START };        // Nwr gap, start token
+        const uint8_t c[2] = { (uint8_t)(crc >> 8), (uint8_t)crc };
+        xfer(t, hdr, NULL, sizeof(hdr));
+        xfer(t, buf, NULL, SD_BLOCK_SIZE);
+        xfer(t, c, NULL, sizeof(c));
+
+        uint8_t r = 0xFF;
+        for (int i = 0; i < NCR_MAX && r == 0xFF; i++)
+            r = rx_byte(t);
+        ok = (r & 0x1F) == 0x05;                               // data accepted
+        ok = wait_ready(t) && ok;                              // programming
+    }
+    release(t);
+    return ok;
+}
+
+// After a failed block the card may still be waiting for the start token
+// of a CMD24 (if that token was corrupted), and would ignore every command
+// from then on. A start token and an all-ones block get it out: the block
+// is rejected for its CRC, or lands in the scratch region. An idle card
+// ignores all of it, as 0xFE and 0xFF never look like a command.
+static void resync(const sd_transport_t *t)
+{
+    static const uint8_t token = TOKEN_START;
+    t->select(t->ctx, true);
+    xfer(t, &token, NULL, 1);
+    xfer(t, NULL, NULL, SD_BLOCK_SIZE + 2);
+    wait_ready(t);
+    release(t);
+}
+
+// xorshift32, never seeded with 0
+static void fill(uint8_t *p, uint32_t seed)
+{
+    uint32_t x = seed | 1;
+    for (uint32_t i = 0; i < SD_BLOCK_SIZE; i += 4) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        memcpy(p + i, &x, 4);
+    }
+}
+
+uint32_t clk_tune_probe(const sd_transport_t *t, bool high_capacity, uint32_t lba,
+                        uint32_t blocks, uint32_t rounds, uint32_t seed, uint8_t *scratch)
+{
+    uint8_t *out = scratch, *in = scratch + SD_BLOCK_SIZE;
+    uint32_t errors = 0;
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t b = 0; b < blocks; b++) {
+            const uint32_t addr = high_capacity ? lba + b : (lba + b) * SD_BLOCK_SIZE;
+            fill(out, seed ^ (r * 0x9E3779B9u) ^ (b << 24));
+            bool ok = write_block(t, addr, out);
+            ok = ok && read_block(t, addr, in) && memcmp(in, out, SD_BLOCK_SIZE) == 0;
+            if (!ok) {
+                errors++;
+                resync(t);
+            }
+        }
+    }
+    return errors;
+}
+
+bool clk_tune_crc(const sd_transport_t *t, bool on)
+{
+    bool ok = false;
+    for (int i = 0; i < 3 && !ok; i++) {
+        ok = command(t, 59, on) == 0x00;
+        release(t);
+    }
+    return ok;
+}
+
+bool clk_tune_read_cid(const sd_transport_t *t, uint8_t cid[16])
+{
+    bool ok = command(t, 10, 0) == 0x00 && read_data(t, cid, 16);
+    release(t);
+    // The CID carries its own CRC7 in the last byte
+    return ok && (uint8_t)(sd_crc7(cid, 15) << 1 | 1) == cid[15];
+}
+
+// ---- sdclk.bin ----
+
+void clk_tune_table_init(clk_tune_table_t *tab)
+{
+    memset(tab, 0, sizeof(*tab));
+    tab->h.magic = CLK_TUNE_MAGIC;
+    tab->h.version = CLK_TUNE_VERSION;
+    tab->h.entry_size = sizeof(clk_tune_entry_t);
+    tab->h.crc = clk_tune_table_crc(tab);
+}
+
+uint32_t clk_tune_table_crc(const clk_tune_table_t *tab)
+{
+    const uint8_t *p = (const uint8_t *)tab->e;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint32_t k = 0; k < sizeof(tab->e); k++) {
+        crc ^= p[k];
+        for (int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+bool clk_tune_table_valid(const clk_tune_table_t *tab)
+{
+    return tab->h.magic == CLK_TUNE_MAGIC && tab->h.version == CLK_TUNE_VERSION &&
+           tab->h.entry_size == sizeof(clk_tune_entry_t) &&
+           tab->h.crc == clk_tune_table_crc(tab);
+}
+
+static int table_slot(const clk_tune_table_t *tab, const uint8_t cid[16])
+{
+    for (int i = 0; i < CLK_TUNE_SLOTS; i++)
+        if (tab->e[i].hz && memcmp(tab->e[i].cid, cid, 16) == 0)
+            return i;
+    return -1;
+}
+
+uint32_t clk_tune_table_find(const clk_tune_table_t *tab, const uint8_t cid[16])
+{
+    int i = table_slot(tab, cid);
+    return i < 0 ? 0 : tab->e[i].hz;
+}
+
+void clk_tune_table_put(clk_tune_table_t *tab, const uint8_t cid[16], uint32_t hz,
+                        uint32_t downshifts)
+{
+    int i = table_slot(tab, cid);
+    if (i < 0) {
+        // A free slot, else the least recently written
+        i = 0;
+        for (int k = 0; k < CLK_TUNE_SLOTS; k++) {
+            if (!tab->e[k].hz) {
+                i = k;
+                break;
+            }
+            if (tab->e[k].seq < tab->e[i].seq)
+                i = k;
+        }
+        memset(&tab->e[i], 0, sizeof(tab->e[i]));
+        memcpy(tab->e[i].cid, cid, 16);
+    }
+    tab->e[i].hz = hz;
+    tab->e[i].seq = ++tab->h.seq;
+    tab->e[i].downshifts = downshifts;
+    tab->h.crc = clk_tune_table_crc(tab);
+}
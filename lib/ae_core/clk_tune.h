@@ -0,0 +1,168 @@
+#ifndef CLK_TUNE_H
+#define CLK_TUNE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sd_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SD bus clock tuning.
+ *
+ * How fast a card runs in SPI mode depends on the card and on the wiring
+ * (trace length, the LCD on the same bus, the pull-ups), so one fixed
+ * clock is either slow or unsafe. After f_mount the logger climbs a
+ * ladder of clocks instead, and at each one writes a pseudo-random
+ * pattern to a scratch region and reads it back: any bad R1, rejected
+ * block, read CRC16 mismatch or differing byte is an error. The first
+ * step with errors ends the climb, and the step below it is confirmed
+ * with a longer probe; if that fails too, the tuner keeps stepping down.
+ *
+ * The tuner does no I/O itself. clk_tune_next() says which clock to probe
+ * and for how many rounds, the caller sets the clock, runs
+ * clk_tune_probe() (or anything else) and hands the error count to
+ * clk_tune_result(), so the same state machine runs on the board and
+ * against the card model in tools/clk_tune_sim.
+ *
+ * The result is kept per card in sdclk.bin in the card root, keyed by
+ * the CID: the file travels with card images, and a clone of the image
+ * on another card must not inherit a clock it was never tested at. A
+ * known card only runs the confirmation probe at its stored clock.
+ *
+ * A short probe can't see rare errors, so the tuner keeps counting them
+ * while recording (clk_tune_note() for every block written): more than
+ * max_errors in a window of window_ops writes steps the clock down, and
+ * the lower clock is saved for the next mount.
+ */
+
+#define CLK_TUNE_FILE    "sdclk.bin"
+#define CLK_TUNE_MAGIC   0x4B4C4341u     // "ACLK"
+#define CLK_TUNE_VERSION 1
+#define CLK_TUNE_SLOTS   8               // cards remembered
+#define CLK_TUNE_STEPS   8               // most ladder steps
+
+typedef enum {
+    CLK_TUNE_PROBE,          // probe at *hz for *rounds, then clk_tune_result()
+    CLK_TUNE_DONE,           // tuned, clk_tune_hz()
+    CLK_TUNE_FAILED,         // errors even at the lowest step
+} clk_tune_state_t;
+
+typedef struct {
+    uint32_t ladder[CLK_TUNE_STEPS];     // bus clocks to try, ascending, Hz
+    uint8_t steps;
+    uint8_t climb_rounds;                // probe rounds per step on the way up
+    uint8_t confirm_rounds;              // probe rounds at the chosen step
+    uint16_t window_ops;                 // runtime: writes per error window
+    uint16_t max_errors;                 // runtime: more in one window steps down
+} clk_tune_config_t;
+
+typedef struct {
+    clk_tune_config_t cfg;
+    uint8_t state;                       // clk_tune_state_t
+    uint8_t step;                        // probing, or chosen when done
+    uint8_t top;                         // highest step not yet seen failing
+    bool confirming;
+
+    // runtime error window
+    uint32_t ops;
+    uint32_t errors;
+
+    // accounting
+    uint32_t probes;                     // clk_tune_result() calls
+    uint32_t rounds;                     // probe rounds run
+    uint32_t probe_errors;
+    uint32_t downshifts;                 // at run time
+    uint32_t write_errors;               // at run time, all windows
+} clk_tune_t;
+
+// 4, 8, 12, 16, 20 and 25 MHz; 4 climb rounds, 32 to confirm; a second
+// error within 1024 writes steps down
+void clk_tune_config_default(clk_tune_config_t *cfg);
+
+// Climb from the lowest step if hz is 0, else confirm the highest step
+// not above hz (a stored result).
+void clk_tune_init(clk_tune_t *t, const clk_tune_config_t *cfg, uint32_t hz);
+
+clk_tune_state_t clk_tune_next(const clk_tune_t *t, uint32_t *hz, uint32_t *rounds);
+void clk_tune_result(clk_tune_t *t, uint32_t errors);
+
+// The chosen clock; the lowest step if tuning failed
+uint32_t clk_tune_hz(const clk_tune_t *t);
+
+// Run time: one write, ok or not. Returns the clock to switch to when the
+// window's errors call for a lower one, else 0.
+uint32_t clk_tune_note(clk_tune_t *t, bool ok);
+
+// ---- Probe, over the same transport as the CMD25 writer ----
+//
+// Blocking, for mount time only. The FatFs driver runs the card with CRC
+// checking off, where a corrupted CMD24 argument would write the pattern
+// somewhere else, so the whole session (CID and probes) runs between
+// clk_tune_crc(t, true) and clk_tune_crc(t, false), both sent at the
+// mount clock, which is known to work.
+//
+// Each round writes `blocks` blocks at lba with CMD24, one at a time, and
+// reads them back with CMD17. Returns the number of failed blocks.
+// scratch holds 2 x SD_BLOCK_SIZE bytes. lba is in blocks, high_capacity
+// selects block or byte addressing.
+uint32_t clk_tune_probe(const sd_transport_t *t, bool high_capacity, uint32_t lba,
+                        uint32_t blocks, uint32_t rounds, uint32_t seed, uint8_t *scratch);
+
+// CMD59: card-side CRC checks on or off, three tries. False if the card
+// never acknowledged; don't probe then.
+bool clk_tune_crc(const sd_transport_t *t, bool on);
+
+// CMD10. Returns false on a bad R1, token or CRC.
+bool clk_tune_read_cid(const sd_transport_t *t, uint8_t cid[16]);
+
+// ---- sdclk.bin ----
+//
+// Layout (little endian): clk_tune_header_t, then CLK_TUNE_SLOTS entries.
+// The least recently tuned entry makes room for a new card.
+
+typedef struct {
+    uint8_t cid[16];
+    uint32_t hz;                         // 0: free slot
+    uint32_t seq;                        // table seq when last written
+    uint32_t downshifts;                 // at run time, since tuned
+    uint32_t reserved;
+} clk_tune_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;                 // sizeof(clk_tune_entry_t)
+    uint32_t seq;                        // bumped on every update
+    uint32_t crc;                        // of the entries, clk_tune_table_crc()
+    uint8_t reserved[16];
+} clk_tune_header_t;
+
+typedef struct {
+    clk_tune_header_t h;
+    clk_tune_entry_t e[CLK_TUNE_SLOTS];
+} clk_tune_table_t;
+
+// An empty table
+void clk_tune_table_init(clk_tune_table_t *tab);
+
+// Header and CRC match; if not, the caller starts from an empty table
+bool clk_tune_table_valid(const clk_tune_table_t *tab);
+
+uint32_t clk_tune_table_crc(const clk_tune_table_t *tab);
+
+// Stored clock for this CID, 0 if none
+uint32_t clk_tune_table_find(const clk_tune_table_t *tab, const uint8_t cid[16]);
+
+// Store (or replace) the clock for this CID and refresh the CRC
+void clk_tune_table_put(clk_tune_table_t *tab, const uint8_t cid[16], uint32_t hz,
+                        uint32_t downshifts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
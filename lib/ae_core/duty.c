@@ -0,0 +1,271 @@
+#include "duty.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *const state_names[DUTY_STATES] = {
+    "sleep", "warm-up", "wait", "capture", "shutdown",
+};
+
+void duty_config_default(duty_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->interval_us = 15ull * 60 * 1000 * 1000;
+    cfg->window_us = 10 * 1000 * 1000;
+    cfg->warmup_us = 300000;
+    cfg->margin_us = 20000;
+    cfg->sleep_ppm = 0;
+    cfg->late_us = 1000;
+    cfg->current_ua[DUTY_SLEEP] = 1500;
+    cfg->current_ua[DUTY_WARMUP] = 40000;
+    cfg->current_ua[DUTY_WAIT] = 15000;
+    cfg->current_ua[DUTY_CAPTURE] = 45000;
+    cfg->current_ua[DUTY_SHUTDOWN] = 35000;
+}
+
+static int32_t clamp_i32(int64_t v)
+{
+    return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : (int32_t)v;
+}
+
+// Time in the current state, since the stats were reset at most
+static uint64_t in_state(const duty_t *d, uint64_t now)
+{
+    return now - (d->state_since_us > d->since_us ? d->state_since_us : d->since_us);
+}
+
+static void enter(duty_t *d, duty_state_t s, uint64_t now)
+{
+    d->state_us[d->state] += in_state(d, now);
+    d->state = (uint8_t)s;
+    d->state_since_us = now;
+}
+
+uint32_t duty_lead_us(const duty_t *d, uint64_t sleep_us)
+{
+    uint64_t lead = (uint64_t)d->peak_us + d->peak_us / 8 + d->cfg.margin_us +
+                    sleep_us * d->cfg.sleep_ppm / 1000000;
+    return lead > UINT32_MAX ? UINT32_MAX : (uint32_t)lead;
+}
+
+// Window `start` becomes the current one, with its wake-up `lead` before
+static void plan(duty_t *d, uint64_t start, uint64_t now)
+{
+    memset(&d->cur, 0, sizeof(d->cur));
+    d->cur.index = d->next_index++;
+    d->cur.start_at_us = start;
+    uint32_t lead = duty_lead_us(d, start > now ? start - now : 0);
+    d->cur.wake_at_us = start > now + lead ? start - lead : now;
+}
+
+// The next window on the grid that can still start on time. Windows whose
+// wake-up has passed are skipped, not started late: the grid stays put.
+static void advance(duty_t *d, uint64_t now)
+{
+    uint64_t start = d->cur.start_at_us + d->cfg.interval_us;
+    for (;;) {
+        if (d->cfg.windows && d->next_index >= d->cfg.windows) {
+            d->finished = true;
+            return;
+        }
+        if (start >= now + duty_lead_us(d, start > now ? start - now : 0))
+            break;
+        d->missed++;
+        d->next_index++;
+        start += d->cfg.interval_us;
+    }
+    plan(d, start, now);
+}
+
+void duty_init(duty_t *d, const duty_config_t *cfg, uint64_t now_us)
+{
+    memset(d, 0, sizeof(*d));
+    d->cfg = *cfg;
+    d->state = DUTY_SLEEP;
+    d->state_since_us = d->since_us = now_us;
+    d->peak_us = cfg->warmup_us;
+
+    uint64_t phase = cfg->phase_us;
+    uint32_t lead = duty_lead_us(d, phase);
+    if (phase < lead)
+        phase = lead;
+    plan(d, now_us + phase, now_us);
+}
+
+duty_action_t duty_next(duty_t *d, uint64_t now_us, uint64_t *at_us)
+{
+    duty_window_t *w = &d->cur;
+    uint64_t first = (uint64_t)((int64_t)w->start_at_us + w->start_late_us);
+    *at_us = UINT64_MAX;
+
+    if (d->finished)
+        return DUTY_FINISHED;
+    if (d->stopping) {
+        if (d->state != DUTY_SHUTDOWN)
+            enter(d, DUTY_SHUTDOWN, now_us);
+        return DUTY_STOP;
+    }
+
+    switch (d->state) {
+    case DUTY_SLEEP:
+        if (now_us < w->wake_at_us) {
+            *at_us = w->wake_at_us;
+            return DUTY_IDLE;
+        }
+        // Lateness the sleep clock allowance already covers stays out of the peak
+        d->drift_us = (uint32_t)((w->wake_at_us - d->state_since_us) * d->cfg.sleep_ppm / 1000000);
+        if (now_us >= w->start_at_us + d->cfg.window_us) {
+            // Overslept the whole window: a sleep clock slower than
+            // sleep_ppm allows. The next lead covers it.
+            uint64_t late = now_us - w->wake_at_us;
+            late = late > d->drift_us ? late - d->drift_us : 0;
+            if (late > d->peak_us)
+                d->peak_us = late > UINT32_MAX ? UINT32_MAX : (uint32_t)late;
+            d->missed++;
+            advance(d, now_us);
+            return duty_next(d, now_us, at_us);
+        }
+        w->wake_late_us = clamp_i32((int64_t)(now_us - w->wake_at_us));
+        enter(d, DUTY_WARMUP, now_us);
+        *at_us = w->start_at_us;
+        return DUTY_POWER_UP;
+
+    case DUTY_WARMUP:
+        *at_us = w->start_at_us;        // until duty_ready()
+        return DUTY_IDLE;
+
+    case DUTY_WAIT:
+        *at_us = w->start_at_us;
+        return now_us >= w->start_at_us ? DUTY_START : DUTY_IDLE;
+
+    case DUTY_CAPTURE:
+        *at_us = first + d->cfg.window_us;
+        if (now_us < *at_us)
+            return DUTY_IDLE;
+        w->capture_us = (uint32_t)(now_us - first);
+        d->stopping = true;
+        enter(d, DUTY_SHUTDOWN, now_us);
+        return DUTY_STOP;
+
+    default:
+        return DUTY_STOP;
+    }
+}
+
+void duty_ready(duty_t *d, uint64_t now_us, bool ok)
+{
+    if (d->state != DUTY_WARMUP)
+        return;
+    duty_window_t *w = &d->cur;
+    w->warmup_us = (uint32_t)(now_us - d->state_since_us);
+    if (!ok) {
+        // A missing card would fail every window: keep it out of the lead
+        d->failed++;
+        d->stopping = true;
+        return;
+    }
+
+    uint32_t late = w->wake_late_us > (int32_t)d->drift_us ? w->wake_late_us - d->drift_us : 0;
+    uint32_t cost = late + w->warmup_us;
+    d->peak_us = cost >= d->peak_us ? cost : d->peak_us - (d->peak_us - cost) / DUTY_DECAY;
+    if (w->wake_late_us > d->max_wake_late_us)
+        d->max_wake_late_us = w->wake_late_us;
+    if (w->warmup_us > d->max_warmup_us)
+        d->max_warmup_us = w->warmup_us;
+    enter(d, DUTY_WAIT, now_us);
+}
+
+void duty_started(duty_t *d, uint64_t now_us, bool ok)
+{
+    if (d->state != DUTY_WAIT)
+        return;
+    duty_window_t *w = &d->cur;
+    w->wait_us = (uint32_t)(now_us - d->state_since_us);
+    if (!ok) {
+        d->failed++;
+        d->stopping = true;
+        return;
+    }
+
+    w->start_late_us = clamp_i32((int64_t)(now_us - w->start_at_us));
+    w->ok = true;
+    d->windows++;
+    if (w->start_late_us > (int32_t)d->cfg.late_us)
+        d->late++;
+    if (w->start_late_us > d->max_start_late_us)
+        d->max_start_late_us = w->start_late_us;
+    enter(d, DUTY_CAPTURE, now_us);
+}
+
+void duty_stopped(duty_t *d, uint64_t now_us)
+{
+    if (d->state != DUTY_SHUTDOWN)
+        return;
+    d->cur.shutdown_us = (uint32_t)(now_us - d->state_since_us);
+    d->last = d->cur;
+    d->stopping = false;
+    enter(d, DUTY_SLEEP, now_us);
+    advance(d, now_us);
+}
+
+static uint64_t state_time(const duty_t *d, duty_state_t s, uint64_t now_us)
+{
+    return d->state_us[s] + (d->state == s ? in_state(d, now_us) : 0);
+}
+
+uint32_t duty_ppm(const duty_t *d, duty_state_t state, uint64_t now_us)
+{
+    uint64_t total = now_us - d->since_us;
+    if (total == 0)
+        return 0;
+    return (uint32_t)(state_time(d, state, now_us) * 1000000 / total);
+}
+
+uint32_t duty_avg_ua(const duty_t *d, uint64_t now_us)
+{
+    uint64_t total = now_us - d->since_us;
+    if (total == 0)
+        return 0;
+    // uA x us: a day at 100 mA is 8.6e15, well inside 64 bits
+    uint64_t charge = 0;
+    for (int s = 0; s < DUTY_STATES; s++)
+        charge += state_time(d, (duty_state_t)s, now_us) * d->cfg.current_ua[s];
+    return (uint32_t)(charge / total);
+}
+
+void duty_reset_stats(duty_t *d, uint64_t now_us)
+{
+    memset(d->state_us, 0, sizeof(d->state_us));
+    d->since_us = now_us;
+    d->windows = d->late = d->missed = d->failed = 0;
+    d->max_wake_late_us = 0;
+    d->max_warmup_us = 0;
+    d->max_start_late_us = 0;
+}
+
+void duty_print_window(const duty_window_t *w)
+{
+    printf("window %lu: wake %+ld us, warm-up %lu ms, wait %lu ms, start %+ld us, "
+           "capture %lu ms, shutdown %lu ms%s\n",
+           (unsigned long)w->index, (long)w->wake_late_us, (unsigned long)(w->warmup_us / 1000),
+           (unsigned long)(w->wait_us / 1000), (long)w->start_late_us,
+           (unsigned long)(w->capture_us / 1000), (unsigned long)(w->shutdown_us / 1000),
+           w->ok ? "" : " (given up)");
+}
+
+void duty_print_stats(const duty_t *d, uint64_t now_us)
+{
+    printf("duty: %lu windows (%lu late, %lu missed, %lu given up), worst wake %+ld us, "
+           "warm-up %lu ms, start %+ld us\n",
+           (unsigned long)d->windows, (unsigned long)d->late, (unsigned long)d->missed,
+           (unsigned long)d->failed, (long)d->max_wake_late_us,
+           (unsigned long)(d->max_warmup_us / 1000), (long)d->max_start_late_us);
+    printf("duty:");
+    for (int s = 0; s < DUTY_STATES; s++) {
+        uint32_t ppm = duty_ppm(d, (duty_state_t)s, now_us);
+        printf(" %s %lu.%02lu %%", state_names[s], (unsigned long)(ppm / 10000),
+               (unsigned long)(ppm % 10000 / 100));
+    }
+    printf(", average %lu uA, lead %lu ms\n", (unsigned long)duty_avg_ua(d, now_us),
+           (unsigned long)(duty_lead_us(d, d->cfg.interval_us) / 1000));
+}
@@ -0,0 +1,156 @@
+#ifndef DUTY_H
+#define DUTY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Scheduled capture windows ("record 10 s every 15 minutes").
+ *
+ * On battery the logger records for window_us at the start of every
+ * interval_us and keeps the ADC, the LCD and the card powered down in
+ * between, with the system asleep on a timer. Powering back up (clocks,
+ * card, opening the file) takes a while, so the engine wakes the system
+ * `lead` before the window: a peak of the recent wake-ups (timer
+ * lateness beyond the drift allowance, plus warm-up) that follows a
+ * slower one at once and decays by 1/DUTY_DECAY of the difference per
+ * faster one, an eighth of that peak and a fixed margin, and the worst
+ * drift of the sleep clock over the sleep. A sleep that runs past its
+ * whole window anyway (a clock worse than sleep_ppm) loses that window
+ * and raises the peak for the next. If the warm-up finishes early the
+ * system waits in light sleep for the window start; that costs far less
+ * than a late window.
+ *
+ * The engine does no I/O. duty_next() says what to do and until when,
+ * and the caller reports back with duty_ready(), duty_started() and
+ * duty_stopped(), so the same state machine runs on the board and against
+ * the power model in tools/duty_sim.
+ *
+ * Every window is measured: how late the timer woke the system, how long
+ * the warm-up took, how late the first sample came relative to the
+ * window start. The time spent in each state gives the duty fractions,
+ * and with the per-state supply currents in the config, an estimate of
+ * the average current.
+ */
+
+#define DUTY_DECAY 64           // lead peak: share of the excess dropped per window
+
+typedef enum {
+    DUTY_SLEEP,             // powered down until the wake time
+    DUTY_WARMUP,            // powering up: card, ADC, LCD
+    DUTY_WAIT,              // up early; light sleep until the window starts
+    DUTY_CAPTURE,           // recording
+    DUTY_SHUTDOWN,          // closing files, powering down
+    DUTY_STATES
+} duty_state_t;
+
+typedef enum {
+    DUTY_IDLE,              // nothing before *at_us: sleep (deep in DUTY_SLEEP)
+    DUTY_POWER_UP,          // power up now, then duty_ready()
+    DUTY_START,             // start recording now, then duty_started()
+    DUTY_STOP,              // stop and power down, then duty_stopped()
+    DUTY_FINISHED,          // cfg.windows done; stay powered down
+} duty_action_t;
+
+typedef struct {
+    uint64_t interval_us;               // window start to window start
+    uint32_t window_us;                 // recording per window
+    uint32_t phase_us;                  // first window after duty_init(); at least one lead
+    uint32_t warmup_us;                 // wake-up to ready, until one is measured
+    uint32_t margin_us;                 // on top of the slowest recent wake-up + 1/8
+    uint32_t sleep_ppm;                 // sleep clock against now_us; 0 if the same
+    uint32_t late_us;                   // a first sample later than this is late
+    uint32_t windows;                   // scheduled windows, missed ones too; 0: forever
+    uint32_t current_ua[DUTY_STATES];   // supply current per state, estimates
+} duty_config_t;
+
+// One window, filled in as it goes; duty_t.last once it is over
+typedef struct {
+    uint32_t index;                     // counts scheduled windows, missed ones too
+    uint64_t start_at_us;               // scheduled window start
+    uint64_t wake_at_us;                // scheduled wake-up
+    int32_t wake_late_us;               // actual wake-up minus wake_at_us
+    uint32_t warmup_us;                 // wake-up to ready
+    uint32_t wait_us;                   // ready to window start
+    int32_t start_late_us;              // first sample minus start_at_us
+    uint32_t capture_us;                // first sample to stop
+    uint32_t shutdown_us;               // stop to powered down
+    bool ok;                            // warmed up and recorded
+} duty_window_t;
+
+typedef struct {
+    duty_config_t cfg;
+    uint8_t state;                      // duty_state_t
+    bool stopping;                      // window over or given up: DUTY_STOP next
+    bool finished;
+
+    duty_window_t cur;
+    duty_window_t last;
+    uint32_t next_index;
+
+    uint32_t peak_us;                   // recent wake lateness + warm-up, for the lead
+    uint32_t drift_us;                  // sleep clock allowance of the last sleep
+
+    uint64_t state_since_us;
+    uint64_t since_us;                  // duty_init() or duty_reset_stats()
+
+    // accounting
+    uint64_t state_us[DUTY_STATES];
+    uint32_t windows;                   // recorded
+    uint32_t late;                      // recorded, first sample later than cfg.late_us
+    uint32_t missed;                    // skipped: the last one ran into their wake-up
+    uint32_t failed;                    // given up: no card, no file, no capture
+    int32_t max_wake_late_us;
+    uint32_t max_warmup_us;
+    int32_t max_start_late_us;
+} duty_t;
+
+// 10 s every 15 minutes; 300 ms first warm-up guess, 20 ms margin, the
+// sleep timed by the clock now_us comes from, late past 1 ms. Currents
+// are rough board figures (benchmarks/duty_cycle.md), not measurements.
+void duty_config_default(duty_config_t *cfg);
+
+void duty_init(duty_t *d, const duty_config_t *cfg, uint64_t now_us);
+
+// What to do at now_us. For DUTY_IDLE, *at_us is when to ask again; for
+// DUTY_POWER_UP and DUTY_START, the window start; for DUTY_STOP, its end.
+duty_action_t duty_next(duty_t *d, uint64_t now_us, uint64_t *at_us);
+
+// Warm-up over; ok false if the card didn't come up or the file didn't
+// open, and the window is given up (duty_next() says DUTY_STOP).
+void duty_ready(duty_t *d, uint64_t now_us, bool ok);
+
+// First sample of the window taken at now_us; ok false if the capture
+// didn't start, which gives the window up too
+void duty_started(duty_t *d, uint64_t now_us, bool ok);
+
+// Powered down after DUTY_STOP
+void duty_stopped(duty_t *d, uint64_t now_us);
+
+// Current state; DUTY_SLEEP is when the caller may power everything down
+static inline duty_state_t duty_state(const duty_t *d)
+{
+    return (duty_state_t)d->state;
+}
+
+// How early the next wake-up comes before its window, for a sleep of sleep_us
+uint32_t duty_lead_us(const duty_t *d, uint64_t sleep_us);
+
+// Share of the time since duty_init() / duty_reset_stats() in `state`,
+// in ppm, and the average current over the same time from cfg.current_ua
+uint32_t duty_ppm(const duty_t *d, duty_state_t state, uint64_t now_us);
+uint32_t duty_avg_ua(const duty_t *d, uint64_t now_us);
+
+void duty_reset_stats(duty_t *d, uint64_t now_us);
+void duty_print_window(const duty_window_t *w);
+void duty_print_stats(const duty_t *d, uint64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+#include "ext_adc.h"
+
+#include <string.h>
+
+int ext_adc_timing(const ext_adc_config_t *c, ext_adc_timing_t *t)
+{
+    memset(t, 0, sizeof(*t));
+    if (c->bits < 1 || c->bits > 16 || c->sample_rate == 0 || c->sys_hz == 0)
+        return -1;
+
+    const uint32_t overhead = EXT_ADC_FIXED_CYCLES + EXT_ADC_BIT_CYCLES * c->bits;
+    for (uint32_t div = 1; div <= 0xFFFF; div++) {
+        uint64_t per = (uint64_t)div * c->sample_rate;
+        uint64_t cycles = (c->sys_hz + per / 2) / per;
+        // A larger divider only shortens the conversion further
+        if (cycles < overhead)
+            return -1;
+        uint32_t conv_ns = (uint32_t)((cycles - overhead + 2) * div * 1000000000ull / c->sys_hz);
+        if (conv_ns < c->tconv_ns)
+            return -1;
+
+        uint32_t sck_hz = c->sys_hz / (div * EXT_ADC_BIT_CYCLES);
+        uint32_t half_ns = (uint32_t)(2ull * div * 1000000000ull / c->sys_hz);
+        if (sck_hz > c->sck_max_hz || half_ns < c->tdsdo_ns)
+            continue;
+
+        t->div = (uint16_t)div;
+        t->cycles = (uint32_t)cycles;
+        t->conv_loops = (uint32_t)(cycles - overhead);
+        t->sample_rate = (uint32_t)(c->sys_hz / (div * cycles));
+        uint64_t exact_mhz = (uint64_t)c->sys_hz * 1000 / (div * cycles);  // in mHz
+        t->rate_error_ppm = (int32_t)(((int64_t)exact_mhz - (int64_t)c->sample_rate * 1000) *
+                                      1000 / (int64_t)c->sample_rate);
+        t->sck_hz = sck_hz;
+        t->conv_ns = conv_ns;
+        t->setup_ns = half_ns - c->tdsdo_ns;
+        t->fifo_us = (uint32_t)((uint64_t)EXT_ADC_FIFO_WORDS * 1000000 / c->sample_rate);
+        return 0;
+    }
+    return -1;
+}
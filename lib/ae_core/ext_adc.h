@@ -0,0 +1,72 @@
+#ifndef EXT_ADC_H
+#define EXT_ADC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Timing of ext_adc.pio, the PIO program that reads an external SPI ADC
+ * with a convert-start pin (AD4000/AD7980 style, 3-wire mode without a busy
+ * indicator) at a fixed sample rate.
+ *
+ * One loop of the program is one sample:
+ *
+ *   CNV high for conv_loops + 2 cycles      the ADC converts
+ *   CNV low, 2 cycles                       MSB appears on SDO
+ *   bits x (SCK high 2, SCK low 2)          SDO read on each rising edge
+ *
+ * so a sample takes conv_loops + 4 + 4 * bits PIO cycles, and the sample
+ * rate is set by the loop length and the state machine's clock divider
+ * alone: no timer, no CPU. ext_adc_timing() picks the smallest integer
+ * divider that keeps SCK under the ADC's limit and still leaves it its
+ * conversion time. tools/ext_adc_sim checks the result against a
+ * bit-level model of the ADC.
+ *
+ * SDO is read on the same cycle SCK rises, 2 PIO cycles after the edge
+ * (SCK or CNV falling) that put the bit out, so those 2 cycles must cover
+ * the ADC's output delay. That only holds with the input synchronizer of
+ * the SDO pin bypassed: its 2 system clocks of latency would read the pin
+ * as it was at the falling edge, one bit early.
+ *
+ * The ISR shifts left with autopush at `bits`, so every RX FIFO word is
+ * one right-justified sample; a 16-bit DMA read of the FIFO stores it
+ * straight into the block ring.
+ */
+
+#define EXT_ADC_FIXED_CYCLES 4      // mov x, y; CNV low with its delay; loop exit
+#define EXT_ADC_BIT_CYCLES   4
+#define EXT_ADC_FIFO_WORDS   8      // RX FIFO joined
+
+typedef struct {
+    uint32_t sys_hz;
+    uint32_t sample_rate;           // Hz
+    uint8_t bits;                   // 1..16
+    uint32_t tconv_ns;              // ADC conversion time: CNV high at least this long
+    uint32_t sck_max_hz;
+    uint32_t tdsdo_ns;              // SCK or CNV falling to SDO valid
+} ext_adc_config_t;
+
+typedef struct {
+    uint16_t div;                   // state machine clock divider (integer)
+    uint32_t cycles;                // PIO cycles per sample
+    uint32_t conv_loops;            // Y
+    uint32_t sample_rate;           // Hz, as achieved
+    int32_t rate_error_ppm;
+    uint32_t sck_hz;
+    uint32_t conv_ns;               // CNV high time
+    uint32_t setup_ns;              // SDO valid to the read, after tdsdo_ns
+    uint32_t fifo_us;               // how long the RX FIFO holds samples while DMA isn't reading
+} ext_adc_timing_t;
+
+// Returns 0, or -1 if no divider meets the rate, SCK, output delay and
+// conversion limits.
+int ext_adc_timing(const ext_adc_config_t *c, ext_adc_timing_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
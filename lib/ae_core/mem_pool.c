@@ -0,0 +1,107 @@
+#include "mem_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void arena_init(arena_t *a, const char *name, void *base, uint32_t size)
+{
+    memset(a, 0, sizeof(*a));
+    a->name = name;
+    a->base = (uint8_t *)base;
+    a->size = size;
+}
+
+void *arena_alloc(arena_t *a, uint32_t size, uint32_t align)
+{
+    if (align == 0 || (align & (align - 1))) {
+        a->failures++;
+        return NULL;
+    }
+
+    uintptr_t at = (uintptr_t)a->base + a->used;
+    uint32_t pad = (uint32_t)(-at & (align - 1));
+
+    if (pad > a->size - a->used || size > a->size - a->used - pad) {
+        a->failures++;
+        return NULL;
+    }
+
+    a->used += pad + size;
+    if (a->used > a->peak)
+        a->peak = a->used;
+    return (void *)(at + pad);
+}
+
+void arena_release(arena_t *a, uint32_t mark)
+{
+    if (mark < a->used)
+        a->used = mark;
+}
+
+void mem_pool_init(mem_pool_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->mode = MEM_MODE_NONE;
+}
+
+void mem_pool_add_bank(mem_pool_t *p, mem_bank_t bank, const char *name,
+                       void *base, uint32_t size)
+{
+    arena_init(&p->bank[bank], name, base, size);
+    p->sealed[bank] = 0;
+}
+
+void *mem_alloc(mem_pool_t *p, mem_bank_t bank, uint32_t size, uint32_t align)
+{
+    arena_t *a = &p->bank[bank];
+    void *ptr = arena_alloc(a, size, align);
+
+    if (ptr && p->mode < MEM_MODES) {
+        uint32_t above = a->used - p->sealed[bank];
+        if (above > p->mode_peak[p->mode][bank])
+            p->mode_peak[p->mode][bank] = above;
+    }
+    return ptr;
+}
+
+void *mem_alloc_ring(mem_pool_t *p, mem_bank_t bank, uint32_t size)
+{
+    if (size == 0 || (size & (size - 1))) {
+        p->bank[bank].failures++;
+        return NULL;
+    }
+    return mem_alloc(p, bank, size, size);
+}
+
+void mem_pool_seal(mem_pool_t *p)
+{
+    for (int b = 0; b < MEM_BANKS; b++)
+        p->sealed[b] = p->bank[b].used;
+}
+
+void mem_mode_enter(mem_pool_t *p, uint8_t mode)
+{
+    for (int b = 0; b < MEM_BANKS; b++)
+        arena_release(&p->bank[b], p->sealed[b]);
+    p->mode = mode;
+}
+
+void mem_pool_print(const mem_pool_t *p, const char *const *mode_names)
+{
+    printf("%-10s %8s %8s %8s %8s", "bank", "size", "fixed", "peak", "failed");
+    for (int m = 0; m < MEM_MODES && mode_names && mode_names[m]; m++)
+        printf(" %8s", mode_names[m]);
+    printf("\n");
+
+    for (int b = 0; b < MEM_BANKS; b++) {
+        const arena_t *a = &p->bank[b];
+        if (!a->base)
+            continue;
+        printf("%-10s %8lu %8lu %8lu %8lu", a->name, (unsigned long)a->size,
+               (unsigned long)p->sealed[b], (unsigned long)a->peak,
+               (unsigned long)a->failures);
+        for (int m = 0; m < MEM_MODES && mode_names && mode_names[m]; m++)
+            printf(" %8lu", (unsigned long)p->mode_peak[m][b]);
+        printf("\n");
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Static buffer pool with one bump arena per SRAM bank.
+ *
+ * The application hands each bank a fixed backing array placed by the
+ * linker (main striped SRAM, SCRATCH_X, SCRATCH_Y on RP2350), so a buffer
+ * lands in the bank the caller asks for: DMA targets in one, buffers the
+ * CPU reads while DMA runs in another.
+ *
+ * Allocations made before mem_pool_seal() are permanent. After that the
+ * pool runs in a mode (plotting, logging, ...): mem_mode_enter() drops
+ * everything the previous mode allocated, in O(banks), so modes reuse the
+ * same memory. Nothing is ever freed individually.
+ *
+ * Peak usage is kept per bank and per mode. No pico-sdk headers: the
+ * backing arrays come from the caller, so the host tools run it on
+ * ordinary memory.
+ */
+
+typedef enum {
+    MEM_MAIN,           // SRAM0-7, word-striped
+    MEM_SCRATCH_X,      // SRAM8, 4 KiB, shared with the core 1 stack
+    MEM_SCRATCH_Y,      // SRAM9, 4 KiB, shared with the core 0 stack
+    MEM_BANKS
+} mem_bank_t;
+
+#define MEM_MODES     4
+#define MEM_MODE_NONE 0xFF
+
+typedef struct {
+    const char *name;
+    uint8_t *base;
+    uint32_t size;
+    uint32_t used;          // bytes, including alignment padding
+    uint32_t peak;
+    uint32_t failures;      // allocations that did not fit
+} arena_t;
+
+typedef struct {
+    arena_t bank[MEM_BANKS];
+    uint32_t sealed[MEM_BANKS];     // end of the permanent allocations
+    uint8_t mode;
+    uint32_t mode_peak[MEM_MODES][MEM_BANKS];   // above `sealed`
+} mem_pool_t;
+
+// ---- Single arena ----
+
+void arena_init(arena_t *a, const char *name, void *base, uint32_t size);
+
+// `align` must be a power of two; alignment is of the absolute address.
+// Returns NULL when the arena is full.
+void *arena_alloc(arena_t *a, uint32_t size, uint32_t align);
+
+static inline uint32_t arena_mark(const arena_t *a) { return a->used; }
+
+// Drop everything allocated since `mark`.
+void arena_release(arena_t *a, uint32_t mark);
+
+// ---- Pool ----
+
+void mem_pool_init(mem_pool_t *p);
+void mem_pool_add_bank(mem_pool_t *p, mem_bank_t bank, const char *name,
+                       void *base, uint32_t size);
+
+void *mem_alloc(mem_pool_t *p, mem_bank_t bank, uint32_t size, uint32_t align);
+
+// Buffer for a DMA ring of `size` bytes (a power of two, as
+// channel_config_set_ring() needs): aligned to its own size so the
+// address wraps without carrying into the upper bits.
+void *mem_alloc_ring(mem_pool_t *p, mem_bank_t bank, uint32_t size);
+
+// Everything allocated so far is permanent.
+void mem_pool_seal(mem_pool_t *p);
+
+// Switch mode: drops the allocations of the previous mode.
+void mem_mode_enter(mem_pool_t *p, uint8_t mode);
+
+// Peak use per bank, and per mode on top of the permanent part.
+void mem_pool_print(const mem_pool_t *p, const char *const *mode_names);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+#include "onset.h"
+
+#include <string.h>
+
+// log2(1 + i / 32) in Q16
+static const int32_t log2_tab[33] = {
+        0,  2909,  5732,  8473, 11136, 13727, 16248, 18704,
+    21098, 23433, 25711, 27936, 30109, 32234, 34312, 36346,
+    38336, 40286, 42196, 44068, 45904, 47705, 49472, 51207,
+    52911, 54584, 56229, 57845, 59434, 60997, 62534, 64047,
+    65536,
+};
+
+void sta_lta_config_default(sta_lta_config_t *cfg)
+{
+    cfg->sta_shift = 3;
+    cfg->lta_shift = 10;
+    cfg->on_q4 = 48;
+    cfg->off_q4 = 24;
+    cfg->floor = 2;
+}
+
+void sta_lta_init(sta_lta_t *s, const sta_lta_config_t *cfg)
+{
+    memset(s, 0, sizeof(*s));
+    s->cfg = *cfg;
+    s->warm = 1u << cfg->lta_shift;
+}
+
+uint32_t sta_lta_run(sta_lta_t *s, const int16_t *x, uint32_t n, uint32_t *on, uint32_t max)
+{
+    const uint32_t ks = s->cfg.sta_shift, kl = s->cfg.lta_shift;
+    const uint32_t up = kl - ks + 4;                // STA to the LTA's scale, and Q4
+    const uint32_t floor = (uint32_t)s->cfg.floor << kl;
+    uint32_t sta = s->sta, lta = s->lta, warm = s->warm, found = 0;
+    bool triggered = s->triggered;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const int32_t v = x[i];
+        const uint32_t a = (uint32_t)(v < 0 ? -v : v);
+        sta += a - (sta >> ks);
+        if (warm) {
+            // A plain sum the first 2^kl samples: the LTA starts at their mean
+            lta += a;
+            warm--;
+            continue;
+        }
+        lta += a - (lta >> kl);
+
+        const uint64_t s4 = (uint64_t)sta << up;
+        const uint64_t ref = lta > floor ? lta : floor;
+        if (triggered) {
+            triggered = s4 >= ref * s->cfg.off_q4;
+        } else if (s4 >= ref * s->cfg.on_q4) {
+            triggered = true;
+            if (found < max)
+                on[found] = i;
+            found++;
+        }
+    }
+
+    s->sta = sta;
+    s->lta = lta;
+    s->warm = warm;
+    s->triggered = triggered;
+    return found;
+}
+
+int32_t onset_log2_q16(uint64_t v)
+{
+    if (v == 0)
+        return 0;
+    const int32_t e = 63 - __builtin_clzll(v);
+    // 16 bits below the leading one: 5 index the table, 11 interpolate
+    const uint32_t f = (uint32_t)(e >= 16 ? v >> (e - 16) : v << (16 - e)) & 0xFFFF;
+    const uint32_t i = f >> 11, r = f & 0x7FF;
+    return (e << 16) + log2_tab[i] + (int32_t)(((log2_tab[i + 1] - log2_tab[i]) * (int32_t)r + 1024) >> 11);
+}
+
+// len x log2 of the variance of len samples with sum s1 and sum of
+// squares s2, in Q16: log2(len s2 - s1^2) - 2 log2(len). Zero variance
+// counts as 1 / len^2.
+static int32_t aic_term(uint32_t len, int64_t s1, uint64_t s2)
+{
+    const uint64_t num = (uint64_t)len * s2 - (uint64_t)(s1 * s1);
+    const int32_t l = onset_log2_q16(num ? num : 1) - 2 * onset_log2_q16(len);
+    return (int32_t)len * l;
+}
+
+int32_t onset_aic_pick(const int16_t *x, uint32_t n, int32_t *aic)
+{
+    if (n <= 2 * ONSET_AIC_EDGE || n > ONSET_AIC_MAX)
+        return -1;
+
+    // Forward: the part before the split, k = EDGE .. n - EDGE
+    int64_t s1 = 0;
+    uint64_t s2 = 0;
+    for (uint32_t k = 1; k <= n - ONSET_AIC_EDGE; k++) {
+        const int32_t v = x[k - 1];
+        s1 += v;
+        s2 += (uint64_t)(v * v);
+        if (k >= ONSET_AIC_EDGE)
+            aic[k] = aic_term(k, s1, s2);
+    }
+
+    // Back: the part from the split on, and the least sum. Going down
+    // with <= keeps the earliest of equal minima.
+    uint32_t best = n - ONSET_AIC_EDGE;
+    s1 = 0;
+    s2 = 0;
+    for (uint32_t k = n; k-- > ONSET_AIC_EDGE;) {
+        const int32_t v = x[k];
+        s1 += v;
+        s2 += (uint64_t)(v * v);
+        if (n - k < ONSET_AIC_EDGE)
+            continue;
+        aic[k] += aic_term(n - k, s1, s2);
+        if (aic[k] <= aic[best])
+            best = k;
+    }
+
+    // Vertex of the parabola through best - 1, best, best + 1
+    int32_t frac = 0;
+    if (best > ONSET_AIC_EDGE && best < n - ONSET_AIC_EDGE) {
+        const int64_t a = aic[best - 1], b = aic[best], c = aic[best + 1];
+        const int64_t den = a - 2 * b + c;
+        const int32_t half = 1 << (ONSET_FRAC_BITS - 1);
+        if (den > 0) {
+            int64_t f = ((a - c) * half) / den;
+            frac = (int32_t)(f < -half ? -half : f > half ? half : f);
+        }
+    }
+    return (int32_t)(best << ONSET_FRAC_BITS) + frac;
+}
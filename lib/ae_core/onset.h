@@ -0,0 +1,82 @@
+#ifndef ONSET_H
+#define ONSET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Arrival-time picking for AE hits.
+ *
+ * A threshold crossing comes late by however long the burst takes to
+ * grow past the threshold, which depends on its amplitude and on the
+ * noise. Picking takes two steps instead:
+ *
+ * STA/LTA marks candidates. The short- and long-term means of |x| are
+ * leaky integrators (acc += |x| - acc / 2^shift: an add and a shift per
+ * sample, no history), and a candidate is the first sample where
+ * STA >= on x LTA. The trigger resets once STA < off x LTA. The LTA has
+ * a floor, so a quiet channel doesn't trigger on its last bit, and there
+ * are no candidates until it has settled (2^lta_shift samples).
+ *
+ * AIC refines a candidate. Over a window of n samples ending a little
+ * after it, Maeda's
+ *
+ *     AIC(k) = k log var(x[0..k)) + (n - k) log var(x[k..n))
+ *
+ * is least where the window splits best into two stationary parts, the
+ * noise and the burst: that k is the arrival. The variances come from
+ * running sums, one pass forward and one back, and the logs from a
+ * 32-entry log2 table, all in integers: O(n) on cores without an FPU. A
+ * parabola through the minimum and its two neighbours places the arrival
+ * to 1/256 sample.
+ *
+ * ae::OnsetPicker (ae_pipeline.hpp) runs both on the acquisition blocks.
+ * tools/onset_batch.cpp is the AIC vectorised in float for the host, and
+ * tools/ae_onset measures both against synthetic bursts.
+ */
+
+#define ONSET_FRAC_BITS 8           // arrivals in 1/256 sample
+#define ONSET_AIC_MAX   512         // longest AIC window
+#define ONSET_AIC_EDGE  8           // shortest part on either side of the split
+
+typedef struct {
+    uint8_t sta_shift;              // STA time constant, 2^sta_shift samples
+    uint8_t lta_shift;              // LTA time constant, at most 16
+    uint16_t on_q4;                 // candidate at STA/LTA >= on_q4 / 16
+    uint16_t off_q4;                // reset below off_q4 / 16
+    uint16_t floor;                 // least LTA, mean |x| in counts
+} sta_lta_config_t;
+
+typedef struct {
+    sta_lta_config_t cfg;
+    uint32_t sta;                   // 2^sta_shift x mean |x|
+    uint32_t lta;                   // 2^lta_shift x mean |x|
+    uint32_t warm;                  // samples until the LTA has settled
+    bool triggered;
+} sta_lta_t;
+
+// For 4 kS/s: STA 8 samples (2 ms), LTA 1024 (256 ms), on 3.0, off 1.5
+void sta_lta_config_default(sta_lta_config_t *cfg);
+void sta_lta_init(sta_lta_t *s, const sta_lta_config_t *cfg);
+
+// Runs x[0..n); the offsets in x of the candidates go to on[], at most
+// max of them. Returns how many there were, which can be more than max.
+uint32_t sta_lta_run(sta_lta_t *s, const int16_t *x, uint32_t n, uint32_t *on, uint32_t max);
+
+// Arrival in x[0..n) in 1/2^ONSET_FRAC_BITS sample from x[0], or -1
+// unless 2 * ONSET_AIC_EDGE < n <= ONSET_AIC_MAX. scratch holds n + 1
+// values.
+int32_t onset_aic_pick(const int16_t *x, uint32_t n, int32_t *scratch);
+
+// log2(v) in Q16 for v > 0, error under 2.5e-4; 0 for v = 0
+int32_t onset_log2_q16(uint64_t v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#include "rate_ctl.h"
+
+#include <string.h>
+
+_Static_assert(sizeof(rate_change_t) == 32, "sidecar record layout");
+_Static_assert(sizeof(rate_header_t) == 32, "sidecar header layout");
+
+void rate_ctl_init(rate_ctl_t *c, const rate_ctl_config_t *cfg)
+{
+    memset((void *)c, 0, sizeof(*c));
+    c->cfg = *cfg;
+    c->rate = cfg->base_rate;
+}
+
+void rate_ctl_header(const rate_ctl_t *c, rate_header_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->magic = RATE_MAGIC;
+    h->version = RATE_VERSION;
+    h->record_size = sizeof(rate_change_t);
+    h->block_samples = c->cfg.block_samples;
+    h->base_rate = c->cfg.base_rate;
+    h->burst_rate = c->cfg.burst_rate;
+    h->hold_us = c->cfg.hold_us;
+    h->threshold = c->cfg.threshold;
+}
+
+uint32_t rate_ctl_div(const rate_ctl_t *c, uint32_t rate)
+{
+    return (uint32_t)(((uint64_t)c->cfg.adc_clk_hz << 8) / rate);
+}
+
+uint32_t rate_ctl_boundary(rate_ctl_t *c, const uint16_t *block, uint64_t t_us)
+{
+    const uint32_t n = c->cfg.block_samples;
+    uint32_t mn = 0xFFFF, mx = 0, sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t v = block[i];
+        mn = v < mn ? v : mn;
+        mx = v > mx ? v : mx;
+        sum += v;
+    }
+
+    bool active = false;
+    if (c->has_center)
+        active = mx > c->center + c->cfg.threshold || mn + c->cfg.threshold < c->center;
+    c->center = (uint16_t)((sum + n / 2) / n);
+    c->has_center = true;
+
+    if (active) {
+        c->last_active_us = t_us;
+        return c->rate != c->cfg.burst_rate ? c->cfg.burst_rate : 0;
+    }
+    if (c->rate != c->cfg.base_rate && t_us - c->last_active_us >= c->cfg.hold_us)
+        return c->cfg.base_rate;
+    return 0;
+}
+
+void rate_ctl_refilled(rate_ctl_t *c, uint32_t block)
+{
+    // Only the interrupt touches records of the head block: the logger
+    // takes a record once its block is written
+    for (uint32_t i = c->q_tail; i != c->q_head; i++) {
+        rate_change_t *r = &c->q[i % RATE_CTL_QUEUE];
+        if (r->block == block && r->lead) {
+            r->sample -= r->lead;
+            r->lead = 0;
+        }
+    }
+}
+
+void rate_ctl_switched(rate_ctl_t *c, uint32_t rate, uint32_t block, uint16_t lead,
+                       uint64_t t_us)
+{
+    if (rate == c->cfg.burst_rate)
+        c->bursts++;
+    c->rate = rate;
+
+    uint32_t head = c->q_head;
+    if (head - c->q_tail >= RATE_CTL_QUEUE) {
+        c->lost++;
+        return;
+    }
+    rate_change_t *r = &c->q[head % RATE_CTL_QUEUE];
+    r->sample = (uint64_t)block * c->cfg.block_samples + lead;
+    r->t_us = t_us;
+    r->rate = rate;
+    r->block = block;
+    r->lead = lead;
+    r->reserved = 0;
+    r->div = rate_ctl_div(c, rate);
+    c->q_head = head + 1;
+}
+
+bool rate_ctl_next(rate_ctl_t *c, uint32_t blocks, rate_change_t *out)
+{
+    uint32_t tail = c->q_tail;
+    if (tail == c->q_head || c->q[tail % RATE_CTL_QUEUE].block >= blocks)
+        return false;
+    *out = c->q[tail % RATE_CTL_QUEUE];
+    c->q_tail = tail + 1;
+    return true;
+}
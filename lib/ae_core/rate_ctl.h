@@ -0,0 +1,120 @@
+#ifndef RATE_CTL_H
+#define RATE_CTL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Activity-adaptive sample rate ("burst mode").
+ *
+ * The ADC runs at base_rate. When a block's peak deviation from the
+ * previous block's mean exceeds threshold, the controller switches to
+ * burst_rate, and back to base_rate once hold_us has passed without
+ * another active block.
+ *
+ * Both the test and the switch run in the DMA interrupt at the block
+ * boundary, after the channel has been restarted into the next block, so
+ * a burst is caught at most one block late and no block is ever split
+ * between two dividers except for its first few samples: the ADC is
+ * stopped, the samples it already took at the old rate (the `lead`, at
+ * the start of the new block) are counted, and it restarts at the new
+ * divider. rate_ctl_switched() records where the new rate starts, exactly
+ * to the sample; the logger takes the records once the blocks they refer
+ * to are written. The test is one min/max/sum pass over the block.
+ *
+ * aXXXX.rat layout (little endian), written next to aXXXX.bin:
+ *   rate_header_t   32 bytes
+ *   rate_change_t   32 bytes each, in sample order
+ *
+ * Sample s of the recording was taken at base_rate before the first
+ * record, and at record k's rate from its `sample` on; the first sample
+ * at a new rate is one period after the record's t_us. Record `block` is
+ * an acquisition block index like store_gap_t.block. tools/burst_sim
+ * replays data through the controller and the switch and rebuilds the
+ * timebase from the records.
+ */
+
+#define RATE_MAGIC   0x54524541u    // "AERT"
+#define RATE_VERSION 1
+
+#define RATE_CTL_QUEUE 8            // switches not yet taken by the logger
+
+typedef struct {
+    uint64_t sample;                // first sample at the new rate, index in the recording
+    uint64_t t_us;                  // ADC restart; its first sample is one period later
+    uint32_t rate;                  // Hz from `sample` on
+    uint32_t block;                 // acquisition block holding `sample`
+    uint16_t lead;                  // samples of that block still at the previous rate
+    uint16_t reserved;
+    uint32_t div;                   // ADC DIV register (16.8 fixed point)
+} rate_change_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;           // sizeof(rate_change_t)
+    uint32_t block_samples;
+    uint32_t base_rate;             // rate at sample 0
+    uint32_t burst_rate;
+    uint32_t hold_us;
+    uint16_t threshold;
+    uint8_t reserved[6];
+} rate_header_t;
+
+typedef struct {
+    uint32_t base_rate;             // Hz
+    uint32_t burst_rate;            // Hz
+    uint32_t hold_us;               // at burst_rate after the last active block
+    uint16_t threshold;             // counts from the previous block's mean
+    uint32_t adc_clk_hz;            // for the DIV value: 48 MHz on RP2350
+    uint32_t block_samples;
+} rate_ctl_config_t;
+
+typedef struct {
+    rate_ctl_config_t cfg;
+    uint32_t rate;                  // rate of the block being filled
+    uint64_t last_active_us;
+    uint16_t center;                // previous block's mean
+    bool has_center;
+
+    rate_change_t q[RATE_CTL_QUEUE];
+    volatile uint32_t q_head;       // written by the interrupt
+    volatile uint32_t q_tail;       // taken by the logger
+    uint32_t lost;                  // switches with the queue full
+
+    uint32_t bursts;                // switches up
+} rate_ctl_t;
+
+void rate_ctl_init(rate_ctl_t *c, const rate_ctl_config_t *cfg);
+
+void rate_ctl_header(const rate_ctl_t *c, rate_header_t *h);
+
+// ADC DIV register value for a rate: clk / rate in 16.8 fixed point, the
+// same as adc_set_clkdiv(clk / rate) without floating point in the IRQ.
+uint32_t rate_ctl_div(const rate_ctl_t *c, uint32_t rate);
+
+// DMA interrupt, for each published block (t_us is when it completed):
+// the rate to switch to now, 0 to stay.
+uint32_t rate_ctl_boundary(rate_ctl_t *c, const uint16_t *block, uint64_t t_us);
+
+// DMA interrupt: block `block` (the ring head after the publish) was
+// refilled after an overrun, so the samples a switch into it left at the
+// old rate are gone. Call before rate_ctl_switched() for the same boundary.
+void rate_ctl_refilled(rate_ctl_t *c, uint32_t block);
+
+// DMA interrupt: `rate` starts `lead` samples into block `block`.
+void rate_ctl_switched(rate_ctl_t *c, uint32_t rate, uint32_t block, uint16_t lead,
+                       uint64_t t_us);
+
+// Logger: the next switch inside the first `blocks` blocks, in order.
+bool rate_ctl_next(rate_ctl_t *c, uint32_t blocks, rate_change_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+#include "replay.h"
+
+#include <string.h>
+
+// Quarter sine wave, 256 steps, Q15
+static const int16_t quarter_sine[257] = {
+        0,   201,   402,   603,   804,  1005,  1206,  1407,  1608,  1809,  2009,  2210,
+     2410,  2611,  2811,  3012,  3212,  3412,  3612,  3811,  4011,  4210,  4410,  4609,
+     4808,  5007,  5205,  5404,  5602,  5800,  5998,  6195,  6393,  6590,  6786,  6983,
+     7179,  7375,  7571,  7767,  7962,  8157,  8351,  8545,  8739,  8933,  9126,  9319,
+     9512,  9704,  9896, 10087, 10278, 10469, 10659, 10849, 11039, 11228, 11417, 11605,
+    11793, 11980, 12167, 12353, 12539, 12725, 12910, 13094, 13279, 13462, 13645, 13828,
+    14010, 14191, 14372, 14553, 14732, 14912, 15090, 15269, 15446, 15623, 15800, 15976,
+    16151, 16325, 16499, 16673, 16846, 17018, 17189, 17360, 17530, 17700, 17869, 18037,
+    18204, 18371, 18537, 18703, 18868, 19032, 19195, 19357, 19519, 19680, 19841, 20000,
+    20159, 20317, 20475, 20631, 20787, 20942, 21096, 21250, 21403, 21554, 21705, 21856,
+    22005, 22154, 22301, 22448, 22594, 22739, 22884, 23027, 23170, 23311, 23452, 23592,
+    23731, 23870, 24007, 24143, 24279, 24413, 24547, 24680, 24811, 24942, 25072, 25201,
+    25329, 25456, 25582, 25708, 25832, 25955, 26077, 26198, 26319, 26438, 26556, 26674,
+    26790, 26905, 27019, 27133, 27245, 27356, 27466, 27575, 27683, 27790, 27896, 28001,
+    28105, 28208, 28310, 28411, 28510, 28609, 28706, 28803, 28898, 28992, 29085, 29177,
+    29268, 29358, 29447, 29534, 29621, 29706, 29791, 29874, 29956, 30037, 30117, 30195,
+    30273, 30349, 30424, 30498, 30571, 30643, 30714, 30783, 30852, 30919, 30985, 31050,
+    31113, 31176, 31237, 31297, 31356, 31414, 31470, 31526, 31580, 31633, 31685, 31736,
+    31785, 31833, 31880, 31926, 31971, 32014, 32057, 32098, 32137, 32176, 32213, 32250,
+    32285, 32318, 32351, 32382, 32412, 32441, 32469, 32495, 32521, 32545, 32567, 32589,
+    32609, 32628, 32646, 32663, 32678, 32692, 32705, 32717, 32728, 32737, 32745, 32752,
+    32757, 32761, 32765, 32766, 32767,
+};
+
+// sin(phase) in Q15, 1024 steps per cycle
+static int32_t sine_q15(uint32_t phase)
+{
+    uint32_t i = phase >> 22;           // 0..1023
+    uint32_t q = i & 255;
+    switch (i >> 8) {
+    case 0:  return quarter_sine[q];
+    case 1:  return quarter_sine[256 - q];
+    case 2:  return -quarter_sine[q];
+    default: return -quarter_sine[256 - q];
+    }
+}
+
+static uint32_t xorshift32(uint32_t *s)
+{
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static uint16_t clamp12(int32_t v)
+{
+    return (uint16_t)(v < 0 ? 0 : v > 4095 ? 4095 : v);
+}
+
+void replay_config_default(replay_config_t *cfg, replay_kind_t kind)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->kind = kind;
+    cfg->sample_rate = 4000;
+    cfg->freq_hz = 1000;
+    cfg->offset = 2048;
+    cfg->amplitude = 1000;
+    cfg->duty_pct = 25;
+    cfg->burst_every = 4000;
+    cfg->burst_len = 100;
+    cfg->noise = 8;
+    cfg->seed = 1;
+
+    if (kind == REPLAY_SQUARE) {
+        cfg->offset = 0;
+        cfg->amplitude = 3000;
+        cfg->noise = 0;
+    }
+}
+
+void replay_init(replay_t *r, const replay_config_t *cfg)
+{
+    memset(r, 0, sizeof(*r));
+    r->cfg = *cfg;
+    r->step = (uint32_t)(((uint64_t)cfg->freq_hz << 32) / cfg->sample_rate);
+    r->rng = cfg->seed ? cfg->seed : 1;
+
+    // e^(-5 / burst_len) per sample, to first order
+    uint32_t len = cfg->burst_len ? cfg->burst_len : 1;
+    r->decay_q16 = len > 5 ? 65536 - (5u * 65536) / len : 0;
+}
+
+static int32_t generate(replay_t *r)
+{
+    const replay_config_t *c = &r->cfg;
+    int32_t v = c->offset;
+
+    switch (c->kind) {
+    case REPLAY_SINE:
+        v += (sine_q15(r->phase) * c->amplitude) >> 15;
+        break;
+    case REPLAY_SQUARE:
+        if (r->phase < (uint32_t)(((uint64_t)c->duty_pct << 32) / 100))
+            v += c->amplitude;
+        break;
+    case REPLAY_BURSTS:
+        if (c->burst_every && r->pos % c->burst_every == 0) {
+            r->env_q16 = 65536;
+            r->phase = 1u << 30;        // start at the peak
+        }
+        if (r->env_q16) {
+            v += (int32_t)(((int64_t)sine_q15(r->phase) * c->amplitude * r->env_q16) >> 31);
+            r->env_q16 = (uint32_t)(((uint64_t)r->env_q16 * r->decay_q16) >> 16);
+        }
+        break;
+    default:
+        break;
+    }
+    r->phase += r->step;
+
+    if (c->noise)
+        v += (int32_t)(xorshift32(&r->rng) % (2u * c->noise + 1)) - c->noise;
+    return v;
+}
+
+uint32_t replay_fill(replay_t *r, uint16_t *dst, uint32_t n)
+{
+    if (r->done)
+        return 0;
+
+    if (r->cfg.kind == REPLAY_FILE) {
+        uint32_t got = (uint32_t)r->cfg.read(r->cfg.ctx, dst, n);
+        if (got < n)
+            r->done = true;
+        r->pos += got;
+        return got;
+    }
+
+    for (uint32_t i = 0; i < n; i++, r->pos++)
+        dst[i] = clamp12(generate(r));
+    return n;
+}
+
+uint64_t replay_time_us(const replay_t *r, uint64_t t0_us)
+{
+    if (r->pos == 0)
+        return t0_us;
+    return t0_us + (r->pos - 1) * 1000000 / r->cfg.sample_rate;
+}
@@ -0,0 +1,74 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Replay source: produces 12-bit ADC samples from a recorded .bin or from
+ * a synthetic generator, block by block, in place of the ADC DMA.
+ *
+ * Generators are integer-only (table sine, phase accumulators, xorshift
+ * noise) so the host build and the target produce bit-identical samples
+ * for the same config. Pacing is up to the caller: replay_time_us() gives
+ * the real-time completion time of the samples produced so far.
+ */
+
+typedef enum {
+    REPLAY_FILE,        // samples from cfg.read()
+    REPLAY_SINE,
+    REPLAY_SQUARE,      // the 1 kHz 25 % PWM test signal by default
+    REPLAY_BURSTS,      // decaying sine bursts every burst_every samples
+    REPLAY_NOISE,       // DC + noise only
+} replay_kind_t;
+
+typedef struct {
+    replay_kind_t kind;
+    uint32_t sample_rate;   // Hz
+    uint32_t freq_hz;       // sine, square and burst carrier
+    uint16_t amplitude;     // peak counts around offset (square: high - low)
+    uint16_t offset;        // DC level in counts
+    uint8_t duty_pct;       // square
+    uint32_t burst_every;   // samples between burst onsets
+    uint32_t burst_len;     // samples per burst; amplitude decays ~e^-5 over it
+    uint16_t noise;         // uniform noise +-noise counts, added to every kind
+    uint32_t seed;
+
+    // REPLAY_FILE: read up to n samples into dst, return the number read
+    size_t (*read)(void *ctx, uint16_t *dst, size_t n);
+    void *ctx;
+} replay_config_t;
+
+typedef struct {
+    replay_config_t cfg;
+    uint64_t pos;           // samples produced
+    uint32_t phase;         // carrier phase, 2^32 per cycle
+    uint32_t step;          // phase increment per sample
+    uint32_t rng;
+    uint32_t decay_q16;     // per-sample burst decay
+    uint32_t env_q16;       // current burst envelope
+    bool done;
+} replay_t;
+
+// Defaults: 4 kS/s, 1 kHz 25 % square between 0 and 3000 counts, like the
+// PWM on PWM_PIN looped back into the ADC.
+void replay_config_default(replay_config_t *cfg, replay_kind_t kind);
+
+void replay_init(replay_t *r, const replay_config_t *cfg);
+
+// Fill dst with up to n samples. Returns fewer only at the end of a file.
+uint32_t replay_fill(replay_t *r, uint16_t *dst, uint32_t n);
+
+// Real-time capture time of the last sample produced, for a start at t0_us.
+uint64_t replay_time_us(const replay_t *r, uint64_t t0_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+#include "sched.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void sched_init(sched_t *s, uint64_t (*now_us)(void), void (*idle)(uint64_t until_us))
+{
+    memset(s, 0, sizeof(*s));
+    s->now_us = now_us;
+    s->idle = idle;
+    s->stats_since_us = now_us();
+}
+
+int sched_add(sched_t *s, const char *name, uint8_t prio, sched_fn_t fn, void *ctx)
+{
+    if (s->n >= SCHED_MAX_TASKS)
+        return -1;
+
+    sched_task_t *t = &s->tasks[s->n];
+    memset(t, 0, sizeof(*t));
+    t->name = name;
+    t->prio = prio;
+    t->fn = fn;
+    t->ctx = ctx;
+    return s->n++;
+}
+
+void sched_post(sched_t *s, int task, uint32_t events)
+{
+    // LDREX/STREX on the M33, AMOOR on Hazard3: no need to mask interrupts
+    __atomic_fetch_or(&s->tasks[task].pending, events, __ATOMIC_RELEASE);
+}
+
+void sched_set_timer(sched_t *s, int task, uint32_t event, uint32_t period_us)
+{
+    sched_task_t *t = &s->tasks[task];
+    t->timer_event = event;
+    t->period_us = period_us;
+    t->next_tick_us = s->now_us() + period_us;
+}
+
+// Post expired timers, return when the next one is due.
+static uint64_t fire_timers(sched_t *s, uint64_t now)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0; i < s->n; i++) {
+        sched_task_t *t = &s->tasks[i];
+        if (!t->period_us)
+            continue;
+
+        if (now >= t->next_tick_us) {
+            sched_post(s, i, t->timer_event);
+            t->next_tick_us += t->period_us;
+            // Fell behind by more than a period: don't replay missed ticks
+            if (t->next_tick_us <= now)
+                t->next_tick_us = now + t->period_us;
+        }
+        if (t->next_tick_us < next)
+            next = t->next_tick_us;
+    }
+    return next;
+}
+
+bool sched_run_once(sched_t *s)
+{
+    uint64_t now = s->now_us();
+    uint64_t next = fire_timers(s, now);
+
+    sched_task_t *best = NULL;
+    for (int i = 0; i < s->n; i++) {
+        sched_task_t *t = &s->tasks[i];
+        if (t->pending && (!best || t->prio > best->prio))
+            best = t;
+    }
+
+    if (!best) {
+        // An IRQ between the scan and the sleep still wakes the idle hook:
+        // exception entry sets the event register that WFE waits on.
+        s->idle(next);
+        s->idle_us += s->now_us() - now;
+        return false;
+    }
+
+    uint32_t ev = __atomic_exchange_n(&best->pending, 0, __ATOMIC_ACQUIRE);
+    TRACE_BEGIN(TR_TASK, best - s->tasks);
+    best->fn(best->ctx, ev);
+    TRACE_END(TR_TASK, best - s->tasks);
+
+    uint32_t us = (uint32_t)(s->now_us() - now);
+    best->busy_us += us;
+    best->runs++;
+    if (us > best->max_us)
+        best->max_us = us;
+    return true;
+}
+
+void sched_run(sched_t *s)
+{
+    s->stop = false;
+    while (!s->stop)
+        sched_run_once(s);
+}
+
+void sched_stop(sched_t *s)
+{
+    s->stop = true;
+}
+
+void sched_reset_stats(sched_t *s)
+{
+    for (int i = 0; i < s->n; i++) {
+        s->tasks[i].busy_us = 0;
+        s->tasks[i].runs = 0;
+        s->tasks[i].max_us = 0;
+    }
+    s->idle_us = 0;
+    s->stats_since_us = s->now_us();
+}
+
+void sched_print_stats(const sched_t *s)
+{
+    uint64_t total = s->now_us() - s->stats_since_us;
+    if (total == 0)
+        total = 1;
+
+    printf("%-10s %8s %10s %8s %7s\n", "task", "runs", "busy us", "max us", "cpu %");
+    for (int i = 0; i < s->n; i++) {
+        const sched_task_t *t = &s->tasks[i];
+        uint32_t bp = (uint32_t)(t->busy_us * 10000 / total);
+        printf("%-10s %8lu %10llu %8lu %4lu.%02lu\n", t->name,
+               (unsigned long)t->runs, (unsigned long long)t->busy_us,
+               (unsigned long)t->max_us, (unsigned long)(bp / 100), (unsigned long)(bp % 100));
+    }
+    uint32_t bp = (uint32_t)(s->idle_us * 10000 / total);
+    printf("%-10s %8s %10llu %8s %4lu.%02lu\n", "idle", "",
+           (unsigned long long)s->idle_us, "", (unsigned long)(bp / 100), (unsigned long)(bp % 100));
+}
@@ -0,0 +1,83 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cooperative event scheduler.
+ *
+ * Each task owns a 32-bit event mask. Interrupt handlers (DMA block ready,
+ * button edge) set bits with sched_post(); periodic timers set bits when
+ * they expire. sched_run_once() picks the highest-priority task with
+ * pending events, hands it the events and lets it run to completion.
+ * With nothing to do it calls the idle hook, which sleeps (WFE on target)
+ * until the next timer or until an interrupt arrives.
+ *
+ * Time and sleep come from the caller, so the host build can drive the
+ * scheduler with a simulated clock.
+ */
+
+#define SCHED_MAX_TASKS 8
+
+typedef void (*sched_fn_t)(void *ctx, uint32_t events);
+
+typedef struct {
+    const char *name;
+    sched_fn_t fn;
+    void *ctx;
+    uint8_t prio;                 // higher runs first
+    volatile uint32_t pending;    // set from IRQs, cleared when the task runs
+
+    uint32_t timer_event;
+    uint32_t period_us;           // 0 = no timer
+    uint64_t next_tick_us;
+
+    // accounting
+    uint64_t busy_us;
+    uint32_t runs;
+    uint32_t max_us;
+} sched_task_t;
+
+typedef struct {
+    sched_task_t tasks[SCHED_MAX_TASKS];
+    uint8_t n;
+
+    uint64_t (*now_us)(void);
+    void (*idle)(uint64_t until_us);   // return at until_us or on any interrupt
+
+    volatile bool stop;
+    uint64_t stats_since_us;
+    uint64_t idle_us;
+} sched_t;
+
+void sched_init(sched_t *s, uint64_t (*now_us)(void), void (*idle)(uint64_t until_us));
+
+// Returns the task id, or -1 if the table is full.
+int sched_add(sched_t *s, const char *name, uint8_t prio, sched_fn_t fn, void *ctx);
+
+// Set event bits on a task. Safe from interrupt handlers.
+void sched_post(sched_t *s, int task, uint32_t events);
+
+// Post `event` to `task` every period_us. period_us == 0 stops the timer.
+void sched_set_timer(sched_t *s, int task, uint32_t event, uint32_t period_us);
+
+// Run one ready task, or idle until the next timer. Returns true if a task ran.
+bool sched_run_once(sched_t *s);
+
+// Loop until sched_stop().
+void sched_run(sched_t *s);
+void sched_stop(sched_t *s);
+
+void sched_reset_stats(sched_t *s);
+void sched_print_stats(const sched_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,322 @@
+#include "sd_proto.h"
+
+#include <string.h>
+
+enum {
+    MBW_CLOSED = 0,
+    MBW_READY_WAIT,   // card must return 0xFF before a command
+    MBW_CMD_TX,
+    MBW_CMD_R1,
+    MBW_OPEN,         // CMD25 accepted, waiting for blocks
+    MBW_DATA_HDR,     // Nwr gap + start token
+    MBW_DATA_BODY,
+    MBW_DATA_CRC,
+    MBW_DATA_RESP,
+    MBW_BUSY,         // card programming the block
+    MBW_STOP_TX,
+    MBW_STOP_BUSY,
+    MBW_FAILED,
+};
+
+#define TOKEN_MULTI_WRITE 0xFC
+#define TOKEN_STOP_TRAN   0xFD
+
+#define NCR_MAX 8          // bytes to wait for R1 / data response
+
+uint8_t sd_crc7(const uint8_t *p, size_t n)
+{
+    uint8_t crc = 0;
+    while (n--) {
+        uint8_t b = *p++;
+        for (int i = 0; i < 8; i++) {
+            crc <<= 1;
+            if ((b ^ crc) & 0x80)
+                crc ^= 0x09;
+            b <<= 1;
+        }
+    }
+    return crc & 0x7F;
+}
+
+uint16_t sd_crc16(uint16_t crc, const uint8_t *p, size_t n)
+{
+    while (n--) {
+        crc ^= (uint16_t)(*p++) << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+static void xfer(sd_mbw_t *w, const uint8_t *tx, uint8_t *rx, uint32_t len, bool crc)
+{
+    w->t->xfer_start(w->t->ctx, tx, rx, len, crc);
+    w->in_flight = true;
+}
+
+static void fail(sd_mbw_t *w, sd_status_t e)
+{
+    w->error = e;
+    w->pending = 0;
+    w->state = MBW_FAILED;
+    w->t->select(w->t->ctx, false);
+}
+
+static void build_cmd(sd_mbw_t *w, uint8_t cmd, uint32_t arg)
+{
+    w->cmd[0] = 0x40 | cmd;
+    w->cmd[1] = (uint8_t)(arg >> 24);
+    w->cmd[2] = (uint8_t)(arg >> 16);
+    w->cmd[3] = (uint8_t)(arg >> 8);
+    w->cmd[4] = (uint8_t)arg;
+    w->cmd[5] = (uint8_t)(sd_crc7(w->cmd, 5) << 1) | 1;
+}
+
+static void wait_ready(sd_mbw_t *w, uint8_t state, uint64_t now_us)
+{
+    w->state = state;
+    w->deadline_us = now_us + SD_WRITE_TIMEOUT_US;
+    w->next_poll_us = now_us;
+}
+
+// Busy polls: true once the card released MISO, fails on timeout.
+static bool busy_done(sd_mbw_t *w, uint32_t len, uint64_t now_us)
+{
+    if (w->rx[len - 1] == 0xFF)
+        return true;
+
+    w->busy_polls++;
+    if (now_us > w->deadline_us)
+        fail(w, SD_ERR_TIMEOUT);
+    else
+        w->next_poll_us = now_us + SD_BUSY_POLL_US;
+    return false;
+}
+
+// Start the transfer belonging to the current state. Returns false if
+// there is nothing to do right now.
+static bool issue(sd_mbw_t *w, uint64_t now_us)
+{
+    switch (w->state) {
+    case MBW_READY_WAIT:
+        if (now_us < w->next_poll_us)
+            return false;
+        xfer(w, NULL, w->rx, 1, false);
+        return true;
+    case MBW_BUSY:
+    case MBW_STOP_BUSY:
+        if (now_us < w->next_poll_us)
+            return false;
+        xfer(w, NULL, w->rx, SD_BUSY_POLL_BYTES, false);
+        return true;
+    case MBW_CMD_TX:
+        xfer(w, w->cmd, NULL, sizeof(w->cmd), false);
+        return true;
+    case MBW_CMD_R1:
+    case MBW_DATA_RESP:
+        xfer(w, NULL, w->rx, 1, false);
+        return true;
+    case MBW_OPEN:
+        if (w->pending == 0)
+            return false;
+        w->hdr[0] = 0xFF;
+        w->hdr[1] = TOKEN_MULTI_WRITE;
+        w->state = MBW_DATA_HDR;
+        // fall through
+    case MBW_DATA_HDR:
+        xfer(w, w->hdr, NULL, sizeof(w->hdr), false);
+        return true;
+    case MBW_DATA_BODY:
+        xfer(w, w->data, NULL, SD_BLOCK_SIZE, true);
+        return true;
+    case MBW_DATA_CRC:
+        xfer(w, w->crc, NULL, sizeof(w->crc), false);
+        return true;
+    case MBW_STOP_TX:
+        xfer(w, w->hdr, NULL, sizeof(w->hdr), false);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void command_done(sd_mbw_t *w, uint64_t now_us)
+{
+    switch (w->cmd[0] & 0x3F) {
+    case 55:
+        build_cmd(w, 23, w->pre_erase);          // ACMD23 SET_WR_BLK_ERASE_COUNT
+        w->state = MBW_CMD_TX;
+        break;
+    case 23:
+        build_cmd(w, 25, w->high_capacity ? w->lba : w->lba * SD_BLOCK_SIZE);
+        wait_ready(w, MBW_READY_WAIT, now_us);
+        break;
+    default:
+        w->state = MBW_OPEN;
+        break;
+    }
+}
+
+// Handle the transfer that just finished.
+static void complete(sd_mbw_t *w, uint64_t now_us)
+{
+    switch (w->state) {
+    case MBW_READY_WAIT:
+        if (w->rx[0] == 0xFF)
+            w->state = MBW_CMD_TX;
+        else
+            busy_done(w, 1, now_us);
+        break;
+    case MBW_CMD_TX:
+        w->state = MBW_CMD_R1;
+        w->tries = 0;
+        break;
+    case MBW_CMD_R1:
+        if (w->rx[0] & 0x80) {
+            if (++w->tries >= NCR_MAX)
+                fail(w, SD_ERR_TIMEOUT);
+            break;
+        }
+        w->r1 = w->rx[0];
+        if (w->r1 != 0)
+            fail(w, SD_ERR_CMD);
+        else
+            command_done(w, now_us);
+        break;
+    case MBW_DATA_HDR:
+        w->state = MBW_DATA_BODY;
+        break;
+    case MBW_DATA_BODY: {
+        uint16_t crc = w->t->xfer_crc(w->t->ctx);
+        w->crc[0] = (uint8_t)(crc >> 8);
+        w->crc[1] = (uint8_t)crc;
+        w->state = MBW_DATA_CRC;
+        break;
+    }
+    case MBW_DATA_CRC:
+        w->state = MBW_DATA_RESP;
+        w->tries = 0;
+        break;
+    case MBW_DATA_RESP:
+        if (w->rx[0] == 0xFF) {
+            if (++w->tries >= NCR_MAX)
+                fail(w, SD_ERR_TIMEOUT);
+            break;
+        }
+        w->data_resp = w->rx[0] & 0x1F;
+        if (w->data_resp == 0x05) {
+            wait_ready(w, MBW_BUSY, now_us);
+        } else {
+            // Rejected block: close the transaction before reporting
+            w->error = w->data_resp == 0x0B ? SD_ERR_CRC : SD_ERR_WRITE;
+            w->pending = 0;
+            w->hdr[0] = TOKEN_STOP_TRAN;
+            w->hdr[1] = 0xFF;
+            w->state = MBW_STOP_TX;
+        }
+        break;
+    case MBW_BUSY:
+        if (busy_done(w, SD_BUSY_POLL_BYTES, now_us)) {
+            w->blocks_done++;
+            w->lba++;
+            w->data += SD_BLOCK_SIZE;
+            w->pending--;
+            w->state = MBW_OPEN;
+        }
+        break;
+    case MBW_STOP_TX:
+        wait_ready(w, MBW_STOP_BUSY, now_us);
+        break;
+    case MBW_STOP_BUSY:
+        if (busy_done(w, SD_BUSY_POLL_BYTES, now_us)) {
+            w->state = w->error == SD_OK ? MBW_CLOSED : MBW_FAILED;
+            w->t->select(w->t->ctx, false);
+        }
+        break;
+    }
+}
+
+void sd_mbw_init(sd_mbw_t *w, const sd_transport_t *t, bool high_capacity)
+{
+    memset(w, 0, sizeof(*w));
+    w->t = t;
+    w->high_capacity = high_capacity;
+    w->state = MBW_CLOSED;
+}
+
+sd_status_t sd_mbw_start(sd_mbw_t *w, uint32_t lba, uint32_t pre_erase, uint64_t now_us)
+{
+    if (w->state != MBW_CLOSED && w->state != MBW_FAILED)
+        return SD_ERR_STATE;
+
+    w->error = SD_OK;
+    w->lba = lba;
+    w->pre_erase = pre_erase;
+    w->pending = 0;
+
+    if (pre_erase)
+        build_cmd(w, 55, 0);
+    else
+        build_cmd(w, 25, w->high_capacity ? lba : lba * SD_BLOCK_SIZE);
+
+    w->t->select(w->t->ctx, true);
+    wait_ready(w, MBW_READY_WAIT, now_us);
+    return sd_mbw_poll(w, now_us);
+}
+
+sd_status_t sd_mbw_write(sd_mbw_t *w, const uint8_t *data, uint32_t count, uint64_t now_us)
+{
+    if (w->state == MBW_CLOSED || w->state == MBW_FAILED ||
+        w->state == MBW_STOP_TX || w->state == MBW_STOP_BUSY)
+        return SD_ERR_STATE;
+    if (w->pending)
+        return SD_BUSY;
+
+    w->data = data;
+    w->pending = count;
+    return sd_mbw_poll(w, now_us);
+}
+
+sd_status_t sd_mbw_stop(sd_mbw_t *w, uint64_t now_us)
+{
+    if (w->state == MBW_STOP_TX || w->state == MBW_STOP_BUSY)
+        return sd_mbw_poll(w, now_us);
+    if (sd_mbw_closed(w))
+        return w->error;
+    if (!sd_mbw_idle(w))
+        return SD_BUSY;
+
+    w->hdr[0] = TOKEN_STOP_TRAN;
+    w->hdr[1] = 0xFF;              // Nbr: one byte before busy starts
+    w->state = MBW_STOP_TX;
+    return sd_mbw_poll(w, now_us);
+}
+
+sd_status_t sd_mbw_poll(sd_mbw_t *w, uint64_t now_us)
+{
+    for (;;) {
+        if (w->in_flight) {
+            if (w->t->xfer_busy(w->t->ctx))
+                return SD_BUSY;
+            w->in_flight = false;
+            complete(w, now_us);
+            continue;
+        }
+        if (w->state == MBW_FAILED)
+            return w->error;
+        if (w->state == MBW_CLOSED)
+            return SD_OK;
+        if (!issue(w, now_us))
+            return w->state == MBW_OPEN ? SD_OK : SD_BUSY;
+    }
+}
+
+bool sd_mbw_idle(const sd_mbw_t *w)
+{
+    return w->state == MBW_OPEN && w->pending == 0 && !w->in_flight;
+}
+
+bool sd_mbw_closed(const sd_mbw_t *w)
+{
+    return w->state == MBW_CLOSED || w->state == MBW_FAILED;
+}
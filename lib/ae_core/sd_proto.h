@@ -0,0 +1,110 @@
+#ifndef SD_PROTO_H
+#define SD_PROTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SD card SPI-mode multi-block writer (CMD25).
+ *
+ * The writer never waits: every call starts at most one bus transfer and
+ * returns. sd_mbw_poll() is called from the main loop until it stops
+ * returning SD_BUSY. Card busy (MISO held low after each block) is polled
+ * with a short read every SD_BUSY_POLL_US instead of spinning on the bus.
+ *
+ * The bus is reached through sd_transport_t, so the same state machine
+ * runs on the RP2350 DMA transport (lib/sd_spi_dma) and against the host
+ * card model in tools/.
+ */
+
+#define SD_BLOCK_SIZE 512
+
+#define SD_BUSY_POLL_US     20       // gap between busy polls
+#define SD_BUSY_POLL_BYTES  8        // bytes clocked per busy poll
+#define SD_WRITE_TIMEOUT_US 250000   // spec limit for one block write
+
+typedef struct {
+    void *ctx;
+    void (*select)(void *ctx, bool on);
+    // Start a full-duplex transfer of len bytes. tx == NULL clocks out 0xFF,
+    // rx == NULL discards. With crc set the transport accumulates the SD
+    // CRC16 of the transmitted bytes, read back with xfer_crc().
+    void (*xfer_start)(void *ctx, const uint8_t *tx, uint8_t *rx, uint32_t len, bool crc);
+    bool (*xfer_busy)(void *ctx);
+    uint16_t (*xfer_crc)(void *ctx);
+} sd_transport_t;
+
+typedef enum {
+    SD_OK = 0,
+    SD_BUSY,          // transfer in flight, poll again
+    SD_ERR_CMD,       // command rejected, see r1
+    SD_ERR_CRC,       // card reported a data CRC error
+    SD_ERR_WRITE,     // card reported a write error
+    SD_ERR_TIMEOUT,
+    SD_ERR_STATE,     // call not valid in the current state
+} sd_status_t;
+
+typedef struct {
+    const sd_transport_t *t;
+    bool high_capacity;       // SDHC/SDXC: block addressing
+
+    uint8_t state;
+    uint8_t next;             // state to enter after a command's R1
+    bool in_flight;
+    uint8_t tries;
+    uint64_t deadline_us;
+    uint64_t next_poll_us;
+
+    uint32_t lba;             // address of the next block
+    uint32_t pre_erase;
+    const uint8_t *data;      // queued blocks
+    uint32_t pending;         // blocks left in the queue
+
+    uint8_t cmd[6];
+    uint8_t hdr[2];
+    uint8_t crc[2];
+    uint8_t rx[SD_BUSY_POLL_BYTES];
+
+    uint8_t r1;               // last R1
+    uint8_t data_resp;        // last data response token
+    sd_status_t error;
+
+    // accounting
+    uint32_t blocks_done;
+    uint32_t busy_polls;
+} sd_mbw_t;
+
+uint8_t sd_crc7(const uint8_t *p, size_t n);
+uint16_t sd_crc16(uint16_t crc, const uint8_t *p, size_t n);
+
+void sd_mbw_init(sd_mbw_t *w, const sd_transport_t *t, bool high_capacity);
+
+// Open a multi-block write at `lba`. pre_erase > 0 sends ACMD23 first so
+// the card can erase that many blocks ahead of the data.
+sd_status_t sd_mbw_start(sd_mbw_t *w, uint32_t lba, uint32_t pre_erase, uint64_t now_us);
+
+// Queue `count` contiguous blocks. The data must stay valid until
+// sd_mbw_idle() is true again. Returns SD_BUSY if blocks are still queued.
+sd_status_t sd_mbw_write(sd_mbw_t *w, const uint8_t *data, uint32_t count, uint64_t now_us);
+
+// Send the stop token and wait for the card to finish programming.
+sd_status_t sd_mbw_stop(sd_mbw_t *w, uint64_t now_us);
+
+sd_status_t sd_mbw_poll(sd_mbw_t *w, uint64_t now_us);
+
+// The transaction is open and every queued block has been accepted.
+bool sd_mbw_idle(const sd_mbw_t *w);
+
+// No transaction open (never started, stopped, or failed).
+bool sd_mbw_closed(const sd_mbw_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
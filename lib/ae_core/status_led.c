@@ -0,0 +1,105 @@
+#include "status_led.h"
+
+#include <string.h>
+
+// lo..LED_LEVEL and back over period_ms
+static uint32_t triangle(uint32_t t_ms, uint32_t period_ms, uint32_t lo)
+{
+    uint32_t half = period_ms / 2;
+    uint32_t ph = t_ms % period_ms;
+    uint32_t up = ph < half ? ph : period_ms - ph;
+    return lo + (LED_LEVEL - lo) * up / half;
+}
+
+static uint32_t state_word(led_state_t state, uint32_t t_ms)
+{
+    switch (state) {
+    case LED_BOOT:
+        return led_word(LED_LEVEL / 4, LED_LEVEL / 4, LED_LEVEL / 4);
+    case LED_IDLE:
+        return led_word(0, LED_LEVEL / 4, 0);
+    case LED_RECORDING:
+        return led_word((uint8_t)triangle(t_ms, 2000, 4), 0, 0);
+    case LED_OVERRUN:
+        return (t_ms % 125) < 62 ? led_word(LED_LEVEL, LED_LEVEL / 2, 0) : 0;
+    case LED_CARD_ERROR: {
+        uint32_t ph = t_ms % 1000;
+        return (ph < 100 || (ph >= 200 && ph < 300)) ? led_word(LED_LEVEL, 0, 0) : 0;
+    }
+    default:
+        return 0;
+    }
+}
+
+void led_frame(led_state_t state, uint32_t t_ms, uint32_t *px, uint32_t n)
+{
+    uint32_t w = state_word(state, t_ms);
+    for (uint32_t i = 0; i < n; i++)
+        px[i] = w;
+}
+
+void status_led_init(status_led_t *l, uint32_t n, led_start_fn start, void *ctx)
+{
+    memset(l, 0, sizeof(*l));
+    l->start = start;
+    l->ctx = ctx;
+    l->n = n < LED_MAX_PIXELS ? n : LED_MAX_PIXELS;
+    l->state = LED_OFF;
+}
+
+void status_led_set(status_led_t *l, led_state_t state)
+{
+    l->state = (uint8_t)state;
+    l->state_seq++;
+}
+
+void status_led_alert(status_led_t *l, led_state_t state, uint32_t hold_us)
+{
+    l->alert_hold_us = hold_us;
+    l->alert = (uint8_t)state;
+    l->alert_seq++;
+}
+
+bool status_led_poll(status_led_t *l, uint64_t now_us)
+{
+    l->polls++;
+
+    // Time states from the first poll that sees them, so only this
+    // function writes the 64-bit timestamps
+    uint8_t seq = l->state_seq;
+    if (seq != l->seen_state_seq) {
+        l->seen_state_seq = seq;
+        l->state_since_us = now_us;
+    }
+    seq = l->alert_seq;
+    if (seq != l->seen_alert_seq) {
+        l->seen_alert_seq = seq;
+        l->alert_since_us = now_us;
+        l->alert_until_us = now_us + l->alert_hold_us;
+    }
+
+    if (l->sent && now_us < l->ready_us) {
+        l->busy++;
+        return false;
+    }
+
+    led_state_t state = (led_state_t)l->state;
+    uint64_t since = l->state_since_us;
+    if (l->alert != LED_OFF && now_us < l->alert_until_us) {
+        state = (led_state_t)l->alert;
+        since = l->alert_since_us;
+    }
+
+    uint32_t next[LED_MAX_PIXELS];
+    led_frame(state, (uint32_t)((now_us - since) / 1000), next, l->n);
+    l->shown = (uint8_t)state;
+    if (l->sent && memcmp(next, l->frame, l->n * sizeof(uint32_t)) == 0)
+        return false;
+
+    memcpy(l->frame, next, l->n * sizeof(uint32_t));
+    l->start(l->ctx, l->frame, l->n);
+    l->ready_us = now_us + led_frame_time_us(l->n);
+    l->sent = true;
+    l->frames++;
+    return true;
+}
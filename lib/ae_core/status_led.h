@@ -0,0 +1,112 @@
+#ifndef STATUS_LED_H
+#define STATUS_LED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Status LED engine for the ws2812 pixels on LCD_D5_PIN.
+ *
+ * The application only says what state it is in (status_led_set) or
+ * flashes a transient one over it (status_led_alert); both are a couple of
+ * stores, safe from interrupt handlers. A periodic timer calls
+ * status_led_poll(), which renders the animation frame for the current
+ * time and, if it differs from the last one, hands the colour words to a
+ * start() callback (on target: one DMA transfer into the PIO TX FIFO).
+ *
+ * WS2812s latch a frame once the line has been low for LED_RESET_US. The
+ * engine knows how long a frame takes on the wire, so it simply doesn't
+ * start the next one before the previous one plus the latch time are
+ * over, instead of sleeping after every write. The frame buffer start()
+ * gets stays untouched until then, so DMA can read it directly.
+ *
+ * Frames depend only on the state and the time since it was entered:
+ * led_frame() is a pure function and the whole engine runs on the host
+ * with a simulated clock (tools/status_led_sim).
+ */
+
+#define LED_MAX_PIXELS 8
+#define LED_FRAME_US   20000   // animation step: poll at 50 Hz
+#define LED_BIT_NS     1250    // 800 kHz
+#define LED_RESET_US   300     // WS2812B-V5 needs 280 us low to latch
+#define LED_LEVEL      0x3F    // brightest channel value used
+
+typedef enum {
+    LED_OFF,
+    LED_BOOT,           // steady dim white while the card mounts
+    LED_IDLE,           // steady dim green, ready to record
+    LED_RECORDING,      // red breathing, 2 s period
+    LED_OVERRUN,        // amber flicker at 8 Hz: a buffer was lost
+    LED_CARD_ERROR,     // red double blink every second
+    LED_STATES
+} led_state_t;
+
+// Colour word as the ws2812 PIO program shifts it out, first byte in
+// bits 31..24. This board's pixels take red first (GRB parts: swap r, g).
+static inline uint32_t led_word(uint8_t r, uint8_t g, uint8_t b)
+{
+    return ((uint32_t)r << 24) | ((uint32_t)g << 16) | ((uint32_t)b << 8);
+}
+
+// Pixels of `state`, t_ms after it was entered.
+void led_frame(led_state_t state, uint32_t t_ms, uint32_t *px, uint32_t n);
+
+// Wire time of an n-pixel frame plus the latch: the earliest the next
+// frame may start.
+static inline uint32_t led_frame_time_us(uint32_t n)
+{
+    return (n * 24 * LED_BIT_NS + 999) / 1000 + LED_RESET_US;
+}
+
+typedef void (*led_start_fn)(void *ctx, const uint32_t *words, uint32_t n);
+
+typedef struct {
+    led_start_fn start;
+    void *ctx;
+    uint32_t n;
+
+    // Written by the application (any context)
+    volatile uint8_t state;
+    volatile uint8_t state_seq;       // bumped on every status_led_set()
+    volatile uint8_t alert;           // LED_OFF = none
+    volatile uint8_t alert_seq;
+    volatile uint32_t alert_hold_us;
+
+    // Owned by status_led_poll()
+    uint8_t seen_state_seq;
+    uint8_t seen_alert_seq;
+    uint8_t shown;                    // state the last frame was rendered for
+    uint64_t state_since_us;
+    uint64_t alert_since_us;
+    uint64_t alert_until_us;
+    uint64_t ready_us;                // previous frame on the wire and latched
+    uint32_t frame[LED_MAX_PIXELS];   // being sent; read by DMA
+    bool sent;
+
+    // accounting
+    uint32_t frames;
+    uint32_t polls;
+    uint32_t busy;                    // polls that found the previous frame still latching
+} status_led_t;
+
+void status_led_init(status_led_t *l, uint32_t n, led_start_fn start, void *ctx);
+
+// Base state, animated from now on.
+void status_led_set(status_led_t *l, led_state_t state);
+
+// Show `state` for hold_us over the base state; a new alert restarts it.
+void status_led_alert(status_led_t *l, led_state_t state, uint32_t hold_us);
+
+// Render and start the frame for now_us if it changed and the previous
+// one has latched. Returns true if a frame was started.
+bool status_led_poll(status_led_t *l, uint64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
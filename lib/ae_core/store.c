@@ -0,0 +1,143 @@
+#include "store.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void store_init(store_t *s, const store_config_t *cfg)
+{
+    memset(s, 0, sizeof(*s));
+    s->cfg = *cfg;
+    if (s->cfg.max_attempts == 0)
+        s->cfg.max_attempts = 1;
+    if (s->cfg.remount_after == 0)
+        s->cfg.remount_after = 1;
+    if (s->cfg.drop_backlog == 0)
+        s->cfg.drop_backlog = 1;
+    s->backoff_us = s->cfg.retry_us;
+}
+
+void store_seek(store_t *s, uint32_t block, uint32_t file_blocks)
+{
+    s->block = block;
+    s->file_blocks = file_blocks;
+}
+
+static void gap_close(store_t *s)
+{
+    if (!s->gap_open)
+        return;
+    s->gap_open = false;
+    s->gaps++;
+    if (s->cfg.gap)
+        s->cfg.gap(s->cfg.ctx, &s->gap);
+}
+
+static store_action_t drop(store_t *s, uint64_t t_us)
+{
+    if (!s->gap_open) {
+        s->gap_open = true;
+        s->gap.block = s->block;
+        s->gap.blocks = 0;
+        s->gap.file_block = s->file_blocks;
+        s->gap.t_us = t_us;
+    }
+    s->gap.blocks++;
+    s->gap.error = s->last_error;
+
+    s->dropped++;
+    s->block++;
+    s->attempts = 0;
+    return STORE_DROPPED;
+}
+
+static void backoff(store_t *s, uint64_t now_us)
+{
+    s->streak++;
+    s->retry_at_us = now_us + s->backoff_us;
+    s->backoff_us *= 2;
+    if (s->backoff_us > s->cfg.retry_max_us)
+        s->backoff_us = s->cfg.retry_max_us;
+}
+
+store_action_t store_push(store_t *s, const void *data, uint64_t t_us,
+                          uint32_t backlog, uint64_t now_us)
+{
+    if (backlog > s->backlog_peak)
+        s->backlog_peak = backlog;
+
+    if (s->need_recover) {
+        if (now_us < s->retry_at_us) {
+            s->waits++;
+            return backlog >= s->cfg.drop_backlog ? drop(s, t_us) : STORE_WAIT;
+        }
+
+        store_recover_t level = s->streak >= s->cfg.remount_after ? STORE_REMOUNT : STORE_REOPEN;
+        if (level == STORE_REMOUNT)
+            s->remounts++;
+        else
+            s->reopens++;
+
+        int r = s->cfg.recover(s->cfg.ctx, level, (uint64_t)s->file_blocks * s->cfg.block_bytes);
+        if (r != 0) {
+            s->recover_failures++;
+            s->last_error = r;
+            backoff(s, now_us);
+            return backlog >= s->cfg.drop_backlog ? drop(s, t_us) : STORE_WAIT;
+        }
+        s->need_recover = false;
+        if (level == STORE_REMOUNT)
+            s->streak = 0;      // another remount_after failures before the next one
+    }
+
+    if (s->attempts)
+        s->retries++;
+
+    int r = s->cfg.write(s->cfg.ctx, data, s->cfg.block_bytes);
+    if (r == 0) {
+        s->writes++;
+        s->file_blocks++;
+        s->block++;
+        s->attempts = 0;
+        s->streak = 0;
+        s->backoff_us = s->cfg.retry_us;
+        gap_close(s);
+        return STORE_WRITTEN;
+    }
+
+    s->errors++;
+    s->attempts++;
+    s->last_error = r;
+    s->need_recover = true;
+    backoff(s, now_us);
+
+    if (s->attempts >= s->cfg.max_attempts || backlog >= s->cfg.drop_backlog)
+        return drop(s, t_us);
+    return STORE_WAIT;
+}
+
+void store_sync_failed(store_t *s, int error, uint64_t now_us)
+{
+    s->sync_errors++;
+    s->last_error = error;
+    s->need_recover = true;
+    backoff(s, now_us);
+}
+
+void store_finish(store_t *s)
+{
+    gap_close(s);
+}
+
+void store_print(const store_t *s)
+{
+    printf("Store: %lu writes, %lu errors, %lu failed syncs, %lu retries, %lu reopens, "
+           "%lu remounts (%lu failed)\n",
+           (unsigned long)s->writes, (unsigned long)s->errors, (unsigned long)s->sync_errors,
+           (unsigned long)s->retries,
+           (unsigned long)s->reopens, (unsigned long)s->remounts,
+           (unsigned long)s->recover_failures);
+    if (s->dropped || s->gaps)
+        printf("Store: %lu blocks lost in %lu gaps, last error %ld\n", (unsigned long)s->dropped,
+               (unsigned long)s->gaps, (long)s->last_error);
+    printf("Store: backlog peak %lu blocks\n", (unsigned long)s->backlog_peak);
+}
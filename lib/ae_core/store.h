@@ -0,0 +1,138 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Storage error path for the logger's block writes.
+ *
+ * Blocks are written in acquisition order from a FIFO the caller owns (on
+ * target the ADC block ring: the blocks queued behind a failed one are the
+ * spare buffers). store_push() makes at most one write attempt per call
+ * and never waits. After a failed write the block stays queued and is
+ * retried after a backoff that doubles up to retry_max_us. Before the retry
+ * the file is reopened at the last good block (FatFs keeps a FIL in error
+ * after a failed f_write, and a partial block has to be cut off), and
+ * after remount_after failures in a row the card is remounted instead.
+ *
+ * A block is given up when it has failed max_attempts times or when the
+ * backlog reaches drop_backlog, so the producer never finds the FIFO full.
+ * Lost blocks are reported as gap records; consecutive ones merge into one
+ * record, which is handed to gap() once the next block is written (or by
+ * store_finish()), when the card is known to work again.
+ *
+ * aXXXX.gap layout (little endian), written next to aXXXX.bin when blocks
+ * were lost:
+ *   gap_header_t   24 bytes
+ *   store_gap_t    24 bytes each, in block order
+ *
+ * All times are microseconds from the caller's clock (time_us_64() on
+ * target, a simulated clock in tools/store_sim).
+ */
+
+#define GAP_MAGIC   0x50474541u     // "AEGP"
+#define GAP_VERSION 1
+
+typedef enum {
+    STORE_REOPEN,       // reopen the file, truncated to good_bytes
+    STORE_REMOUNT,      // bus recovery and f_mount first, then reopen
+} store_recover_t;
+
+typedef enum {
+    STORE_WRITTEN,      // block is on the card: pop it
+    STORE_WAIT,         // keep the block queued, offer it again later
+    STORE_DROPPED,      // block given up and counted in a gap: pop it
+} store_action_t;
+
+typedef struct {
+    uint32_t block;                 // acquisition index of the first lost block
+    uint32_t blocks;                // lost blocks in a row
+    uint32_t file_block;            // blocks in the file before the gap
+    int32_t error;                  // last write error (FRESULT on target)
+    uint64_t t_us;                  // when the first lost block completed
+} store_gap_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;           // sizeof(store_gap_t)
+    uint32_t block_samples;
+    uint32_t sample_rate;
+    uint8_t reserved[8];
+} gap_header_t;
+
+typedef struct {
+    // 0 = all bytes written, anything else is an error code
+    int (*write)(void *ctx, const void *data, uint32_t bytes);
+    // 0 = the file can be written again at good_bytes
+    int (*recover)(void *ctx, store_recover_t level, uint64_t good_bytes);
+    void (*gap)(void *ctx, const store_gap_t *g);
+    void *ctx;
+
+    uint32_t block_bytes;
+    uint32_t retry_us;              // first backoff after a failure
+    uint32_t retry_max_us;          // backoff cap
+    uint8_t max_attempts;           // per block, then it becomes a gap
+    uint8_t remount_after;          // failures in a row before a remount
+    uint32_t drop_backlog;          // queued blocks at which the oldest is given up
+} store_config_t;
+
+typedef struct {
+    store_config_t cfg;
+
+    uint32_t block;                 // acquisition index of the next block
+    uint32_t file_blocks;           // blocks in the file
+    uint8_t attempts;               // failed attempts on the current block
+    uint8_t streak;                 // failed writes or recoveries in a row
+    bool need_recover;
+    int32_t last_error;
+    uint64_t retry_at_us;
+    uint32_t backoff_us;
+    bool gap_open;
+    store_gap_t gap;                // being extended
+
+    // accounting
+    uint32_t writes;
+    uint32_t errors;                // failed writes
+    uint32_t sync_errors;           // failed syncs
+    uint32_t retries;               // writes of a block that had failed before
+    uint32_t reopens;
+    uint32_t remounts;
+    uint32_t recover_failures;
+    uint32_t dropped;               // blocks lost
+    uint32_t gaps;                  // gap records emitted
+    uint32_t waits;                 // calls that found a retry not yet due
+    uint32_t backlog_peak;
+} store_t;
+
+void store_init(store_t *s, const store_config_t *cfg);
+
+// Continue at acquisition index `block` with `file_blocks` already in the
+// file (e.g. after the CMD25 raw stream fell back to f_write).
+void store_seek(store_t *s, uint32_t block, uint32_t file_blocks);
+
+// Offer the oldest queued block; `backlog` counts it and everything
+// queued behind it. t_us is when the block completed.
+store_action_t store_push(store_t *s, const void *data, uint64_t t_us,
+                          uint32_t backlog, uint64_t now_us);
+
+// f_sync failed after the blocks written so far. The file is recovered
+// before the next write, with the same backoff and escalation as after a
+// failed write.
+void store_sync_failed(store_t *s, int error, uint64_t now_us);
+
+// End of recording: emit the open gap record, if any.
+void store_finish(store_t *s);
+
+void store_print(const store_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,99 @@
+#include "sync_policy.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void sync_policy_init(sync_policy_t *p, const sync_policy_config_t *cfg)
+{
+    memset(p, 0, sizeof(*p));
+    p->cfg = *cfg;
+}
+
+void sync_policy_note_write(sync_policy_t *p, uint32_t bytes,
+                            uint64_t data_us, uint32_t write_us)
+{
+    if (p->dirty_bytes == 0)
+        p->first_dirty_us = data_us;
+
+    p->dirty_bytes += bytes;
+    p->bytes_total += bytes;
+    p->write_us_total += write_us;
+}
+
+bool sync_policy_should_sync(sync_policy_t *p, uint64_t now_us, uint32_t idle_us)
+{
+    const sync_policy_config_t *c = &p->cfg;
+
+    if (p->dirty_bytes == 0)
+        return false;
+    if (c->max_bytes == 0 && c->max_interval_us == 0)
+        return false;   // SYNC_POLICY_NEVER
+
+    uint64_t age = now_us - p->first_dirty_us;
+
+    /* The first sync publishes the start cluster in the directory entry.
+       Until then a crash leaves nothing for the recovery tool to follow. */
+    bool due = (p->syncs == 0);
+    bool overdue = false;
+
+    /* Due at half the bound, so an idle window has time to come. Forced
+       when waiting for the next buffer would take the age past the bound. */
+    if (c->max_bytes) {
+        due     |= p->dirty_bytes >= (c->max_bytes + 1) / 2;
+        overdue |= p->dirty_bytes >= c->max_bytes;
+    }
+    if (c->max_interval_us) {
+        due     |= age >= (c->max_interval_us + 1) / 2;
+        overdue |= age + idle_us >= c->max_interval_us;
+    }
+
+    if (!due)
+        return false;
+
+    if (idle_us >= c->min_idle_us)
+        return true;
+
+    if (overdue) {
+        p->forced_syncs++;
+        return true;
+    }
+
+    p->deferred++;
+    return false;
+}
+
+void sync_policy_note_sync(sync_policy_t *p, uint64_t now_us, uint32_t sync_us)
+{
+    uint64_t exposure = now_us - p->first_dirty_us;
+    if (exposure > p->max_exposure_us)
+        p->max_exposure_us = exposure;
+
+    p->dirty_bytes = 0;
+    p->syncs++;
+    p->sync_us_total += sync_us;
+    if (sync_us > p->max_sync_us)
+        p->max_sync_us = sync_us;
+}
+
+uint32_t sync_policy_cost_bp(const sync_policy_t *p)
+{
+    if (p->write_us_total == 0)
+        return 0;
+    return (uint32_t)(p->sync_us_total * 10000u / p->write_us_total);
+}
+
+void sync_policy_print(const sync_policy_t *p)
+{
+    uint32_t bp = sync_policy_cost_bp(p);
+
+    printf("sync: %lu syncs (%lu forced, %lu deferred), %llu bytes\n",
+           (unsigned long)p->syncs, (unsigned long)p->forced_syncs,
+           (unsigned long)p->deferred, (unsigned long long)p->bytes_total);
+    printf("sync: write %llu us, sync %llu us (max %lu us), cost %lu.%02lu %%\n",
+           (unsigned long long)p->write_us_total,
+           (unsigned long long)p->sync_us_total,
+           (unsigned long)p->max_sync_us,
+           (unsigned long)(bp / 100), (unsigned long)(bp % 100));
+    printf("sync: worst unsynced age %llu us\n",
+           (unsigned long long)p->max_exposure_us);
+}
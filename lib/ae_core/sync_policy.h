@@ -0,0 +1,77 @@
+#ifndef SYNC_POLICY_H
+#define SYNC_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Decides when the logger should call f_sync().
+ *
+ * f_sync rewrites the FAT and the directory entry, so everything written
+ * before it survives a power loss. It is also the most expensive call in
+ * the write path, so a sync becomes due once half the configured bound is
+ * at risk (bytes or age) and runs when the next DMA buffer is far enough
+ * away that it fits into the idle window. If the idle window never comes,
+ * the sync is forced at the bound itself: the bound is a hard ceiling.
+ *
+ * All times are microseconds from the caller's clock (time_us_64() on
+ * target, a simulated clock on host).
+ */
+
+typedef struct {
+    uint32_t max_bytes;        // at most this many bytes unsynced (0 = no byte bound)
+    uint32_t max_interval_us;  // oldest unsynced byte at most this old (0 = no time bound)
+    uint32_t min_idle_us;      // only sync if at least this long until the next buffer is due
+} sync_policy_config_t;
+
+typedef struct {
+    sync_policy_config_t cfg;
+
+    uint64_t first_dirty_us;   // when the oldest unsynced sample was taken
+    uint32_t dirty_bytes;      // bytes written since the last sync
+
+    // accounting
+    uint64_t bytes_total;
+    uint64_t write_us_total;   // time spent inside f_write
+    uint64_t sync_us_total;    // time spent inside f_sync
+    uint32_t max_sync_us;
+    uint64_t max_exposure_us;  // worst age of unsynced data when a sync ran
+    uint32_t syncs;
+    uint32_t forced_syncs;     // syncs that ran outside an idle window
+    uint32_t deferred;         // calls where a sync was due but deferred
+} sync_policy_t;
+
+// Presets. Bounds are for the 4 kS/s, 1024-sample buffer logger.
+#define SYNC_POLICY_NEVER        ((sync_policy_config_t){ 0, 0, 0 })
+#define SYNC_POLICY_EVERY_BUFFER ((sync_policy_config_t){ 1, 0, 0 })
+#define SYNC_POLICY_1S           ((sync_policy_config_t){ 0, 1000000, 20000 })
+
+void sync_policy_init(sync_policy_t *p, const sync_policy_config_t *cfg);
+
+// Record an f_write of `bytes` that took write_us. data_us is when the
+// first sample in them was taken: a block that waited in a backlog is
+// already that old when it is written.
+void sync_policy_note_write(sync_policy_t *p, uint32_t bytes,
+                            uint64_t data_us, uint32_t write_us);
+
+// idle_us: time left until the next buffer has to be written.
+bool sync_policy_should_sync(sync_policy_t *p, uint64_t now_us, uint32_t idle_us);
+
+// Record an f_sync that finished at now_us and took sync_us. Only a
+// successful one: after a failed sync the data is still at risk.
+void sync_policy_note_sync(sync_policy_t *p, uint64_t now_us, uint32_t sync_us);
+
+// Sync overhead relative to the pure write time, in 1/100 %.
+uint32_t sync_policy_cost_bp(const sync_policy_t *p);
+
+void sync_policy_print(const sync_policy_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,137 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+trace_t *trace_sink;
+
+static const struct {
+    const char *name;
+    uint8_t lane;
+} trace_info[TR_IDS] = {
+    [TR_NONE]          = { "none",          0 },
+    [TR_DMA_IRQ]       = { "dma_irq",       1 },
+    [TR_BLOCK_PUBLISH] = { "block_publish", 1 },
+    [TR_BLOCK_CONSUME] = { "block_consume", 0 },
+    [TR_OVERRUN]       = { "overrun",       1 },
+    [TR_F_WRITE]       = { "f_write",       0 },
+    [TR_F_SYNC]        = { "f_sync",        0 },
+    [TR_CARD_WRITE]    = { "card_write",    0 },
+    [TR_SPI_SD]        = { "spi_sd",        0 },
+    [TR_SPI_LCD]       = { "spi_lcd",       0 },
+    [TR_LCD_FLUSH]     = { "lcd_flush",     0 },
+    [TR_BUTTON]        = { "button",        1 },
+    [TR_TASK]          = { "task",          0 },
+    [TR_PIPELINE]      = { "pipeline",      0 },
+    [TR_HIT]           = { "hit",           0 },
+    [TR_STORE_ERROR]   = { "store_error",   0 },
+    [TR_MARK]          = { "mark",          0 },
+    [TR_RATE]          = { "rate",          1 },
+    [TR_ONSET]         = { "onset",         0 },
+    [TR_SD_CLK]        = { "sd_clk",        0 },
+    [TR_DUTY]          = { "duty",          0 },
+};
+
+void trace_init(trace_t *t, trace_event_t *buf, uint32_t events, const volatile uint32_t *counter,
+                uint32_t (*clock)(void), uint32_t clock_hz)
+{
+    memset(t, 0, sizeof(*t));
+    t->ev = buf;
+    t->mask = events - 1;
+    t->counter = counter;
+    t->clock = clock;
+    t->clock_hz = clock_hz;
+}
+
+void trace_reset(trace_t *t)
+{
+    // Hold writers off while the ring state is cleared; they see the new
+    // head and trigger state before `stopped` drops. An emit that already
+    // passed its `stopped` check may still land one event after the reset.
+    t->stopped = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t->head = 0;
+    t->triggered = false;
+    t->stop_at = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t->stopped = false;
+}
+
+void trace_trigger(trace_t *t, uint32_t post)
+{
+    if (t->triggered)
+        return;
+    t->stop_at = t->head + post;
+    t->triggered = true;
+}
+
+uint32_t trace_count(const trace_t *t, uint32_t *first)
+{
+    uint32_t head = t->head;
+    uint32_t n = head > t->mask + 1 ? t->mask + 1 : head;
+    *first = head - n;
+    return n;
+}
+
+int trace_dump(trace_t *t, int (*write)(void *ctx, const void *data, uint32_t bytes), void *ctx)
+{
+    bool was_stopped = t->stopped;
+    t->stopped = true;
+
+    uint32_t first;
+    uint32_t n = trace_count(t, &first);
+    trace_header_t h = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .event_size = sizeof(trace_event_t),
+        .events = n,
+        .lost = first,
+        .clock_hz = t->clock_hz,
+    };
+    int r = write(ctx, &h, sizeof(h));
+
+    // Oldest first: at most two contiguous runs
+    uint32_t start = first & t->mask;
+    uint32_t run = n < t->mask + 1 - start ? n : t->mask + 1 - start;
+    if (r == 0 && run)
+        r = write(ctx, &t->ev[start], run * sizeof(trace_event_t));
+    if (r == 0 && n > run)
+        r = write(ctx, &t->ev[0], (n - run) * sizeof(trace_event_t));
+
+    t->stopped = was_stopped;
+    return r;
+}
+
+static int print_hex(void *ctx, const void *data, uint32_t bytes)
+{
+    uint32_t *col = ctx;
+    const uint8_t *p = data;
+    for (uint32_t i = 0; i < bytes; i++) {
+        if (*col == 0)
+            fputs("trace: ", stdout);
+        printf("%02x", p[i]);
+        if (++*col == 32) {
+            putchar('\n');
+            *col = 0;
+        }
+    }
+    return 0;
+}
+
+void trace_print(trace_t *t)
+{
+    uint32_t col = 0;
+    trace_dump(t, print_hex, &col);
+    if (col)
+        putchar('\n');
+}
+
+const char *trace_name(uint8_t id)
+{
+    return id < TR_IDS ? trace_info[id].name : "?";
+}
+
+uint8_t trace_lane(uint8_t id)
+{
+    return id < TR_IDS ? trace_info[id].lane : 0;
+}
@@ -0,0 +1,165 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Event trace of the acquisition hot path.
+ *
+ * A flight recorder: a power-of-two ring of 8-byte events (timestamp, id,
+ * begin/end/instant, 16-bit argument) that keeps overwriting the oldest.
+ * Recording one is a load of the counter, an atomic increment of the head
+ * (LDREX/STREX on the M33, AMOADD on Hazard3) and two stores, so it is
+ * safe from interrupt handlers and costs no lock. The TRACE* macros go
+ * through trace_sink, so code that is shared with the host tools records
+ * wherever a ring is installed and costs a load and a branch where none
+ * is; -DAE_TRACE=0 removes them.
+ *
+ * trace_trigger() keeps `post` more events and then stops, so the ring
+ * holds what led up to the problem (a ring overrun, a failed write) until
+ * it is dumped. trace_dump() writes a header and the events oldest first
+ * through a callback (a file on the card); trace_print() writes the same
+ * bytes as "trace: " hex lines on stdout, so a serial log can be cut
+ * out. tools/ae_trace turns either into Chrome trace JSON (Perfetto,
+ * chrome://tracing).
+ *
+ * Timestamps are the low 32 bits of the clock (on target the 1 MHz
+ * timer: 71 minutes before they wrap); the converter unwraps them.
+ */
+
+#ifndef AE_TRACE
+#define AE_TRACE 1
+#endif
+
+#define TRACE_MAGIC   0x52544541u   // "AETR"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TR_NONE,
+    TR_DMA_IRQ,         // dma_handler; arg: DMA channel
+    TR_BLOCK_PUBLISH,   // block completed into the ring; arg: ring head (low 16 bits)
+    TR_BLOCK_CONSUME,   // block taken off the ring; arg: ring tail
+    TR_OVERRUN,         // block lost with the ring full; arg: ring head
+    TR_F_WRITE,         // f_write; arg: bytes
+    TR_F_SYNC,          // f_sync
+    TR_CARD_WRITE,      // CMD25 block handed to the card; arg: ring tail
+    TR_SPI_SD,          // set_spi_mode_sdcard
+    TR_SPI_LCD,         // set_spi_mode_lcd
+    TR_LCD_FLUSH,       // u8g2_SendBuffer
+    TR_BUTTON,          // button interrupt; arg: GPIO
+    TR_TASK,            // scheduler task run; arg: task id
+    TR_PIPELINE,        // acquisition pipeline on one block; arg: block number
+    TR_HIT,             // AE hit; arg: peak
+    TR_STORE_ERROR,     // failed card write; arg: error code
+    TR_MARK,            // anything else; arg: caller's
+    TR_RATE,            // burst mode sample rate switch; arg: new rate / 100 Hz
+    TR_ONSET,           // picked arrival; arg: samples it lies before the STA/LTA candidate
+    TR_SD_CLK,          // SD bus clock stepped down; arg: new clock / 1 kHz
+    TR_DUTY,            // capture schedule state change; arg: duty_state_t
+    TR_IDS
+} trace_id_t;
+
+typedef enum {
+    TRACE_I,            // instant
+    TRACE_B,            // begin
+    TRACE_E,            // end
+} trace_phase_t;
+
+typedef struct {
+    uint32_t t;         // clock, low 32 bits
+    uint8_t id;         // trace_id_t
+    uint8_t phase;      // trace_phase_t
+    uint16_t arg;
+} trace_event_t;
+
+// What trace_dump() writes first
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t event_size;        // sizeof(trace_event_t)
+    uint32_t events;            // that follow
+    uint32_t lost;              // overwritten before the dump
+    uint32_t clock_hz;
+    uint32_t reserved[3];
+} trace_header_t;
+
+typedef struct {
+    trace_event_t *ev;
+    uint32_t mask;                      // events - 1
+    const volatile uint32_t *counter;   // read directly if set...
+    uint32_t (*clock)(void);            // ...otherwise called
+    uint32_t clock_hz;
+
+    volatile uint32_t head;             // events claimed (free-running)
+    volatile bool stopped;
+    bool triggered;
+    uint32_t stop_at;                   // head at which a trigger stops the ring
+} trace_t;
+
+extern trace_t *trace_sink;
+
+// `events` must be a power of two. Pass the clock as a counter register
+// (fastest) or as a function.
+void trace_init(trace_t *t, trace_event_t *buf, uint32_t events, const volatile uint32_t *counter,
+                uint32_t (*clock)(void), uint32_t clock_hz);
+
+// Empties the ring and starts recording again.
+void trace_reset(trace_t *t);
+
+static inline void trace_emit(trace_t *t, uint8_t id, uint8_t phase, uint16_t arg)
+{
+    if (t->stopped)
+        return;
+    uint32_t i = __atomic_fetch_add(&t->head, 1, __ATOMIC_RELAXED);
+    trace_event_t *e = &t->ev[i & t->mask];
+    e->t = t->counter ? *t->counter : t->clock();
+    e->id = id;
+    e->phase = phase;
+    e->arg = arg;
+    if (t->triggered && (int32_t)(i + 1 - t->stop_at) >= 0)
+        t->stopped = true;
+}
+
+// Stop after `post` more events. Only the first trigger counts.
+void trace_trigger(trace_t *t, uint32_t post);
+
+// Events in the ring, oldest first from *first.
+uint32_t trace_count(const trace_t *t, uint32_t *first);
+
+// Header and events through write() (0 = ok). Recording pauses meanwhile.
+int trace_dump(trace_t *t, int (*write)(void *ctx, const void *data, uint32_t bytes), void *ctx);
+
+// trace_dump() to stdout as hex lines.
+void trace_print(trace_t *t);
+
+const char *trace_name(uint8_t id);
+
+// Lane the converter draws an event on: 1 for interrupt handlers, 0 for
+// everything else.
+uint8_t trace_lane(uint8_t id);
+
+#if AE_TRACE
+#define TRACE_AT(id, ph, arg)                                                                      \
+    do {                                                                                           \
+        trace_t *t_ = trace_sink;                                                                  \
+        if (t_)                                                                                    \
+            trace_emit(t_, (id), (ph), (uint16_t)(arg));                                           \
+    } while (0)
+#else
+#define TRACE_AT(id, ph, arg) do { } while (0)
+#endif
+
+#define TRACE(id, arg)       TRACE_AT(id, TRACE_I, arg)
+#define TRACE_BEGIN(id, arg) TRACE_AT(id, TRACE_B, arg)
+#define TRACE_END(id, arg)   TRACE_AT(id, TRACE_E, arg)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
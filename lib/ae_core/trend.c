@@ -0,0 +1,277 @@
+#include "trend.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "block_stats.h"
+
+_Static_assert(sizeof(trend_record_t) == 32, "trend record layout");
+_Static_assert(sizeof(trend_header_t) == 32, "trend header layout");
+
+// Samples per pass with 32-bit partial sums: 65536 * 4095 fits an int32
+#define TREND_CHUNK 65536u
+
+void trend_acc_reset(trend_acc_t *a, uint16_t center)
+{
+    a->n = 0;
+    a->sum = 0;
+    a->sumsq = 0;
+    a->abs_sum = 0;
+    a->min = 0xFFFF;
+    a->max = 0;
+    a->center = center;
+    a->clipped = 0;
+    a->groups = 0;
+    for (int b = 0; b < TREND_BANDS; b++)
+        a->band_e[b] = 0;
+    a->low_sum = 0;
+}
+
+// Three Haar levels over whole groups of 8: the detail energies of each
+// level and the energy of the group sums. Differences don't depend on the
+// center, and every square fits 32 bits.
+static void haar_groups(trend_acc_t *a, const uint16_t *p, uint32_t groups)
+{
+    const int32_t c = a->center;
+    uint64_t e0 = 0, e1 = 0, e2 = 0, e3 = 0;
+    int64_t low = 0;
+
+    for (uint32_t g = 0; g < groups; g++, p += TREND_GROUP) {
+        int32_t d0 = (int32_t)p[0] - p[1], d1 = (int32_t)p[2] - p[3];
+        int32_t d2 = (int32_t)p[4] - p[5], d3 = (int32_t)p[6] - p[7];
+        int32_t s0 = p[0] + p[1], s1 = p[2] + p[3];
+        int32_t s2 = p[4] + p[5], s3 = p[6] + p[7];
+        int32_t dd0 = s0 - s1, dd1 = s2 - s3;
+        int32_t ddd = (s0 + s1) - (s2 + s3);
+        int32_t sss = s0 + s1 + s2 + s3 - TREND_GROUP * c;
+
+        e0 += (uint32_t)(d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3);
+        e1 += (uint32_t)(dd0 * dd0 + dd1 * dd1);
+        e2 += (uint32_t)(ddd * ddd);
+        e3 += (uint32_t)(sss * sss);
+        low += sss;
+    }
+    a->band_e[0] += e0;
+    a->band_e[1] += e1;
+    a->band_e[2] += e2;
+    a->band_e[3] += e3;
+    a->low_sum += low;
+    a->groups += groups;
+}
+
+void trend_accumulate(trend_acc_t *a, const uint16_t *p, uint32_t n)
+{
+    const int32_t c = a->center;
+    uint32_t mn = a->min, mx = a->max;
+
+    // Branch-free like block_stats_compute: vectorises on the host
+    for (uint32_t off = 0; off < n; off += TREND_CHUNK) {
+        uint32_t m = n - off < TREND_CHUNK ? n - off : TREND_CHUNK;
+        const uint16_t *q = p + off;
+        int32_t sum = 0;
+        uint32_t abs_sum = 0, clipped = 0;
+        uint64_t sumsq = 0;
+
+        for (uint32_t i = 0; i < m; i++) {
+            uint32_t v = q[i];
+            int32_t x = (int32_t)v - c;
+            mn = v < mn ? v : mn;
+            mx = v > mx ? v : mx;
+            sum += x;
+            sumsq += (uint32_t)(x * x);
+            abs_sum += (uint32_t)(x < 0 ? -x : x);
+            clipped += (v <= BLOCK_STATS_CLIP_LO) | (v >= BLOCK_STATS_CLIP_HI);
+        }
+        a->sum += sum;
+        a->sumsq += sumsq;
+        a->abs_sum += abs_sum;
+        a->clipped += clipped;
+    }
+    a->min = (uint16_t)mn;
+    a->max = (uint16_t)mx;
+    a->n += n;
+
+    // Haar groups: complete the carried one, then straight from p
+    uint32_t i = 0;
+    if (a->ncarry) {
+        while (a->ncarry < TREND_GROUP && i < n)
+            a->carry[a->ncarry++] = p[i++];
+        if (a->ncarry < TREND_GROUP)
+            return;
+        haar_groups(a, a->carry, 1);
+        a->ncarry = 0;
+    }
+    uint32_t g = (n - i) / TREND_GROUP;
+    haar_groups(a, p + i, g);
+    for (i += g * TREND_GROUP; i < n; i++)
+        a->carry[a->ncarry++] = p[i];
+}
+
+uint32_t trend_isqrt(uint64_t v)
+{
+    uint64_t r = 0, bit = (uint64_t)1 << 62;
+    while (bit > v)
+        bit >>= 2;
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+// 2000 * log10(v_q8 / 256): log2 by repeated squaring of the mantissa,
+// 16 fraction bits, then times 2000 * log10(2) = 602.06.
+int32_t trend_cdb(uint32_t v_q8)
+{
+    if (v_q8 == 0)
+        return TREND_ASL_NONE;
+
+    int32_t e = 31 - __builtin_clz(v_q8);
+    uint64_t m = (uint64_t)v_q8 << (30 - e);        // [1, 2) in Q30
+    int32_t frac = 0;
+    for (int b = 15; b >= 0; b--) {
+        m = (m * m) >> 30;
+        if (m >= ((uint64_t)2 << 30)) {
+            m >>= 1;
+            frac |= 1 << b;
+        }
+    }
+    int64_t l = ((int64_t)(e - 8) << 16) + frac;    // log2(v), Q16
+    int64_t num = l * 602060;
+    return (int32_t)((num + (num < 0 ? -32768000 : 32768000)) / 65536000);
+}
+
+static uint16_t sat16(uint64_t v)
+{
+    return v > 0xFFFF ? 0xFFFF : (uint16_t)v;
+}
+
+// Per-sample variance in Q8 counts^2 from an unscaled Haar energy
+static uint64_t band_var(uint64_t e, uint32_t shift, uint64_t samples)
+{
+    return (e << shift) / samples;
+}
+
+void trend_finish(const trend_acc_t *a, trend_record_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->samples = a->n;
+    r->asl = TREND_ASL_NONE;
+    if (a->n == 0)
+        return;
+
+    int64_t n = a->n;
+    int64_t m8 = (a->sum * 256) / n;                 // mean - center, Q8
+    int64_t var8 = (int64_t)((a->sumsq << 8) / (uint64_t)n) - ((m8 * m8) >> 8);
+    if (var8 < 0)
+        var8 = 0;
+
+    int32_t mean = a->center + (int32_t)((m8 + (m8 < 0 ? -128 : 128)) / 256);
+    mean = mean < 0 ? 0 : mean > BLOCK_STATS_CLIP_HI ? BLOCK_STATS_CLIP_HI : mean;
+    int32_t up = (int32_t)a->max - mean, down = mean - (int32_t)a->min;
+
+    r->mean = (uint16_t)mean;
+    r->rms = sat16(trend_isqrt((uint64_t)var8));
+    r->peak = (uint16_t)(up > down ? up : down);
+    r->asl = (int16_t)trend_cdb((uint32_t)((a->abs_sum << 8) / a->n));
+    r->crest = r->rms ? sat16(((uint64_t)r->peak << 12) / r->rms) : 0;
+    r->flags = a->clipped ? TREND_CLIPPED : 0;
+
+    // Orthonormal Haar: detail energies are d^2 / 2, / 4, / 8 and the
+    // group sums s^2 / 8, less the DC left in them
+    if (a->groups) {
+        uint64_t ns = (uint64_t)a->groups * TREND_GROUP;
+        int64_t dc8 = (a->low_sum * 256) / (int64_t)ns;
+        int64_t low8 = (int64_t)band_var(a->band_e[3], 5, ns) - ((dc8 * dc8) >> 8);
+        r->band[0] = sat16(trend_isqrt(band_var(a->band_e[0], 7, ns)));
+        r->band[1] = sat16(trend_isqrt(band_var(a->band_e[1], 6, ns)));
+        r->band[2] = sat16(trend_isqrt(band_var(a->band_e[2], 5, ns)));
+        r->band[3] = sat16(trend_isqrt(low8 > 0 ? (uint64_t)low8 : 0));
+    }
+}
+
+void trend_init(trend_t *t, const trend_config_t *cfg)
+{
+    memset(t, 0, sizeof(*t));
+    t->cfg = *cfg;
+    trend_acc_reset(&t->acc, 2048);
+}
+
+// Time of sample k: counted from the anchor, so DMA interrupt latency in
+// the block timestamps doesn't move interval boundaries.
+static uint64_t sample_us(const trend_t *t, uint64_t k)
+{
+    return t->anchor_us + (k - t->anchor_pos) * 1000000 / t->cfg.sample_rate;
+}
+
+static void close_interval(trend_t *t)
+{
+    trend_record_t r;
+    trend_finish(&t->acc, &r);
+    r.t_us = t->interval_start;
+    r.flags |= t->flags;
+    if (r.samples) {
+        t->cfg.emit(t->cfg.ctx, &r);
+        t->records++;
+    }
+    trend_acc_reset(&t->acc, r.samples ? r.mean : t->acc.center);
+    t->flags = 0;
+}
+
+void trend_push(trend_t *t, const uint16_t *p, uint32_t n, uint64_t t_last_us)
+{
+    const uint64_t rate = t->cfg.sample_rate;
+    const uint64_t iv = t->cfg.interval_us;
+    if (n == 0)
+        return;
+    uint64_t t_first = t_last_us - (uint64_t)(n - 1) * 1000000 / rate;
+    bool gap = false;
+
+    if (t->pos == 0) {
+        // Seed the DC accumulator with the first block's mean, and align
+        // the first interval down to a multiple of interval_us
+        trend_acc_reset(&t->acc, block_stats_center(p, n));
+        t->anchor_us = t->start_us = t_first;
+        t->interval_start = t_first - t_first % iv;
+        t->flags = t_first % iv ? TREND_PARTIAL : 0;
+    } else if (t_first > sample_us(t, t->pos) + (uint64_t)n * 500000 / rate) {
+        // More than half a block late: samples were lost
+        gap = true;
+        t->gaps++;
+        t->flags |= TREND_GAP | TREND_PARTIAL;
+        t->anchor_us = t_first;
+        t->anchor_pos = t->pos;
+    }
+
+    uint32_t i = 0;
+    while (i < n) {
+        uint64_t now = sample_us(t, t->pos);
+        uint64_t end = t->interval_start + iv;
+        if (now >= end) {
+            close_interval(t);
+            t->interval_start = now - now % iv;
+            if (gap && i == 0)
+                t->flags = TREND_GAP | TREND_PARTIAL;
+            continue;
+        }
+        // First sample at or after `end`
+        uint64_t stop = t->anchor_pos + ((end - t->anchor_us) * rate + 999999) / 1000000;
+        uint32_t m = stop - t->pos < n - i ? (uint32_t)(stop - t->pos) : n - i;
+        trend_accumulate(&t->acc, p + i, m);
+        i += m;
+        t->pos += m;
+    }
+}
+
+void trend_flush(trend_t *t)
+{
+    if (t->acc.n == 0)
+        return;
+    t->flags |= TREND_PARTIAL;
+    close_interval(t);
+}
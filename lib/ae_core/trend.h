@@ -0,0 +1,138 @@
+#ifndef TREND_H
+#define TREND_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Long-term trend records for condition monitoring: the ADC runs
+ * continuously and each wall-clock interval (1 s by default) is reduced
+ * to one 32-byte record, ~32 B/s instead of the raw 8 KB/s.
+ *
+ * Intervals are aligned to multiples of interval_us on the time_us_64()
+ * clock, so records from different recordings (and boards started
+ * together) line up. Sample times are counted from the first block and
+ * re-anchored only when a block arrives late enough to mean lost samples.
+ *
+ * aXXXX.trd layout (little endian):
+ *   trend_header_t   32 bytes
+ *   trend_record_t   32 bytes each, in time order
+ *
+ * Levels are in ADC counts around the interval mean. RMS values are Q4
+ * (counts * 16). The bands are a three-level Haar split of the signal:
+ * band 0 is fs/4..fs/2, band 1 fs/8..fs/4, band 2 fs/16..fs/8 and band 3
+ * everything below fs/16 except DC. Haar responses overlap, but the band
+ * energies add up to the total: sum of band[i]^2 ~ rms^2.
+ *
+ * Codes are 12 bits (the internal ADC): the partial sums and squares are
+ * 32-bit and the Q4 levels are 16-bit, neither of which holds 16-bit
+ * codes. The firmware refuses to build trend mode for wider ones.
+ */
+
+#define TREND_MAGIC   0x44525441u   // "ATRD"
+#define TREND_VERSION 1
+#define TREND_BANDS   4
+#define TREND_GROUP   8             // samples per Haar group (2^3 levels)
+
+#define TREND_ASL_NONE INT16_MIN    // no signal at all
+
+// trend_record_t.flags
+#define TREND_PARTIAL (1u << 0)     // interval not fully covered (start, stop, gap)
+#define TREND_GAP     (1u << 1)     // samples were lost in this interval
+#define TREND_CLIPPED (1u << 2)     // a sample hit the ADC rails
+
+typedef struct {
+    uint64_t t_us;                  // interval start, a multiple of interval_us
+    uint32_t samples;               // samples reduced into this record
+    uint16_t mean;                  // ADC counts
+    uint16_t rms;                   // AC rms, Q4 counts
+    uint16_t peak;                  // largest |v - mean|, counts
+    int16_t asl;                    // average signal level, 0.01 dB re 1 count
+    uint16_t crest;                 // peak / rms, Q8.8
+    uint16_t band[TREND_BANDS];     // rms per band, Q4 counts
+    uint16_t flags;
+} trend_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;           // sizeof(trend_record_t)
+    uint32_t interval_us;
+    uint32_t sample_rate;
+    uint64_t start_us;              // time_us_64() of the first sample
+    uint8_t reserved[8];
+} trend_header_t;
+
+// Running sums of one interval. Samples are taken around `center`, the
+// previous interval's mean, so the sums stay small and the rectified sum
+// is the ASL without a second pass. The Haar split works on groups of
+// TREND_GROUP samples; a partial group is carried into the next call.
+typedef struct {
+    uint32_t n;
+    int64_t sum;                    // sum of (v - center)
+    uint64_t sumsq;                 // sum of (v - center)^2
+    uint64_t abs_sum;               // sum of |v - center|
+    uint16_t min, max;
+    uint16_t center;
+    uint32_t clipped;
+
+    uint32_t groups;                // Haar groups completed
+    uint64_t band_e[TREND_BANDS];   // unscaled Haar energies
+    int64_t low_sum;                // sum of group sums, for the DC of band 3
+    uint16_t carry[TREND_GROUP];
+    uint32_t ncarry;
+} trend_acc_t;
+
+// Clears the sums for a new interval around `center`; keeps the carry.
+void trend_acc_reset(trend_acc_t *a, uint16_t center);
+
+// The reduction kernel: adds n samples to the interval.
+void trend_accumulate(trend_acc_t *a, const uint16_t *p, uint32_t n);
+
+// Record for the interval so far. Integer only: runs once per interval
+// on a core without an FPU.
+void trend_finish(const trend_acc_t *a, trend_record_t *r);
+
+typedef void (*trend_emit_fn)(void *ctx, const trend_record_t *r);
+
+typedef struct {
+    uint32_t interval_us;
+    uint32_t sample_rate;
+    trend_emit_fn emit;             // called once per closed interval
+    void *ctx;
+} trend_config_t;
+
+typedef struct {
+    trend_config_t cfg;
+    trend_acc_t acc;
+    uint64_t anchor_us;             // time of sample `anchor_pos`
+    uint64_t anchor_pos;
+    uint64_t pos;                   // samples pushed so far
+    uint64_t start_us;              // time of the first sample
+    uint64_t interval_start;        // start of the open interval
+    uint16_t flags;                 // for the open interval
+    uint32_t records;
+    uint32_t gaps;
+} trend_t;
+
+void trend_init(trend_t *t, const trend_config_t *cfg);
+
+// One block of n samples; t_last_us is when the last one was taken (the
+// DMA completion time). Emits every interval the block closes.
+void trend_push(trend_t *t, const uint16_t *p, uint32_t n, uint64_t t_last_us);
+
+// Emits the open interval as a partial record, at the end of a recording.
+void trend_flush(trend_t *t);
+
+// sqrt and 100 * 20 * log10, integer only; exposed for the host checks.
+uint32_t trend_isqrt(uint64_t v);
+int32_t trend_cdb(uint32_t v_q8);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
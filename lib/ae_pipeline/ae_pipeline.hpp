@@ -0,0 +1,491 @@
+#ifndef AE_PIPELINE_HPP
+#define AE_PIPELINE_HPP
+
+/*
+ * Compile-time composed acquisition pipeline.
+ *
+ * A pipeline is a fixed chain of stages, each a plain class with
+ *
+ *     template <class In, class Next> void push(const In &in, Next &&next);
+ *     void reset();
+ *
+ * A stage handles one block and hands its output block (same or another
+ * type) to next(). Sinks simply don't call next(). Pipeline<A, B, C> owns
+ * the stages by value and wires A -> B -> C with lambdas, so the whole
+ * chain inlines into one function: no virtual calls, no heap.
+ *
+ * Block size and sample rate are part of the block type, so a stage that
+ * changes them (Decimate) produces a new type, and mismatched stages fail
+ * to compile instead of misbehaving. A block also carries the rate it was
+ * actually taken at, which is what the stages time samples by: in burst
+ * mode (rate_ctl.h) the firmware pushes blocks of its nominal type at
+ * another rate, the first few at the rate before the switch.
+ *
+ * Header-only and free of pico-sdk headers: the same stages run in the
+ * firmware (acq_pipeline.cpp) and in host benchmarks (tools/pipeline_bench).
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+#include "adc_cal.h"
+#include "block_stats.h"
+#include "onset.h"
+
+namespace ae {
+
+// One block of N samples at Rate Hz. t_us is the time the last sample
+// was taken; seq counts blocks from the start of the recording. A block
+// taken at another rate says so in `rate`, and if the switch came during
+// it, its first `lead` samples were still taken at lead_rate.
+template <class T, uint32_t N, uint32_t Rate>
+struct Block {
+    using sample_type = T;
+    static constexpr uint32_t samples = N;
+    static constexpr uint32_t sample_rate = Rate;
+    static constexpr uint64_t period_us = uint64_t(N) * 1000000 / Rate;
+
+    const T *data;
+    uint64_t t_us;
+    uint32_t seq;
+    uint32_t rate = Rate;
+    uint32_t lead = 0;
+    uint32_t lead_rate = Rate;
+
+    // Time of sample i
+    constexpr uint64_t sample_us(uint32_t i) const
+    {
+        if (i >= lead)
+            return t_us - uint64_t(N - 1 - i) * 1000000 / rate;
+        return sample_us(lead) - uint64_t(lead - i) * 1000000 / lead_rate;
+    }
+};
+
+template <uint32_t N, uint32_t Rate>
+using AdcBlock = Block<uint16_t, N, Rate>;
+
+template <class... Stages>
+class Pipeline {
+public:
+    static_assert(sizeof...(Stages) > 0, "empty pipeline");
+
+    Pipeline() = default;
+    explicit Pipeline(Stages... stages) : stages_(std::move(stages)...) {}
+
+    template <class B>
+    void push(const B &b) { run<0>(b); }
+
+    void reset()
+    {
+        std::apply([](auto &...s) { (s.reset(), ...); }, stages_);
+    }
+
+    template <size_t I>
+    auto &stage() { return std::get<I>(stages_); }
+
+private:
+    template <size_t I, class B>
+    void run(const B &b)
+    {
+        if constexpr (I + 1 == sizeof...(Stages))
+            std::get<I>(stages_).push(b, [](const auto &) {});
+        else
+            std::get<I>(stages_).push(b, [this](const auto &out) { this->template run<I + 1>(out); });
+    }
+
+    std::tuple<Stages...> stages_;
+};
+
+// ---- Sources ----
+
+// Whole blocks from a sample array, timestamped as if captured at Rate
+// starting at t0_us. A trailing partial block is dropped.
+template <uint32_t N, uint32_t Rate>
+class MemorySource {
+public:
+    using block_type = AdcBlock<N, Rate>;
+
+    MemorySource(const uint16_t *data, size_t count, uint64_t t0_us = 0)
+        : data_(data), blocks_(count / N), t0_us_(t0_us) {}
+
+    bool next(AdcBlock<N, Rate> &b)
+    {
+        if (seq_ >= blocks_)
+            return false;
+        b.data = data_ + size_t(seq_) * N;
+        b.seq = seq_++;
+        b.t_us = t0_us_ + (uint64_t(b.seq + 1) * N - 1) * 1000000 / Rate;
+        return true;
+    }
+
+private:
+    const uint16_t *data_;
+    size_t blocks_;
+    uint64_t t0_us_;
+    uint32_t seq_ = 0;
+};
+
+// Push every block of src through p; returns the number of blocks.
+template <class Source, class P>
+uint32_t drain(Source &src, P &p)
+{
+    uint32_t n = 0;
+    for (typename Source::block_type b; src.next(b); n++)
+        p.push(b);
+    return n;
+}
+
+// ---- Transforms ----
+
+// block_stats_t per block (the aXXXX.sum record), handed to fn; the block
+// passes through unchanged. Zero crossings are counted around the previous
+// block's mean, like the firmware always has; the first block of a
+// recording around its own.
+template <uint32_t N, class Fn>
+class BlockStats {
+public:
+    explicit BlockStats(Fn fn = Fn()) : fn_(std::move(fn)) {}
+
+    void reset()
+    {
+        centered_ = false;
+        above_ = BLOCK_STATS_ABOVE_UNKNOWN;
+    }
+
+    template <uint32_t Rate, class Next>
+    void push(const AdcBlock<N, Rate> &in, Next &&next)
+    {
+        if (!centered_) {
+            center_ = block_stats_center(in.data, N);
+            centered_ = true;
+        }
+        block_stats_t r;
+        block_stats_compute(&r, in.data, N, center_, &above_);
+        r.seq = in.seq;
+        r.t_us = in.t_us;
+        center_ = block_stats_mean(&r, N);
+        fn_(r);
+        next(in);
+    }
+
+private:
+    Fn fn_;
+    uint16_t center_ = 0;
+    bool centered_ = false;
+    uint8_t above_ = BLOCK_STATS_ABOVE_UNKNOWN;
+};
+
+// ADC codes through a calibration table (adc_cal.h), rounded back to 12
+// bits. Without a table the block passes through untouched.
+template <uint32_t N>
+class Linearize {
+public:
+    void set_table(const uint16_t *lut) { lut_ = lut; }
+    void reset() {}
+
+    template <uint32_t Rate, class Next>
+    void push(const AdcBlock<N, Rate> &in, Next &&next)
+    {
+        if (!lut_) {
+            next(in);
+            return;
+        }
+        adc_cal_apply(lut_, in.data, out_.data(), N);
+        AdcBlock<N, Rate> out = in;
+        out.data = out_.data();
+        next(out);
+    }
+
+private:
+    const uint16_t *lut_ = nullptr;
+    std::array<uint16_t, N> out_{};
+};
+
+// Unsigned ADC codes to signed samples around the previous block's mean;
+// the first block of a recording around its own. Codes of any width up to
+// 16 bits: differences beyond the int16_t range saturate.
+template <uint32_t N>
+class DcBlock {
+public:
+    void reset() { centered_ = false; }
+
+    template <uint32_t Rate, class Next>
+    void push(const AdcBlock<N, Rate> &in, Next &&next)
+    {
+        if (!centered_) {
+            center_ = block_stats_center(in.data, N);
+            centered_ = true;
+        }
+        uint32_t sum = 0;
+        const int32_t c = center_;
+        for (uint32_t i = 0; i < N; i++) {
+            sum += in.data[i];
+            out_[i] = int16_t(std::clamp(int32_t(in.data[i]) - c, int32_t(INT16_MIN),
+                                         int32_t(INT16_MAX)));
+        }
+        center_ = uint16_t((sum + N / 2) / N);
+        next(Block<int16_t, N, Rate>{out_.data(), in.t_us, in.seq, in.rate, in.lead, in.lead_rate});
+    }
+
+private:
+    std::array<int16_t, N> out_{};
+    uint16_t center_ = 0;
+    bool centered_ = false;
+};
+
+// Boxcar average of F samples: N -> N/F samples, Rate -> Rate/F. An
+// output sample with any lead sample in it counts as lead.
+template <class T, uint32_t N, uint32_t F>
+class Decimate {
+public:
+    static_assert(F > 0 && N % F == 0, "block size must be a multiple of the factor");
+
+    void reset() {}
+
+    template <uint32_t Rate, class Next>
+    void push(const Block<T, N, Rate> &in, Next &&next)
+    {
+        static_assert(Rate % F == 0, "sample rate must be a multiple of the factor");
+        for (uint32_t o = 0; o < N / F; o++) {
+            int32_t sum = 0;
+            for (uint32_t k = 0; k < F; k++)
+                sum += in.data[o * F + k];
+            out_[o] = T(sum / int32_t(F));
+        }
+        next(Block<T, N / F, Rate / F>{out_.data(), in.t_us, in.seq, in.rate / F,
+                                       (in.lead + F - 1) / F, in.lead_rate / F});
+    }
+
+private:
+    std::array<T, N / F> out_{};
+};
+
+// ---- Detectors ----
+
+struct Hit {
+    uint64_t t_us;          // time of the first sample over threshold
+    uint64_t start;         // sample index of that sample
+    uint32_t duration;      // samples from first to last over threshold
+    uint16_t peak;          // largest |x|
+    uint16_t counts;        // upward threshold crossings
+};
+
+// Classic AE hit detection on signed samples: a hit opens at the first
+// |x| >= threshold and closes once the signal has stayed below it for the
+// hit definition time (HdtUs), counted in samples at the block's rate.
+// Each closed hit goes to fn; blocks pass through unchanged. Hits may
+// span blocks.
+template <uint32_t HdtUs, class Fn>
+class HitDetector {
+public:
+    explicit HitDetector(Fn fn = Fn(), uint16_t threshold = 200)
+        : fn_(std::move(fn)), threshold_(threshold) {}
+
+    void set_threshold(uint16_t t) { threshold_ = t; }
+
+    void reset()
+    {
+        pos_ = 0;
+        active_ = false;
+        above_ = false;
+    }
+
+    template <uint32_t N, uint32_t Rate, class Next>
+    void push(const Block<int16_t, N, Rate> &in, Next &&next)
+    {
+        static_assert(uint64_t(HdtUs) * Rate / 1000000 > 0,
+                      "hit definition time shorter than one sample");
+        const uint64_t hdt = std::max<uint64_t>(uint64_t(HdtUs) * in.rate / 1000000, 1);
+
+        for (uint32_t i = 0; i < N; i++, pos_++) {
+            int32_t x = in.data[i];
+            uint16_t a = uint16_t(x < 0 ? -x : x);
+
+            if (a >= threshold_) {
+                if (!active_) {
+                    active_ = true;
+                    hit_ = Hit{in.sample_us(i), pos_, 0, 0, 0};
+                }
+                if (!above_ && hit_.counts != UINT16_MAX)
+                    hit_.counts++;
+                if (a > hit_.peak)
+                    hit_.peak = a;
+                last_ = pos_;
+                above_ = true;
+            } else {
+                above_ = false;
+                if (active_ && pos_ - last_ >= hdt) {
+                    hit_.duration = uint32_t(last_ - hit_.start + 1);
+                    fn_(hit_);
+                    active_ = false;
+                }
+            }
+        }
+        next(in);
+    }
+
+private:
+    Fn fn_;
+    uint16_t threshold_;
+    uint64_t pos_ = 0;
+    uint64_t last_ = 0;
+    bool active_ = false;
+    bool above_ = false;
+    Hit hit_{};
+};
+
+struct Onset {
+    uint64_t t_us;          // arrival, on the clock of the block it was picked in
+    uint64_t at_q8;         // arrival, sample index in 1/256 sample
+    uint64_t trigger;       // sample index of the STA/LTA candidate
+    bool refined;           // by AIC; otherwise at_q8 is the candidate
+};
+
+// Arrival picking (onset.h) on signed samples: STA/LTA candidates, each
+// refined by AIC over the W samples up to Post after it once those are
+// in, so an onset comes out up to one block after its candidate. The last
+// W samples of the previous block are kept for windows that reach back
+// across the boundary. Each onset goes to fn; blocks pass through
+// unchanged.
+template <uint32_t N, uint32_t W, uint32_t Post, class Fn>
+class OnsetPicker {
+public:
+    static_assert(W > 2 * ONSET_AIC_EDGE && W <= ONSET_AIC_MAX, "AIC window size");
+    static_assert(Post < W - ONSET_AIC_EDGE, "window must reach back before the candidate");
+
+    explicit OnsetPicker(Fn fn = Fn()) : fn_(std::move(fn)) { sta_lta_config_default(&cfg_); }
+
+    void set_config(const sta_lta_config_t &cfg) { cfg_ = cfg; }
+    void set_refine(bool on) { refine_ = on; }
+    uint32_t dropped() const { return dropped_; }
+
+    void reset()
+    {
+        sta_lta_init(&sl_, &cfg_);
+        hist_.fill(0);
+        pos_ = 0;
+        pending_ = 0;
+        dropped_ = 0;
+        prev_t_us_ = 0;
+        prev_rate_ = 0;
+    }
+
+    template <uint32_t Rate, class Next>
+    void push(const Block<int16_t, N, Rate> &in, Next &&next)
+    {
+        uint32_t on[QUEUE];
+        const uint32_t found = sta_lta_run(&sl_, in.data, N, on, QUEUE);
+        if (found > QUEUE)
+            dropped_ += found - QUEUE;
+
+        if (!refine_) {
+            for (uint32_t j = 0; j < found && j < QUEUE; j++)
+                fn_(Onset{in.sample_us(on[j]), (pos_ + on[j]) << ONSET_FRAC_BITS, pos_ + on[j], false});
+            pos_ += N;
+            prev_t_us_ = in.t_us;
+            prev_rate_ = in.rate;
+            next(in);
+            return;
+        }
+
+        // hist_ is the W samples before this block, then the block
+        std::copy(in.data, in.data + N, hist_.begin() + W);
+        for (uint32_t j = 0; j < found && j < QUEUE; j++) {
+            if (pending_ < QUEUE)
+                queue_[pending_++] = pos_ + on[j];
+            else
+                dropped_++;
+        }
+
+        const uint64_t end = pos_ + N;
+        uint32_t done = 0;
+        for (; done < pending_ && queue_[done] + Post <= end; done++) {
+            const uint64_t cand = queue_[done], e = cand + Post;
+            const uint64_t s = e > W ? e - W : 0;
+            const int32_t k = onset_aic_pick(&hist_[size_t(s + W - pos_)], uint32_t(e - s), scratch_.data());
+            Onset o{0, cand << ONSET_FRAC_BITS, cand, k >= 0};
+            if (k >= 0)
+                o.at_q8 = (s << ONSET_FRAC_BITS) + uint64_t(k);
+            o.t_us = time_us(in, o.at_q8);
+            fn_(o);
+        }
+        std::copy(queue_ + done, queue_ + pending_, queue_);
+        pending_ -= done;
+
+        std::copy(hist_.begin() + N, hist_.end(), hist_.begin());
+        pos_ = end;
+        prev_t_us_ = in.t_us;
+        prev_rate_ = in.rate;
+        next(in);
+    }
+
+private:
+    static constexpr uint32_t QUEUE = 4;    // candidates waiting for their Post samples
+
+    // t_us less q8 (1/256 sample) at rate, rounded
+    static uint64_t back_us(uint64_t t_us, uint64_t q8, uint32_t rate)
+    {
+        const uint64_t den = uint64_t(rate) << ONSET_FRAC_BITS;
+        return t_us - (q8 * 1000000 + den / 2) / den;
+    }
+
+    // Time of at_q8, back from the last sample of the stretch it falls in
+    // that was taken at one rate: the whole span back from this block's
+    // end unless the rate changed in it, else this block from its lead
+    // on, its lead, or the previous block
+    template <uint32_t Rate>
+    uint64_t time_us(const Block<int16_t, N, Rate> &in, uint64_t at_q8) const
+    {
+        const uint64_t first_new = (pos_ + in.lead) << ONSET_FRAC_BITS;
+        if (at_q8 >= first_new || (in.lead == 0 && in.rate == prev_rate_))
+            return back_us(in.t_us, ((pos_ + N - 1) << ONSET_FRAC_BITS) - at_q8, in.rate);
+        if (at_q8 >= pos_ << ONSET_FRAC_BITS)
+            return back_us(in.sample_us(in.lead), first_new - at_q8, in.lead_rate);
+        return back_us(prev_t_us_, ((pos_ - 1) << ONSET_FRAC_BITS) - at_q8, prev_rate_);
+    }
+
+    Fn fn_;
+    sta_lta_config_t cfg_;
+    sta_lta_t sl_{};
+    bool refine_ = true;
+    std::array<int16_t, W + N> hist_{};
+    std::array<int32_t, W + 1> scratch_{};
+    uint64_t queue_[QUEUE] = {};
+    uint32_t pending_ = 0;
+    uint32_t dropped_ = 0;
+    uint64_t pos_ = 0;
+    uint64_t prev_t_us_ = 0;            // last sample of the previous block
+    uint32_t prev_rate_ = 0;            // and the rate it was taken at
+};
+
+// ---- Sinks ----
+
+struct Discard {
+    void reset() {}
+
+    template <class In, class Next>
+    void push(const In &, Next &&) {}
+};
+
+// Hands every block to fn(block).
+template <class Fn>
+class Call {
+public:
+    explicit Call(Fn fn = Fn()) : fn_(std::move(fn)) {}
+
+    void reset() {}
+
+    template <class In, class Next>
+    void push(const In &in, Next &&) { fn_(in); }
+
+private:
+    Fn fn_;
+};
+
+} // namespace ae
+
+#endif
@@ -0,0 +1,99 @@
+#include "sd_spi_dma.h"
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+
+static void tr_select(void *ctx, bool on)
+{
+    sd_spi_dma_t *d = ctx;
+    gpio_put(d->cs_pin, !on);
+}
+
+static void tr_xfer_start(void *ctx, const uint8_t *tx, uint8_t *rx, uint32_t len, bool crc)
+{
+    sd_spi_dma_t *d = ctx;
+    spi_hw_t *hw = spi_get_hw(d->spi);
+
+    // Drop stale bytes so RX stays in step with TX
+    while (spi_is_readable(d->spi))
+        (void)hw->dr;
+
+    dma_channel_config c = dma_channel_get_default_config(d->tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(d->spi, true));
+    channel_config_set_read_increment(&c, tx != NULL);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_sniff_enable(&c, crc);
+    dma_channel_configure(d->tx_chan, &c, &hw->dr, tx ? tx : &d->fill, len, false);
+
+    c = dma_channel_get_default_config(d->rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(d->spi, false));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, rx != NULL);
+    dma_channel_configure(d->rx_chan, &c, rx ? rx : &d->sink, &hw->dr, len, false);
+
+    d->crc = crc;
+    if (crc) {
+        // CRC-16-CCITT, seed 0: the SD data CRC
+        dma_sniffer_enable(d->tx_chan, DMA_SNIFF_CTRL_CALC_VALUE_CRC16, true);
+        dma_sniffer_set_data_accumulator(0);
+    }
+
+    dma_start_channel_mask((1u << d->tx_chan) | (1u << d->rx_chan));
+}
+
+static bool tr_xfer_busy(void *ctx)
+{
+    sd_spi_dma_t *d = ctx;
+    // RX finishes last: the final byte is only received after it was sent
+    return dma_channel_is_busy(d->rx_chan);
+}
+
+static uint16_t tr_xfer_crc(void *ctx)
+{
+    sd_spi_dma_t *d = ctx;
+    if (!d->crc)
+        return 0;
+    d->crc = false;
+    uint16_t crc = (uint16_t)dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    return crc;
+}
+
+void sd_spi_dma_init(sd_spi_dma_t *d, spi_inst_t *spi, uint cs_pin)
+{
+    d->spi = spi;
+    d->cs_pin = cs_pin;
+    d->fill = 0xFF;
+    d->crc = false;
+    d->tx_chan = dma_claim_unused_channel(true);
+    d->rx_chan = dma_claim_unused_channel(true);
+
+    d->transport = (sd_transport_t){
+        .ctx = d,
+        .select = tr_select,
+        .xfer_start = tr_xfer_start,
+        .xfer_busy = tr_xfer_busy,
+        .xfer_crc = tr_xfer_crc,
+    };
+}
+
+void sd_spi_dma_deinit(sd_spi_dma_t *d)
+{
+    dma_channel_abort(d->tx_chan);
+    dma_channel_abort(d->rx_chan);
+    dma_channel_unclaim(d->tx_chan);
+    dma_channel_unclaim(d->rx_chan);
+}
+
+uint sd_spi_dma_set_clock(sd_spi_dma_t *d, uint hz)
+{
+    uint max = clock_get_hz(clk_peri) / 2;
+    if (hz > max)
+        hz = max;
+    if (hz > SD_SPI_DMA_MAX_HZ)
+        hz = SD_SPI_DMA_MAX_HZ;
+    return spi_set_baudrate(d->spi, hz);
+}
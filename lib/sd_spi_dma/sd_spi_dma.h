@@ -0,0 +1,37 @@
+#ifndef SD_SPI_DMA_H
+#define SD_SPI_DMA_H
+
+#include "hardware/spi.h"
+#include "sd_proto.h"
+
+// SPI-mode SD cards are specified up to 25 MHz (default speed). The
+// RP2350 SPI tops out at clk_peri / 2.
+#define SD_SPI_DMA_MAX_HZ (25 * 1000 * 1000)
+
+/*
+ * sd_transport_t on top of two DMA channels (TX and RX) on one SPI port.
+ * The CRC16 of data blocks comes from the DMA sniffer on the TX channel,
+ * so neither the transfer nor the checksum cost CPU time.
+ *
+ * The card must already be initialised (pico_fatfs f_mount): this
+ * transport only takes over the bus for bulk writes.
+ */
+typedef struct {
+    spi_inst_t *spi;
+    uint cs_pin;
+    int tx_chan;
+    int rx_chan;
+    uint8_t fill;       // 0xFF clocked out when tx == NULL
+    uint8_t sink;       // rx target when rx == NULL
+    bool crc;
+    sd_transport_t transport;
+} sd_spi_dma_t;
+
+void sd_spi_dma_init(sd_spi_dma_t *d, spi_inst_t *spi, uint cs_pin);
+void sd_spi_dma_deinit(sd_spi_dma_t *d);
+
+// Set the bus clock, clamped to SD_SPI_DMA_MAX_HZ and clk_peri / 2.
+// Returns the clock actually set.
+uint sd_spi_dma_set_clock(sd_spi_dma_t *d, uint hz);
+
+#endif
@@ -13,8 +13,36 @@
 #include <ctype.h>
 #include "hardware/spi.h"
 #include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "hardware/pll.h"
+#ifdef __riscv
+#include "hardware/riscv.h"
+#else
+#include "hardware/structs/scb.h"
+#endif
 #include "ws2812.pio.h"
 #include "u8g2.h"
+#include "sync_policy.h"
+#include "sd_spi_dma.h"
+#include "diskio.h"
+#include "sd_card_fat.h"
+#include "sched.h"
+#include "block_stats.h"
+#include "acq_pipeline.h"
+#include "mem_pool.h"
+#include "replay.h"
+#include "trend.h"
+#include "status_led.h"
+#include "boot_log.h"
+#include "store.h"
+#include "adc_cal.h"
+#include "trace.h"
+#include "acq_source.h"
+#include "ext_adc.h"
+#include "ext_adc.pio.h"
+#include "rate_ctl.h"
+#include "clk_tune.h"
+#include "duty.h"
 
 #define PWM_PIN 22
 #define PWM_FREQ 1000  // 1 kHz
@@ -132,6 +160,11 @@ uint8_t u8x8_gpio_and_delay_pico(u8x8_t *u8x8,
 
 #define CLK_SLOW (2* 1000 * 1000)
 #define CLK_FAST (4 * 1000 * 1000)
+#define CLK_LCD  (4 * 1000 * 1000)
+
+// Card bus clock for FatFs and the raw stream. Mounts run at CLK_FAST,
+// then card_tune() raises it as far as the card and wiring allow.
+uint32_t sd_clk = CLK_FAST;
 
 #define LCD_W 128
 #define LCD_H 64
@@ -176,9 +209,55 @@ static void sd_spi_recovery(void)
     sleep_ms(2); // give card time to exit partial command
 }
 
-void init_sd_card(){
-    printf("SD Init..\n");
+PIO pio = pio0;
+int sm = 0;
+
+// ---- Status LED ----
+// status_led.c renders the animation; a 50 Hz timer polls it and each new
+// frame goes to the PIO by DMA, so nothing here waits for the pixels.
+#define LED_PIXELS 2
+#define LED_OVERRUN_HOLD_US (2 * 1000 * 1000)
+
+status_led_t status_led;
+int led_dma_chan;
+repeating_timer_t led_timer;
+
+static void led_dma_start(void *ctx, const uint32_t *words, uint32_t n) {
+    (void)ctx;
+    dma_channel_transfer_from_buffer_now(led_dma_chan, words, n);
+}
+
+static bool led_timer_cb(repeating_timer_t *t) {
+    (void)t;
+    status_led_poll(&status_led, time_us_64());
+    return true;
+}
+
+void neopixel_init(uint32_t pin){
+    // Load the PIO program
+    uint offset = pio_add_program(pio, &ws2812_program);
 
+    // 👇 Use your LCD pin here
+    ws2812_program_init(pio, sm, offset, pin, 800000, false);
+
+    // 32-bit words into the TX FIFO, paced by its DREQ
+    led_dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(led_dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(led_dma_chan, &c, &pio->txf[sm], NULL, 0, false);
+
+    status_led_init(&status_led, LED_PIXELS, led_dma_start, NULL);
+    add_repeating_timer_us(-LED_FRAME_US, led_timer_cb, NULL, &led_timer);
+}
+
+bool card_mounted = false;
+
+// Bus recovery, SPI config and f_mount. Also the remount after repeated
+// write failures, so it must not block forever.
+bool card_mount(void) {
     spi_set_format(spi1, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
     sd_spi_recovery();
     /* SPI configuration */
@@ -195,14 +274,144 @@ void init_sd_card(){
 
     if (!pico_fatfs_set_config(&config)) {
         printf("Failed to set config\n");
-        while (1) sleep_ms(5);
+        return false;
     }
 
+    f_unmount("");
     FRESULT fr  = f_mount(&fs, "", 1);
     if (fr != FR_OK) {
         printf("f_mount fail: %d\n", fr);
-        while (1) sleep_ms(5);
+        return false;
+    }
+    return true;
+}
+
+// ---- SD bus clock ----
+// After a fresh mount card_tune() probes the card at rising clocks
+// (lib/ae_core/clk_tune.h): write and read back sdclk.tmp, 4 blocks kept
+// contiguous for it, over the DMA transport. sdclk.bin remembers the
+// result per card, so a known card only confirms its clock. While
+// recording, failed writes can step the clock down; the lower clock is
+// saved when the recording stops.
+#define CLK_TUNE_TMP    "sdclk.tmp"
+#define CLK_TUNE_BLOCKS 4
+
+clk_tune_t clk_tune;
+clk_tune_table_t clk_table;
+uint8_t card_cid[16];
+bool card_cid_valid;
+uint32_t clk_saved_downshifts;  // run-time downshifts already in sdclk.bin
+
+static void clk_table_load(void) {
+    FIL f;
+    UINT br = 0;
+    bool ok = f_open(&f, CLK_TUNE_FILE, FA_READ) == FR_OK;
+    if (ok) {
+        ok = f_read(&f, &clk_table, sizeof(clk_table), &br) == FR_OK && br == sizeof(clk_table);
+        f_close(&f);
+    }
+    if (!ok || !clk_tune_table_valid(&clk_table))
+        clk_tune_table_init(&clk_table);
+}
+
+static void clk_table_save(void) {
+    if (!card_cid_valid)
+        return;
+    clk_tune_table_put(&clk_table, card_cid, sd_clk, clk_tune.downshifts);
+    clk_saved_downshifts = clk_tune.downshifts;
+
+    FIL f;
+    UINT bw = 0;
+    if (f_open(&f, CLK_TUNE_FILE, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK) {
+        f_write(&f, &clk_table, sizeof(clk_table), &bw);
+        f_close(&f);
     }
+    if (bw != sizeof(clk_table))
+        printf("%s not saved\n", CLK_TUNE_FILE);
+}
+
+void card_tune(void) {
+    clk_tune_config_t cfg;
+    clk_tune_config_default(&cfg);
+    clk_tune_init(&clk_tune, &cfg, 0);
+    clk_saved_downshifts = 0;
+    card_cid_valid = false;
+    sd_clk = CLK_FAST;
+
+#if FF_USE_EXPAND
+    FIL f;
+    const FSIZE_t bytes = CLK_TUNE_BLOCKS * SD_BLOCK_SIZE;
+    if (f_open(&f, CLK_TUNE_TMP, FA_READ | FA_WRITE | FA_OPEN_ALWAYS) != FR_OK)
+        return;
+    bool ok = f_size(&f) == bytes;
+    if (!ok)     // f_expand wants an empty file
+        ok = f_truncate(&f) == FR_OK && f_expand(&f, bytes, 1) == FR_OK && f_sync(&f) == FR_OK;
+    LBA_t lba = file_lba(&f);
+    bool high_capacity = card_high_capacity(f.obj.fs);
+    f_close(&f);
+    if (!ok) {
+        printf("No %s, SD clock stays at %d Hz\n", CLK_TUNE_TMP, CLK_FAST);
+        return;
+    }
+
+    clk_table_load();
+    uint64_t t0 = time_us_64();
+    static sd_spi_dma_t dma;
+    static uint8_t scratch[2 * SD_BLOCK_SIZE];
+    sd_spi_dma_init(&dma, SPI_PORT, SPI_CS_PIN);
+    sd_spi_dma_set_clock(&dma, CLK_FAST);
+
+    // Card-side CRC checks for the session: see clk_tune.h
+    uint32_t stored = 0;
+    clk_tune_state_t st = CLK_TUNE_FAILED;
+    if (clk_tune_crc(&dma.transport, true)) {
+        card_cid_valid = clk_tune_read_cid(&dma.transport, card_cid);
+        if (card_cid_valid)
+            stored = clk_tune_table_find(&clk_table, card_cid);
+        clk_tune_init(&clk_tune, &cfg, stored);
+
+        uint32_t hz, rounds;
+        while ((st = clk_tune_next(&clk_tune, &hz, &rounds)) == CLK_TUNE_PROBE) {
+            sd_spi_dma_set_clock(&dma, hz);
+            clk_tune_result(&clk_tune, clk_tune_probe(&dma.transport, high_capacity, (uint32_t)lba,
+                                                      CLK_TUNE_BLOCKS, rounds,
+                                                      (uint32_t)time_us_64(), scratch));
+        }
+        sd_spi_dma_set_clock(&dma, CLK_FAST);
+    }
+    bool crc_off = clk_tune_crc(&dma.transport, false);
+    sd_spi_dma_deinit(&dma);
+
+    // FatFs sends dummy CRCs: if CMD59 didn't get through, the CMD0 of a
+    // remount turns the checks off
+    if (!crc_off && !(card_mounted = card_mount()))
+        return;
+
+    sd_clk = clk_tune_hz(&clk_tune);
+    spi_set_baudrate(SPI_PORT, sd_clk);
+    printf("SD clock %lu Hz (%s, stored %lu), %lu probes, %lu errors, %lu ms\n",
+           (unsigned long)sd_clk, st == CLK_TUNE_DONE ? "tuned" : "failed",
+           (unsigned long)stored, (unsigned long)clk_tune.probes,
+           (unsigned long)clk_tune.probe_errors, (unsigned long)((time_us_64() - t0) / 1000));
+    if (st == CLK_TUNE_DONE && sd_clk != stored)
+        clk_table_save();
+#endif
+}
+
+#define CARD_MOUNT_TRIES 3
+
+// A missing card no longer hangs the logger: it stays in plot mode with
+// the card error pattern, and each recording start tries to mount again.
+void init_sd_card(){
+    printf("SD Init..\n");
+
+    card_mounted = false;
+    for (int i = 0; i < CARD_MOUNT_TRIES && !card_mounted; i++)
+        card_mounted = card_mount();
+    if (card_mounted)
+        card_tune();
+    if (!card_mounted)
+        status_led_set(&status_led, LED_CARD_ERROR);
 }
 
 void _create_hello_world_file(){
@@ -227,63 +436,239 @@ void _create_hello_world_file(){
     printf("Done\n");
 }
 
+// ---- Scheduler ----
+// Event bits, per task
+#define EV_START      (1u << 0)   // logger: start a recording
+#define EV_BUF_READY  (1u << 1)   // logger: dma_handler completed a buffer
+#define EV_BUTTON     (1u << 0)   // button: falling edge on BTN_ENC_PIN
+#define EV_STOP       (1u << 2)   // logger: end the recording (capture window over)
+#define EV_LOG_DONE   (1u << 0)   // duty: the logger closed the window's files
+#define EV_TICK       (1u << 31)  // any task: its periodic timer expired
+
+sched_t sched;
+int tid_logger, tid_button, tid_display, tid_stats, tid_duty;
+
+// ---- Boot ----
+// With BOOT_RECORD the ADC records into the block ring from power-on,
+// before stdio, the LED, the card and the LCD are up. The file is opened
+// once the card is mounted and the logger drains the backlog on its first
+// ticks. The LCD's settle time after InitDisplay runs during the mount.
+// Phase times go to the console once the first block is on the card.
+#ifndef BOOT_RECORD
+#define BOOT_RECORD 0
+#endif
+#define LCD_SETTLE_US 50000
+
+boot_log_t boot;
+bool boot_pending;          // report not printed yet
+bool boot_first_sample;     // mark it once the first block is in
+volatile uint64_t boot_first_block_us;  // stamped by dma_handler, 0 until then
+bool lcd_ready;
+
+static void boot_report(void) {
+    boot_pending = false;
+    printf("Boot timing (ms since reset):\n");
+    boot_log_print(&boot);
+}
+
 #define ADC_PIN 26          // ADC0
-#define SAMPLE_RATE 4000    // 4 kHz
-#define BUF_SIZE 1024       // samples
 
-uint16_t adc_buf1[BUF_SIZE];
-uint16_t adc_buf2[BUF_SIZE];
+// Where a recording takes its samples from. The replay sources stand in
+// for the ADC DMA, so detectors and writers see identical input on every
+// run and the output can be compared with tools/ae_replay on the host.
+#define ACQ_SOURCE_ADC       0
+#define ACQ_SOURCE_SD_REPLAY 1      // REPLAY_FILE_NAME on the card, to its end
+#define ACQ_SOURCE_SYNTH     2      // replay.c generator REPLAY_SYNTH_KIND
+#define ACQ_SOURCE_EXT_ADC   3      // SPI ADC clocked by ext_adc.pio
+#ifndef ACQ_SOURCE
+#define ACQ_SOURCE ACQ_SOURCE_ADC
+#endif
+#define REPLAY_FILE_NAME  "replay.bin"
+#define REPLAY_SYNTH_KIND REPLAY_SQUARE
+#define REPLAY_REALTIME   1         // 0: next block as soon as the last is written
+
+// What a recording keeps. LOG_MODE_TREND is for condition monitoring over
+// weeks: the ADC runs until the button is pressed again and only aXXXX.trd
+// is written, one 32-byte record per TREND_INTERVAL_US (~32 B/s instead
+// of 8 KB/s).
+#define LOG_MODE_RAW   0
+#define LOG_MODE_TREND 1
+#ifndef LOG_MODE
+#define LOG_MODE LOG_MODE_RAW
+#endif
+#define TREND_INTERVAL_US (1000 * 1000)
+
+// Burst mode (lib/ae_core/rate_ctl.h): the ADC samples at SAMPLE_RATE and
+// switches to BURST_RATE when a block's peak leaves the previous block's
+// mean by BURST_THRESHOLD counts, until BURST_HOLD_US without activity.
+// Switches are listed in aXXXX.rat; tools/burst_sim replays data through
+// the same controller. Raw recordings from the internal ADC only.
+#ifndef ACQ_BURST
+#define ACQ_BURST 0
+#endif
+#define BURST_RATE      100000      // 200 KB/s to the card
+#define BURST_THRESHOLD 200         // counts, like ACQ_HIT_THRESHOLD
+#define BURST_HOLD_US   (2 * 1000 * 1000)
+#if ACQ_BURST && (ACQ_SOURCE != ACQ_SOURCE_ADC || LOG_MODE != LOG_MODE_RAW)
+#error "ACQ_BURST needs ACQ_SOURCE_ADC and LOG_MODE_RAW"
+#endif
+
+// Scheduled capture (lib/ae_core/duty.h) for battery runs: the logger
+// records DUTY_WINDOW_US at the start of every DUTY_INTERVAL_US instead of
+// on the button. In between the ADC, the LCD and the status LED are off,
+// the card is deselected (or switched off with SD_PWR_PIN) and the system
+// sleeps on the timer. tools/duty_sim runs the schedule on the host.
+#ifndef DUTY_CYCLE
+#define DUTY_CYCLE 0
+#endif
+#ifndef DUTY_WINDOW_US
+#define DUTY_WINDOW_US   (10 * 1000 * 1000)
+#endif
+#ifndef DUTY_INTERVAL_US
+#define DUTY_INTERVAL_US (15ull * 60 * 1000 * 1000)
+#endif
+#ifndef SD_PWR_PIN
+#define SD_PWR_PIN -1               // card supply switch, active high; none on this board
+#endif
+#if DUTY_CYCLE && (BOOT_RECORD || ACQ_SOURCE == ACQ_SOURCE_SD_REPLAY || LOG_MODE != LOG_MODE_RAW)
+#error "DUTY_CYCLE needs a live source and LOG_MODE_RAW, without BOOT_RECORD"
+#endif
+
+#define SAMPLE_RATE ACQ_SAMPLE_RATE    // 4 kHz
+#define BUF_SIZE ACQ_BLOCK_SAMPLES      // 1024 samples
+
+// ---- Buffer pool ----
+// Buffers come from per-bank arenas instead of loose globals: DMA targets
+// from main SRAM, buffers the CPU works on while DMA runs from the scratch
+// banks. Each mode's buffers are dropped when the next mode is entered,
+// so plotting and logging share the same memory.
+#define MEM_MAIN_BYTES    (48 * 1024)
+#define MEM_SCRATCH_BYTES 1024          // per bank; the rest of the 4 KiB is stack
+
+enum { MODE_PLOT, MODE_LOG, MODE_CAL };
+static const char *const mem_mode_names[MEM_MODES] = { "plot", "log", "adc cal" };
+
+static uint8_t mem_main[MEM_MAIN_BYTES] __attribute__((aligned(8)));
+static uint8_t __scratch_x("mem_pool") __attribute__((aligned(8))) mem_scratch_x[MEM_SCRATCH_BYTES];
+static uint8_t __scratch_y("mem_pool") __attribute__((aligned(8))) mem_scratch_y[MEM_SCRATCH_BYTES];
+mem_pool_t mem;
+uint16_t *adc_lut;                 // permanent; valid while adc_cal_active
+
+// Event trace (lib/ae_core/trace.h), permanent: 512 events is about a
+// minute of recording. Frozen shortly after a ring overrun or a failed
+// write and saved with the recording as aXXXX.trc; 't' on the console
+// prints it, 'w' saves it as trace.trc while idle.
+#define TRACE_EVENTS 512
+#define TRACE_POST   64                 // events kept after the trigger
+trace_t trace;
+
+void mem_init(void) {
+    mem_pool_init(&mem);
+    mem_pool_add_bank(&mem, MEM_MAIN, "main", mem_main, sizeof(mem_main));
+    mem_pool_add_bank(&mem, MEM_SCRATCH_X, "scratch_x", mem_scratch_x, sizeof(mem_scratch_x));
+    mem_pool_add_bank(&mem, MEM_SCRATCH_Y, "scratch_y", mem_scratch_y, sizeof(mem_scratch_y));
+    adc_lut = mem_alloc(&mem, MEM_MAIN, ADC_CAL_CODES * sizeof(uint16_t), 4);
+    trace_event_t *trace_buf = mem_alloc(&mem, MEM_MAIN, TRACE_EVENTS * sizeof(trace_event_t), 8);
+    mem_pool_seal(&mem);
+
+    trace_init(&trace, trace_buf, TRACE_EVENTS, &timer_hw->timerawl, NULL, 1000000);
+    trace_sink = &trace;
+    mem_mode_enter(&mem, MODE_PLOT);
+}
 
-volatile uint16_t *active_buf;     // DMA writes here
-volatile uint16_t *sd_buf;         // ready for SD write
-volatile bool sd_write_pending = false;
+// Sample block ring (lib/ae_core/acq_source.h), allocated in MODE_LOG. The
+// source completes blocks at the head, the logger writes them from the
+// tail, so a slow card write (or the mount at boot, with BOOT_RECORD) is
+// absorbed by up to ADC_RING_BLOCKS - 1 blocks of backlog instead of
+// losing a buffer. DMA is pointed at each block in turn, not wrapped by
+// the hardware, so the ring needs no alignment beyond its words.
+#define ADC_RING_BLOCKS 8               // power of two; 2 s at 4 kHz
 
+acq_ring_t ring;
 int dma_chan;
 uint byte_written;
+uint32_t ring_peak;                // most blocks waiting for the logger
+
+#if ACQ_BURST
+rate_ctl_t rate_ctl;
+
+// After the DMA restart at a block boundary: the activity test on the
+// block just published, and the switch if it asks for one. The samples
+// the ADC took at the old rate are the first `lead` of the new block.
+static void burst_boundary(void) {
+    uint32_t last = ring.head - 1;
+    uint32_t rate = rate_ctl_boundary(&rate_ctl, acq_ring_block(&ring, last),
+                                      acq_ring_time(&ring, last));
+    if (!rate)
+        return;
 
+    adc_run(false);
+    while (!(adc_hw->cs & ADC_CS_READY_BITS))
+        tight_loop_contents();
+    while (adc_fifo_get_level())
+        tight_loop_contents();  // DMA takes the last old-rate samples
+    uint16_t lead = BUF_SIZE - (dma_channel_hw_addr(dma_chan)->transfer_count &
+                                DMA_CH0_TRANS_COUNT_COUNT_BITS);
+    adc_hw->div = rate_ctl_div(&rate_ctl, rate);
+    uint64_t t_us = time_us_64();
+    adc_run(true);
+    rate_ctl_switched(&rate_ctl, rate, ring.head, lead, t_us);
+    TRACE(TR_RATE, rate / 100);
+}
+#endif
+
+// DMA sources (internal and external ADC) share this handler
 void dma_handler() {
+    TRACE_BEGIN(TR_DMA_IRQ, dma_chan);
     dma_hw->ints0 = 1u << dma_chan;  // clear IRQ
 
-    // Buffer just completed
-    sd_buf = active_buf;
-    sd_write_pending = true;
-
-    // Swap buffer
-    active_buf = (active_buf == adc_buf1) ? adc_buf2 : adc_buf1;
+    // Block just completed; with the ring full it is overwritten by the next
+    uint64_t t_us = time_us_64();
+    bool published = acq_ring_publish(&ring, t_us);
+    if (!boot_first_block_us)
+        boot_first_block_us = t_us;
+    if (published) {
+        TRACE(TR_BLOCK_PUBLISH, ring.head);
+    } else {
+        status_led_alert(&status_led, LED_OVERRUN, LED_OVERRUN_HOLD_US);
+        TRACE(TR_OVERRUN, ring.head);
+        trace_trigger(&trace, TRACE_POST);
+    }
+    sched_post(&sched, tid_logger, EV_BUF_READY);
 
     // Restart DMA immediately
-    dma_channel_set_write_addr(dma_chan, active_buf, false);
+    dma_channel_set_write_addr(dma_chan, acq_ring_block(&ring, ring.head), false);
     dma_channel_set_trans_count(dma_chan, BUF_SIZE, true);
-}
-
 
-PIO pio = pio0;
-int sm = 0;
-
-void neopixel_init(uint32_t pin){
-    // Load the PIO program
-    uint offset = pio_add_program(pio, &ws2812_program);
-
-    // 👇 Use your LCD pin here
-    ws2812_program_init(pio, sm, offset, pin, 800000, false);
+#if ACQ_BURST
+    if (published)
+        burst_boundary();
+    else
+        rate_ctl_refilled(&rate_ctl, ring.head);
+#endif
+    TRACE_END(TR_DMA_IRQ, dma_chan);
 }
 
-void neopixel_write(uint32_t* colors, size_t count) {
-    
-    for (size_t i = 0; i < count; i++) {
-        pio_sm_put_blocking(pio, sm, colors[i]);
-    }
-    sleep_ms(60);
-}
 
 u8g2_t u8g2;
 
+static void lcd_flush(void) {
+    TRACE_BEGIN(TR_LCD_FLUSH, 0);
+    u8g2_SendBuffer(&u8g2);
+    TRACE_END(TR_LCD_FLUSH, 0);
+}
+
+// The LCD shares the bus, and stays at CLK_LCD whatever the card runs at
 void set_spi_mode_sdcard(){
+    TRACE(TR_SPI_SD, 0);
     spi_set_format(spi1, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+    spi_set_baudrate(spi1, sd_clk);
 }
 
 void set_spi_mode_lcd(){
+    TRACE(TR_SPI_LCD, 0);
     spi_set_format(SPI_PORT,8,SPI_CPOL_1,SPI_CPHA_1,SPI_MSB_FIRST);
+    spi_set_baudrate(SPI_PORT, CLK_LCD);
 }  
 
 void adc_init_sdcard_logging(){
@@ -330,7 +715,7 @@ void lcd_plot(uint16_t *buf)
         u8g2_DrawPixel(&u8g2, x, y);
     }
 
-    u8g2_SendBuffer(&u8g2);
+    lcd_flush();
 }
 
 void adc_init_polling(void)
@@ -340,22 +725,21 @@ void adc_init_polling(void)
     adc_select_input(0);        // ADC channel 0
 }
 
-void _dma_init(){
+// 16-bit reads from a source FIFO into the ring block at the head
+void acq_dma_init(uint dreq, const volatile void *fifo){
     dma_chan = dma_claim_unused_channel(true);
     dma_channel_config cfg = dma_channel_get_default_config(dma_chan);
 
     channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
     channel_config_set_read_increment(&cfg, false);
     channel_config_set_write_increment(&cfg, true);
-    channel_config_set_dreq(&cfg, DREQ_ADC);
-
-    active_buf = adc_buf1;
+    channel_config_set_dreq(&cfg, dreq);
 
     dma_channel_configure(
         dma_chan,
         &cfg,
-        active_buf,
-        &adc_hw->fifo,
+        acq_ring_block(&ring, ring.head),
+        fifo,
         BUF_SIZE,
         false
     );
@@ -363,21 +747,21 @@ void _dma_init(){
     dma_channel_set_irq0_enabled(dma_chan, true);
     irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
     irq_set_enabled(DMA_IRQ_0, true);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
-    irq_set_enabled(DMA_IRQ_0, true);
 }
 
 
 
 
 
-FRESULT open_new_log(FIL *fp, char *out_name, size_t name_len)
+// Highest aXXXX<ext> index on the card
+static FRESULT log_scan(const char *ext, uint32_t *max_index)
 {
     DIR dir;
     FILINFO fno;
-    uint32_t max_index = 0;
     FRESULT fr;
 
+    *max_index = 0;
+
     /* Scan root directory */
     fr = f_opendir(&dir, "/");
     if (fr != FR_OK)
@@ -393,14 +777,14 @@ FRESULT open_new_log(FIL *fp, char *out_name, size_t name_len)
         if (fno.fattrib & AM_DIR)
             continue;
 
-        /* Expect exactly: aXXXX.bin (9 chars) */
+        /* Expect exactly: aXXXX.bin / aXXXX.trd (9 chars) */
         if (strlen(fno.fname) != 9)
             continue;
 
         if (fno.fname[0] != 'a')
             continue;
 
-        if (strcmp(&fno.fname[5], ".bin") != 0)
+        if (strcmp(&fno.fname[5], ext) != 0)
             continue;
 
         /* Check digits */
@@ -417,22 +801,49 @@ FRESULT open_new_log(FIL *fp, char *out_name, size_t name_len)
             continue;
 
         uint32_t idx = atoi(&fno.fname[1]);
-        if (idx > max_index)
-            max_index = idx;
+        if (idx > *max_index)
+            *max_index = idx;
     }
 
     f_closedir(&dir);
+    return FR_OK;
+}
 
-    /* Next index */
-    uint32_t next = max_index + 1;
-    if (next > 9999)
-        next = 9999;
+// Last index per extension. Only the first recording after boot scans the
+// directory (which grows with every recording); later ones open the next
+// name directly and rescan only if it turns out to exist.
+static uint32_t log_index[2];
+static bool log_index_known[2];
 
-    /* Build filename */
-    snprintf(out_name, name_len, "a%04lu.bin", next);
+// Next free aXXXX<ext>, numbered separately per extension
+FRESULT open_new_log(FIL *fp, char *out_name, size_t name_len, const char *ext)
+{
+    int slot = strcmp(ext, ".trd") == 0;
+    FRESULT fr;
 
-    /* Open new file (fail if already exists = safety) */
-    fr = f_open(fp, out_name, FA_WRITE | FA_CREATE_NEW);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!log_index_known[slot] || attempt > 0) {
+            fr = log_scan(ext, &log_index[slot]);
+            if (fr != FR_OK)
+                return fr;
+            log_index_known[slot] = true;
+        }
+
+        /* Next index */
+        uint32_t next = log_index[slot] + 1;
+        if (next > 9999)
+            next = 9999;
+
+        /* Build filename */
+        snprintf(out_name, name_len, "a%04lu%s", next, ext);
+
+        /* Open new file (fail if already exists = safety) */
+        fr = f_open(fp, out_name, FA_WRITE | FA_CREATE_NEW);
+        if (fr == FR_OK)
+            log_index[slot] = next;
+        if (fr != FR_EXIST)
+            break;
+    }
     return fr;
 }
 
@@ -450,57 +861,698 @@ void lcd_show_logging(const char *fname)
 
     u8g2_DrawStr(&u8g2, 0, 48, "Recording...");
 
-    u8g2_SendBuffer(&u8g2);  // push to screen
+    lcd_flush();
 }
 
-char filename[64];
-void task_sdcard_adc_loggin() {
-    
-    set_spi_mode_sdcard();
+#define BUF_PERIOD_US ((uint32_t)((uint64_t)BUF_SIZE * 1000000 / SAMPLE_RATE))
 
-    // _create_hello_world_file();
+// At most 1 s of samples is lost on power failure. Syncs only run when at
+// least 20 ms are left before the next buffer completes.
+#define SYNC_MAX_INTERVAL_US 1000000
+#define SYNC_MIN_IDLE_US     20000
 
-    FRESULT fr = open_new_log(&fil, filename, sizeof(filename));
+sync_policy_t sync_policy;
 
-    if(fr != FR_OK) {
-        printf("Failed to open file: %d\n", fr);
+// Bulk recording can bypass FatFs: the file is preallocated contiguously
+// with f_expand and filled with CMD25 multi-block writes over DMA at
+// sd_clk. The file is truncated to the written size on close, or when the
+// preallocation is used up and the recording continues through f_write.
+// Needs FF_USE_EXPAND in ffconf.h, otherwise the f_write path is used.
+#define RAW_PREALLOC_BYTES (64u * 1024 * 1024)
+#define BUF_BYTES (BUF_SIZE * sizeof(uint16_t))
+
+sd_spi_dma_t sd_dma;
+sd_mbw_t sd_mbw;
+bool raw_stream = false;
+bool raw_inflight;             // acq_ring_block(&ring, ring.tail) is on the bus
+
+static bool raw_stream_begin(FIL *fp)
+{
+#if FF_USE_EXPAND
+    if (f_expand(fp, RAW_PREALLOC_BYTES, 1) != FR_OK || f_sync(fp) != FR_OK)
+        return false;
+
+    LBA_t lba = file_lba(fp);
+    bool high_capacity = card_high_capacity(fp->obj.fs);
+
+    sd_spi_dma_init(&sd_dma, SPI_PORT, SPI_CS_PIN);
+    uint hz = sd_spi_dma_set_clock(&sd_dma, sd_clk);
+    sd_mbw_init(&sd_mbw, &sd_dma.transport, high_capacity);
+
+    sd_status_t st = sd_mbw_start(&sd_mbw, (uint32_t)lba,
+                                  RAW_PREALLOC_BYTES / SD_BLOCK_SIZE, time_us_64());
+    while (st == SD_BUSY)
+        st = sd_mbw_poll(&sd_mbw, time_us_64());
+
+    if (st != SD_OK) {
+        printf("CMD25 failed: %d (r1 0x%02x)\n", st, sd_mbw.r1);
+        spi_set_baudrate(SPI_PORT, sd_clk);
+        sd_spi_dma_deinit(&sd_dma);
+        f_truncate(fp);
+        return false;
+    }
+
+    printf("Raw stream at LBA %lu, %u Hz\n", (unsigned long)lba, hz);
+    return true;
+#else
+    (void)fp;
+    return false;
+#endif
+}
+
+// Close the CMD25 transaction so FatFs can use the card (e.g. to append
+// the staged sidecar records). raw_stream_resume() reopens it where it
+// stopped, with ACMD23 announcing `pre_erase` blocks.
+static sd_status_t raw_stream_suspend(void)
+{
+    while (!sd_mbw_closed(&sd_mbw) && !sd_mbw_idle(&sd_mbw))
+        sd_mbw_poll(&sd_mbw, time_us_64());
+
+    sd_status_t st = sd_mbw_stop(&sd_mbw, time_us_64());
+    while (st == SD_BUSY)
+        st = sd_mbw_poll(&sd_mbw, time_us_64());
+
+    spi_set_baudrate(SPI_PORT, sd_clk);
+    return st;
+}
+
+static void raw_stream_resume(uint32_t pre_erase)
+{
+    sd_spi_dma_set_clock(&sd_dma, sd_clk);
+
+    uint32_t left = RAW_PREALLOC_BYTES / SD_BLOCK_SIZE - sd_mbw.blocks_done;
+    if (pre_erase > left)
+        pre_erase = left;
+    sd_status_t st = sd_mbw_start(&sd_mbw, sd_mbw.lba, pre_erase, time_us_64());
+    while (st == SD_BUSY)
+        st = sd_mbw_poll(&sd_mbw, time_us_64());
+
+    if (st != SD_OK)
+        printf("CMD25 resume failed: %d (r1 0x%02x)\n", st, sd_mbw.r1);
+}
+
+static void raw_stream_end(FIL *fp)
+{
+    sd_status_t st = raw_stream_suspend();
+    sd_spi_dma_deinit(&sd_dma);
+
+    // Give FatFs back the bus and cut the file to what the card accepted
+    uint32_t bytes = sd_mbw.blocks_done * SD_BLOCK_SIZE;
+    f_lseek(fp, bytes);
+    f_truncate(fp);
+
+    printf("Raw stream: %lu bytes, status %d, %lu busy polls\n",
+           (unsigned long)bytes, st, (unsigned long)sd_mbw.busy_polls);
+}
+
+// ---- ADC linearity table ----
+// adccal.bin in the card root (lib/ae_core/adc_cal.h) is loaded at mount.
+// With a table, Linearize at the head of the acquisition pipeline corrects
+// the statistics and hits; the .bin keeps the raw codes, and the table goes
+// next to it as aXXXX.cal so readers can correct (or not) the same way.
+bool adc_cal_active;
+uint32_t adc_cal_crc_active;       // adc_cal_crc() of adc_lut, 0 without a table
+
+void adc_cal_load(void) {
+    FIL f;
+    UINT br = 0;
+    adc_cal_header_t h;
+    adc_cal_active = false;
+    if (f_open(&f, ADC_CAL_FILE, FA_READ) == FR_OK) {
+        adc_cal_active = f_read(&f, &h, sizeof(h), &br) == FR_OK && br == sizeof(h) &&
+                         f_read(&f, adc_lut, ADC_CAL_CODES * sizeof(uint16_t), &br) == FR_OK &&
+                         br == ADC_CAL_CODES * sizeof(uint16_t) && adc_cal_check(&h, adc_lut) == 0;
+        f_close(&f);
+        if (!adc_cal_active)
+            printf("Ignoring %s: bad header or CRC\n", ADC_CAL_FILE);
+    }
+    // The table describes the internal ADC; an external one has its own
+    adc_cal_active = adc_cal_active && ACQ_SOURCE != ACQ_SOURCE_EXT_ADC;
+    adc_cal_crc_active = adc_cal_active ? h.crc : 0;
+    acq_pipeline_set_cal(adc_cal_active ? adc_lut : NULL);
+    if (adc_cal_active)
+        printf("ADC table %s, crc %08lx\n", ADC_CAL_FILE, (unsigned long)adc_cal_crc_active);
+}
+
+static FRESULT adc_cal_save(const char *name, const adc_cal_header_t *h) {
+    FIL f;
+    UINT bw;
+    FRESULT fr = f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK)
+        return fr;
+    fr = f_write(&f, h, sizeof(*h), &bw);
+    if (fr == FR_OK)
+        fr = f_write(&f, adc_lut, ADC_CAL_CODES * sizeof(uint16_t), &bw);
+    FRESULT fc = f_close(&f);
+    return fr != FR_OK ? fr : fc;
+}
+
+// aXXXX.cal: copy of the table the recording's statistics went through
+void adc_cal_sidecar(const char *bin_name) {
+    if (!adc_cal_active)
         return;
+    char name[16];
+    snprintf(name, sizeof(name), "%.5s.cal", bin_name);
+    adc_cal_header_t h;
+    adc_cal_header(&h, adc_lut, NULL);
+    if (adc_cal_save(name, &h) != FR_OK)
+        printf("No ADC table sidecar for %s\n", bin_name);
+}
+
+// Per-block statistics go to aXXXX.sum, one 32-byte record per buffer.
+// The records come out of the acquisition pipeline (acq_on_stats) and are
+// collected into a 512-byte sector that is appended when it fills; slot 0
+// of the first sector holds the header.
+//
+// During a CMD25 raw stream FatFs can only reach the card with the stream
+// stopped, so the records stay in a stage of SIDECAR_STAGE_SECTORS
+// sectors instead (512 blocks: about 2 minutes at 4 kS/s, 5 s at
+// BURST_RATE). They are written when the stream ends, or with the stream
+// stopped once when the stage is half full and the ring is empty at the
+// base rate; only a full stage stops it in the middle of a burst.
+#define SIDECAR_STAGE_SECTORS 32
+#define SUMMARY_SLOTS       (512 / sizeof(block_stats_t))
+#define SUMMARY_STAGE_SLOTS (SIDECAR_STAGE_SECTORS * SUMMARY_SLOTS)
+
+FIL sum_fil;
+bool sum_open = false;
+char sum_name[16];
+block_stats_t *sum_stage;      // SUMMARY_STAGE_SLOTS records, in main SRAM
+uint32_t sum_used;
+uint32_t sum_lost;             // records a failed write didn't get to the card
+uint32_t sidecar_stops;        // raw stream stops to write the stages
+uint32_t sidecar_forced;       // of those, with a full stage
+
+// Reopens a sidecar at its end, cut back to whole records: after a
+// remount, or after a failed write, which leaves the FIL in error
+static bool sidecar_reopen(FIL *fp, const char *name, uint32_t record_size) {
+    if (f_open(fp, name, FA_WRITE | FA_OPEN_APPEND) != FR_OK)
+        return false;
+    FSIZE_t whole = f_size(fp) - f_size(fp) % record_size;
+    if (whole != f_size(fp) && (f_lseek(fp, whole) != FR_OK || f_truncate(fp) != FR_OK)) {
+        f_close(fp);
+        return false;
     }
+    return true;
+}
 
-    set_spi_mode_lcd();
-    lcd_show_logging(filename);
-    set_spi_mode_sdcard();
+// Appends `count` records and returns how many of them didn't make it.
+// The file stays open for the next ones if it can be reopened.
+static uint32_t sidecar_write(FIL *fp, bool *open, const char *name, const void *records,
+                              uint32_t count, uint32_t record_size) {
+    FSIZE_t before = f_size(fp);
+    UINT bytes = count * record_size;
+    UINT bw = 0;
+    TRACE_BEGIN(TR_F_WRITE, bytes);
+    FRESULT fr = f_write(fp, records, bytes, &bw);
+    TRACE_END(TR_F_WRITE, bytes);
+    if (fr == FR_OK && bw == bytes)
+        return 0;
 
+    if (fr == FR_OK)
+        fr = FR_DENIED;        // card full
+    TRACE(TR_STORE_ERROR, fr);
+    trace_trigger(&trace, TRACE_POST);
+    printf("%s: write failed (%d)\n", name, fr);
+    f_close(fp);
+    *open = sidecar_reopen(fp, name, record_size);
+    uint32_t written = *open ? (uint32_t)((f_size(fp) - before) / record_size) : 0;
+    return count - written;
+}
 
-    adc_init_sdcard_logging();
+FRESULT summary_open(const char *bin_name)
+{
+    snprintf(sum_name, sizeof(sum_name), "%.5s.sum", bin_name);   // aXXXX.bin -> aXXXX.sum
+
+    FRESULT fr = f_open(&sum_fil, sum_name, FA_WRITE | FA_CREATE_ALWAYS);
+    sum_open = (fr == FR_OK);
+
+    summary_header_t h = {
+        .magic = SUMMARY_MAGIC,
+        .version = SUMMARY_VERSION,
+        .record_size = sizeof(block_stats_t),
+        .block_samples = BUF_SIZE,
+        .sample_rate = SAMPLE_RATE,
+        .cal_crc = adc_cal_crc_active,
+    };
+    memcpy(&sum_stage[0], &h, sizeof(h));
+    sum_used = 1;
+    sum_lost = 0;
+    sidecar_stops = 0;
+    sidecar_forced = 0;
+    return fr;
+}
 
-    _dma_init();
-    adc_run(true);
-    dma_start_channel_mask(1u << dma_chan);
+// Appends the staged records; FatFs needs the card, so no raw stream open
+static void summary_write(void) {
+    if (sum_used == 0)
+        return;
 
+    if (sum_open)
+        sum_lost += sidecar_write(&sum_fil, &sum_open, sum_name, sum_stage, sum_used,
+                                  sizeof(block_stats_t));
+    else
+        sum_lost += sum_used;
+    sum_used = 0;
+}
 
-    printf("DMA started, loxgging ADC data to SD card...\n");
-    printf("Logging to file: %s\n", filename);
-    printf("Logging for 5 seconds...\n");
+#if ACQ_BURST
+// Rate switches go to aXXXX.rat like the summary: 512-byte sectors,
+// header in slot 0 of the first, appended when one fills or, during a raw
+// stream, staged with the summary. A switch is taken from rate_ctl once
+// the block it starts in has been through the pipeline.
+#define RATE_SLOTS       (512 / sizeof(rate_change_t))
+#define RATE_STAGE_SLOTS (4 * RATE_SLOTS)     // 32 bursts
+
+FIL rat_fil;
+bool rat_open = false;
+char rat_name[16];
+rate_change_t *rat_stage;      // RATE_STAGE_SLOTS records, in main SRAM
+uint32_t rat_used;
+uint32_t rat_lost;             // without them the .bin timebase can't be rebuilt
+uint64_t burst_samples;        // samples recorded at BURST_RATE
+uint64_t rat_last_sample;
+
+// The last switch taken, for the pipeline: block rat_switch_block is at
+// rat_rate from its rat_lead-th sample on, at rat_lead_rate before
+uint32_t rat_rate;
+uint32_t rat_lead_rate;
+uint32_t rat_switch_block;
+uint16_t rat_lead;
+
+void rate_log_open(const char *bin_name) {
+    snprintf(rat_name, sizeof(rat_name), "%.5s.rat", bin_name);
+    rat_open = f_open(&rat_fil, rat_name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK;
+    if (!rat_open)
+        printf("No rate sidecar for %s\n", bin_name);
+
+    rate_header_t h;
+    rate_ctl_header(&rate_ctl, &h);
+    memcpy(&rat_stage[0], &h, sizeof(h));
+    rat_used = 1;
+    rat_lost = 0;
+    burst_samples = 0;
+    rat_last_sample = 0;
+    rat_rate = rat_lead_rate = SAMPLE_RATE;
+    rat_switch_block = UINT32_MAX;
+    rat_lead = 0;
+}
 
-    absolute_time_t start_time = get_absolute_time();
+static void rate_log_write(void) {
+    if (rat_used == 0)
+        return;
 
-    // --- MAIN LOOP ---
-    while (absolute_time_diff_us(start_time, get_absolute_time()) < 5 * 1000 * 1000) {
+    if (rat_open)
+        rat_lost += sidecar_write(&rat_fil, &rat_open, rat_name, rat_stage, rat_used,
+                                  sizeof(rate_change_t));
+    else
+        rat_lost += rat_used;
+    rat_used = 0;
+}
+#endif
+
+// Stop the raw stream once to write both stages. The next stop comes
+// within a stage of blocks, so that much is pre-erased.
+static void sidecar_flush_stream(void) {
+    raw_stream_suspend();
+    summary_write();
+#if ACQ_BURST
+    rate_log_write();
+#endif
+    raw_stream_resume(SUMMARY_STAGE_SLOTS * (BUF_BYTES / SD_BLOCK_SIZE));
+    sidecar_stops++;
+}
 
-        if (sd_write_pending) {
-           
-            sd_write_pending = false;
-            f_write(&fil, (const void *)sd_buf, BUF_SIZE * sizeof(uint16_t), &byte_written);
-            // printf("SD wrote buffer, first = %u\n", sd_buf[0]);
+static bool sidecar_stage_full(uint32_t div) {
+#if ACQ_BURST
+    if (rat_used >= RATE_STAGE_SLOTS / div)
+        return true;
+#endif
+    return sum_used >= SUMMARY_STAGE_SLOTS / div;
+}
+
+// The ring just ran empty during a raw stream: write the stages if they
+// are half full and the next block is a base-rate block away
+static void sidecar_flush_idle(void) {
+#if ACQ_BURST
+    if (rate_ctl.rate != SAMPLE_RATE)
+        return;
+#endif
+    if (sidecar_stage_full(2))
+        sidecar_flush_stream();
+}
+
+// Without a raw stream a full sector is appended right away
+static void sidecar_record_added(void) {
+    if (raw_stream) {
+        if (sidecar_stage_full(1)) {
+            sidecar_forced++;
+            sidecar_flush_stream();
         }
+        return;
     }
-    printf("Stopping...\n");
+    if (sum_used >= SUMMARY_SLOTS)
+        summary_write();
+#if ACQ_BURST
+    if (rat_used >= RATE_SLOTS)
+        rate_log_write();
+#endif
+}
 
-    f_sync(&fil);
+#if ACQ_BURST
+static void rate_log_take(uint32_t blocks) {
+    rate_change_t r;
+    while (rate_ctl_next(&rate_ctl, blocks, &r)) {
+        if (r.rate != BURST_RATE)
+            burst_samples += r.sample - rat_last_sample;
+        rat_last_sample = r.sample;
+        rat_lead_rate = rat_rate;
+        rat_rate = r.rate;
+        rat_switch_block = r.block;
+        rat_lead = r.lead;
+        rat_stage[rat_used++] = r;
+        sidecar_record_added();
+    }
+}
+
+void rate_log_close(uint32_t blocks) {
+    rate_log_take(blocks);
+    if (rate_ctl.rate == BURST_RATE)
+        burst_samples += (uint64_t)blocks * BUF_SIZE - rat_last_sample;
+    rate_log_write();
+    if (rat_open)
+        f_close(&rat_fil);
+    rat_open = false;
+    printf("Burst mode: %lu bursts, %llu of %llu samples at %lu S/s, %lu switches not logged\n",
+           (unsigned long)rate_ctl.bursts, (unsigned long long)burst_samples,
+           (unsigned long long)blocks * BUF_SIZE, (unsigned long)BURST_RATE,
+           (unsigned long)rate_ctl.lost);
+    if (rat_lost)
+        printf("%s: %lu records not written, the timebase can't be rebuilt\n", rat_name,
+               (unsigned long)rat_lost);
+}
+#endif
+
+void acq_on_stats(const block_stats_t *r) {
+    sum_stage[sum_used++] = *r;
+    sidecar_record_added();
+}
+
+// Block `index` of the ring into the pipeline. In burst builds the
+// switches into it are taken first, so hits and onsets in it are timed at
+// the rate it was taken at rather than SAMPLE_RATE.
+static void pipeline_push(uint32_t index) {
+    const uint16_t *block = acq_ring_block(&ring, index);
+    uint64_t t_us = acq_ring_time(&ring, index);
+#if ACQ_BURST
+    rate_log_take(index + 1);
+    if (rat_switch_block == index)
+        acq_pipeline_push_rate(block, t_us, rat_rate, rat_lead, rat_lead_rate);
+    else
+        acq_pipeline_push_rate(block, t_us, rat_rate, 0, rat_rate);
+#else
+    acq_pipeline_push(block, t_us);
+#endif
+}
+
+// AE hits found by the pipeline during the current recording
+uint32_t hit_count;
+uint16_t hit_peak;
+
+void acq_on_hit(const acq_hit_t *h) {
+    hit_count++;
+    if (h->peak > hit_peak)
+        hit_peak = h->peak;
+}
+
+// Arrivals picked by the pipeline; with ACQ_ONSET_AIC 0 only the STA/LTA
+// candidates, which ae_onset refines from the .bin
+uint32_t onset_count;
+
+void acq_on_onset(const acq_onset_t *o) {
+    (void)o;
+    onset_count++;
+}
+
+void summary_close() {
+    summary_write();
+    if (sum_open)
+        f_close(&sum_fil);
+    sum_open = false;
+    if (sum_lost)
+        printf("%s: %lu records not written\n", sum_name, (unsigned long)sum_lost);
+}
+
+// Trend records are collected into a 512-byte sector like the summary,
+// header in slot 0 of the first. Each full sector (16 intervals) is
+// appended and synced, so power loss costs at most 16 s of trend.
+#define TREND_SLOTS (512 / sizeof(trend_record_t))
+
+trend_t trend;
+trend_record_t *trend_sector;  // TREND_SLOTS records, in SCRATCH_X
+uint32_t trend_used;
+char trd_name[16];
+bool trd_open;
+uint32_t trend_lost;           // records a failed write or sync didn't get to the card
+
+// Appends and syncs the sector. A failed sync may leave any of its
+// records out; the file is reopened and its size says which made it.
+static void trend_write_sector(void) {
+    if (trend_used == 0)
+        return;
+
+    if (trd_open) {
+        FSIZE_t before = f_size(&fil);
+        uint32_t lost = sidecar_write(&fil, &trd_open, trd_name, trend_sector, trend_used,
+                                      sizeof(trend_record_t));
+        FRESULT fr = trd_open ? f_sync(&fil) : FR_OK;
+        if (fr != FR_OK) {
+            TRACE(TR_STORE_ERROR, fr);
+            trace_trigger(&trace, TRACE_POST);
+            printf("%s: sync failed (%d)\n", trd_name, fr);
+            f_close(&fil);
+            trd_open = sidecar_reopen(&fil, trd_name, sizeof(trend_record_t));
+            uint32_t written = trd_open ? (uint32_t)((f_size(&fil) - before) / sizeof(trend_record_t)) : 0;
+            lost = trend_used - written;
+        }
+        trend_lost += lost;
+    } else {
+        trend_lost += trend_used;
+    }
+    trend_used = 0;
+}
+
+static void trend_emit(void *ctx, const trend_record_t *r) {
+    (void)ctx;
+    // The first sample's time is known once the first interval closes
+    if (trend.records == 0)
+        ((trend_header_t *)&trend_sector[0])->start_us = trend.start_us;
+
+    trend_sector[trend_used++] = *r;
+    if (trend_used == TREND_SLOTS)
+        trend_write_sector();
+}
+
+void trend_open(const char *name) {
+    snprintf(trd_name, sizeof(trd_name), "%s", name);
+    trd_open = true;
+    trend_lost = 0;
+
+    trend_config_t cfg = {
+        .interval_us = TREND_INTERVAL_US,
+        .sample_rate = SAMPLE_RATE,
+        .emit = trend_emit,
+        .ctx = NULL,
+    };
+    trend_init(&trend, &cfg);
+
+    trend_header_t h = {
+        .magic = TREND_MAGIC,
+        .version = TREND_VERSION,
+        .record_size = sizeof(trend_record_t),
+        .interval_us = TREND_INTERVAL_US,
+        .sample_rate = SAMPLE_RATE,
+    };
+    memcpy(&trend_sector[0], &h, sizeof(h));
+    trend_used = 1;
+}
+
+void trend_close(void) {
+    trend_flush(&trend);
+    trend_write_sector();
+    printf("Trend: %lu records, %lu gaps, %lu bytes\n", (unsigned long)trend.records,
+           (unsigned long)trend.gaps, (unsigned long)((trend.records + 1) * sizeof(trend_record_t)));
+    if (trend_lost)
+        printf("%s: %lu records not written\n", trd_name, (unsigned long)trend_lost);
+}
+
+#define LOG_DURATION_US    (5 * 1000 * 1000)
+#define LOG_TICK_US        1000      // sd_mbw polling and end-of-recording check
+#define DISPLAY_TICK_US    1000      // one ADC_BLOCK burst per tick
+#define BUTTON_DEBOUNCE_US 500000
+#define STATS_PERIOD_US    (10 * 1000 * 1000)
+
+char filename[64];
+bool logging = false;
+uint64_t log_start_us;
+
+// ---- Storage errors ----
+// Blocks reach the card through store.c. A failed f_write leaves the block
+// in the ring, and it is retried from there after a backoff: the file is
+// reopened at the last good block first, or the card is remounted after
+// STORE_REMOUNT_AFTER failures in a row. At STORE_DROP_BACKLOG queued
+// blocks the oldest one is given up, so dma_handler always finds a free
+// block; lost blocks are listed in aXXXX.gap. tools/store_sim runs the
+// same policy against a failing disk.
+#define STORE_RETRY_US      20000
+#define STORE_RETRY_MAX_US  500000
+#define STORE_MAX_ATTEMPTS  4
+#define STORE_REMOUNT_AFTER 3
+#define STORE_DROP_BACKLOG  (ADC_RING_BLOCKS - 2)
+#define GAP_SLOTS (512 / sizeof(store_gap_t))
+
+store_t store;
+store_gap_t *gap_sector;       // header + GAP_SLOTS - 1 records, in SCRATCH_Y
+uint32_t gap_used;
+uint32_t gaps_unsaved;         // records that didn't fit
+
+// One card write while recording. FR_DISK_ERR is the driver's own
+// failure (bad response, CRC, timeout); a full card isn't the bus.
+static void card_clk_note(bool ok) {
+    uint32_t hz = clk_tune_note(&clk_tune, ok);
+    if (!hz)
+        return;
+    sd_clk = hz;
+    TRACE(TR_SD_CLK, hz / 1000);
+    printf("SD clock down to %lu Hz\n", (unsigned long)hz);
+    if (!raw_stream)
+        spi_set_baudrate(SPI_PORT, sd_clk);   // the raw stream applies it when it closes
+}
+
+static int store_write(void *ctx, const void *data, uint32_t bytes) {
+    (void)ctx;
+    TRACE_BEGIN(TR_F_WRITE, bytes);
+    FRESULT fr = f_write(&fil, data, bytes, &byte_written);
+    TRACE_END(TR_F_WRITE, bytes);
+    card_clk_note(fr != FR_DISK_ERR);
+    if (fr == FR_OK && byte_written != bytes)
+        fr = FR_DENIED;        // card full
+    if (fr != FR_OK) {
+        TRACE(TR_STORE_ERROR, fr);
+        trace_trigger(&trace, TRACE_POST);
+    }
+    return fr;
+}
+
+// FatFs leaves a FIL in error after a failed write, and a remount
+// invalidates every open file: reopen, cut the partial block off
+static int store_recover(void *ctx, store_recover_t level, uint64_t good_bytes) {
+    (void)ctx;
     f_close(&fil);
-    
-    
+
+    if (level == STORE_REMOUNT) {
+        if (sum_open)
+            f_close(&sum_fil);
+#if ACQ_BURST
+        if (rat_open)
+            f_close(&rat_fil);
+#endif
+        card_mounted = card_mount();
+        if (!card_mounted) {
+            status_led_set(&status_led, LED_CARD_ERROR);
+            return FR_NOT_READY;
+        }
+        spi_set_baudrate(SPI_PORT, sd_clk);   // the same card: keep its clock
+        status_led_set(&status_led, LED_RECORDING);
+        if (sum_open)
+            sum_open = sidecar_reopen(&sum_fil, sum_name, sizeof(block_stats_t));
+#if ACQ_BURST
+        if (rat_open)
+            rat_open = sidecar_reopen(&rat_fil, rat_name, sizeof(rate_change_t));
+#endif
+    }
+
+    FRESULT fr = f_open(&fil, filename, FA_WRITE | FA_OPEN_EXISTING);
+    if (fr == FR_OK)
+        fr = f_lseek(&fil, good_bytes);
+    if (fr == FR_OK)
+        fr = f_truncate(&fil);
+    return fr;
+}
+
+static void store_gap(void *ctx, const store_gap_t *g) {
+    (void)ctx;
+    if (gap_used < GAP_SLOTS)
+        gap_sector[gap_used++] = *g;
+    else
+        gaps_unsaved++;
+}
+
+void store_open(void) {
+    store_config_t cfg = {
+        .write = store_write,
+        .recover = store_recover,
+        .gap = store_gap,
+        .block_bytes = BUF_BYTES,
+        .retry_us = STORE_RETRY_US,
+        .retry_max_us = STORE_RETRY_MAX_US,
+        .max_attempts = STORE_MAX_ATTEMPTS,
+        .remount_after = STORE_REMOUNT_AFTER,
+        .drop_backlog = STORE_DROP_BACKLOG,
+    };
+    store_init(&store, &cfg);
+
+    gap_header_t h = {
+        .magic = GAP_MAGIC,
+        .version = GAP_VERSION,
+        .record_size = sizeof(store_gap_t),
+        .block_samples = BUF_SIZE,
+        .sample_rate = SAMPLE_RATE,
+    };
+    memcpy(&gap_sector[0], &h, sizeof(h));
+    gap_used = 1;
+    gaps_unsaved = 0;
+}
+
+// aXXXX.gap, only if blocks were lost
+void store_close(void) {
+    store_finish(&store);
+    if (store.writes || store.errors)
+        store_print(&store);
+    if (gap_used <= 1)
+        return;
+
+    char name[16];
+    snprintf(name, sizeof(name), "%.5s.gap", filename);
+    FIL gap_fil;
+    UINT bw = 0;
+    FRESULT fr = f_open(&gap_fil, name, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr == FR_OK) {
+        fr = f_write(&gap_fil, gap_sector, gap_used * sizeof(store_gap_t), &bw);
+        f_close(&gap_fil);
+    }
+    printf("%lu gap records in %s (%d), %lu not saved\n", (unsigned long)(gap_used - 1), name,
+           fr, (unsigned long)gaps_unsaved);
+}
+
+// ---- Acquisition sources ----
+// ACQ_SOURCE picks one at build time; the rest of the firmware only sees
+// acq_src (lib/ae_core/acq_source.h).
+
+void acq_dma_stop(void) {
+    // ---- STEP 4: Disable DMA channel gracefully ----
+    dma_channel_set_irq0_enabled(dma_chan, false);
+    // Abort only this channel: a reset of the whole DMA block would also
+    // drop the status LED channel, and acq_dma_init claims a fresh one
+    dma_channel_abort(dma_chan);
+
+    // ---- STEP 7: Clear any latched interrupt ----
+    dma_hw->ints0 = 1u << dma_chan;
+    dma_channel_unclaim(dma_chan);
+}
+
+// Stops the ADC and its DMA channel; the calibration mode uses it directly
+void adc_capture_stop(void) {
     // ---- STEP 1: Stop ADC generating NEW samples ----
     adc_run(false);
 
@@ -516,41 +1568,710 @@ void task_sdcard_adc_loggin() {
 
     sleep_us(5);
 
-    // ---- STEP 4: Disable DMA channel gracefully ----
-    dma_channel_set_irq0_enabled(dma_chan, false);
-    // Disable channel immediately
-    dma_hw->ch[dma_chan].ctrl_trig = 0;
+    acq_dma_stop();
+}
 
-    // Reset the DMA block for this channel
-    reset_block(RESETS_RESET_DMA_BITS);
-    unreset_block_wait(RESETS_RESET_DMA_BITS);
+// Internal ADC: conversions paced by its clock divider, DMA from its FIFO
+static bool adc_src_start(void *ctx, acq_ring_t *r) {
+    (void)ctx;
+    (void)r;
+    adc_init_sdcard_logging();
+    acq_dma_init(DREQ_ADC, &adc_hw->fifo);
+    adc_run(true);
+    dma_start_channel_mask(1u << dma_chan);
+    return true;
+}
 
-    // ---- STEP 7: Clear any latched interrupt ----
-    dma_hw->ints0 = 1u << dma_chan;
+static void adc_src_stop(void *ctx) {
+    (void)ctx;
+    adc_capture_stop();
+}
+
+const acq_source_t acq_src_adc = {
+    .name = "internal ADC", .start = adc_src_start, .stop = adc_src_stop,
+};
+
+// External ADC on PIO: ext_adc.pio clocks a SPI ADC with a CNV pin at
+// SAMPLE_RATE (lib/ae_core/ext_adc.h has the timing) and DMA takes its RX
+// FIFO into the same ring, through the same dma_handler. Build with
+// -DACQ_SOURCE=ACQ_SOURCE_EXT_ADC and the rate and code width to match,
+// e.g. -DACQ_SAMPLE_RATE=1000000 -DACQ_ADC_BITS=16 -DBLOCK_STATS_CLIP_HI=65535;
+// the hit threshold scales with the width unless ACQ_HIT_THRESHOLD is set.
+// tools/ext_adc_sim runs the timing, the wire protocol and the ring on the
+// host.
+#define EXT_ADC_PIO        pio1
+#define EXT_ADC_SDO_PIN    17
+#define EXT_ADC_SCK_PIN    18       // CNV on 19: side-set pins are consecutive
+#define EXT_ADC_BITS       16
+#if ACQ_SOURCE == ACQ_SOURCE_EXT_ADC && \
+    (ACQ_ADC_BITS != EXT_ADC_BITS || BLOCK_STATS_CLIP_HI != (1 << EXT_ADC_BITS) - 1)
+#error "the external ADC needs -DACQ_ADC_BITS=16 -DBLOCK_STATS_CLIP_HI=65535"
+#endif
+#if LOG_MODE == LOG_MODE_TREND && ACQ_ADC_BITS > 12
+#error "trend records (lib/ae_core/trend.h) are for 12-bit codes: no LOG_MODE_TREND with the external ADC"
+#endif
+#define EXT_ADC_TCONV_NS   500      // worst-case conversion time of the part
+#define EXT_ADC_SCK_MAX_HZ 40000000
+#define EXT_ADC_TDSDO_NS   10       // SCK falling to SDO valid
+
+static uint ext_sm;
+static uint ext_offset;
+
+static bool ext_src_start(void *ctx, acq_ring_t *r) {
+    (void)ctx;
+    (void)r;
+    ext_adc_config_t cfg = {
+        .sys_hz = clock_get_hz(clk_sys),
+        .sample_rate = SAMPLE_RATE,
+        .bits = EXT_ADC_BITS,
+        .tconv_ns = EXT_ADC_TCONV_NS,
+        .sck_max_hz = EXT_ADC_SCK_MAX_HZ,
+        .tdsdo_ns = EXT_ADC_TDSDO_NS,
+    };
+    ext_adc_timing_t tm;
+    if (ext_adc_timing(&cfg, &tm) != 0) {
+        printf("External ADC: no PIO timing for %lu S/s at %d bits\n",
+               (unsigned long)cfg.sample_rate, EXT_ADC_BITS);
+        return false;
+    }
+    if (!pio_can_add_program(EXT_ADC_PIO, &ext_adc_program)) {
+        printf("External ADC: no room for the PIO program\n");
+        return false;
+    }
+    ext_sm = pio_claim_unused_sm(EXT_ADC_PIO, true);
+    ext_offset = pio_add_program(EXT_ADC_PIO, &ext_adc_program);
+    ext_adc_program_init(EXT_ADC_PIO, ext_sm, ext_offset, EXT_ADC_SDO_PIN, EXT_ADC_SCK_PIN,
+                         EXT_ADC_BITS, tm.conv_loops, tm.div);
+
+    acq_dma_init(pio_get_dreq(EXT_ADC_PIO, ext_sm, false), &EXT_ADC_PIO->rxf[ext_sm]);
+    dma_start_channel_mask(1u << dma_chan);
+    pio_sm_set_enabled(EXT_ADC_PIO, ext_sm, true);
+
+    printf("External ADC: %lu S/s (%+ld ppm), SCK %lu Hz, conversion %lu ns, FIFO %lu us\n",
+           (unsigned long)tm.sample_rate, (long)tm.rate_error_ppm, (unsigned long)tm.sck_hz,
+           (unsigned long)tm.conv_ns, (unsigned long)tm.fifo_us);
+    return true;
+}
+
+static void ext_src_stop(void *ctx) {
+    (void)ctx;
+    pio_sm_set_enabled(EXT_ADC_PIO, ext_sm, false);
+    acq_dma_stop();
+    pio_sm_clear_fifos(EXT_ADC_PIO, ext_sm);
+    hw_clear_bits(&EXT_ADC_PIO->input_sync_bypass, 1u << EXT_ADC_SDO_PIN);
+    pio_remove_program(EXT_ADC_PIO, &ext_adc_program, ext_offset);
+    pio_sm_unclaim(EXT_ADC_PIO, ext_sm);
+}
+
+const acq_source_t acq_src_ext = {
+    .name = "external ADC", .start = ext_src_start, .stop = ext_src_stop,
+};
+
+// Replay: a file from the card or a generator (lib/ae_core/replay.c) in
+// place of the ADC, completing blocks from the logger task
+replay_t replay;
+FIL replay_fil;
+uint64_t replay_start_us;
+
+static size_t replay_read_sd(void *ctx, uint16_t *dst, size_t n) {
+    UINT br = 0;
+    f_read((FIL *)ctx, dst, (UINT)(n * sizeof(uint16_t)), &br);
+    return br / sizeof(uint16_t);
+}
+
+static bool replay_src_start(void *ctx, acq_ring_t *r) {
+    (void)r;
+    replay_config_t cfg;
+    replay_config_default(&cfg, ctx ? REPLAY_FILE : REPLAY_SYNTH_KIND);
+
+    if (ctx) {
+        FRESULT fr = f_open(&replay_fil, REPLAY_FILE_NAME, FA_READ);
+        if (fr != FR_OK) {
+            printf("No %s to replay: %d\n", REPLAY_FILE_NAME, fr);
+            return false;
+        }
+        cfg.read = replay_read_sd;
+        cfg.ctx = &replay_fil;
+    }
+    replay_init(&replay, &cfg);
+    replay_start_us = time_us_64();
+    printf("Replaying %s instead of the ADC\n", ctx ? REPLAY_FILE_NAME : "synthetic signal");
+    return true;
+}
+
+// Stand-in for dma_handler: completes the next block once it is due and
+// the ring has room. Returns false at the end of the replay file.
+static bool replay_src_poll(void *ctx, acq_ring_t *r) {
+    (void)ctx;
+    uint64_t due = replay_start_us + (replay.pos + BUF_SIZE) * 1000000 / SAMPLE_RATE;
+    if (acq_ring_backlog(r) + 1 >= r->blocks || (REPLAY_REALTIME && time_us_64() < due))
+        return true;
+
+    if (replay_fill(&replay, acq_ring_block(r, r->head), BUF_SIZE) < BUF_SIZE)
+        return false;
+
+    acq_ring_publish(r, time_us_64());
+    sched_post(&sched, tid_logger, EV_BUF_READY);
+    return true;
+}
+
+static void replay_src_stop(void *ctx) {
+    if (ctx)
+        f_close(&replay_fil);
+}
+
+const acq_source_t acq_src_sd_replay = {
+    .name = "replay", .reads_card = true,
+    .start = replay_src_start, .stop = replay_src_stop, .poll = replay_src_poll,
+    .ctx = &replay_fil,
+};
+
+const acq_source_t acq_src_synth = {
+    .name = "synthetic", .start = replay_src_start, .stop = replay_src_stop, .poll = replay_src_poll,
+};
+
+#if ACQ_SOURCE == ACQ_SOURCE_EXT_ADC
+const acq_source_t *const acq_src = &acq_src_ext;
+#elif ACQ_SOURCE == ACQ_SOURCE_SD_REPLAY
+const acq_source_t *const acq_src = &acq_src_sd_replay;
+#elif ACQ_SOURCE == ACQ_SOURCE_SYNTH
+const acq_source_t *const acq_src = &acq_src_synth;
+#else
+const acq_source_t *const acq_src = &acq_src_adc;
+#endif
+
+// ---- Trace dumps ----
+static int trace_write_fil(void *ctx, const void *data, uint32_t bytes) {
+    UINT bw;
+    FRESULT fr = f_write((FIL *)ctx, data, bytes, &bw);
+    return fr == FR_OK && bw == bytes ? 0 : -1;
+}
+
+bool trace_save(const char *name) {
+    FIL f;
+    if (f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return false;
+    int r = trace_dump(&trace, trace_write_fil, &f);
+    return f_close(&f) == FR_OK && r == 0;
+}
+
+// 't' prints the trace on the console (tools/ae_trace reads the log),
+// 'w' saves it on the card; the card is the logger's while recording
+void trace_console_poll(void) {
+    int c = getchar_timeout_us(0);
+    if (c == 't') {
+        trace_print(&trace);
+    } else if (c == 'w') {
+        if (logging || !card_mounted) {
+            printf("Trace not saved: card busy or not mounted\n");
+            return;
+        }
+        set_spi_mode_sdcard();
+        bool ok = trace_save("trace.trc");
+        set_spi_mode_lcd();
+        printf(ok ? "Trace saved to trace.trc\n" : "Trace not saved\n");
+    }
+}
+
+// A recording is three steps so that boot can run them apart: buffers,
+// then the sample source (which only needs RAM), then the files (which
+// need the card). Samples taken before the files are open wait in the ring.
+bool logging_alloc(void) {
+    mem_mode_enter(&mem, MODE_LOG);
+    uint16_t *blocks = mem_alloc(&mem, MEM_MAIN, ADC_RING_BLOCKS * BUF_BYTES, 4);
+#if LOG_MODE == LOG_MODE_TREND
+    trend_sector = mem_alloc(&mem, MEM_SCRATCH_X, TREND_SLOTS * sizeof(trend_record_t), 8);
+    void *sector = trend_sector;
+#else
+    sum_stage = mem_alloc(&mem, MEM_MAIN, SUMMARY_STAGE_SLOTS * sizeof(block_stats_t), 8);
+    void *sector = sum_stage;
+#endif
+#if ACQ_BURST
+    rat_stage = mem_alloc(&mem, MEM_MAIN, RATE_STAGE_SLOTS * sizeof(rate_change_t), 8);
+    sector = rat_stage ? sector : NULL;
+#endif
+    gap_sector = mem_alloc(&mem, MEM_SCRATCH_Y, GAP_SLOTS * sizeof(store_gap_t), 8);
+    if (!blocks || !sector || !gap_sector) {
+        printf("Out of buffer memory\n");
+        mem_pool_print(&mem, mem_mode_names);
+        mem_mode_enter(&mem, MODE_PLOT);
+        return false;
+    }
+
+    acq_ring_init(&ring, blocks, ADC_RING_BLOCKS, BUF_SIZE);
+    raw_inflight = false;
+    ring_peak = 0;
+#if ACQ_BURST
+    rate_ctl_config_t rate_cfg = {
+        .base_rate = SAMPLE_RATE,
+        .burst_rate = BURST_RATE,
+        .hold_us = BURST_HOLD_US,
+        .threshold = BURST_THRESHOLD,
+        .adc_clk_hz = 48000000,
+        .block_samples = BUF_SIZE,
+    };
+    rate_ctl_init(&rate_ctl, &rate_cfg);
+#endif
+    return true;
+}
+
+bool acq_start(void) {
+    return acq_src->start(acq_src->ctx, &ring);
+}
+
+void acq_stop(void) {
+    acq_src->stop(acq_src->ctx);
+}
+
+// ---- ADC calibration mode ----
+// Hold the button at power-on with a slow ramp or triangle on the input
+// that runs past both rails (a function generator, 0.1-1 Hz). The ADC runs
+// flat out through the block ring for ADC_CAL_SECONDS while every block
+// goes into a code histogram; the table built from it replaces adccal.bin
+// and is used from then on. 20 s at 500 kS/s is 10 M samples, about 2400
+// per code, which puts the table within ~0.05 LSB.
+#define ADC_CAL_SECONDS 20
+#define ADC_CAL_CLKDIV  0              // back to back conversions, 500 kS/s
+
+static void lcd_show_cal(const char *l1, const char *l2, const char *l3) {
+    set_spi_mode_lcd();
+    u8g2_ClearBuffer(&u8g2);
+    u8g2_SetFont(&u8g2, u8g2_font_6x12_tf);
+    u8g2_DrawStr(&u8g2, 0, 12, l1);
+    u8g2_DrawStr(&u8g2, 0, 28, l2);
+    u8g2_DrawStr(&u8g2, 0, 44, l3);
+    lcd_flush();
+    set_spi_mode_sdcard();
+}
+
+bool adc_cal_run(void) {
+    mem_mode_enter(&mem, MODE_CAL);
+    adc_hist_t *hist = mem_alloc(&mem, MEM_MAIN, sizeof(adc_hist_t), 8);
+    uint16_t *blocks = mem_alloc(&mem, MEM_MAIN, ADC_RING_BLOCKS * BUF_BYTES, 4);
+    if (!hist || !blocks) {
+        printf("Out of buffer memory\n");
+        mem_pool_print(&mem, mem_mode_names);
+        mem_mode_enter(&mem, MODE_PLOT);
+        return false;
+    }
+
+    printf("ADC calibration: ramp past both rails for %d s\n", ADC_CAL_SECONDS);
+    lcd_show_cal("ADC calibration", "ramp past both rails", "sampling...");
+    status_led_set(&status_led, LED_RECORDING);
+
+    adc_hist_reset(hist);
+    acq_ring_init(&ring, blocks, ADC_RING_BLOCKS, BUF_SIZE);
+    adc_init_sdcard_logging();
+    adc_set_clkdiv(ADC_CAL_CLKDIV);
+    acq_dma_init(DREQ_ADC, &adc_hw->fifo);
+    adc_run(true);
+    dma_start_channel_mask(1u << dma_chan);
+
+    uint64_t end = time_us_64() + ADC_CAL_SECONDS * 1000000ull;
+    while (time_us_64() < end) {
+        while (ring.tail != ring.head) {
+            adc_hist_add(hist, acq_ring_block(&ring, ring.tail), BUF_SIZE);
+            ring.tail++;
+        }
+        tight_loop_contents();
+    }
+    adc_capture_stop();
+
+    adc_cal_quality_t q;
+    adc_cal_quality(hist, &q);
+    printf("ADC calibration: %llu samples, %lu blocks skipped, %u missing codes\n",
+           (unsigned long long)hist->total, (unsigned long)ring.overruns, q.missing);
+    printf("ADC calibration: DNL %ld.%03ld LSB at %u, INL %ld.%03ld LSB at %u\n",
+           (long)(q.dnl_max_mlsb / 1000), (long)(q.dnl_max_mlsb % 1000), q.dnl_code,
+           (long)(q.inl_max_mlsb / 1000), (long)(q.inl_max_mlsb % 1000), q.inl_code);
+
+    char line[2][24];
+    snprintf(line[0], sizeof(line[0]), "DNL %ld.%02ld INL %ld.%02ld",
+             (long)(q.dnl_max_mlsb / 1000), (long)(q.dnl_max_mlsb % 1000 / 10),
+             (long)(q.inl_max_mlsb / 1000), (long)(q.inl_max_mlsb % 1000 / 10));
+
+    // Without both rails the end points are wrong; keep the old table
+    bool ok = q.missing == 0 && hist->count[0] > 0 && hist->count[ADC_CAL_CODES - 1] > 0 &&
+              adc_cal_build(hist, adc_lut) == 0;
+    if (ok) {
+        adc_cal_header_t h;
+        adc_cal_header(&h, adc_lut, hist);
+        ok = adc_cal_save(ADC_CAL_FILE, &h) == FR_OK;
+        snprintf(line[1], sizeof(line[1]), ok ? "saved, crc %08lx" : "card write failed",
+                 (unsigned long)h.crc);
+    } else {
+        snprintf(line[1], sizeof(line[1]), "no table: %u missing", q.missing);
+    }
+    printf("ADC calibration: %s\n", line[1]);
+    lcd_show_cal("ADC calibration", line[0], line[1]);
+
+    mem_mode_enter(&mem, MODE_PLOT);
+    adc_cal_load();         // the new table, or back to the old one
+    status_led_set(&status_led, ok ? LED_IDLE : LED_CARD_ERROR);
+    return ok;
+}
+
+bool logging_open(void) {
+    set_spi_mode_sdcard();
+
+    if (!card_mounted) {
+        if ((card_mounted = card_mount()))
+            card_tune();
+        if (!card_mounted) {
+            status_led_set(&status_led, LED_CARD_ERROR);
+            return false;
+        }
+    }
+
+    // _create_hello_world_file();
+
+    FRESULT fr = open_new_log(&fil, filename, sizeof(filename),
+                              LOG_MODE == LOG_MODE_TREND ? ".trd" : ".bin");
+
+    if(fr != FR_OK) {
+        printf("Failed to open file: %d\n", fr);
+        status_led_set(&status_led, LED_CARD_ERROR);
+        return false;
+    }
+
+#if LOG_MODE == LOG_MODE_TREND
+    trend_open(filename);
+#else
+    if (summary_open(filename) != FR_OK)
+        printf("No summary sidecar for %s\n", filename);
+    adc_cal_sidecar(filename);
+#if ACQ_BURST
+    rate_log_open(filename);
+#endif
+    acq_pipeline_reset();
+    hit_count = 0;
+    hit_peak = 0;
+    onset_count = 0;
+#endif
+
+    if (lcd_ready) {
+        set_spi_mode_lcd();
+        lcd_show_logging(filename);
+        set_spi_mode_sdcard();
+    }
+
+    sync_policy_config_t sync_cfg = {
+        .max_bytes = 0,
+        .max_interval_us = SYNC_MAX_INTERVAL_US,
+        .min_idle_us = SYNC_MIN_IDLE_US,
+    };
+    sync_policy_init(&sync_policy, &sync_cfg);
+    store_open();
+
+    // Replay from the card reads between writes: no CMD25 stream
+    raw_stream = LOG_MODE == LOG_MODE_RAW && !acq_src->reads_card &&
+                 raw_stream_begin(&fil);
+
+    printf("Logging to file: %s\n", filename);
+    if (LOG_MODE == LOG_MODE_TREND)
+        printf("Trend logging until the button is pressed again...\n");
+    else
+        printf("Logging for 5 seconds...\n");
+
+    status_led_set(&status_led, LED_RECORDING);
+    log_start_us = time_us_64();
+    return true;
+}
+
+static void logging_close_files(void) {
+#if LOG_MODE == LOG_MODE_TREND
+    trend_close();
+#endif
+    // The staged sidecar records go to the card once the stream is closed
+    if (raw_stream)
+        raw_stream_end(&fil);
+
+    summary_close();
+#if ACQ_BURST
+    rate_log_close(ring.tail);
+#endif
+
+    f_sync(&fil);
+    f_close(&fil);
+}
+
+bool logging_start() {
+    if (!logging_alloc())
+        return false;
+
+    if (!logging_open()) {
+        mem_mode_enter(&mem, MODE_PLOT);
+        return false;
+    }
+
+    if (!acq_start()) {
+        logging_close_files();
+        mem_mode_enter(&mem, MODE_PLOT);
+        return false;
+    }
+
+    printf("DMA started, loxgging ADC data to SD card...\n");
+    return true;
+}
+
+// Leave the CMD25 stream for f_write: keep the whole blocks the card
+// accepted and continue after them through the storage error path.
+static void raw_stream_leave(void) {
+    raw_stream_end(&fil);
+    raw_stream = false;
+    summary_write();
+#if ACQ_BURST
+    rate_log_write();
+#endif
+
+    uint32_t blocks = sd_mbw.blocks_done * SD_BLOCK_SIZE / BUF_BYTES;
+    f_lseek(&fil, (FSIZE_t)blocks * BUF_BYTES);
+    f_truncate(&fil);
+
+    // The block on the bus made it if the card took all of its sectors
+    if (raw_inflight && blocks > ring.tail) {
+        pipeline_push(ring.tail);
+        ring.tail++;
+    }
+    raw_inflight = false;
+    store_seek(&store, ring.tail, blocks);
+}
+
+// The CMD25 stream failed mid-recording
+static void raw_stream_fallback(void) {
+    printf("CMD25 stream failed: %d (r1 0x%02x), continuing with f_write\n",
+           sd_mbw.error, sd_mbw.r1);
+    card_clk_note(sd_mbw.error != SD_ERR_STATE);
+    raw_stream_leave();
+}
+
+// Writes the oldest completed block. Returns true if another one is
+// already waiting and can be written right away.
+bool logging_write_buffer() {
+
+    if (ring.tail == ring.head)
+        return false;
+
+    uint32_t tail = ring.tail;
+    if (ring.head - tail > ring_peak)
+        ring_peak = ring.head - tail;
+    const uint16_t *block = acq_ring_block(&ring, tail);
+    uint64_t block_time = acq_ring_time(&ring, tail);
+
+#if LOG_MODE == LOG_MODE_TREND
+    trend_push(&trend, block, BUF_SIZE, block_time);
+    ring.tail = tail + 1;
+    TRACE(TR_BLOCK_CONSUME, ring.tail);
+    return ring.tail != ring.head;
+#endif
+
+    if (raw_stream) {
+        // The block on the bus is DMA's source until the card took it, so
+        // it only goes back to the ring then
+        if (!sd_mbw_idle(&sd_mbw))
+            return false;
+        if (raw_inflight) {
+            raw_inflight = false;
+            card_clk_note(true);
+            pipeline_push(tail);
+            ring.tail = ++tail;
+            TRACE(TR_BLOCK_CONSUME, tail);
+            if (tail == ring.head) {
+                sidecar_flush_idle();
+                return false;
+            }
+            block = acq_ring_block(&ring, tail);
+            block_time = acq_ring_time(&ring, tail);
+        }
+
+        if (sd_mbw.blocks_done * SD_BLOCK_SIZE + BUF_BYTES <= RAW_PREALLOC_BYTES) {
+            TRACE(TR_CARD_WRITE, tail);
+            sd_mbw_write(&sd_mbw, (const uint8_t *)block,
+                         BUF_BYTES / SD_BLOCK_SIZE, time_us_64());
+            raw_inflight = true;
+            return false;
+        }
+
+        // Preallocation used up: this block and the rest go through f_write
+        printf("Raw stream full after %lu blocks, continuing with f_write\n",
+               (unsigned long)(sd_mbw.blocks_done * SD_BLOCK_SIZE / BUF_BYTES));
+        raw_stream_leave();
+    }
+
+    uint64_t t0 = time_us_64();
+    store_action_t action = store_push(&store, block, block_time, ring.head - tail, t0);
+    if (action == STORE_WAIT)
+        return false;       // retried on a later tick
+    uint64_t t1 = time_us_64();
+
+    pipeline_push(tail);
+    ring.tail = tail + 1;
+    TRACE(TR_BLOCK_CONSUME, ring.tail);
+    if (action == STORE_DROPPED) {
+        status_led_alert(&status_led, LED_OVERRUN, LED_OVERRUN_HOLD_US);
+        return ring.tail != ring.head;
+    }
+    // Unsynced data is as old as the block's first sample, however long
+    // it waited in the ring (burst blocks are younger than that)
+    sync_policy_note_write(&sync_policy, BUF_BYTES, block_time - BUF_PERIOD_US,
+                           (uint32_t)(t1 - t0));
+    // printf("SD wrote buffer, first = %u\n", block[0]);
+
+    // Time left before the DMA completes the next block; none while a
+    // backlog is waiting
+    bool backlog = ring.tail != ring.head;
+#if ACQ_BURST
+    uint64_t next_due = block_time + (uint64_t)BUF_SIZE * 1000000 / rate_ctl.rate;
+#else
+    uint64_t next_due = block_time + BUF_PERIOD_US;
+#endif
+    uint32_t idle_us = (!backlog && next_due > t1) ? (uint32_t)(next_due - t1) : 0;
+
+    if (sync_policy_should_sync(&sync_policy, t1, idle_us)) {
+        TRACE_BEGIN(TR_F_SYNC, 0);
+        FRESULT fr = f_sync(&fil);
+        TRACE_END(TR_F_SYNC, 0);
+        uint64_t t2 = time_us_64();
+        if (fr == FR_OK) {
+            sync_policy_note_sync(&sync_policy, t2, (uint32_t)(t2 - t1));
+        } else {
+            // Recovered like a failed write before the next block
+            TRACE(TR_STORE_ERROR, fr);
+            trace_trigger(&trace, TRACE_POST);
+            store_sync_failed(&store, fr, t2);
+        }
+    }
+    return backlog;
+}
+
+void logging_stop() {
+    printf("Stopping...\n");
+
+    logging_close_files();
+    store_close();
+    if (card_mounted && clk_tune.downshifts != clk_saved_downshifts)
+        clk_table_save();      // the next mount starts from the lower clock
+    if (!raw_stream)
+        sync_policy_print(&sync_policy);
+    else if (LOG_MODE == LOG_MODE_RAW)
+        printf("Sidecars: raw stream stopped %lu times for them, %lu with a full stage\n",
+               (unsigned long)sidecar_stops, (unsigned long)sidecar_forced);
+    if (LOG_MODE == LOG_MODE_RAW)
+        printf("%lu hits, peak %u, %lu onsets\n", (unsigned long)hit_count, hit_peak,
+               (unsigned long)onset_count);
+    printf("Ring: peak backlog %lu of %d blocks\n", (unsigned long)ring_peak, ADC_RING_BLOCKS - 1);
+    if (ring.overruns)
+        printf("%lu buffers lost to overruns\n", (unsigned long)ring.overruns);
+    if (trace.stopped) {
+        char name[16];
+        snprintf(name, sizeof(name), "%.5s.trc", filename);
+        if (trace_save(name))
+            printf("Trace of the overrun or write error in %s\n", name);
+        trace_reset(&trace);
+    }
+    status_led_set(&status_led, LED_IDLE);
+
+    acq_stop();
+
+    mem_pool_print(&mem, mem_mode_names);
+    mem_mode_enter(&mem, MODE_PLOT);
 
     printf("Done logging to SD card.\n");
     printf("Return to default SPI mode for LCD...\n");
     // dma_channel_set_enabled(dma_chan, false);
+
+    adc_init_polling();
+    set_spi_mode_lcd();
+
+    u8g2_ClearBuffer(&u8g2);
+    u8g2_SetDrawColor(&u8g2, 1);
+    lcd_flush();
 }
 
+// ---- Logger task: owns the ADC DMA and the card while recording ----
+void task_logger(void *ctx, uint32_t events) {
+    (void)ctx;
 
-uint8_t x = 0;   // current column
-void task_lcd_plotting(){
-    uint32_t t0 = time_us_32();
+    if ((events & EV_START) && !logging) {
+        if (!logging_start())
+            return;
+        logging = true;
+        sched_set_timer(&sched, tid_logger, EV_TICK, LOG_TICK_US);
+        events &= ~EV_START;    // the press that started it doesn't stop it
+    }
+    if (!logging)
+        return;
 
-    uint16_t min_v = 0xFFFF;
-    uint16_t max_v = 0;
+    if (raw_stream) {
+        sd_mbw_poll(&sd_mbw, time_us_64());
+        if (sd_mbw_closed(&sd_mbw))
+            raw_stream_fallback();
+    }
 
-    // ---- Capture for fixed time window ----
-    while ((time_us_32() - t0) < COLUMN_TIME_US)
-    {
-        
-        uint16_t v = adc_read();
+    // Every run, not only on EV_BUF_READY: a backlog (the blocks taken
+    // while the card mounted, or behind a slow write) drains on the ticks
+    while (logging_write_buffer()) {
+    }
+
+    if (boot_pending && ring.tail > 0) {
+        // The interrupt's stamp is the block's last sample; the ADC clock
+        // puts the first BUF_SIZE - 1 periods before it
+        if (boot_first_sample)
+            boot_mark(&boot, "first sample",
+                      boot_first_block_us - (uint64_t)(BUF_SIZE - 1) * 1000000 / SAMPLE_RATE);
+        boot_mark(&boot, "first block", time_us_64());
+        boot_report();
+    }
+
+#if DUTY_CYCLE
+    bool done = (events & EV_STOP) != 0;        // task_duty ends the window
+#else
+    bool done = LOG_MODE == LOG_MODE_TREND ? (events & EV_START) != 0
+                                           : time_us_64() - log_start_us >= LOG_DURATION_US;
+#endif
+    if (acq_src->poll) {
+        bool more = acq_src->poll(acq_src->ctx, &ring);
+        if (acq_src->reads_card)
+            done = !more;       // the whole file, however long
+    }
 
-        if (v < min_v) min_v = v;
-        if (v > max_v) max_v = v;
-        
+    if (done) {
+        sched_set_timer(&sched, tid_logger, 0, 0);
+        logging_stop();
+        logging = false;
+#if DUTY_CYCLE
+        sched_post(&sched, tid_duty, EV_LOG_DONE);
+#endif
     }
+}
+
+// ---- Button task: debounced press starts a recording ----
+uint64_t last_press_us;
+
+void button_irq(uint gpio, uint32_t events) {
+    (void)events;
+    TRACE(TR_BUTTON, gpio);
+    sched_post(&sched, tid_button, EV_BUTTON);
+}
+
+void task_button(void *ctx, uint32_t events) {
+    (void)ctx;
+    (void)events;
+
+    uint64_t now = time_us_64();
+    if (now - last_press_us < BUTTON_DEBOUNCE_US)
+        return;
+    if (gpio_get(BTN_ENC_PIN) != 0)
+        return;     // bounce on release
+
+    last_press_us = now;
+    sched_post(&sched, tid_logger, EV_START);
+}
+
+// ---- Display task: scrolling min/max plot while not recording ----
+uint8_t x = 0;   // current column
+
+void lcd_draw_column(uint16_t min_v, uint16_t max_v){
 
     // ---- Convert ADC values to LCD Y coordinates ----
     uint8_t y_min = LCD_H - 1 - (min_v * LCD_H / 4096);
@@ -575,44 +2296,276 @@ void task_lcd_plotting(){
     u8g2_DrawVLine(&u8g2, cursor_x, 0, LCD_H);
 
     // ---- Send to LCD ----
-    u8g2_SendBuffer(&u8g2);
+    lcd_flush();
 
     // ---- Advance column ----
     x++;
     if (x >= LCD_W) x = 0;
 }
 
+uint16_t col_min = 0xFFFF;
+uint16_t col_max = 0;
+uint64_t col_start_us;
 
-int main() {
-    stdio_init_all();
-    printf("starting...\n");
-    gpio_init(BTN_ENC_PIN);
-    gpio_set_dir(BTN_ENC_PIN, GPIO_IN);
+void task_display(void *ctx, uint32_t events) {
+    (void)ctx;
+    (void)events;
 
-    neopixel_init(LCD_D5_PIN);
-    uint32_t colors[2] = {
-        0x3F000000, // Red
-        0  // Green
-    };
-    neopixel_write(colors, 2);
+    trace_console_poll();
+    if (logging)
+        return;
 
+    // ---- Sample a short burst per tick instead of spinning ----
+    for (int i = 0; i < ADC_BLOCK; i++) {
+        uint16_t v = adc_read();
 
+        if (v < col_min) col_min = v;
+        if (v > col_max) col_max = v;
+    }
 
-    
+    uint64_t now = time_us_64();
+    if (now - col_start_us < COLUMN_TIME_US)
+        return;
 
-    printf("init sdcard\n");
-    init_sd_card();
-    printf("finish init sdcard\n");
+    lcd_draw_column(col_min, col_max);
+    col_min = 0xFFFF;
+    col_max = 0;
+    col_start_us = now;
+}
 
-    
+// ---- Stats task: per-task CPU time over the last period ----
+void task_stats(void *ctx, uint32_t events) {
+    (void)ctx;
+    (void)events;
 
-    
+    sched_print_stats(&sched);
+    sched_reset_stats(&sched);
+}
 
-    
-    
-    colors[0] = 0x3F3F3F00;
-    neopixel_write(colors, 2);
+#if DUTY_CYCLE
+// ---- Duty task: capture windows on a schedule, powered down between ----
+#define DUTY_DEEP_MIN_US  20000                      // shorter sleeps stay in WFE
+#define DUTY_TIMER_MAX_US (60u * 60 * 1000 * 1000)   // sched timers are 32-bit
+#define SD_PWR_SETTLE_US  2000
+
+duty_t duty;
+uint8_t duty_traced = DUTY_SLEEP;
+
+// Everything but the core and the timer off. logging_stop() has closed
+// the files and left the ADC polling and the LCD cleared.
+static void duty_power_down(void) {
+#if SD_PWR_PIN >= 0
+    f_unmount("");
+    card_mounted = false;
+    gpio_put(SD_PWR_PIN, 0);
+#endif
+    set_spi_mode_lcd();
+    u8g2_SetPowerSave(&u8g2, 1);        // display and its booster off
+
+    adc_run(false);
+    hw_clear_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+    clock_stop(clk_adc);
+
+    // One more frame shows the pixels dark, then no more timer wake-ups
+    status_led_set(&status_led, LED_OFF);
+    sleep_us(2 * LED_FRAME_US);
+    cancel_repeating_timer(&led_timer);
+}
+
+// Clocks are back (duty_sleep_until); the rest comes up and the file is
+// opened before the window, so only the capture is left at its start.
+static bool duty_power_up(void) {
+    add_repeating_timer_us(-LED_FRAME_US, led_timer_cb, NULL, &led_timer);
+    status_led_set(&status_led, LED_BOOT);
+    clock_configure_undivided(clk_adc, 0, CLOCKS_CLK_ADC_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+                              USB_CLK_HZ);
+#if SD_PWR_PIN >= 0
+    gpio_put(SD_PWR_PIN, 1);
+    sleep_us(SD_PWR_SETTLE_US);
+#endif
+    set_spi_mode_lcd();
+    u8g2_SetPowerSave(&u8g2, 0);
+
+    if (!logging_alloc())
+        return false;
+    if (!logging_open()) {          // mounts and tunes the card if it was off
+        mem_mode_enter(&mem, MODE_PLOT);
+        return false;
+    }
+    return true;
+}
+
+static volatile bool duty_alarm;
+
+static int64_t duty_alarm_cb(alarm_id_t id, void *ctx) {
+    (void)id;
+    (void)ctx;
+    duty_alarm = true;
+    return 0;
+}
+
+static void deep_sleep_enable(bool on) {
+#ifdef __riscv
+    if (on)
+        riscv_set_csr(RVCSR_MSLEEP_OFFSET, RVCSR_MSLEEP_DEEPSLEEP_BITS);
+    else
+        riscv_clear_csr(RVCSR_MSLEEP_OFFSET, RVCSR_MSLEEP_DEEPSLEEP_BITS);
+#else
+    if (on)
+        scb_hw->scr |= M33_SCR_SLEEPDEEP_BITS;
+    else
+        scb_hw->scr &= ~M33_SCR_SLEEPDEEP_BITS;
+#endif
+}
+
+// Clock-gated sleep: clk_sys drops to the 12 MHz crystal and the system
+// PLL stops; in WFI only the timer (ticked from clk_ref) keeps a clock,
+// and its alarm wakes the core. time_us_64() counts on throughout, so the
+// schedule needs no drift allowance (sleep_ppm 0). Dormant would also stop
+// the crystal, but then the AON timer wakes the chip from the low-power
+// oscillator, percent-level off on this board (duty_sim's lposc rows).
+static void duty_sleep_until(uint64_t until_us) {
+    uint32_t sys_khz = clock_get_hz(clk_sys) / 1000;
+    uart_default_tx_wait_blocking();
+
+    duty_alarm = false;
+    if (add_alarm_at(from_us_since_boot(until_us), duty_alarm_cb, NULL, false) <= 0)
+        return;                     // already due
+
+    clock_configure_undivided(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF, 0, XOSC_HZ);
+    pll_deinit(pll_sys);
+    clocks_hw->sleep_en0 = 0;
+    clocks_hw->sleep_en1 = CLOCKS_SLEEP_EN1_CLK_REF_TICKS_BITS |
+                           CLOCKS_SLEEP_EN1_CLK_SYS_TIMER0_BITS;
+    deep_sleep_enable(true);
+    while (!duty_alarm)
+        __wfi();
+    deep_sleep_enable(false);
+    clocks_hw->sleep_en0 = ~0u;
+    clocks_hw->sleep_en1 = ~0u;
+    set_sys_clock_khz(sys_khz, true);     // clk_peri with it: UART and SPI rates hold
+}
+
+static void duty_window_done(void) {
+    duty_power_down();
+    duty_stopped(&duty, time_us_64());
+    duty_print_window(&duty.last);
+    duty_print_stats(&duty, time_us_64());
+    sched_post(&sched, tid_stats, EV_TICK);     // the window's CPU time
+}
+
+void task_duty(void *ctx, uint32_t events) {
+    (void)ctx;
+
+    if (events & EV_LOG_DONE)
+        duty_window_done();
 
+    for (;;) {
+        uint64_t now = time_us_64(), at;
+        duty_action_t a = duty_next(&duty, now, &at);
+        if (duty_state(&duty) != duty_traced) {
+            duty_traced = duty_state(&duty);
+            TRACE(TR_DUTY, duty_traced);
+        }
+
+        switch (a) {
+        case DUTY_POWER_UP:
+            duty_ready(&duty, time_us_64(), duty_power_up());
+            break;
+
+        case DUTY_START: {
+            bool ok = acq_start();
+            uint64_t t = time_us_64();
+            if (ok) {
+                logging = true;
+                log_start_us = t;
+                sched_set_timer(&sched, tid_logger, EV_TICK, LOG_TICK_US);
+            } else {
+                logging_close_files();
+                mem_mode_enter(&mem, MODE_PLOT);
+            }
+            duty_started(&duty, t, ok);
+            break;
+        }
+
+        case DUTY_STOP:
+            if (logging) {
+                sched_post(&sched, tid_logger, EV_STOP);
+                sched_set_timer(&sched, tid_duty, 0, 0);
+                return;             // back with EV_LOG_DONE
+            }
+            duty_window_done();     // given up before the capture
+            break;
+
+        case DUTY_IDLE:
+            at = at > now ? at - now : 1;
+            sched_set_timer(&sched, tid_duty, EV_TICK,
+                            at < DUTY_TIMER_MAX_US ? (uint32_t)at : DUTY_TIMER_MAX_US);
+            return;
+
+        case DUTY_FINISHED:
+            sched_set_timer(&sched, tid_duty, EV_TICK, DUTY_TIMER_MAX_US);
+            return;
+        }
+    }
+}
+#endif
+
+static uint64_t sched_clock(void) {
+    return time_us_64();
+}
+
+// Sleep until the next timer; any interrupt (DMA, GPIO) wakes us early.
+// Between capture windows nothing else runs, and the clocks stop too.
+static void sched_idle(uint64_t until_us) {
+#if DUTY_CYCLE
+    if (duty_state(&duty) == DUTY_SLEEP && until_us >= time_us_64() + DUTY_DEEP_MIN_US) {
+        duty_sleep_until(until_us);
+        return;
+    }
+#endif
+    best_effort_wfe_or_timeout(from_us_since_boot(until_us));
+}
+
+
+int main() {
+    boot_end(&boot, boot_begin(&boot, "runtime", 0), time_us_64());
+    boot_pending = true;
+    int ph;
+
+    mem_init();
+    sched_init(&sched, sched_clock, sched_idle);
+    tid_logger  = sched_add(&sched, "logger",  3, task_logger,  NULL);
+    tid_button  = sched_add(&sched, "button",  2, task_button,  NULL);
+    tid_display = sched_add(&sched, "display", 1, task_display, NULL);
+    tid_stats   = sched_add(&sched, "stats",   0, task_stats,   NULL);
+#if DUTY_CYCLE
+    tid_duty    = sched_add(&sched, "duty",    2, task_duty,    NULL);
+#endif
+
+#if BOOT_RECORD
+    // Only RAM is needed to sample; replay sources wait for the card
+    ph = boot_begin(&boot, "adc start", time_us_64());
+    bool boot_rec = logging_alloc() && (acq_src->poll || acq_start());
+    boot_end(&boot, ph, time_us_64());
+    boot_first_sample = boot_rec && !acq_src->poll;
+#endif
+
+    ph = boot_begin(&boot, "stdio", time_us_64());
+    stdio_init_all();
+    boot_end(&boot, ph, time_us_64());
+    printf("starting...\n");
+    gpio_init(BTN_ENC_PIN);
+    gpio_set_dir(BTN_ENC_PIN, GPIO_IN);
+    bool cal_requested = gpio_get(BTN_ENC_PIN) == 0;    // held at power-on
+
+    ph = boot_begin(&boot, "led", time_us_64());
+    neopixel_init(LCD_D5_PIN);
+    status_led_set(&status_led, LED_BOOT);
+    boot_end(&boot, ph, time_us_64());
+
+    // Reset the LCD now and let it settle while the card mounts
+    int ph_lcd = boot_begin(&boot, "lcd", time_us_64());
     u8g2_Setup_st7567_jlx12864_f(
         &u8g2,
         U8G2_R2,
@@ -621,8 +2574,26 @@ int main() {
     );
 
     u8g2_InitDisplay(&u8g2);
-    sleep_ms(50);
+    uint64_t lcd_due = time_us_64() + LCD_SETTLE_US;
+
+#if SD_PWR_PIN >= 0
+    gpio_init(SD_PWR_PIN);
+    gpio_set_dir(SD_PWR_PIN, GPIO_OUT);
+    gpio_put(SD_PWR_PIN, 1);
+#endif
+    printf("init sdcard\n");
+    ph = boot_begin(&boot, "card", time_us_64());
+    init_sd_card();
+    boot_end(&boot, ph, time_us_64());
+    printf("finish init sdcard\n");
+
+    if (card_mounted) {
+        adc_cal_load();
+        status_led_set(&status_led, LED_IDLE);
+    }
 
+    sleep_until(from_us_since_boot(lcd_due));     // normally long past
+    set_spi_mode_lcd();
     u8g2_SetPowerSave(&u8g2, 0);
     u8g2_SetContrast(&u8g2, 128);
 
@@ -630,24 +2601,64 @@ int main() {
     u8x8_cad_SendCmd(&u8g2.u8x8, 0x81);   // EV command
     u8x8_cad_SendCmd(&u8g2.u8x8, 0x2F);   // your working value
     u8x8_cad_EndTransfer(&u8g2.u8x8);
+    lcd_ready = true;
+    boot_end(&boot, ph_lcd, time_us_64());
 
     set_spi_mode_sdcard();
     set_spi_mode_lcd();
-    adc_init_polling();
 
-    while (1)
-    {
-        if (gpio_get(BTN_ENC_PIN) == 0) {
-            task_sdcard_adc_loggin();
-            sleep_ms(500);
-            adc_init_polling();
-            set_spi_mode_lcd();
-
-            u8g2_ClearBuffer(&u8g2);
-            u8g2_SetDrawColor(&u8g2, 1);
-            u8g2_SendBuffer(&u8g2);
+#if BOOT_RECORD
+    if (boot_rec && cal_requested) {
+        if (!acq_src->poll)
+            acq_stop();
+        mem_mode_enter(&mem, MODE_PLOT);
+        boot_rec = false;
+    }
+    if (boot_rec) {
+        ph = boot_begin(&boot, "open", time_us_64());
+        bool opened = logging_open();
+        if (opened && acq_src->poll && !acq_start()) {
+            logging_close_files();
+            opened = false;
+        }
+        boot_end(&boot, ph, time_us_64());
+
+        if (opened) {
+            logging = true;
+            sched_set_timer(&sched, tid_logger, EV_TICK, LOG_TICK_US);
+            sched_post(&sched, tid_logger, EV_BUF_READY);
+        } else {
+            if (!acq_src->poll)
+                acq_stop();
+            mem_mode_enter(&mem, MODE_PLOT);
         }
-        task_lcd_plotting();
     }
+#endif
+    if (cal_requested && card_mounted)
+        adc_cal_run();
+    if (!logging)
+        adc_init_polling();    // adc_init() would reset a running capture
+
+#if DUTY_CYCLE
+    // The schedule replaces the button, the plot and the periodic stats
+    duty_power_down();              // until the first window
+    duty_config_t duty_cfg;
+    duty_config_default(&duty_cfg);
+    duty_cfg.window_us = DUTY_WINDOW_US;
+    duty_cfg.interval_us = DUTY_INTERVAL_US;
+    duty_init(&duty, &duty_cfg, time_us_64());
+    printf("Capture %lu ms every %lu s\n", (unsigned long)(DUTY_WINDOW_US / 1000),
+           (unsigned long)(DUTY_INTERVAL_US / 1000000));
+    sched_post(&sched, tid_duty, EV_TICK);
+#else
+    sched_set_timer(&sched, tid_display, EV_TICK, DISPLAY_TICK_US);
+    sched_set_timer(&sched, tid_stats, EV_TICK, STATS_PERIOD_US);
+
+    gpio_set_irq_enabled_with_callback(BTN_ENC_PIN, GPIO_IRQ_EDGE_FALL, true, button_irq);
+#endif
+
+    boot_mark(&boot, "scheduler", time_us_64());
+    if (!logging)
+        boot_report();
+    sched_run(&sched);
 }
-
@@ -0,0 +1,37 @@
+#ifndef SD_CARD_FAT_H
+#define SD_CARD_FAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ff.h"
+#include "diskio.h"
+
+/*
+ * Where FatFs put a file on the card, for the writes that go around it:
+ * the CMD25 raw stream and the clock probe in main.c, and
+ * test/sd_dma_write_main.c. The file must be contiguous (f_expand).
+ */
+
+// First block of a contiguous file, as an LBA
+static inline LBA_t file_lba(const FIL *fp)
+{
+    const FATFS *vol = fp->obj.fs;
+    return vol->database + (LBA_t)(fp->obj.sclust - 2) * vol->csize;
+}
+
+// Block addressing for SDHC/SDXC; a standard-capacity card takes byte
+// addresses. Without MMC_GET_TYPE, anything above 2 GB cannot be a
+// standard-capacity card.
+static inline bool card_high_capacity(FATFS *vol)
+{
+    bool high_capacity = (uint64_t)vol->n_fatent * vol->csize * FF_MIN_SS > 0x80000000ull;
+#ifdef MMC_GET_TYPE
+    BYTE card_type;
+    if (disk_ioctl(vol->pdrv, MMC_GET_TYPE, &card_type) == RES_OK)
+        high_capacity = (card_type & 0x08) != 0;   // CT_BLOCK
+#endif
+    return high_capacity;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "block_stats.h"
+
+// Cost of block_stats_compute on one logger buffer (1024 samples), the
+// on-target counterpart of `ae_summary --bench`.
+
+#define BUF_SIZE 1024
+#define ROUNDS   1000
+
+uint16_t buf[BUF_SIZE];
+
+int main(void) {
+    stdio_init_all();
+    sleep_ms(1000);
+
+    // 1 kHz-ish square around mid-scale with some noise, like the PWM test signal
+    uint32_t x = 1;
+    for (int i = 0; i < BUF_SIZE; i++) {
+        x = x * 1664525 + 1013904223;
+        buf[i] = (uint16_t)(((i % 4) == 0 ? 3000 : 1000) + (x >> 26));
+    }
+
+    block_stats_t st;
+    uint8_t above = BLOCK_STATS_ABOVE_UNKNOWN;
+
+    uint64_t t0 = time_us_64();
+    for (int r = 0; r < ROUNDS; r++)
+        block_stats_compute(&st, buf, BUF_SIZE, 2048, &above);
+    uint64_t us = time_us_64() - t0;
+
+    double per_block = (double)us / ROUNDS;
+    double cycles = per_block * (clock_get_hz(clk_sys) / 1e6) / BUF_SIZE;
+
+    printf("block_stats_compute: %.2f us per %d-sample block, %.2f cycles/sample\n",
+           per_block, BUF_SIZE, cycles);
+    printf("min %u max %u sum %lu zc %u\n", st.min, st.max, (unsigned long)st.sum, st.zero_cross);
+
+    while (1) sleep_ms(5);
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "ff.h"
+#include "tf_card.h"
+#include <string.h>
+#include "hardware/spi.h"
+#include "sd_spi_dma.h"
+#include "sd_card_fat.h"
+
+// Write throughput: f_write (pico_fatfs, blocking byte-wise SPI) against
+// CMD25 multi-block writes over DMA (lib/sd_spi_dma) at several clocks.
+// Both paths write TEST_BYTES in 2048-byte chunks, like the logger.
+
+// pi interface board
+#define SPI_MISO_PIN 12
+#define SPI_CS_PIN   16
+#define SPI_SCK_PIN  14
+#define SPI_MOSI_PIN 15
+
+#define CLK_SLOW (2 * 1000 * 1000)
+#define CLK_FAST (4 * 1000 * 1000)
+
+#define TEST_BYTES (1024 * 1024)
+#define CHUNK 2048
+
+FATFS fs;
+uint8_t chunk[CHUNK];
+
+void init_sd_card(){
+    printf("SD Init..\n");
+
+    pico_fatfs_spi_config_t config = {
+        spi1,
+        CLK_SLOW,
+        CLK_FAST,
+        SPI_MISO_PIN,
+        SPI_CS_PIN,
+        SPI_SCK_PIN,
+        SPI_MOSI_PIN,
+        true
+    };
+
+    if (!pico_fatfs_set_config(&config)) {
+        printf("Failed to set config\n");
+        while (1) sleep_ms(5);
+    }
+
+    FRESULT fr  = f_mount(&fs, "", 1);
+    if (fr != FR_OK) {
+        printf("f_mount fail: %d\n", fr);
+        while (1) sleep_ms(5);
+    }
+}
+
+void bench_f_write(){
+    FIL fil;
+    UINT bw;
+
+    f_open(&fil, "bench.bin", FA_WRITE | FA_CREATE_ALWAYS);
+
+    uint64_t t0 = time_us_64();
+    for (uint32_t n = 0; n < TEST_BYTES; n += CHUNK)
+        f_write(&fil, chunk, CHUNK, &bw);
+    f_sync(&fil);
+    uint64_t us = time_us_64() - t0;
+
+    f_close(&fil);
+    printf("f_write  @ %u Hz: %.3f MB/s\n", CLK_FAST, (double)TEST_BYTES / us);
+}
+
+void bench_cmd25(uint hz){
+    FIL fil;
+    f_open(&fil, "bench.bin", FA_WRITE | FA_CREATE_ALWAYS);
+
+#if FF_USE_EXPAND
+    f_expand(&fil, TEST_BYTES, 1);
+    f_sync(&fil);
+    uint32_t lba = (uint32_t)file_lba(&fil);
+    bool high_capacity = card_high_capacity(fil.obj.fs);
+
+    sd_spi_dma_t d;
+    sd_mbw_t w;
+    sd_spi_dma_init(&d, spi1, SPI_CS_PIN);
+    uint actual = sd_spi_dma_set_clock(&d, hz);
+    sd_mbw_init(&w, &d.transport, high_capacity);
+
+    uint64_t t0 = time_us_64();
+    sd_status_t st = sd_mbw_start(&w, lba, TEST_BYTES / SD_BLOCK_SIZE, time_us_64());
+    while (st == SD_BUSY)
+        st = sd_mbw_poll(&w, time_us_64());
+    for (uint32_t n = 0; st == SD_OK && n < TEST_BYTES; n += CHUNK) {
+        while (st == SD_BUSY || (st == SD_OK && !sd_mbw_idle(&w)))
+            st = sd_mbw_poll(&w, time_us_64());
+        if (st == SD_OK)
+            st = sd_mbw_write(&w, chunk, CHUNK / SD_BLOCK_SIZE, time_us_64());
+    }
+    while (st == SD_BUSY || (st == SD_OK && !sd_mbw_idle(&w)))
+        st = sd_mbw_poll(&w, time_us_64());
+    st = sd_mbw_stop(&w, time_us_64());
+    while (st == SD_BUSY)
+        st = sd_mbw_poll(&w, time_us_64());
+    uint64_t us = time_us_64() - t0;
+
+    spi_set_baudrate(spi1, CLK_FAST);
+    sd_spi_dma_deinit(&d);
+
+    printf("CMD25 DMA @ %u Hz: %.3f MB/s, status %d, %lu busy polls\n",
+           actual, (double)TEST_BYTES / us, st, (unsigned long)w.busy_polls);
+#else
+    (void)hz;
+    printf("CMD25 DMA: needs FF_USE_EXPAND\n");
+#endif
+
+    f_close(&fil);
+}
+
+int main(void) {
+    stdio_init_all();
+    sleep_ms(1000);
+
+    for (int i = 0; i < CHUNK; i++)
+        chunk[i] = (uint8_t)i;
+
+    init_sd_card();
+
+    bench_f_write();
+    bench_cmd25(CLK_FAST);
+    bench_cmd25(12500000);
+    bench_cmd25(SD_SPI_DMA_MAX_HZ);
+
+    printf("Done\n");
+    while (1) sleep_ms(5);
+}
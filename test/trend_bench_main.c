@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "block_stats.h"
+#include "trend.h"
+
+// Cost of the trend reduction on one logger buffer (1024 samples) and of
+// closing an interval, the on-target counterpart of `ae_trend --bench`.
+
+#define BUF_SIZE 1024
+#define ROUNDS   1000
+
+uint16_t buf[BUF_SIZE];
+
+static double cycles_per_sample(uint64_t us, int rounds) {
+    return (double)us / rounds * (clock_get_hz(clk_sys) / 1e6) / BUF_SIZE;
+}
+
+int main(void) {
+    stdio_init_all();
+    sleep_ms(1000);
+
+    // Same input as block_stats_bench_main.c
+    uint32_t x = 1;
+    for (int i = 0; i < BUF_SIZE; i++) {
+        x = x * 1664525 + 1013904223;
+        buf[i] = (uint16_t)(((i % 4) == 0 ? 3000 : 1000) + (x >> 26));
+    }
+
+    block_stats_t st;
+    uint8_t above = BLOCK_STATS_ABOVE_UNKNOWN;
+    uint64_t t0 = time_us_64();
+    for (int r = 0; r < ROUNDS; r++)
+        block_stats_compute(&st, buf, BUF_SIZE, 2048, &above);
+    uint64_t base_us = time_us_64() - t0;
+
+    trend_acc_t acc = {0};
+    trend_acc_reset(&acc, 1500);
+    t0 = time_us_64();
+    for (int r = 0; r < ROUNDS; r++)
+        trend_accumulate(&acc, buf, BUF_SIZE);
+    uint64_t acc_us = time_us_64() - t0;
+
+    trend_record_t rec;
+    t0 = time_us_64();
+    for (int r = 0; r < ROUNDS; r++)
+        trend_finish(&acc, &rec);
+    uint64_t finish_us = time_us_64() - t0;
+
+    printf("block_stats_compute: %.2f us per %d-sample block, %.2f cycles/sample\n",
+           (double)base_us / ROUNDS, BUF_SIZE, cycles_per_sample(base_us, ROUNDS));
+    printf("trend_accumulate:    %.2f us per %d-sample block, %.2f cycles/sample\n",
+           (double)acc_us / ROUNDS, BUF_SIZE, cycles_per_sample(acc_us, ROUNDS));
+    printf("trend_finish:        %.2f us per interval\n", (double)finish_us / ROUNDS);
+    printf("rms %u peak %u asl %d crest %u bands %u %u %u %u\n", rec.rms, rec.peak, rec.asl, rec.crest,
+           rec.band[0], rec.band[1], rec.band[2], rec.band[3]);
+
+    while (1) sleep_ms(5);
+}
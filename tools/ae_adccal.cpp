@@ -0,0 +1,488 @@
+// ADC linearity tables (lib/ae_core/adc_cal.c): build, inspect, apply.
+//
+// --build takes a recording of a slow ramp that runs past both rails and
+// writes the code-density table the firmware's calibration mode would
+// (adccal.bin). --info prints a table's header. Without a mode the
+// recordings are corrected into float32 counts (file.f32) with a gathered
+// lookup. The table is aXXXX.cal next to the recording (the firmware
+// copies its table there), or --cal.
+//
+// --bench builds a table for a model ADC with RP2350-like wide codes (512,
+// 1536, 2560, 3584), random DNL and a bowed INL. It checks the table
+// against the model's true transition levels and shows what the
+// correction does to sine RMS and peak estimates. Then it times the
+// firmware's integer pass against the host float gather, scalar and AVX2.
+//
+// usage: ae_adccal --build ramp.bin [-o adccal.bin]
+//        ae_adccal --info adccal.bin
+//        ae_adccal [--cal adccal.bin] file.bin ... [-o out.f32]
+//        ae_adccal --bench [MSAMPLES]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "adc_cal.h"
+#include "tool_util.h"
+
+namespace {
+
+bool read_codes(const std::string &path, std::vector<uint16_t> &v)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    v.resize(size_t(n) / 2);
+    bool ok = fread(v.data(), 2, v.size(), f) == v.size();
+    fclose(f);
+    return ok;
+}
+
+struct Table {
+    adc_cal_header_t h;
+    std::vector<uint16_t> lut = std::vector<uint16_t>(ADC_CAL_CODES);
+};
+
+bool load_table(const std::string &path, Table &t, bool quiet = false)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        if (!quiet)
+            perror(path.c_str());
+        return false;
+    }
+    bool ok = fread(&t.h, sizeof(t.h), 1, f) == 1 &&
+              fread(t.lut.data(), 2, ADC_CAL_CODES, f) == ADC_CAL_CODES &&
+              adc_cal_check(&t.h, t.lut.data()) == 0;
+    fclose(f);
+    if (!ok)
+        fprintf(stderr, "%s: not an ADC table, or its CRC doesn't match\n", path.c_str());
+    return ok;
+}
+
+bool save_table(const std::string &path, const Table &t)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    bool ok = fwrite(&t.h, sizeof(t.h), 1, f) == 1 &&
+              fwrite(t.lut.data(), 2, ADC_CAL_CODES, f) == ADC_CAL_CODES;
+    fclose(f);
+    return ok;
+}
+
+void print_quality(const char *label, const adc_cal_quality_t &q)
+{
+    printf("%s: DNL max %.3f LSB at code %u, INL max %.3f LSB at code %u, %u missing codes\n", label,
+           q.dnl_max_mlsb / 1000.0, q.dnl_code, q.inl_max_mlsb / 1000.0, q.inl_code, q.missing);
+}
+
+// ---- Float gather: Q4 table -> counts ----
+
+std::vector<float> float_table(const uint16_t *lut)
+{
+    std::vector<float> f(ADC_CAL_CODES);
+    for (uint32_t k = 0; k < ADC_CAL_CODES; k++)
+        f[k] = lut[k] / float(ADC_CAL_ONE);
+    return f;
+}
+
+__attribute__((optimize("no-tree-vectorize")))
+void gather_scalar(const float *lut, const uint16_t *in, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = lut[in[i] & (ADC_CAL_CODES - 1)];
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+void gather_avx2(const float *lut, const uint16_t *in, float *out, size_t n)
+{
+    const __m256i mask = _mm256_set1_epi32(ADC_CAL_CODES - 1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m256i idx = _mm256_and_si256(_mm256_cvtepu16_epi32(v), mask);
+        _mm256_storeu_ps(out + i, _mm256_i32gather_ps(lut, idx, 4));
+    }
+    for (; i < n; i++)
+        out[i] = lut[in[i] & (ADC_CAL_CODES - 1)];
+}
+
+bool have_avx2() { return __builtin_cpu_supports("avx2"); }
+#else
+void gather_avx2(const float *lut, const uint16_t *in, float *out, size_t n)
+{
+    gather_scalar(lut, in, out, n);
+}
+
+bool have_avx2() { return false; }
+#endif
+
+void gather(const float *lut, const uint16_t *in, float *out, size_t n)
+{
+    static const bool avx2 = have_avx2();
+    if (avx2)
+        gather_avx2(lut, in, out, n);
+    else
+        gather_scalar(lut, in, out, n);
+}
+
+// ---- Modes ----
+
+int build(const std::string &ramp, const std::string &out)
+{
+    std::vector<uint16_t> v;
+    if (!read_codes(ramp, v))
+        return 1;
+
+    adc_hist_t *h = new adc_hist_t;
+    adc_hist_reset(h);
+    adc_hist_add(h, v.data(), uint32_t(v.size()));
+
+    adc_cal_quality_t q;
+    adc_cal_quality(h, &q);
+    printf("%s: %zu samples, %llu at the rails\n", ramp.c_str(), v.size(),
+           (unsigned long long)(h->count[0] + h->count[ADC_CAL_CODES - 1]));
+    print_quality("measured", q);
+    if (q.missing > 0 || h->count[0] == 0 || h->count[ADC_CAL_CODES - 1] == 0)
+        fprintf(stderr, "warning: the ramp should cover every code and run past both rails\n");
+
+    Table t;
+    int r = adc_cal_build(h, t.lut.data());
+    if (r == 0)
+        adc_cal_header(&t.h, t.lut.data(), h);
+    delete h;
+    if (r != 0) {
+        fprintf(stderr, "%s: no samples between the rails\n", ramp.c_str());
+        return 1;
+    }
+    if (!save_table(out, t))
+        return 1;
+    printf("wrote %s, crc %08x\n", out.c_str(), t.h.crc);
+    return 0;
+}
+
+int info(const std::string &path)
+{
+    Table t;
+    if (!load_table(path, t))
+        return 1;
+    double worst = 0;
+    uint32_t at = 0;
+    for (uint32_t k = 0; k < ADC_CAL_CODES; k++) {
+        double d = std::fabs(t.lut[k] / double(ADC_CAL_ONE) - k);
+        if (d > worst) {
+            worst = d;
+            at = k;
+        }
+    }
+    printf("%s: crc %08x, built from %llu samples, DNL max %.3f, INL max %.3f LSB; "
+           "largest correction %.3f LSB at code %u\n",
+           path.c_str(), t.h.crc, (unsigned long long)t.h.samples, t.h.dnl_max_mlsb / 1000.0,
+           t.h.inl_max_mlsb / 1000.0, worst, at);
+    return 0;
+}
+
+int apply(const std::vector<std::string> &files, const std::string &cal, const std::string &out)
+{
+    if (!out.empty() && files.size() != 1) {
+        fprintf(stderr, "-o takes a single input\n");
+        return 2;
+    }
+    int rc = 0;
+    for (const std::string &path : files) {
+        Table t;
+        std::string table = cal.empty() ? with_ext(path, ".cal") : cal;
+        if (!load_table(table, t)) {
+            rc = 1;
+            continue;
+        }
+        std::vector<uint16_t> v;
+        if (!read_codes(path, v)) {
+            rc = 1;
+            continue;
+        }
+        std::vector<float> lutf = float_table(t.lut.data());
+        std::vector<float> y(v.size());
+        gather(lutf.data(), v.data(), y.data(), v.size());
+
+        std::string dst = out.empty() ? with_ext(path, ".f32") : out;
+        FILE *f = fopen(dst.c_str(), "wb");
+        if (!f || fwrite(y.data(), 4, y.size(), f) != y.size()) {
+            perror(dst.c_str());
+            rc = 1;
+        }
+        if (f)
+            fclose(f);
+        printf("%s -> %s through %s (crc %08x), %zu samples\n", path.c_str(), dst.c_str(),
+               table.c_str(), t.h.crc, v.size());
+    }
+    return rc;
+}
+
+// ---- Bench ----
+
+struct Rng {
+    uint64_t s;
+    double uniform()
+    {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return (s >> 11) * (1.0 / 9007199254740992.0);
+    }
+    double gauss()
+    {
+        double u = std::max(uniform(), 1e-300), v = uniform();
+        return std::sqrt(-2 * std::log(u)) * std::cos(2 * M_PI * v);
+    }
+};
+
+// Model ADC: lower edge of every code, in LSB. End points are exact, so
+// the table corrects the model completely (no gain/offset part).
+struct ModelAdc {
+    std::vector<double> edge = std::vector<double>(ADC_CAL_CODES + 1);
+
+    explicit ModelAdc(uint64_t seed)
+    {
+        Rng rng{seed};
+        const uint32_t last = ADC_CAL_CODES - 2;
+        std::vector<double> w(ADC_CAL_CODES, 1.0);
+        for (uint32_t k = 1; k <= last; k++) {
+            w[k] += 0.06 * rng.gauss();
+            w[k] += 1.5 * M_PI / last * std::cos(M_PI * (k - 0.5) / last);    // 1.5 LSB bow
+        }
+        for (uint32_t k = 512; k < ADC_CAL_CODES; k += 1024) {
+            w[k] += 0.9;
+            w[k - 1] -= 0.45;
+            w[k + 1] -= 0.45;
+        }
+        double sum = 0;
+        for (uint32_t k = 1; k <= last; k++)
+            sum += w[k];
+        edge[0] = -1e9;
+        edge[1] = 0.5;
+        for (uint32_t k = 1; k <= last; k++)
+            edge[k + 1] = edge[k] + w[k] * last / sum;
+        edge[ADC_CAL_CODES] = 1e9;
+    }
+
+    uint16_t code(double x) const
+    {
+        auto it = std::upper_bound(edge.begin() + 1, edge.end() - 1, x);
+        return uint16_t(it - edge.begin() - 1);
+    }
+
+    double centre(uint32_t k) const
+    {
+        if (k == 0)
+            return 0;
+        if (k == ADC_CAL_CODES - 1)
+            return k;
+        return (edge[k] + edge[k + 1]) / 2;
+    }
+};
+
+template <class F>
+double ns_per_sample(F &&f, size_t n, int reps)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++)
+        f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() /
+           (double(n) * reps);
+}
+
+volatile float sink_f;
+volatile uint16_t sink_u;
+
+int bench(double msamples)
+{
+    ModelAdc adc(7);
+    Rng rng{12345};
+
+    // Code-density test: slow triangle 20 LSB past both rails, 0.3 LSB noise
+    size_t n = size_t(msamples * 1e6);
+    adc_hist_t *h = new adc_hist_t;
+    adc_hist_reset(h);
+    std::vector<uint16_t> chunk(1 << 16);
+    const double lo = -20, hi = ADC_CAL_CODES - 1 + 20, period = 4e6;
+    for (size_t i = 0; i < n;) {
+        size_t m = std::min(chunk.size(), n - i);
+        for (size_t j = 0; j < m; j++, i++) {
+            double ph = std::fmod(double(i), period) / period;
+            double x = lo + (hi - lo) * (ph < 0.5 ? 2 * ph : 2 - 2 * ph);
+            chunk[j] = adc.code(x + 0.3 * rng.gauss());
+        }
+        adc_hist_add(h, chunk.data(), uint32_t(m));
+    }
+
+    adc_cal_quality_t q;
+    adc_cal_quality(h, &q);
+    print_quality("model, measured", q);
+    std::vector<uint16_t> lut(ADC_CAL_CODES);
+    check(adc_cal_build(h, lut.data()) == 0, "table built");
+    delete h;
+
+    double raw_err = 0, cal_err = 0;
+    for (uint32_t k = 1; k < ADC_CAL_CODES - 1; k++) {
+        raw_err = std::max(raw_err, std::fabs(k - adc.centre(k)));
+        cal_err = std::max(cal_err, std::fabs(lut[k] / double(ADC_CAL_ONE) - adc.centre(k)));
+    }
+    printf("largest code-centre error: raw %.3f LSB, through the table %.3f LSB\n", raw_err, cal_err);
+    check(raw_err > 1.0, "model has INL over 1 LSB", raw_err, 1);
+    check(cal_err < 0.15, "table within 0.15 LSB of the true bin centres", cal_err, 0.15);
+
+    // Integer pass == rounded float gather, AVX2 == scalar, file round trip
+    std::vector<float> lutf = float_table(lut.data());
+    std::vector<uint16_t> all(ADC_CAL_CODES), dev(ADC_CAL_CODES);
+    for (uint32_t k = 0; k < ADC_CAL_CODES; k++)
+        all[k] = uint16_t(k);
+    adc_cal_apply(lut.data(), all.data(), dev.data(), ADC_CAL_CODES);
+    std::vector<float> fs(ADC_CAL_CODES), fv(ADC_CAL_CODES);
+    gather_scalar(lutf.data(), all.data(), fs.data(), ADC_CAL_CODES);
+    gather_avx2(lutf.data(), all.data(), fv.data(), ADC_CAL_CODES);
+    uint32_t mism = 0, vmism = 0;
+    for (uint32_t k = 0; k < ADC_CAL_CODES; k++) {
+        mism += dev[k] != uint16_t(std::floor(fs[k] + 0.5f));
+        vmism += fs[k] != fv[k];
+    }
+    check(mism == 0, "firmware pass is the rounded float table", mism, 0);
+    check(vmism == 0, "AVX2 gather equals scalar", vmism, 0);
+
+    Table t;
+    t.lut = lut;
+    adc_cal_header(&t.h, t.lut.data(), nullptr);
+    check(adc_cal_check(&t.h, t.lut.data()) == 0, "header matches table");
+    t.lut[100]++;
+    check(adc_cal_check(&t.h, t.lut.data()) != 0, "CRC catches a changed entry");
+
+    // Sines at a few amplitudes: RMS and peak, raw vs corrected vs ideal quantiser
+    printf("\n%-10s %12s %12s %12s %12s\n", "amplitude", "rms raw", "rms cal", "peak raw", "peak cal");
+    double worst_raw = 0, worst_cal = 0;
+    for (double amp : {20.0, 60.0, 200.0, 600.0, 1500.0}) {
+        const size_t ns = 400000;
+        double s2r = 0, s2c = 0, s2i = 0, mr = 0, mc = 0, mi = 0;
+        double pr = 0, pc = 0;
+        std::vector<uint16_t> codes(ns);
+        std::vector<float> cal(ns);
+        const double centre = 1536.3;       // around a wide code
+        for (size_t i = 0; i < ns; i++) {
+            double x = centre + amp * std::sin(2 * M_PI * 0.0123457 * i) + 0.3 * rng.gauss();
+            codes[i] = adc.code(x);
+            s2i += x * x;
+            mi += x;
+        }
+        gather(lutf.data(), codes.data(), cal.data(), ns);
+        for (size_t i = 0; i < ns; i++) {
+            mr += codes[i];
+            mc += cal[i];
+            s2r += double(codes[i]) * codes[i];
+            s2c += double(cal[i]) * cal[i];
+        }
+        mr /= ns;
+        mc /= ns;
+        mi /= ns;
+        double ri = std::sqrt(s2i / ns - mi * mi);
+        double rr = std::sqrt(s2r / ns - mr * mr);
+        double rc = std::sqrt(s2c / ns - mc * mc);
+        for (size_t i = 0; i < ns; i++) {
+            pr = std::max(pr, std::fabs(codes[i] - mr));
+            pc = std::max(pc, std::fabs(cal[i] - mc));
+        }
+        double er = 100 * (rr - ri) / ri, ec = 100 * (rc - ri) / ri;
+        printf("%-10.0f %+11.3f%% %+11.3f%% %+11.3f%% %+11.3f%%\n", amp, er, ec,
+               100 * (pr - amp) / amp, 100 * (pc - amp) / amp);
+        worst_raw = std::max(worst_raw, std::fabs(er));
+        worst_cal = std::max(worst_cal, std::fabs(ec));
+    }
+    check(worst_cal < worst_raw / 2, "correction at least halves the worst RMS error", worst_cal,
+          worst_raw / 2);
+
+    // Throughput on a recording-sized buffer
+    const size_t nb = 1 << 20;
+    std::vector<uint16_t> in(nb), out16(nb);
+    std::vector<float> outf(nb);
+    for (size_t i = 0; i < nb; i++)
+        in[i] = uint16_t(rng.uniform() * ADC_CAL_CODES);
+    const int reps = 40;
+
+    double t_dev = ns_per_sample([&] { adc_cal_apply(lut.data(), in.data(), out16.data(), nb); sink_u = out16[7]; }, nb, reps);
+    double t_sca = ns_per_sample([&] { gather_scalar(lutf.data(), in.data(), outf.data(), nb); sink_f = outf[7]; }, nb, reps);
+    printf("\n%-34s %8s %10s\n", "pass", "ns/samp", "MS/s");
+    printf("%-34s %8.3f %10.0f\n", "firmware adc_cal_apply (Q4 -> u16)", t_dev, 1e3 / t_dev);
+    printf("%-34s %8.3f %10.0f\n", "host gather, scalar (-> f32)", t_sca, 1e3 / t_sca);
+    if (have_avx2()) {
+        double t_avx = ns_per_sample([&] { gather_avx2(lutf.data(), in.data(), outf.data(), nb); sink_f = outf[7]; }, nb, reps);
+        printf("%-34s %8.3f %10.0f\n", "host gather, AVX2 (-> f32)", t_avx, 1e3 / t_avx);
+    } else {
+        printf("%-34s %8s\n", "host gather, AVX2 (-> f32)", "n/a");
+    }
+    double block_us = t_dev * 1024 / 1000;
+    printf("firmware pass per 1024-sample block here: %.2f us\n", block_us);
+
+    return check_summary();
+}
+
+int usage()
+{
+    fprintf(stderr,
+            "usage: ae_adccal --build ramp.bin [-o adccal.bin]\n"
+            "       ae_adccal --info adccal.bin\n"
+            "       ae_adccal [--cal adccal.bin] file.bin ... [-o out.f32]\n"
+            "       ae_adccal --bench [MSAMPLES]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string build_from, info_of, cal, out;
+    std::vector<std::string> files;
+    bool bench_mode = false;
+    double msamples = 40;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--build" && more) build_from = argv[++i];
+        else if (a == "--info" && more) info_of = argv[++i];
+        else if (a == "--cal" && more) cal = argv[++i];
+        else if (a == "-o" && more) out = argv[++i];
+        else if (a == "--bench") {
+            bench_mode = true;
+            if (more && argv[i + 1][0] != '-')
+                msamples = atof(argv[++i]);
+        }
+        else if (!a.empty() && a[0] == '-') return usage();
+        else files.push_back(a);
+    }
+
+    if (bench_mode)
+        return bench(msamples);
+    if (!build_from.empty())
+        return build(build_from, out.empty() ? ADC_CAL_FILE : out);
+    if (!info_of.empty())
+        return info(info_of);
+    if (files.empty())
+        return usage();
+    return apply(files, cal, out);
+}
@@ -0,0 +1,575 @@
+// Archive of recordings on one wall-clock timeline (archive.cpp).
+//
+// `ingest` adds recordings, timed from their aXXXX.sum / aXXXX.rat
+// sidecars (archive_source.cpp). The board has no calendar clock, so
+// each recording is placed by --start (the local time of its first
+// sample, one file only) or else by its file's mtime, taken as the time
+// of its last sample. `read` writes the samples of a time range, `stats`
+// prints count/min/max/mean/RMS per interval. Times are local, as
+// "YYYY-MM-DD HH:MM[:SS[.ffffff]]" or "@UNIX_SECONDS".
+//
+// --bench writes a synthetic archive of GB gigabytes of hour-long
+// recordings with gaps and bursts, checks reads and aggregates against
+// the source files, the commit protocol and the CRCs, then times ingest
+// and queries.
+//
+// usage: ae_archive ingest [-j N] [--start TIME] [--rate HZ] [--chunk SAMPLES] ARCHIVE file.bin ...
+//        ae_archive info ARCHIVE
+//        ae_archive read [-j N] [-o out.bin] ARCHIVE FROM TO
+//        ae_archive stats [-j N] [--every SECONDS] ARCHIVE FROM TO
+//        ae_archive --bench [GB] [-j N]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "tool_util.h"
+
+namespace {
+
+int usage()
+{
+    fprintf(stderr,
+            "usage: ae_archive ingest [-j N] [--start TIME] [--rate HZ] [--chunk SAMPLES] ARCHIVE file.bin ...\n"
+            "       ae_archive info ARCHIVE\n"
+            "       ae_archive read [-j N] [-o out.bin] ARCHIVE FROM TO\n"
+            "       ae_archive stats [-j N] [--every SECONDS] ARCHIVE FROM TO\n"
+            "       ae_archive --bench [GB] [-j N]\n");
+    return 2;
+}
+
+// Local "YYYY-MM-DD[ T]HH:MM[:SS[.ffffff]]", or "@SECONDS" since the epoch
+bool parse_time(const char *s, int64_t &us)
+{
+    if (s[0] == '@') {
+        char *end;
+        double v = strtod(s + 1, &end);
+        us = int64_t(std::llround(v * 1e6));
+        return *end == 0 && end != s + 1;
+    }
+    struct tm tm {};
+    double sec = 0;
+    char sep;
+    int n = sscanf(s, "%d-%d-%d%c%d:%d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &sep,
+                   &tm.tm_hour, &tm.tm_min, &sec);
+    if (n != 3 && n < 6)
+        return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == time_t(-1))
+        return false;
+    us = int64_t(t) * 1000000 + int64_t(std::llround(sec * 1e6));
+    return true;
+}
+
+std::string format_time(int64_t us)
+{
+    time_t t = time_t(us >= 0 ? us / 1000000 : (us - 999999) / 1000000);
+    struct tm tm {};
+    localtime_r(&t, &tm);
+    char buf[48];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + n, sizeof(buf) - n, ".%03d", int((us - int64_t(t) * 1000000) / 1000));
+    return buf;
+}
+
+int cmd_ingest(const std::string &dir, const std::vector<std::string> &files, const char *start,
+               uint32_t rate, uint32_t chunk, unsigned threads)
+{
+    int64_t start_us = 0;
+    if (start && (files.size() != 1 || !parse_time(start, start_us))) {
+        fprintf(stderr, "--start takes a time and exactly one file\n");
+        return 2;
+    }
+
+    std::vector<TimedRecording> recs(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        TimedRecording &r = recs[i];
+        if (!load_recording(files[i], rate, r))
+            return 1;
+        // The board's clock starts at boot: place the recording by its
+        // first sample, or end it at the file's mtime
+        if (start)
+            r.anchor(start_us);
+        else
+            r.anchor(r.mtime_us - (r.end_us() - (r.segments.empty() ? 0 : r.segments[0].t_us)));
+        printf("%s: %llu samples, %zu segments%s%s, %s .. %s\n", files[i].c_str(),
+               (unsigned long long)r.samples, r.segments.size(), r.has_sum ? ", .sum" : "",
+               r.has_rat ? ", .rat" : "", format_time(r.segments.empty() ? 0 : r.segments[0].t_us).c_str(),
+               format_time(r.end_us()).c_str());
+    }
+
+    Archive a;
+    if (!a.open(dir, true, chunk))
+        return 1;
+    IngestStats st;
+    if (!a.ingest(recs, threads, st))
+        return 1;
+    printf("%s: %u recordings added, %u already there; %llu chunks, %.1f MB -> %.1f MB (%.2fx), "
+           "%.2f s on %u threads, %.0f MB/s\n",
+           dir.c_str(), st.sessions, st.skipped, (unsigned long long)st.chunks, st.raw_bytes / 1e6,
+           st.stored_bytes / 1e6, st.stored_bytes ? double(st.raw_bytes) / st.stored_bytes : 0.0,
+           st.seconds, st.threads, st.raw_bytes / 1e6 / st.seconds);
+    return 0;
+}
+
+int cmd_info(const std::string &dir)
+{
+    Archive a;
+    if (!a.open(dir))
+        return 1;
+    uint64_t raw = 0, stored = 0;
+    for (const ChunkRecord &c : a.chunks())
+        stored += c.bytes;
+    printf("%-20s %-23s %-23s %12s %7s %6s\n", "recording", "start", "end", "samples", "chunks",
+           "ratio");
+    for (const SessionRecord &s : a.sessions()) {
+        uint64_t bytes = 0;
+        for (uint64_t c = s.first_chunk; c < s.first_chunk + s.chunks; c++)
+            bytes += a.chunks()[c].bytes;
+        raw += s.raw_bytes;
+        printf("%-20s %-23s %-23s %12llu %7u %5.2fx\n", s.name, format_time(s.t0_us).c_str(),
+               format_time(s.t1_us).c_str(), (unsigned long long)s.samples, s.chunks,
+               bytes ? double(s.raw_bytes) / bytes : 0.0);
+    }
+    printf("%zu recordings, %zu chunks of up to %u samples, %.1f MB -> %.1f MB\n",
+           a.sessions().size(), a.chunks().size(), a.chunk_samples(), raw / 1e6, stored / 1e6);
+    return 0;
+}
+
+int cmd_read(const std::string &dir, int64_t from, int64_t to, const std::string &out,
+             unsigned threads)
+{
+    Archive a;
+    if (!a.open(dir))
+        return 1;
+    std::vector<uint16_t> v;
+    std::vector<ArchiveSpan> spans;
+    QueryStats qs;
+    if (!a.read(from, to, v, spans, threads, qs))
+        return 1;
+    for (const ArchiveSpan &s : spans)
+        printf("%s  %10llu samples at %6u S/s from %s (sample %llu of the output)\n",
+               format_time(s.t0_us).c_str(), (unsigned long long)s.count, s.rate,
+               a.sessions()[s.session].name, (unsigned long long)s.offset);
+    printf("%llu samples from %llu chunks in %.3f ms\n", (unsigned long long)qs.samples,
+           (unsigned long long)qs.chunks, qs.seconds * 1e3);
+    if (!out.empty()) {
+        FILE *f = fopen(out.c_str(), "wb");
+        if (!f || fwrite(v.data(), 2, v.size(), f) != v.size() || fclose(f) != 0) {
+            perror(out.c_str());
+            return 1;
+        }
+        printf("wrote %s\n", out.c_str());
+    }
+    return 0;
+}
+
+int cmd_stats(const std::string &dir, int64_t from, int64_t to, double every, unsigned threads)
+{
+    Archive a;
+    if (!a.open(dir))
+        return 1;
+    const int64_t every_us = every > 0 ? int64_t(every * 1e6) : to - from;
+    std::vector<ArchiveBucket> out;
+    QueryStats qs;
+    if (!a.aggregate(from, to, every_us, out, threads, qs))
+        return 1;
+    printf("%-23s %12s %6s %6s %9s %9s\n", "from", "samples", "min", "max", "mean", "rms");
+    for (const ArchiveBucket &b : out) {
+        if (!b.count) {
+            printf("%-23s %12d\n", format_time(b.t0_us).c_str(), 0);
+            continue;
+        }
+        printf("%-23s %12llu %6u %6u %9.2f %9.2f\n", format_time(b.t0_us).c_str(),
+               (unsigned long long)b.count, b.min, b.max, double(b.sum) / b.count,
+               std::sqrt(double(b.sumsq) / b.count));
+    }
+    printf("%llu samples, %llu chunks (%llu decoded) in %.3f ms\n", (unsigned long long)qs.samples,
+           (unsigned long long)qs.chunks, (unsigned long long)qs.decoded, qs.seconds * 1e3);
+    return 0;
+}
+
+// ---- Benchmark ----
+
+constexpr uint32_t BENCH_RATE = 4000;
+constexpr uint32_t BENCH_BURST_RATE = 100000;
+constexpr int64_t BENCH_EPOCH_US = 1767571200LL * 1000000;      // 2026-01-05 00:00 UTC
+
+struct BenchSource {
+    std::string path;
+    std::vector<TimedSegment> segments;
+};
+
+// One recording: noise around a drifting baseline with AE hits; an hour
+// at 4 kS/s with a 5-minute gap in the middle, every third one with 10 s
+// at the burst rate after the gap
+bool write_source(const std::string &path, uint32_t idx, int64_t t0_us, BenchSource &src)
+{
+    std::mt19937 rng(idx + 1);
+    std::normal_distribution<float> noise(0, 3.0f);
+    const uint64_t half = 1800ull * BENCH_RATE;
+    src.path = path;
+    src.segments.push_back({0, half, t0_us, BENCH_RATE});
+    int64_t t = t0_us + 2100LL * 1000000;
+    uint64_t first = half;
+    if (idx % 3 == 0) {
+        src.segments.push_back({first, 10ull * BENCH_BURST_RATE, t, BENCH_BURST_RATE});
+        first += 10ull * BENCH_BURST_RATE;
+        t += 10LL * 1000000;
+    }
+    src.segments.push_back({first, half, t, BENCH_RATE});
+
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    std::vector<uint16_t> buf(1 << 16);
+    float hit = 0, phase = 0;
+    uint64_t i = 0;
+    for (const TimedSegment &g : src.segments)
+        for (uint64_t j = 0; j < g.count; j++, i++) {
+            if (rng() % 20000 == 0)
+                hit = 600.0f * (1 + rng() % 4);
+            hit *= 0.995f;
+            phase += 0.9f;
+            float base = 2048 + 40 * std::sin(float(i) * 1e-6f);
+            float v = base + noise(rng) + hit * std::sin(phase);
+            buf[i % buf.size()] = uint16_t(std::clamp(v, 0.0f, 4095.0f));
+            if (i % buf.size() == buf.size() - 1)
+                fwrite(buf.data(), 2, buf.size(), f);
+        }
+    fwrite(buf.data(), 2, i % buf.size(), f);
+    return fclose(f) == 0;
+}
+
+// Expected aggregate straight from a source file: every sample whose time
+// (by the chunk records) falls in a bucket
+void brute_aggregate(const Archive &a, const std::vector<BenchSource> &src, int64_t from,
+                     int64_t to, int64_t every, std::vector<ArchiveBucket> &out)
+{
+    out.assign(size_t((to - from + every - 1) / every), ArchiveBucket{});
+    for (size_t b = 0; b < out.size(); b++)
+        out[b].t0_us = from + int64_t(b) * every;
+    std::vector<uint16_t> v;
+    for (const ChunkRecord &c : a.chunks()) {
+        if (c.t1_us() <= from || c.t0_us >= to)
+            continue;
+        v.resize(c.samples);
+        FILE *f = fopen(src[c.session].path.c_str(), "rb");
+        fseek(f, long(c.first * 2), SEEK_SET);
+        size_t got = fread(v.data(), 2, c.samples, f);
+        fclose(f);
+        for (uint32_t j = 0; j < got; j++) {
+            int64_t t = c.t0_us + int64_t(uint64_t(j) * 1000000 / c.rate);
+            if (t < from || t >= to)
+                continue;
+            ArchiveBucket &b = out[size_t((t - from) / every)];
+            b.count++;
+            b.min = std::min(b.min, v[j]);
+            b.max = std::max(b.max, v[j]);
+            b.sum += v[j];
+            b.sumsq += uint64_t(v[j]) * v[j];
+        }
+    }
+}
+
+bool same(const std::vector<ArchiveBucket> &a, const std::vector<ArchiveBucket> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].t0_us != b[i].t0_us || a[i].count != b[i].count || a[i].sum != b[i].sum ||
+            a[i].sumsq != b[i].sumsq || (a[i].count && (a[i].min != b[i].min || a[i].max != b[i].max)))
+            return false;
+    return true;
+}
+
+void rm_rf(const std::string &dir, const std::vector<std::string> &files)
+{
+    for (const std::string &f : files)
+        unlink((dir + "/" + f).c_str());
+    rmdir(dir.c_str());
+}
+
+int bench(double gb, unsigned threads)
+{
+    // Codec round trip on edge cases
+    {
+        std::vector<std::vector<uint16_t>> cases = {
+            {}, {7}, {0, 65535, 0, 65535}, std::vector<uint16_t>(1000, 2048)};
+        std::vector<uint16_t> ramp(ARCHIVE_FRAME * 3 + 5);
+        for (size_t i = 0; i < ramp.size(); i++)
+            ramp[i] = uint16_t(i * 977);
+        cases.push_back(ramp);
+        for (const auto &c : cases) {
+            std::vector<uint8_t> z = archive_encode(c.data(), uint32_t(c.size()));
+            std::vector<uint16_t> back(c.size());
+            bool ok = archive_decode(z.data(), z.size(), uint32_t(c.size()), back.data()) && back == c;
+            check(ok, "codec round trip", double(c.size()));
+            if (z.size() > 2)
+                check(!archive_decode(z.data(), z.size() - 1, uint32_t(c.size()), back.data()),
+                      "truncated chunk rejected");
+        }
+    }
+
+    char tmpl[] = "/tmp/ae_archive_benchXXXXXX";
+    if (!mkdtemp(tmpl)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string root = tmpl, dir = root + "/archive";
+
+    // Sources: hour-long recordings, 10 minutes apart
+    const uint64_t per = (3600ull * BENCH_RATE + 10ull * BENCH_BURST_RATE / 3) * 2;
+    const uint32_t n = std::max<uint32_t>(2, uint32_t(gb * 1e9 / per + 0.5));
+    std::vector<BenchSource> src(n);
+    std::vector<std::string> src_names;
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t raw = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "a%04u.bin", i);
+        src_names.push_back(name);
+        if (!write_source(root + "/" + name, i, BENCH_EPOCH_US + int64_t(i) * 4200 * 1000000, src[i]))
+            return 1;
+        for (const TimedSegment &g : src[i].segments)
+            raw += g.count * 2;
+    }
+    printf("%u recordings, %.2f GB written in %.1f s\n", n, raw / 1e9, seconds_since(t0));
+
+    auto timed = [&](uint32_t i) {
+        TimedRecording r;
+        load_recording(src[i].path, BENCH_RATE, r);
+        r.segments = src[i].segments;
+        return r;
+    };
+
+    // Ingest the first half, then everything: the first half is skipped
+    Archive a;
+    check(a.open(dir, true), "create archive");
+    std::vector<TimedRecording> first, all;
+    for (uint32_t i = 0; i < n; i++) {
+        all.push_back(timed(i));
+        if (i < n / 2)
+            first.push_back(all.back());
+    }
+    IngestStats s1, s2;
+    check(a.ingest(first, threads, s1), "ingest");
+    check(a.ingest(all, threads, s2), "append");
+    check(s2.skipped == n / 2, "recordings already there skipped", s2.skipped, n / 2);
+    const double secs = s1.seconds + s2.seconds;
+    const uint64_t stored = s1.stored_bytes + s2.stored_bytes;
+    printf("ingest: %llu chunks, %.2f GB -> %.2f GB (%.2fx), %.2f s on %u threads, %.0f MB/s\n",
+           (unsigned long long)(s1.chunks + s2.chunks), raw / 1e9, stored / 1e9,
+           double(raw) / stored, secs, s2.threads, raw / 1e6 / secs);
+
+    // A fresh handle sees what was committed
+    Archive q;
+    check(q.open(dir), "reopen");
+    check(q.sessions().size() == n, "sessions", double(q.sessions().size()), n);
+
+    std::mt19937_64 rng(42);
+    const int64_t span = int64_t(n) * 4200 * 1000000;
+    auto random_from = [&](int64_t len) {
+        return BENCH_EPOCH_US + int64_t(rng() % uint64_t(span - len));
+    };
+
+    // Reads against the source files
+    const int reads = 50;
+    const int64_t five_min = 300LL * 1000000;
+    double read_s = 0;
+    uint64_t read_samples = 0, read_chunks = 0;
+    for (int k = 0; k < reads; k++) {
+        int64_t from = random_from(five_min), to = from + five_min;
+        std::vector<uint16_t> v;
+        std::vector<ArchiveSpan> spans;
+        QueryStats qs;
+        check(q.read(from, to, v, spans, threads, qs), "read");
+        read_s += qs.seconds;
+        read_samples += qs.samples;
+        read_chunks += qs.chunks;
+
+        // Brute force: every chunk that overlaps, in time order, from the source
+        std::vector<uint16_t> want;
+        std::vector<const ChunkRecord *> hit;
+        for (const ChunkRecord &c : q.chunks())
+            if (archive_sample_at(c, from) < archive_sample_at(c, to))
+                hit.push_back(&c);
+        std::sort(hit.begin(), hit.end(),
+                  [](const ChunkRecord *x, const ChunkRecord *y) { return x->t0_us < y->t0_us; });
+        for (const ChunkRecord *c : hit) {
+            uint64_t j0 = archive_sample_at(*c, from), j1 = archive_sample_at(*c, to);
+            std::vector<uint16_t> part(j1 - j0);
+            FILE *f = fopen(src[c->session].path.c_str(), "rb");
+            fseek(f, long((c->first + j0) * 2), SEEK_SET);
+            size_t got = fread(part.data(), 2, part.size(), f);
+            fclose(f);
+            part.resize(got);
+            want.insert(want.end(), part.begin(), part.end());
+        }
+        if (v != want) {
+            check(false, "read matches the source files", double(v.size()), double(want.size()));
+            break;
+        }
+    }
+
+    // Aggregates against the source files, and the same on one thread
+    const int aggs = 10;
+    double agg_s = 0;
+    uint64_t agg_chunks = 0, agg_decoded = 0;
+    for (int k = 0; k < aggs; k++) {
+        int64_t len = 3600LL * 1000000, from = random_from(len);
+        std::vector<ArchiveBucket> got, one, want;
+        QueryStats qs, qs1;
+        check(q.aggregate(from, from + len, 60LL * 1000000, got, threads, qs), "aggregate");
+        agg_s += qs.seconds;
+        agg_chunks += qs.chunks;
+        agg_decoded += qs.decoded;
+        q.aggregate(from, from + len, 60LL * 1000000, one, 1, qs1);
+        brute_aggregate(q, src, from, from + len, 60LL * 1000000, want);
+        check(same(got, want), "aggregate matches the source files");
+        check(same(got, one), "aggregate independent of the thread count");
+    }
+
+    // Whole archive by day: nearly all from chunk records; vs decoding everything
+    const int64_t day = 86400LL * 1000000;
+    std::vector<ArchiveBucket> days, days_full;
+    QueryStats dq;
+    check(q.aggregate(BENCH_EPOCH_US, BENCH_EPOCH_US + span, day, days, threads, dq), "daily");
+    t0 = std::chrono::steady_clock::now();
+    std::vector<uint16_t> v;
+    uint64_t scanned = 0;
+    for (uint32_t c = 0; c < q.chunks().size(); c++) {
+        q.decode(c, v);
+        scanned += v.size();
+    }
+    const double scan_s = seconds_since(t0);
+    uint64_t day_total = 0;
+    for (const ArchiveBucket &b : days)
+        day_total += b.count;
+    check(day_total == scanned, "daily counts cover every sample", double(day_total), double(scanned));
+    check(q.chunks_in(BENCH_EPOCH_US - day, BENCH_EPOCH_US).empty(), "nothing before the first recording");
+
+    printf("read 5 min:         %6.2f ms, %4.1f chunks, %.0f M samples/s (%d ranges)\n",
+           read_s * 1e3 / reads, double(read_chunks) / reads, read_samples / read_s / 1e6, reads);
+    printf("stats 1 h by 1 min: %6.2f ms, %4.1f chunks, %4.1f decoded (%d ranges)\n",
+           agg_s * 1e3 / aggs, double(agg_chunks) / aggs, double(agg_decoded) / aggs, aggs);
+    printf("stats all by day:   %6.2f ms, %llu chunks, %llu decoded (%zu days)\n", dq.seconds * 1e3,
+           (unsigned long long)dq.chunks, (unsigned long long)dq.decoded, days.size());
+    printf("decode everything:  %6.0f ms, %.0f M samples/s on 1 thread\n", scan_s * 1e3,
+           scanned / scan_s / 1e6);
+
+    // An ingest that died before its commit: chunk records without a
+    // session record are ignored, and the next ingest appends after them
+    {
+        int fd = ::open((dir + "/chunks.idx").c_str(), O_WRONLY | O_APPEND);
+        ChunkRecord junk = q.chunks()[0];
+        junk.t0_us = BENCH_EPOCH_US - day;
+        junk.session = n;
+        check(write(fd, &junk, sizeof(junk)) == ssize_t(sizeof(junk)), "write orphan record");
+        ::close(fd);
+        Archive c;
+        check(c.open(dir), "reopen after a torn ingest");
+        check(c.chunks_in(BENCH_EPOCH_US - day, BENCH_EPOCH_US).empty(), "orphan chunk ignored");
+
+        std::string extra = root + "/extra.bin";
+        BenchSource e;
+        write_source(extra, n, BENCH_EPOCH_US + span, e);
+        src.push_back(e);
+        src_names.push_back("extra.bin");
+        TimedRecording r;
+        load_recording(extra, BENCH_RATE, r);
+        r.segments = e.segments;
+        IngestStats st;
+        check(c.ingest({r}, threads, st), "ingest after a torn one");
+        std::vector<ArchiveBucket> got, want;
+        QueryStats qs;
+        c.aggregate(BENCH_EPOCH_US + span, BENCH_EPOCH_US + span + 3600LL * 1000000,
+                    600LL * 1000000, got, threads, qs);
+        brute_aggregate(c, src, BENCH_EPOCH_US + span, BENCH_EPOCH_US + span + 3600LL * 1000000,
+                        600LL * 1000000, want);
+        check(same(got, want), "recording added after a torn ingest");
+    }
+
+    // A flipped bit in chunks.dat is caught by the chunk's CRC
+    {
+        const ChunkRecord &c = q.chunks()[q.chunks().size() / 2];
+        int fd = ::open((dir + "/chunks.dat").c_str(), O_RDWR);
+        uint8_t b = 0;
+        pread(fd, &b, 1, off_t(c.offset + c.bytes / 2));
+        b ^= 0x10;
+        pwrite(fd, &b, 1, off_t(c.offset + c.bytes / 2));
+        ::close(fd);
+        fprintf(stderr, "(a corrupt chunk is expected next)\n");
+        check(!q.decode(uint32_t(q.chunks().size() / 2), v), "corrupt chunk rejected");
+    }
+
+    for (const std::string &f : src_names)
+        unlink((root + "/" + f).c_str());
+    rm_rf(dir, {"chunks.dat", "chunks.idx", "sessions.idx"});
+    rmdir(root.c_str());
+
+    return check_summary();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return usage();
+
+    std::string cmd = argv[1];
+    unsigned threads = 0;
+    uint32_t rate = 4000, chunk = ARCHIVE_CHUNK_SAMPLES;
+    const char *start = nullptr;
+    double every = 0;
+    std::string out;
+    std::vector<std::string> args;
+
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "-j" && more) threads = unsigned(atoi(argv[++i]));
+        else if (a == "--start" && more) start = argv[++i];
+        else if (a == "--rate" && more) rate = uint32_t(atoi(argv[++i]));
+        else if (a == "--chunk" && more) chunk = uint32_t(atoi(argv[++i]));
+        else if (a == "--every" && more) every = atof(argv[++i]);
+        else if (a == "-o" && more) out = argv[++i];
+        else if (a[0] == '-' && a.size() > 1 && !isdigit(uint8_t(a[1]))) return usage();
+        else args.push_back(a);
+    }
+
+    if (cmd == "--bench")
+        return bench(args.empty() ? 1.0 : atof(args[0].c_str()), threads);
+    if (cmd == "ingest" && args.size() >= 2 && rate && chunk)
+        return cmd_ingest(args[0], std::vector<std::string>(args.begin() + 1, args.end()), start,
+                          rate, chunk, threads);
+    if (cmd == "info" && args.size() == 1)
+        return cmd_info(args[0]);
+
+    int64_t from, to;
+    if (args.size() != 3 || !parse_time(args[1].c_str(), from) || !parse_time(args[2].c_str(), to))
+        return usage();
+    if (cmd == "read")
+        return cmd_read(args[0], from, to, out, threads);
+    if (cmd == "stats")
+        return cmd_stats(args[0], from, to, every, threads);
+    return usage();
+}
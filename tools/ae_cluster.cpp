@@ -0,0 +1,459 @@
+// Cluster AE hits and find similar ones (hit_cluster.cpp).
+//
+// Hits come out of raw recordings through the firmware's detector
+// (hit_extract.cpp), each with a HIT_WINDOW-sample waveform. Their feature
+// vectors are z-scored, then grouped with k-means or DBSCAN; the table
+// shows what each cluster looks like, -o writes every hit with its label,
+// and --knn lists the hits whose waveforms are most alike to one hit.
+//
+// --bench builds synthetic hit sets from a few source mechanisms (damped
+// tones and broadband bursts with randomised amplitude, frequency, decay
+// and rise), checks that both algorithms recover them and that results
+// don't depend on the thread count, then times the distance kernel and
+// every stage at 1, 2, 4, ... threads.
+//
+// usage: ae_cluster [--kmeans K | --dbscan EPS|auto] [--min-pts N]
+//                   [--knn HIT] [--k N] [-j THREADS] [-o hits.csv] file.bin ...
+//        ae_cluster --bench [HITS] [-j THREADS]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fft.h"
+#include "hit_cluster.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t KMEANS_RESTARTS = 8;
+
+int usage()
+{
+    fprintf(stderr, "usage: ae_cluster [--kmeans K | --dbscan EPS|auto] [--min-pts N]\n"
+                    "                  [--knn HIT] [--k N] [-j THREADS] [-o hits.csv] file.bin ...\n"
+                    "       ae_cluster --bench [HITS] [-j THREADS]\n");
+    return 2;
+}
+
+// ---- Hits from recordings ----
+
+struct Options {
+    uint32_t k = 4;
+    bool use_dbscan = false;
+    float eps = 0;                  // 0: dbscan_eps()
+    uint32_t min_pts = 8;
+    long knn_hit = -1;
+    uint32_t knn_k = 10;
+    unsigned threads = 0;
+    std::string out;
+};
+
+void print_clusters(const HitSet &set, const FeatureRows &raw, const Clustering &c)
+{
+    struct Acc {
+        uint64_t n = 0;
+        double peak = 0, dur = 0, counts = 0, rise = 0, centroid = 0;
+    };
+    std::map<int32_t, Acc> acc;
+    for (size_t i = 0; i < set.hits.size(); i++) {
+        const HitRecord &h = set.hits[i];
+        Acc &a = acc[c.label[i]];
+        a.n++;
+        a.peak += h.peak;
+        a.dur += h.duration;
+        a.counts += h.counts;
+        a.rise += h.rise;
+        a.centroid += raw[i].v[7];
+    }
+    const double ms = 1000.0 / set.sample_rate;
+    printf("cluster    hits  peak   dur_ms  counts  rise_ms  centroid_hz\n");
+    for (const auto &[label, a] : acc) {
+        char name[16];
+        if (label == CLUSTER_NOISE)
+            snprintf(name, sizeof(name), "noise");
+        else
+            snprintf(name, sizeof(name), "%d", label);
+        printf("%-7s %7llu %6.0f %8.2f %7.1f %8.2f %12.0f\n", name, (unsigned long long)a.n,
+               a.peak / a.n, a.dur / a.n * ms, a.counts / a.n, a.rise / a.n * ms,
+               a.centroid / a.n * set.sample_rate / 2);
+    }
+}
+
+bool write_csv(const std::string &path, const HitSet &set, const Clustering &c)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    fprintf(f, "file,start,t_s,duration,peak,counts,rise,cluster\n");
+    for (size_t i = 0; i < set.hits.size(); i++) {
+        const HitRecord &h = set.hits[i];
+        fprintf(f, "%s,%llu,%.4f,%u,%u,%u,%u,%d\n", set.files[h.file].c_str(),
+                (unsigned long long)h.start, double(h.start) / set.sample_rate, h.duration,
+                h.peak, h.counts, h.rise, c.label[i]);
+    }
+    fclose(f);
+    return true;
+}
+
+int run(const std::vector<std::string> &files, const Options &o)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    HitSet set;
+    for (const std::string &f : files)
+        if (!extract_hits(f, set))
+            return 1;
+    double t_extract = seconds_since(t0);
+    if (set.hits.empty()) {
+        printf("no hits over %u counts\n", hit_threshold());
+        return 0;
+    }
+
+    t0 = std::chrono::steady_clock::now();
+    FeatureRows raw, x;
+    build_features(set, raw, o.threads);
+    x = raw;
+    normalize(x);
+    double t_feat = seconds_since(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    Clustering c;
+    float eps = o.eps;
+    if (o.use_dbscan) {
+        if (eps <= 0)
+            eps = dbscan_eps(x, o.min_pts, o.threads);
+        c = dbscan(x, eps, o.min_pts, o.threads);
+    } else {
+        c = kmeans(x, o.k, 100, KMEANS_RESTARTS, 1, o.threads);
+    }
+    double t_cluster = seconds_since(t0);
+
+    printf("%zu hits from %zu file(s), threshold %u\n", set.hits.size(), files.size(), hit_threshold());
+    if (o.use_dbscan)
+        printf("DBSCAN eps %.3f min_pts %u: %u clusters\n", eps, o.min_pts, c.clusters);
+    else
+        printf("k-means k %u: %u iterations, inertia %.1f\n", c.clusters, c.iterations, c.inertia);
+    print_clusters(set, raw, c);
+    printf("extract %.3f s, features %.3f s, clustering %.3f s\n", t_extract, t_feat, t_cluster);
+
+    if (o.knn_hit >= 0) {
+        if (size_t(o.knn_hit) >= set.hits.size()) {
+            fprintf(stderr, "hit %ld out of range (0..%zu)\n", o.knn_hit, set.hits.size() - 1);
+            return 1;
+        }
+        uint32_t q = uint32_t(o.knn_hit);
+        std::vector<Neighbour> nb;
+        knn(x, &q, 1, o.knn_k, nb, o.threads);
+        const HitRecord &h = set.hits[q];
+        printf("\nnearest to hit %u (%s @ %.4f s, cluster %d):\n", q, set.files[h.file].c_str(),
+               double(h.start) / set.sample_rate, c.label[q]);
+        printf("   hit  distance  file                 t_s  peak  dur  cluster\n");
+        for (const Neighbour &n : nb) {
+            if (n.index == UINT32_MAX)
+                break;
+            const HitRecord &m = set.hits[n.index];
+            printf("%6u %9.3f  %-16s %8.4f %5u %4u %8d\n", n.index, std::sqrt(n.d2),
+                   set.files[m.file].c_str(), double(m.start) / set.sample_rate, m.peak,
+                   m.duration, c.label[n.index]);
+        }
+    }
+
+    if (!o.out.empty() && !write_csv(o.out, set, c))
+        return 1;
+    return 0;
+}
+
+// ---- Synthetic hits ----
+
+struct Mechanism {
+    double freq;            // Hz, 0 = broadband
+    double tau;             // decay, samples
+    double rise;            // samples
+};
+
+const Mechanism MECHANISMS[] = {
+    {250, 60, 12}, {700, 20, 2}, {1400, 10, 1},
+    {450, 120, 40}, {1000, 35, 8}, {0, 30, 3},
+};
+constexpr uint32_t N_MECH = sizeof(MECHANISMS) / sizeof(MECHANISMS[0]);
+
+struct Rng {
+    uint64_t s;
+    double uniform() { s = s * 6364136223846793005ull + 1442695040888963407ull; return double(s >> 11) / 9007199254740992.0; }
+    double normal() { return std::sqrt(-2 * std::log(uniform() + 1e-300)) * std::cos(2 * M_PI * uniform()); }
+};
+
+// n hits drawn evenly from MECHANISMS; features measured from the window
+// the same way the detector and hit_extract.cpp would
+void synthesize(size_t n, uint64_t seed, HitSet &set, std::vector<int32_t> &truth)
+{
+    constexpr uint32_t LEN = 2 * HIT_WINDOW;
+    constexpr uint32_t ONSET = 48;
+    const int32_t thr = hit_threshold();
+    Rng r{seed};
+    set = HitSet{};
+    set.files.push_back("synthetic");
+    set.waves.resize(n * HIT_WINDOW);
+    truth.resize(n);
+    std::vector<double> s(LEN);
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t m = uint32_t(i % N_MECH);
+        const Mechanism &me = MECHANISMS[m];
+        double amp = 400 * std::pow(4.5, r.uniform());
+        double f = me.freq * (1 + 0.08 * (2 * r.uniform() - 1));
+        double tau = me.tau * (1 + 0.2 * (2 * r.uniform() - 1));
+        double rise = me.rise * (1 + 0.3 * (2 * r.uniform() - 1));
+        double ph = 2 * M_PI * r.uniform();
+        for (uint32_t t = 0; t < LEN; t++) {
+            double env = 0, u = double(t) - ONSET;
+            if (u >= 0)
+                env = (u < rise ? u / std::max(rise, 1.0) : std::exp(-(u - rise) / tau));
+            double carrier = me.freq > 0 ? std::sin(2 * M_PI * f * t / set.sample_rate + ph) : r.normal() * 0.6;
+            s[t] = amp * env * carrier + 6 * r.normal();
+        }
+
+        uint32_t first = ONSET, last = ONSET;
+        uint16_t counts = 0, peak = 0, rise_at = 0;
+        bool above = false, seen = false;
+        for (uint32_t t = 0; t < LEN; t++) {
+            int32_t a = int32_t(std::lround(std::fabs(s[t])));
+            if (a >= thr) {
+                if (!seen)
+                    first = t;
+                seen = true;
+                counts += !above;
+                last = t;
+                if (a > peak) {
+                    peak = uint16_t(std::min(a, 4095));
+                    rise_at = uint16_t(t - first);
+                }
+            }
+            above = a >= thr;
+        }
+        int16_t *w = &set.waves[i * HIT_WINDOW];
+        for (uint32_t k = 0; k < HIT_WINDOW; k++) {
+            int64_t t = int64_t(first) - HIT_PRETRIGGER + k;
+            w[k] = t >= 0 && t < LEN ? int16_t(std::lround(std::clamp(s[t], -2048.0, 2047.0))) : 0;
+        }
+        set.hits.push_back(HitRecord{0, uint64_t(i) * LEN + first, last - first + 1, peak,
+                                     std::max<uint16_t>(counts, 1), rise_at});
+        truth[i] = int32_t(m);
+    }
+}
+
+// ---- Checks ----
+
+// Adjusted Rand index; noise counts as one more label
+double adjusted_rand(const std::vector<int32_t> &a, const std::vector<int32_t> &b)
+{
+    std::map<std::pair<int32_t, int32_t>, double> nij;
+    std::map<int32_t, double> na, nb;
+    for (size_t i = 0; i < a.size(); i++) {
+        nij[{a[i], b[i]}]++;
+        na[a[i]]++;
+        nb[b[i]]++;
+    }
+    auto c2 = [](double v) { return v * (v - 1) / 2; };
+    double sij = 0, sa = 0, sb = 0;
+    for (const auto &e : nij) sij += c2(e.second);
+    for (const auto &e : na) sa += c2(e.second);
+    for (const auto &e : nb) sb += c2(e.second);
+    double expect = sa * sb / c2(double(a.size()));
+    double top = 0.5 * (sa + sb);
+    return top == expect ? 1.0 : (sij - expect) / (top - expect);
+}
+
+void check_kernels()
+{
+    // FFT against a direct DFT of a random frame
+    Rng r{7};
+    Fft fft(HIT_WINDOW);
+    std::vector<float> in(HIT_WINDOW), p(HIT_WINDOW / 2 + 1);
+    for (float &v : in)
+        v = float(r.normal());
+    fft.power(in.data(), p.data());
+    double worst = 0;
+    for (uint32_t k = 0; k <= HIT_WINDOW / 2; k++) {
+        double re = 0, im = 0;
+        for (uint32_t t = 0; t < HIT_WINDOW; t++) {
+            re += in[t] * std::cos(2 * M_PI * k * t / HIT_WINDOW);
+            im -= in[t] * std::sin(2 * M_PI * k * t / HIT_WINDOW);
+        }
+        worst = std::max(worst, std::fabs(p[k] - (re * re + im * im)) / (re * re + im * im + 1));
+    }
+    check(worst < 1e-3, "FFT power vs DFT", worst, 1e-3);
+
+    Feature a, b;
+    for (int i = 0; i < 1000; i++) {
+        for (uint32_t k = 0; k < FEATURE_DIM; k++) {
+            a.v[k] = float(r.normal());
+            b.v[k] = float(r.normal());
+        }
+        float s = dist2(a, b), ref = dist2_scalar(a, b);
+        if (std::fabs(s - ref) > 1e-4f * ref) {
+            check(false, "dist2 vs scalar", s, ref);
+            break;
+        }
+    }
+}
+
+void check_clustering(const FeatureRows &x, const std::vector<int32_t> &truth, unsigned threads)
+{
+    Clustering km = kmeans(x, N_MECH, 100, KMEANS_RESTARTS, 1, threads);
+    double ari = adjusted_rand(km.label, truth);
+    printf("k-means: k %u, %u iterations, ARI %.3f\n", N_MECH, km.iterations, ari);
+    check(ari > 0.9, "k-means recovers the mechanisms (ARI)", ari, 0.9);
+
+    float eps = dbscan_eps(x, 8, threads);
+    Clustering db = dbscan(x, eps, 8, threads);
+    size_t noise = size_t(std::count(db.label.begin(), db.label.end(), CLUSTER_NOISE));
+    ari = adjusted_rand(db.label, truth);
+    printf("DBSCAN: eps %.3f, %u clusters, %.1f%% noise, ARI %.3f\n", eps, db.clusters,
+           100.0 * noise / x.size(), ari);
+    check(db.clusters == N_MECH, "DBSCAN cluster count", db.clusters, N_MECH);
+    check(ari > 0.9, "DBSCAN recovers the mechanisms (ARI)", ari, 0.9);
+    check(noise < x.size() / 20, "DBSCAN noise under 5%", double(noise), x.size() / 20.0);
+
+    // Same answer on one thread
+    check(kmeans(x, N_MECH, 100, KMEANS_RESTARTS, 1, 1).label == km.label, "k-means independent of threads");
+    check(dbscan(x, eps, 8, 1).label == db.label, "DBSCAN independent of threads");
+
+    // kNN against a full sort
+    const uint32_t k = 10;
+    std::vector<uint32_t> q;
+    for (size_t i = 0; i < 50; i++)
+        q.push_back(uint32_t(i * x.size() / 50));
+    std::vector<Neighbour> nb;
+    knn(x, q.data(), q.size(), k, nb, threads);
+    size_t same_class = 0;
+    for (size_t i = 0; i < q.size(); i++) {
+        std::vector<std::pair<float, uint32_t>> all;
+        for (size_t j = 0; j < x.size(); j++)
+            if (j != q[i])
+                all.push_back({dist2(x[q[i]], x[j]), uint32_t(j)});
+        std::partial_sort(all.begin(), all.begin() + k, all.end());
+        for (uint32_t j = 0; j < k; j++) {
+            if (nb[i * k + j].index != all[j].second) {
+                check(false, "kNN matches a full sort", nb[i * k + j].index, all[j].second);
+                i = q.size();
+                break;
+            }
+            same_class += truth[all[j].second] == truth[q[i]];
+        }
+    }
+    double prec = double(same_class) / (q.size() * k);
+    printf("kNN: %.1f%% of %u nearest from the same mechanism\n", 100 * prec, k);
+    check(prec > 0.9, "kNN precision", prec, 0.9);
+}
+
+int bench(size_t hits, unsigned max_threads)
+{
+    HitSet set;
+    std::vector<int32_t> truth;
+    auto t0 = std::chrono::steady_clock::now();
+    synthesize(hits, 1, set, truth);
+    printf("%zu synthetic hits from %u mechanisms (%.2f s to generate)\n", hits, N_MECH, seconds_since(t0));
+
+    check_kernels();
+    FeatureRows x;
+    build_features(set, x, 0);
+    normalize(x);
+    check_clustering(x, truth, 0);
+
+    // Distance kernel, one row against a tile that stays in L1
+    const size_t tile = 256, reps = 20000;
+    volatile float sink = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; r++)
+        for (size_t j = 0; j < tile; j++)
+            sink += dist2(x[r % x.size()], x[j]);
+    double simd = seconds_since(t0);
+    t0 = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; r++)
+        for (size_t j = 0; j < tile; j++)
+            sink += dist2_scalar(x[r % x.size()], x[j]);
+    double scalar = seconds_since(t0);
+    printf("\ndistance kernel (%u floats): vector %.2f ns, scalar %.2f ns (%.1fx)\n", FEATURE_DIM,
+           simd * 1e9 / (reps * tile), scalar * 1e9 / (reps * tile), scalar / simd);
+
+    if (max_threads == 0)
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+    const uint32_t kk = 10;
+    std::vector<uint32_t> all(x.size());
+    for (size_t i = 0; i < all.size(); i++)
+        all[i] = uint32_t(i);
+    float eps = dbscan_eps(x, 8, 0);
+
+    printf("\nthreads  features  k-means   DBSCAN   kNN-%u(all)  total   speedup\n", kk);
+    double base = 0;
+    for (unsigned t = 1;; t = std::min(t * 2, max_threads)) {
+        FeatureRows y;
+        std::vector<Neighbour> nb;
+        auto s0 = std::chrono::steady_clock::now();
+        build_features(set, y, t);
+        normalize(y);
+        double tf = seconds_since(s0);
+        s0 = std::chrono::steady_clock::now();
+        kmeans(y, N_MECH, 100, KMEANS_RESTARTS, 1, t);
+        double tk = seconds_since(s0);
+        s0 = std::chrono::steady_clock::now();
+        dbscan(y, eps, 8, t);
+        double td = seconds_since(s0);
+        s0 = std::chrono::steady_clock::now();
+        knn(y, all.data(), all.size(), kk, nb, t);
+        double tn = seconds_since(s0);
+        double total = tf + tk + td + tn;
+        if (t == 1)
+            base = total;
+        printf("%7u %8.3fs %8.3fs %8.3fs %10.3fs %7.3fs %7.2fx\n", t, tf, tk, td, tn, total, base / total);
+        if (t == max_threads)
+            break;
+    }
+    printf("(%.1f M distances per DBSCAN pass, %u hardware threads)\n",
+           double(x.size()) * x.size() / 1e6, std::thread::hardware_concurrency());
+
+    printf("\n");
+    return check_summary();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o;
+    std::vector<std::string> files;
+    long bench_hits = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--kmeans" && more) o.k = uint32_t(atoi(argv[++i]));
+        else if (a == "--dbscan" && more) {
+            o.use_dbscan = true;
+            std::string v = argv[++i];
+            o.eps = v == "auto" ? 0 : float(atof(v.c_str()));
+        }
+        else if (a == "--min-pts" && more) o.min_pts = uint32_t(atoi(argv[++i]));
+        else if (a == "--knn" && more) o.knn_hit = atol(argv[++i]);
+        else if (a == "--k" && more) o.knn_k = uint32_t(atoi(argv[++i]));
+        else if (a == "-j" && more) o.threads = unsigned(atoi(argv[++i]));
+        else if (a == "-o" && more) o.out = argv[++i];
+        else if (a == "--bench") bench_hits = more && argv[i + 1][0] != '-' ? atol(argv[++i]) : 12000;
+        else if (a[0] == '-') return usage();
+        else files.push_back(a);
+    }
+    if (bench_hits >= 0)
+        return bench(size_t(std::max(bench_hits, long(N_MECH * 10))), o.threads);
+    if (files.empty() || o.k == 0 || o.min_pts == 0 || o.knn_k == 0)
+        return usage();
+    return run(files, o);
+}
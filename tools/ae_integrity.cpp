@@ -0,0 +1,434 @@
+// Sampling-integrity check of a capture of the PWM reference signal.
+//
+// test/adc_dma_main.c and test/adc_to_sdcard_main.c drive a 1 kHz 25 %
+// PWM on PWM_PIN into the ADC. This fits the captured period and duty
+// cycle and reports:
+//   - effective sample rate error, taking the PWM (same crystal) as the
+//     reference
+//   - edge jitter: rising-edge residuals against the fitted sample clock
+//   - sample slips: missing or duplicated samples show up as a persistent
+//     one-sample step in the edge phase; each is located to within a PWM
+//     period and checked against the DMA buffer boundaries (every --block
+//     samples)
+//   - isolated edge glitches (one edge off, no persistent step)
+// and exits non-zero when a limit is exceeded, so it can gate changes.
+//
+// Pass 1 streams the file through mmap in 64 Ki-sample chunks: threshold
+// compare and transition detection are branch-free loops the compiler
+// vectorizes; only the rising-edge intervals are kept (2 bytes per PWM
+// period). Pass 2 tracks the edge phase over those intervals.
+//
+// usage: ae_integrity [--rate HZ] [--pwm-hz HZ] [--duty PCT] [--block N]
+//                     [--max-ppm N] [--max-duty-err PCT] [--max-glitch-ppm N]
+//                     [-v] file.bin ...
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct Options {
+    double rate = 4000;
+    double pwm_hz = 1000;
+    double duty_pct = 25;
+    uint32_t block = 1024;
+    double max_ppm = 500;
+    double max_duty_err = 2;      // percentage points
+    double max_glitch_ppm = 1000; // glitches per million edges
+    bool verbose = false;
+};
+
+constexpr size_t CHUNK = 64 * 1024;
+constexpr size_t SLIP_WINDOW = 64;    // edges averaged either side of a step
+
+// Against the fitted line a whole-sample edge position is off by at most
+// half a sample; an edge beyond this is a glitch.
+constexpr double BAND = 0.55;
+
+struct Slip {
+    size_t edge;        // first rising edge after the slip
+    uint64_t sample;    // where it happened, to within a PWM period
+    int step;           // samples: < 0 missing, > 0 duplicated
+};
+
+struct Capture {
+    uint64_t samples = 0;
+    uint64_t high = 0;
+    uint16_t thr = 0;
+    uint64_t first_edge = 0;
+    std::vector<uint16_t> interval;     // samples between rising edges
+};
+
+// Threshold halfway between the 2nd and 98th percentile of the first chunk
+uint16_t pick_threshold(const uint16_t *s, size_t n)
+{
+    std::vector<uint32_t> hist(4096);
+    n = std::min(n, size_t(1) << 20);
+    for (size_t i = 0; i < n; i++)
+        hist[s[i] & 4095]++;
+
+    uint64_t acc = 0, lo = 0, hi = 4095;
+    bool have_lo = false;
+    for (uint32_t v = 0; v < 4096; v++) {
+        acc += hist[v];
+        if (!have_lo && acc * 50 >= n) {
+            lo = v;
+            have_lo = true;
+        }
+        if (acc * 50 >= n * 49) {
+            hi = v;
+            break;
+        }
+    }
+    return uint16_t((lo + hi + 1) / 2);
+}
+
+// Pass 1: high-sample count and rising edges, chunk by chunk
+void scan(const uint16_t *s, size_t n, Capture &c)
+{
+    c.samples = n;
+    c.thr = pick_threshold(s, n);
+
+    std::vector<uint8_t> h(CHUNK + 1), rise(CHUNK);
+    uint8_t prev = 1;           // no edge at sample 0
+    uint64_t last_edge = UINT64_MAX;
+
+    for (size_t off = 0; off < n; off += CHUNK) {
+        size_t m = std::min(CHUNK, n - off);
+        const uint16_t *p = s + off;
+        const uint16_t thr = c.thr;
+
+        uint32_t high = 0;
+        for (size_t i = 0; i < m; i++) {
+            h[i + 1] = p[i] >= thr;
+            high += h[i + 1];
+        }
+        c.high += high;
+
+        h[0] = prev;
+        for (size_t i = 0; i < m; i++)
+            rise[i] = h[i + 1] & uint8_t(h[i] ^ 1);
+        prev = h[m];
+
+        // Edges are sparse: skip 8 samples at a time
+        for (size_t i = 0; i < m; i += 8) {
+            uint64_t w = 0;
+            size_t k = std::min<size_t>(8, m - i);
+            memcpy(&w, &rise[i], k);
+            if (!w)
+                continue;
+            for (size_t j = 0; j < k; j++) {
+                if (!rise[i + j])
+                    continue;
+                uint64_t at = off + i + j;
+                if (last_edge == UINT64_MAX)
+                    c.first_edge = at;
+                else
+                    c.interval.push_back(uint16_t(std::min<uint64_t>(at - last_edge, 65535)));
+                last_edge = at;
+            }
+        }
+    }
+}
+
+struct Result {
+    double period = 0;          // samples per PWM period
+    double jitter_rms = 0;      // samples, residual after quantization
+    double resid_pp = 0;
+    uint64_t glitches = 0;
+    uint64_t dropouts = 0;      // intervals far longer than a period
+    std::vector<Slip> slips;
+};
+
+// Pass 2 works on the edge phase: for edge i, n = PWM periods since the
+// first edge and y = samples since it, less the slips before it. Without
+// slips y follows the line c0 + n * period to within half a sample
+// (quantization); a missing (duplicated) sample moves every later edge
+// one sample early (late), a glitch moves a single edge.
+struct Line {
+    double c0 = 0;
+    double period = 0;
+};
+
+template <class Fn>
+void walk(const Capture &c, double period, const std::vector<Slip> &slips, Fn fn)
+{
+    uint64_t at = c.first_edge;
+    double n = 0;
+    int64_t off = 0;
+    size_t next = 0;
+
+    for (size_t i = 0; i < c.interval.size(); i++) {
+        uint16_t d = c.interval[i];
+        at += d;
+        bool dropout = d > 3 * period;
+        // Count the periods an interval covers, so a lost pulse (or the
+        // signal gone for a while) doesn't shift every later edge
+        n += std::max(1.0, std::round(d / period));
+        while (next < slips.size() && slips[next].edge == i)
+            off += slips[next++].step;
+        fn(i, n, double(int64_t(at - c.first_edge) - off), at, dropout);
+    }
+}
+
+Line fit(const Capture &c, double period, const std::vector<Slip> &slips)
+{
+    double sn = 0, sy = 0, snn = 0, sny = 0, cnt = 0;
+    walk(c, period, slips, [&](size_t, double n, double y, uint64_t, bool) {
+        sn += n;
+        sy += y;
+        snn += n * n;
+        sny += n * y;
+        cnt++;
+    });
+
+    Line l;
+    l.period = (cnt * sny - sn * sy) / (cnt * snn - sn * sn);
+    l.c0 = (sy - l.period * sn) / cnt;
+    return l;
+}
+
+// Steps in the residual y - line: the difference between its means over
+// the w edges after and before each edge. A slip is a one-sample step; it
+// shows as a run where the difference exceeds half a sample, and is placed
+// at the peak of the run. With a fractional period the residual also
+// carries the quantization sawtooth, which wraps every 1 / frac(period)
+// edges; w is a whole number of wraps so its mean cancels. Slips within w
+// edges of either end are not located.
+size_t slip_window(double period, size_t edges)
+{
+    double frac = std::fabs(period - std::round(period));
+    if (frac * double(edges) < 4)
+        return SLIP_WINDOW;
+    double wraps = std::ceil(SLIP_WINDOW * frac);
+    return std::max<size_t>(SLIP_WINDOW, size_t(std::llround(wraps / frac)));
+}
+
+std::vector<Slip> find_slips(const Capture &c, const Line &l)
+{
+    const size_t m = c.interval.size();
+    const size_t w = slip_window(l.period, m);
+    std::vector<Slip> found;
+    if (m < 2 * w)
+        return found;
+
+    std::vector<double> sum(m + 1);
+    walk(c, l.period, {}, [&](size_t i, double n, double y, uint64_t, bool) {
+        sum[i + 1] = sum[i] + (y - l.c0 - n * l.period);
+    });
+
+    size_t best = 0;
+    double best_d = 0;
+    auto flush = [&] {
+        int step = int(std::lround(best_d));
+        if (!step)
+            step = best_d < 0 ? -1 : 1;
+        found.push_back({best, 0, step});
+        best_d = 0;
+    };
+    for (size_t i = w; i + w <= m; i++) {
+        double d = (sum[i + w] - sum[i] - (sum[i] - sum[i - w])) / double(w);
+        if (std::fabs(d) > 0.5) {
+            if (std::fabs(d) > std::fabs(best_d)) {
+                best = i;
+                best_d = d;
+            }
+        } else if (best_d != 0) {
+            flush();
+        }
+    }
+    if (best_d != 0)
+        flush();
+
+    // Place each slip halfway into the interval it happened in
+    uint64_t at = c.first_edge;
+    size_t k = 0;
+    for (size_t i = 0; i < m && k < found.size(); i++) {
+        at += c.interval[i];
+        for (; k < found.size() && found[k].edge == i; k++)
+            found[k].sample = at - c.interval[i] / 2;
+    }
+    return found;
+}
+
+void edge_stats(const Capture &c, const Line &l, Result &r)
+{
+    double lo = 1e9, hi = -1e9, sum = 0, sumsq = 0, cnt = 0;
+    r.glitches = 0;
+    r.dropouts = 0;
+
+    walk(c, l.period, r.slips, [&](size_t, double n, double y, uint64_t, bool dropout) {
+        r.dropouts += dropout;
+        double e = y - l.c0 - n * l.period;
+        if (std::fabs(e) > BAND) {
+            r.glitches++;
+            return;
+        }
+        lo = std::min(lo, e);
+        hi = std::max(hi, e);
+        sum += e;
+        sumsq += e * e;
+        cnt++;
+    });
+
+    if (cnt) {
+        double mean = sum / cnt;
+        double var = std::max(0.0, sumsq / cnt - mean * mean);
+        // An edge position quantized to whole samples adds up to 1/12 sample^2
+        double frac = std::fabs(l.period - std::round(l.period));
+        double quant = frac > 1e-6 ? 1.0 / 12 : 0;
+        r.jitter_rms = std::sqrt(std::max(0.0, var - quant));
+        r.resid_pp = hi - lo;
+    }
+}
+
+bool analyse(const std::string &path, const Options &o)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path.c_str());
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    size_t n = size_t(st.st_size) / sizeof(uint16_t);
+    if (n < 16) {
+        printf("%s: too short\n", path.c_str());
+        close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path.c_str());
+        return false;
+    }
+    madvise(map, size_t(st.st_size), MADV_SEQUENTIAL);
+
+    auto t0 = std::chrono::steady_clock::now();
+    Capture c;
+    scan(static_cast<const uint16_t *>(map), n, c);
+    munmap(map, size_t(st.st_size));
+
+    if (c.interval.size() < 2 * SLIP_WINDOW) {
+        printf("%s: %zu rising edges at threshold %u, no PWM signal\nFAIL\n",
+               path.c_str(), c.interval.size(), c.thr);
+        return false;
+    }
+
+    // Slips bias the plain fit, and with it the sawtooth window. Refit
+    // without the slips found and look again from scratch until the set
+    // stops changing.
+    uint64_t span = 0;
+    for (uint16_t v : c.interval)
+        span += v;
+    Result r;
+    Line line = fit(c, double(span) / c.interval.size(), r.slips);
+    for (int iter = 0; iter < 4; iter++) {
+        std::vector<Slip> found = find_slips(c, line);
+        bool same = found.size() == r.slips.size() &&
+                    std::equal(found.begin(), found.end(), r.slips.begin(),
+                               [](const Slip &a, const Slip &b) { return a.edge == b.edge && a.step == b.step; });
+        r.slips = std::move(found);
+        line = fit(c, line.period, r.slips);
+        if (same)
+            break;
+    }
+    edge_stats(c, line, r);
+    r.period = line.period;
+    double period = line.period;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    double expected = o.rate / o.pwm_hz;
+    double rate = period * o.pwm_hz;
+    double ppm = (rate - o.rate) / o.rate * 1e6;
+    double duty = 100.0 * double(c.high) / double(c.samples);
+    double us_per_sample = 1e6 / rate;
+    uint64_t at_boundary = 0;
+    for (const Slip &s : r.slips) {
+        // Slip position is known to within half a PWM period
+        uint64_t into = s.sample % o.block;
+        uint64_t dist = std::min<uint64_t>(into, o.block - into);
+        if (dist <= uint64_t(std::ceil(period)))
+            at_boundary++;
+    }
+    double glitch_ppm = 1e6 * double(r.glitches) / double(c.interval.size());
+
+    printf("%s: %llu samples (%.1f s), %zu periods, threshold %u\n", path.c_str(),
+           (unsigned long long)c.samples, c.samples / o.rate, c.interval.size(), c.thr);
+    printf("  period        %.6f samples (expected %.6f), PWM %.4f Hz at nominal rate\n",
+           period, expected, o.rate / period);
+    printf("  sample rate   %.3f Hz, error %+.1f ppm\n", rate, ppm);
+    printf("  duty          %.2f %% (expected %.2f %%)\n", duty, o.duty_pct);
+    printf("  edge jitter   %.3f samples rms (%.2f us), residual p-p %.2f samples\n",
+           r.jitter_rms, r.jitter_rms * us_per_sample, r.resid_pp);
+    printf("  slips         %zu (%llu within a period of a %u-sample boundary)\n",
+           r.slips.size(), (unsigned long long)at_boundary, o.block);
+    printf("  glitches      %llu (%.1f ppm of edges), dropouts %llu\n",
+           (unsigned long long)r.glitches, glitch_ppm, (unsigned long long)r.dropouts);
+    if (o.verbose)
+        for (const Slip &s : r.slips)
+            printf("    %d %s near %llu (block %llu + %llu)\n",
+                   std::abs(s.step), s.step < 0 ? "missing" : "duplicated", (unsigned long long)s.sample,
+                   (unsigned long long)(s.sample / o.block), (unsigned long long)(s.sample % o.block));
+    printf("  analysed in %.3f s (%.0f MS/s)\n", secs, c.samples / secs / 1e6);
+
+    bool ok = true;
+    auto fail = [&](const char *what) {
+        printf("  FAIL: %s\n", what);
+        ok = false;
+    };
+    if (std::fabs(ppm) > o.max_ppm) fail("sample rate error");
+    if (std::fabs(duty - o.duty_pct) > o.max_duty_err) fail("duty cycle");
+    if (!r.slips.empty()) fail("missing or duplicated samples");
+    if (glitch_ppm > o.max_glitch_ppm) fail("edge glitches");
+    if (r.dropouts) fail("signal dropouts");
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--rate" && more) o.rate = atof(argv[++i]);
+        else if (a == "--pwm-hz" && more) o.pwm_hz = atof(argv[++i]);
+        else if (a == "--duty" && more) o.duty_pct = atof(argv[++i]);
+        else if (a == "--block" && more) o.block = uint32_t(atoi(argv[++i]));
+        else if (a == "--max-ppm" && more) o.max_ppm = atof(argv[++i]);
+        else if (a == "--max-duty-err" && more) o.max_duty_err = atof(argv[++i]);
+        else if (a == "--max-glitch-ppm" && more) o.max_glitch_ppm = atof(argv[++i]);
+        else if (a == "-v") o.verbose = true;
+        else if (a[0] == '-') {
+            fprintf(stderr, "usage: ae_integrity [--rate HZ] [--pwm-hz HZ] [--duty PCT] [--block N]\n"
+                            "                    [--max-ppm N] [--max-duty-err PCT] [--max-glitch-ppm N]\n"
+                            "                    [-v] file.bin ...\n");
+            return 2;
+        }
+        else files.push_back(a);
+    }
+
+    int rc = 0;
+    for (const std::string &f : files)
+        if (!analyse(f, o))
+            rc = 1;
+    return rc;
+}
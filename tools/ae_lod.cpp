@@ -0,0 +1,168 @@
+// Min/max level-of-detail cache for plotting long recordings.
+//
+// `build` writes aXXXX.bin.lod (rebuilds unconditionally), `query` prints
+// the min/max envelope of a sample range in N columns, rebuilding the
+// cache first if the recording changed. data/data_plot.py calls `query`
+// on every pan/zoom, so a redraw costs O(columns) whatever the file size.
+//
+// usage: ae_lod build [-j N] file.bin
+//        ae_lod query [--binary] file.bin FIRST LAST COLUMNS
+//        ae_lod info file.bin
+//        ae_lod --bench [MSAMPLES] [-j N]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "lod_pyramid.h"
+#include "tool_util.h"
+
+namespace {
+
+int usage()
+{
+    fprintf(stderr, "usage: ae_lod build [-j N] file.bin\n"
+                    "       ae_lod query [--binary] file.bin FIRST LAST COLUMNS\n"
+                    "       ae_lod info file.bin\n"
+                    "       ae_lod --bench [MSAMPLES] [-j N]\n");
+    return 2;
+}
+
+int cmd_build(const std::string &path, unsigned threads)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    if (!LodPyramid::build(path, LodPyramid::default_cache(path), threads))
+        return 1;
+    double secs = seconds_since(t0);
+
+    LodPyramid lod;
+    if (!lod.open(path))
+        return 1;
+    printf("%s: %llu samples, %u levels in %.3f s (%.1f MS/s)\n",
+           path.c_str(), (unsigned long long)lod.samples(), lod.levels(), secs,
+           lod.samples() / secs / 1e6);
+    return 0;
+}
+
+int cmd_query(const std::string &path, uint64_t first, uint64_t last, uint32_t cols, bool binary)
+{
+    LodPyramid lod;
+    if (!lod.open(path))
+        return 1;
+
+    std::vector<LodEntry> env = lod.query(first, last, cols);
+    if (binary) {
+        fwrite(env.data(), sizeof(LodEntry), env.size(), stdout);
+        return 0;
+    }
+    for (const LodEntry &e : env)
+        printf("%u %u\n", e.min, e.max);
+    return 0;
+}
+
+int cmd_info(const std::string &path)
+{
+    LodPyramid lod;
+    if (!lod.open(path))
+        return 1;
+    printf("%s: %llu samples, %u levels, base %u, fanout %u\n",
+           path.c_str(), (unsigned long long)lod.samples(), lod.levels(), LOD_BASE, LOD_FANOUT);
+    return 0;
+}
+
+// Build and query a synthetic recording; reports build throughput per
+// thread count and query time at several zoom levels.
+int bench(uint32_t msamples, unsigned threads)
+{
+    char path[] = "/tmp/ae_lod_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    std::vector<uint16_t> block(1 << 20);
+    uint32_t x = 1;
+    for (uint32_t m = 0; m < msamples; m++) {
+        for (auto &v : block) {
+            x = x * 1664525 + 1013904223;
+            v = uint16_t(x >> 20);
+        }
+        if (write(fd, block.data(), block.size() * 2) != ssize_t(block.size() * 2)) {
+            perror(path);
+            close(fd);
+            unlink(path);
+            return 1;
+        }
+    }
+    close(fd);
+
+    std::string src = path;
+    std::string cache = LodPyramid::default_cache(src);
+    std::vector<unsigned> counts = {1, 2, 4, 8};
+    if (threads)
+        counts = {threads};
+
+    for (unsigned t : counts) {
+        auto t0 = std::chrono::steady_clock::now();
+        LodPyramid::build(src, cache, t);
+        double secs = seconds_since(t0);
+        printf("build  %u Mi samples, %u threads: %.3f s, %.1f MS/s\n",
+               msamples, t, secs, msamples * 1048576.0 / secs / 1e6);
+    }
+
+    LodPyramid lod;
+    lod.open(src, cache);
+    uint64_t check = 0;
+    for (uint64_t span = lod.samples(); span >= 1000; span /= 16) {
+        const int reps = 100;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < reps; r++)
+            for (const LodEntry &e : lod.query(0, span, 1920))
+                check += e.max - e.min;
+        double us = seconds_since(t0) * 1e6 / reps;
+        printf("query  %12llu samples -> 1920 cols: level %2d, %8.1f us\n",
+               (unsigned long long)span, lod.last_level(), us);
+    }
+    printf("check %llu\n", (unsigned long long)check);
+
+    unlink(path);
+    unlink(cache.c_str());
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return usage();
+
+    std::string cmd = argv[1];
+    unsigned threads = 0;
+    bool binary = false;
+    std::vector<std::string> args;
+
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-j" && i + 1 < argc) threads = unsigned(atoi(argv[++i]));
+        else if (a == "--binary") binary = true;
+        else if (a[0] == '-') return usage();
+        else args.push_back(a);
+    }
+
+    if (cmd == "--bench")
+        return bench(args.empty() ? 256 : uint32_t(atoi(args[0].c_str())), threads);
+    if (cmd == "build" && args.size() == 1)
+        return cmd_build(args[0], threads);
+    if (cmd == "info" && args.size() == 1)
+        return cmd_info(args[0]);
+    if (cmd == "query" && args.size() == 4)
+        return cmd_query(args[0], strtoull(args[1].c_str(), nullptr, 0),
+                         strtoull(args[2].c_str(), nullptr, 0),
+                         uint32_t(atoi(args[3].c_str())), binary);
+    return usage();
+}
@@ -0,0 +1,442 @@
+// Arrival times of AE hits in raw recordings (onset_batch.cpp).
+//
+// Candidates come from the board's STA/LTA, each refined by AIC in float
+// over --window samples ending --post after it. --board picks with the
+// firmware's own fixed-point stage instead (ae_pipeline OnsetPicker),
+// as a board built with ACQ_ONSET_AIC does. Arrivals are sample indices,
+// and times on the board's time_us_64() clock from the block stamps in
+// aXXXX.sum, as the board stamps them; without a .sum, from the start of
+// the file at --rate.
+//
+// --bench makes recordings of rising, decaying tones at known fractional
+// onsets over noise at several amplitudes, and compares the threshold
+// crossing, the STA/LTA candidate, the board's pick and the host's
+// against them. It checks the fixed-point log and AIC against float, then
+// times every kernel.
+//
+// usage: ae_onset [--window N] [--post N] [--rate HZ] [--board] [-o onsets.csv] file.bin ...
+//        ae_onset --bench [BURSTS]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "acq_pipeline.h"
+#include "ae_pipeline.hpp"
+#include "block_stats.h"
+#include "onset.h"
+#include "onset_batch.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t N = ACQ_BLOCK_SAMPLES;
+constexpr uint32_t RATE = ACQ_SAMPLE_RATE;
+
+int usage()
+{
+    fprintf(stderr, "usage: ae_onset [--window N] [--post N] [--rate HZ] [--board] [-o onsets.csv] file.bin ...\n"
+                    "       ae_onset --bench [BURSTS]\n");
+    return 2;
+}
+
+bool read_file(const std::string &path, std::vector<uint16_t> &v)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    v.resize(size_t(bytes) / sizeof(uint16_t));
+    bool ok = fread(v.data(), sizeof(uint16_t), v.size(), f) == v.size();
+    fclose(f);
+    if (!ok)
+        perror(path.c_str());
+    return ok;
+}
+
+// Block stamps from aXXXX.sum, and its sample rate
+bool read_stamps(const std::string &bin, std::vector<uint64_t> &t_us, uint32_t &rate)
+{
+    size_t dot = bin.rfind('.');
+    std::string path = (dot == std::string::npos ? bin : bin.substr(0, dot)) + ".sum";
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    summary_header_t h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == SUMMARY_MAGIC &&
+              h.record_size == sizeof(block_stats_t) && h.block_samples == N;
+    block_stats_t r;
+    while (ok && fread(&r, sizeof(r), 1, f) == 1 && r.seq == t_us.size())
+        t_us.push_back(r.t_us);
+    fclose(f);
+    if (ok && h.sample_rate)
+        rate = h.sample_rate;
+    return ok;
+}
+
+// Board picks: DcBlock > OnsetPicker with AIC, as in acq_pipeline.cpp
+struct BoardCollect {
+    std::vector<ae::Onset> *out;
+    void operator()(const ae::Onset &o) const { out->push_back(o); }
+};
+
+using BoardPicker = ae::OnsetPicker<N, ACQ_ONSET_WINDOW, ACQ_ONSET_POST, BoardCollect>;
+
+std::vector<ae::Onset> board_onsets(const uint16_t *s, size_t n, bool refine = true)
+{
+    std::vector<ae::Onset> out;
+    ae::Pipeline<ae::DcBlock<N>, BoardPicker, ae::Discard> p(ae::DcBlock<N>{},
+                                                           BoardPicker(BoardCollect{&out}),
+                                                           ae::Discard{});
+    p.stage<1>().set_refine(refine);
+    p.reset();
+    ae::MemorySource<N, RATE> src(s, n);
+    ae::drain(src, p);
+    return out;
+}
+
+int run(const std::vector<std::string> &files, const OnsetBatchConfig &cfg, uint32_t rate,
+        bool board, const std::string &csv)
+{
+    FILE *out = nullptr;
+    if (!csv.empty()) {
+        out = fopen(csv.c_str(), "w");
+        if (!out) {
+            perror(csv.c_str());
+            return 1;
+        }
+        fprintf(out, "file,trigger,at,t_us,refined\n");
+    }
+
+    for (const std::string &path : files) {
+        std::vector<uint16_t> v;
+        if (!read_file(path, v))
+            return 1;
+        uint32_t r = rate;
+        std::vector<uint64_t> stamps;
+        bool stamped = read_stamps(path, stamps, r);
+
+        std::vector<OnsetPick> picks;
+        const uint32_t post = board ? ACQ_ONSET_POST : cfg.post;
+        auto t0 = std::chrono::steady_clock::now();
+        if (board)
+            for (const ae::Onset &o : board_onsets(v.data(), v.size()))
+                picks.push_back({o.trigger, double(o.at_q8) / (1 << ONSET_FRAC_BITS), o.refined});
+        else
+            picks = pick_onsets(v.data(), v.size(), cfg);
+        double secs = seconds_since(t0);
+
+        double moved = 0;
+        for (const OnsetPick &p : picks) {
+            moved += double(p.trigger) - p.at;
+            // Stamp of the block the board picks it in: the one that
+            // completes its window
+            double t_us = p.at * 1e6 / r;
+            const uint64_t b = (p.trigger + post + N - 1) / N - 1;
+            if (stamped && b < stamps.size())
+                t_us = double(stamps[b]) - (double((b + 1) * N - 1) - p.at) * 1e6 / r;
+            if (out)
+                fprintf(out, "%s,%llu,%.3f,%.1f,%d\n", path.c_str(), (unsigned long long)p.trigger,
+                        p.at, t_us, p.refined);
+        }
+        printf("%s: %zu onsets, picks %.1f samples before the candidate on average, %s timebase, "
+               "%.0f MS/s\n",
+               path.c_str(), picks.size(), picks.empty() ? 0.0 : moved / picks.size(),
+               stamped ? ".sum" : "file", v.size() / secs / 1e6);
+    }
+    if (out && fclose(out) != 0) {
+        perror(csv.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+// ---- Benchmark ----
+
+constexpr uint32_t BENCH_EVERY = 3001;      // samples between bursts, not a block multiple
+constexpr double BENCH_SIGMA = 4;           // noise, counts
+constexpr double BENCH_RISE = 4;            // envelope rise and decay, samples
+constexpr double BENCH_DECAY = 60;
+
+// Bursts at fractional onsets over gaussian noise: a tone of random
+// frequency and phase under a (1 - e^-t/rise) e^-t/decay envelope
+std::vector<uint16_t> make_bursts(uint32_t count, double amp, uint32_t seed, std::vector<double> &onsets)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0, BENCH_SIGMA);
+    std::uniform_real_distribution<double> u(0, 1);
+    const size_t n = size_t(count + 1) * BENCH_EVERY + 2 * N;
+    std::vector<double> x(n);
+    for (double &v : x)
+        v = 2048 + noise(rng);
+    onsets.clear();
+    for (uint32_t b = 0; b < count; b++) {
+        const double t0 = 2 * N + double(b) * BENCH_EVERY + 200 * u(rng) + u(rng);
+        const double f = (300 + 400 * u(rng)) / RATE, ph = 2 * M_PI * u(rng);
+        onsets.push_back(t0);
+        for (size_t i = size_t(std::ceil(t0)); i < n && i < t0 + 10 * BENCH_DECAY; i++) {
+            const double t = double(i) - t0;
+            x[i] += amp * (1 - std::exp(-t / BENCH_RISE)) * std::exp(-t / BENCH_DECAY) *
+                    std::sin(2 * M_PI * f * t + ph);
+        }
+    }
+    std::vector<uint16_t> s(n);
+    for (size_t i = 0; i < n; i++)
+        s[i] = uint16_t(std::clamp(std::lround(x[i]), 0L, 4095L));
+    return s;
+}
+
+struct Accuracy {
+    uint32_t found = 0, extra = 0;
+    double bias = 0, median = 0, p90 = 0;
+};
+
+// Each onset's first pick in [-50, +150] samples of it
+Accuracy score(const std::vector<double> &onsets, std::vector<double> picks)
+{
+    std::sort(picks.begin(), picks.end());
+    Accuracy a;
+    std::vector<double> err;
+    size_t j = 0;
+    for (double t0 : onsets) {
+        while (j < picks.size() && picks[j] < t0 - 50) {
+            a.extra++;
+            j++;
+        }
+        if (j < picks.size() && picks[j] <= t0 + 150) {
+            err.push_back(picks[j] - t0);
+            j++;
+            while (j < picks.size() && picks[j] <= t0 + 150) {
+                a.extra++;
+                j++;
+            }
+        }
+    }
+    a.extra += uint32_t(picks.size() - j);
+    a.found = uint32_t(err.size());
+    if (err.empty())
+        return a;
+    for (double e : err)
+        a.bias += e;
+    a.bias /= err.size();
+    for (double &e : err)
+        e = std::fabs(e);
+    std::sort(err.begin(), err.end());
+    a.median = err[err.size() / 2];
+    a.p90 = err[err.size() * 9 / 10];
+    return a;
+}
+
+std::vector<double> threshold_picks(const std::vector<uint16_t> &s, uint16_t threshold)
+{
+    std::vector<double> out;
+    auto on_hit = [&](const ae::Hit &h) { out.push_back(double(h.start)); };
+    using Det = ae::HitDetector<ACQ_HIT_DEFINITION_US, decltype(on_hit)>;
+    ae::Pipeline<ae::DcBlock<N>, Det, ae::Discard> p(ae::DcBlock<N>{}, Det(on_hit, threshold),
+                                                     ae::Discard{});
+    ae::MemorySource<N, RATE> src(s.data(), s.size());
+    ae::drain(src, p);
+    return out;
+}
+
+int bench(uint32_t bursts)
+{
+    // Fixed-point log2 against libm
+    {
+        std::mt19937_64 rng(3);
+        double worst = 0;
+        for (int i = 0; i < 1000000; i++) {
+            uint64_t v = rng() >> (rng() % 64);
+            if (!v)
+                continue;
+            double e = std::fabs(onset_log2_q16(v) / 65536.0 - std::log2(double(v)));
+            worst = std::max(worst, e);
+        }
+        for (uint64_t v = 1; v < 70000; v++)
+            worst = std::max(worst, std::fabs(onset_log2_q16(v) / 65536.0 - std::log2(double(v))));
+        printf("log2 Q16: worst error %.2e\n", worst);
+        check(worst < 2.5e-4, "log2 Q16 error", worst, 2.5e-4);
+    }
+
+    // Accuracy against the true onsets
+    const double amps[] = {400, 126, 40, 20};
+    printf("\n%-6s %-30s %7s %6s %7s %7s %7s\n", "amp/σ", "method", "found", "extra", "bias",
+           "median", "p90");
+    std::vector<uint16_t> s;
+    std::vector<double> onsets;
+    OnsetBatchConfig cfg;
+    AicPicker aic;
+    double fx_fl_sum = 0;
+    size_t fx_fl_n = 0, fx_fl_far = 0, base_diff = 0;
+    for (double amp : amps) {
+        s = make_bursts(bursts, amp, uint32_t(amp), onsets);
+        std::vector<double> thr = threshold_picks(s, ACQ_HIT_THRESHOLD);
+        std::vector<double> thr6 = threshold_picks(s, uint16_t(6 * BENCH_SIGMA));
+        std::vector<double> cand, fixed, host;
+        for (const ae::Onset &o : board_onsets(s.data(), s.size(), false))
+            cand.push_back(double(o.trigger));
+        std::vector<ae::Onset> board = board_onsets(s.data(), s.size());
+        for (const ae::Onset &o : board)
+            fixed.push_back(double(o.at_q8) / (1 << ONSET_FRAC_BITS));
+        std::vector<OnsetPick> picks = pick_onsets(s.data(), s.size(), cfg);
+        for (const OnsetPick &p : picks)
+            host.push_back(p.at);
+
+        // Fixed against float on the same windows, and the two vector units
+        for (size_t i = 0, j = 0; i < picks.size(); i++) {
+            while (j < board.size() && board[j].trigger < picks[i].trigger)
+                j++;
+            if (j == board.size() || board[j].trigger != picks[i].trigger)
+                continue;
+            double d = std::fabs(fixed[j] - host[i]);
+            fx_fl_sum += d;
+            fx_fl_n++;
+            fx_fl_far += d > 1;
+            const uint64_t e = picks[i].trigger + cfg.post, s0 = e - cfg.window;
+            std::vector<int16_t> w(s.begin() + long(s0), s.begin() + long(e));
+            if (aic.pick_base(w.data(), cfg.window) != aic.pick(w.data(), cfg.window))
+                base_diff++;
+        }
+
+        struct Row {
+            const char *name;
+            const std::vector<double> &picks;
+        } rows[] = {
+            {"threshold 200 (board)", thr},
+            {"threshold 6σ", thr6},
+            {"STA/LTA candidate", cand},
+            {"AIC fixed point (board)", fixed},
+            {"AIC float (host)", host},
+        };
+        Accuracy acc[5];
+        for (int r = 0; r < 5; r++) {
+            acc[r] = score(onsets, rows[r].picks);
+            const Accuracy &a = acc[r];
+            if (a.found)
+                printf("%-6.0f %-30s %7.3f %6u %7.2f %7.2f %7.2f\n", amp / BENCH_SIGMA, rows[r].name,
+                       double(a.found) / bursts, a.extra, a.bias, a.median, a.p90);
+            else
+                printf("%-6.0f %-30s %7.3f %6u %7s %7s %7s\n", amp / BENCH_SIGMA, rows[r].name, 0.0,
+                       a.extra, "-", "-", "-");
+        }
+        if (amp >= 40) {
+            check(acc[2].found == bursts, "STA/LTA finds every burst", acc[2].found, bursts);
+            check(acc[3].median < acc[1].median, "board AIC closer than the 6σ threshold",
+                  acc[3].median, acc[1].median);
+            check(acc[4].median < acc[1].median, "host AIC closer than the 6σ threshold",
+                  acc[4].median, acc[1].median);
+        }
+        if (amp >= 126)
+            check(acc[3].median < 1 && acc[4].median < 1, "AIC within a sample at high SNR",
+                  std::max(acc[3].median, acc[4].median), 1);
+    }
+    printf("\nfixed vs float AIC on the same windows: mean |diff| %.3f samples, %zu of %zu over 1\n",
+           fx_fl_sum / fx_fl_n, fx_fl_far, fx_fl_n);
+    check(fx_fl_sum / fx_fl_n < 0.25, "fixed point AIC agrees with float", fx_fl_sum / fx_fl_n, 0.25);
+    check(base_diff == 0, "AVX2 and baseline picks identical", double(base_diff), 0);
+
+    // Throughput
+    printf("\n%-36s %12s\n", "kernel", "time");
+    s = make_bursts(bursts, 126, 7, onsets);
+    std::vector<int16_t> x(s.size());
+    for (size_t i = 0; i < s.size(); i++)
+        x[i] = int16_t(s[i] - 2048);
+    {
+        sta_lta_config_t c;
+        sta_lta_config_default(&c);
+        sta_lta_t st;
+        uint32_t on[16];
+        uint64_t found = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        int reps = 0;
+        do {
+            sta_lta_init(&st, &c);
+            for (size_t i = 0; i + N <= x.size(); i += N)
+                found += sta_lta_run(&st, &x[i], N, on, 16);
+            reps++;
+        } while (seconds_since(t0) < 0.5);
+        double secs = seconds_since(t0);
+        printf("%-36s %9.2f ns/sample (%llu)\n", "STA/LTA, fixed point", secs * 1e9 / (double(x.size()) * reps),
+               (unsigned long long)(found / reps));
+    }
+
+    // AIC on windows around each burst
+    const uint32_t W = ACQ_ONSET_WINDOW;
+    std::vector<size_t> starts;
+    for (double t0 : onsets)
+        starts.push_back(size_t(t0) + 10 - (W - ACQ_ONSET_POST));
+    std::vector<int32_t> scratch(W + 1);
+    auto time_aic = [&](const char *name, auto &&fn) {
+        double sink = 0;
+        int reps = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        do {
+            for (size_t st : starts)
+                sink += fn(&x[st]);
+            reps++;
+        } while (seconds_since(t0) < 0.5);
+        double secs = seconds_since(t0);
+        double per = secs / (double(starts.size()) * reps);
+        printf("%-36s %9.2f us/pick, %.2f ns/sample\n", name, per * 1e6, per * 1e9 / W);
+        return sink;
+    };
+    time_aic("AIC fixed point, 256 samples", [&](const int16_t *w) {
+        return double(onset_aic_pick(w, W, scratch.data()));
+    });
+    time_aic("AIC float baseline, 256 samples", [&](const int16_t *w) { return aic.pick_base(w, W); });
+    time_aic("AIC float AVX2, 256 samples", [&](const int16_t *w) { return aic.pick(w, W); });
+
+    // Whole recordings
+    auto time_file = [&](const char *name, auto &&fn) {
+        int reps = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        do {
+            fn();
+            reps++;
+        } while (seconds_since(t0) < 0.5);
+        double secs = seconds_since(t0) / reps;
+        printf("%-36s %9.2f ns/sample, %.0f MS/s\n", name, secs * 1e9 / s.size(), s.size() / secs / 1e6);
+    };
+    time_file("board stage (DcBlock > OnsetPicker)", [&] { board_onsets(s.data(), s.size()); });
+    time_file("host batch (pick_onsets)", [&] { pick_onsets(s.data(), s.size(), cfg); });
+
+    return check_summary();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    OnsetBatchConfig cfg;
+    uint32_t rate = RATE;
+    bool board = false;
+    std::string csv;
+    std::vector<std::string> files;
+
+    if (argc >= 2 && std::string(argv[1]) == "--bench")
+        return bench(argc > 2 ? uint32_t(atoi(argv[2])) : 1000);
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--window" && more) cfg.window = uint32_t(atoi(argv[++i]));
+        else if (a == "--post" && more) cfg.post = uint32_t(atoi(argv[++i]));
+        else if (a == "--rate" && more) rate = uint32_t(atoi(argv[++i]));
+        else if (a == "--board") board = true;
+        else if (a == "-o" && more) csv = argv[++i];
+        else if (a[0] == '-') return usage();
+        else files.push_back(a);
+    }
+    if (files.empty() || !rate || cfg.post >= cfg.window || cfg.window > 65536)
+        return usage();
+    return run(files, cfg, rate, board, csv);
+}
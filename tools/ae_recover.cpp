@@ -0,0 +1,606 @@
+// Salvage aXXXX.bin recordings from a raw SD card image.
+//
+// The logger only calls f_sync every SYNC_MAX_INTERVAL_US, so after a
+// power loss the directory entry holds the size of the last sync while the
+// data sectors written after it are already on the card. FatFs allocates
+// clusters for a growing file linearly, so the tail is found by following
+// the FAT chain past the recorded size and then walking the free clusters
+// that follow it. Every tail sector is checked to still look like 12-bit
+// ADC samples; the first one that does not ends the recording.
+//
+// Raw-streamed recordings are preallocated, so after a crash their size is
+// the preallocation. --trim cuts such files after the last sector that
+// still looks like samples.
+//
+// --bench builds FAT16 and FAT32 images in memory with recordings cut off
+// after their last sync and checks that the salvage is byte-exact.
+//
+// usage: ae_recover <card.img> [-o outdir] [-f a0007.bin] [--max-tail bytes] [--trim] [-n]
+//        ae_recover --bench
+//
+// Make the image with e.g. `dd if=/dev/sdX of=card.img bs=4M`.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "tool_util.h"
+
+namespace {
+
+uint16_t rd16(const uint8_t *p) { return uint16_t(p[0] | p[1] << 8); }
+uint32_t rd32(const uint8_t *p) { return uint32_t(p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24); }
+
+struct FatVolume {
+    FILE *f = nullptr;
+    uint64_t base = 0;            // byte offset of the volume in the image
+    uint32_t bytes_per_sec = 0;
+    uint32_t sec_per_clus = 0;
+    uint32_t fat_type = 0;        // 16 or 32
+    uint32_t root_dir_sec = 0;    // FAT16 fixed root directory
+    uint32_t root_dir_secs = 0;
+    uint32_t root_clus = 0;       // FAT32 root directory cluster
+    uint32_t data_sec = 0;
+    uint32_t n_clusters = 0;
+    std::vector<uint32_t> fat;    // first FAT, decoded
+
+    uint32_t cluster_bytes() const { return bytes_per_sec * sec_per_clus; }
+    bool valid_cluster(uint32_t c) const { return c >= 2 && c < n_clusters + 2; }
+
+    bool read(uint64_t sector, uint32_t count, void *dst) const
+    {
+        if (fseeko(f, off_t(base + sector * bytes_per_sec), SEEK_SET) != 0)
+            return false;
+        return fread(dst, bytes_per_sec, count, f) == count;
+    }
+
+    bool read_cluster(uint32_t c, void *dst) const
+    {
+        return read(data_sec + uint64_t(c - 2) * sec_per_clus, sec_per_clus, dst);
+    }
+};
+
+bool open_volume(FatVolume &v, FILE *f, const char *path)
+{
+    v.f = f;
+
+    uint8_t s[512];
+    if (fread(s, 1, sizeof(s), v.f) != sizeof(s) || rd16(s + 510) != 0xAA55) {
+        fprintf(stderr, "%s: no boot signature\n", path);
+        return false;
+    }
+
+    // Either a bare volume or an MBR whose first used entry holds the volume
+    if (s[0] != 0xEB && s[0] != 0xE9) {
+        for (int i = 0; i < 4; i++) {
+            const uint8_t *e = s + 446 + 16 * i;
+            if (e[4] != 0) {
+                v.base = uint64_t(rd32(e + 8)) * 512;
+                break;
+            }
+        }
+        if (v.base == 0 || fseeko(v.f, off_t(v.base), SEEK_SET) != 0 ||
+            fread(s, 1, sizeof(s), v.f) != sizeof(s)) {
+            fprintf(stderr, "%s: no FAT partition\n", path);
+            return false;
+        }
+    }
+
+    v.bytes_per_sec = rd16(s + 11);
+    v.sec_per_clus = s[13];
+    uint32_t reserved = rd16(s + 14);
+    uint32_t n_fats = s[16];
+    uint32_t root_ent = rd16(s + 17);
+    uint32_t tot_sec = rd16(s + 19) ? rd16(s + 19) : rd32(s + 32);
+    uint32_t fat_sz = rd16(s + 22) ? rd16(s + 22) : rd32(s + 36);
+
+    if (v.bytes_per_sec < 512 || v.sec_per_clus == 0 || fat_sz == 0) {
+        fprintf(stderr, "%s: not a FAT volume (exFAT is not supported)\n", path);
+        return false;
+    }
+
+    v.root_dir_sec = reserved + n_fats * fat_sz;
+    v.root_dir_secs = (root_ent * 32 + v.bytes_per_sec - 1) / v.bytes_per_sec;
+    v.data_sec = v.root_dir_sec + v.root_dir_secs;
+    v.n_clusters = (tot_sec - v.data_sec) / v.sec_per_clus;
+
+    if (v.n_clusters < 4085) {
+        fprintf(stderr, "%s: FAT12 is not supported\n", path);
+        return false;
+    }
+    v.fat_type = v.n_clusters < 65525 ? 16 : 32;
+    v.root_clus = v.fat_type == 32 ? rd32(s + 44) : 0;
+
+    std::vector<uint8_t> raw(size_t(fat_sz) * v.bytes_per_sec);
+    if (!v.read(reserved, fat_sz, raw.data())) {
+        fprintf(stderr, "%s: short read in FAT\n", path);
+        return false;
+    }
+
+    v.fat.resize(v.n_clusters + 2);
+    for (uint32_t c = 0; c < v.n_clusters + 2; c++)
+        v.fat[c] = v.fat_type == 32 ? rd32(&raw[c * 4]) & 0x0FFFFFFF : rd16(&raw[c * 2]);
+
+    return true;
+}
+
+bool open_volume(FatVolume &v, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    return open_volume(v, f, path);
+}
+
+struct DirEntry {
+    std::string name;
+    uint32_t start;
+    uint32_t size;
+};
+
+std::string short_name(const uint8_t *e)
+{
+    std::string n, x;
+    for (int i = 0; i < 8 && e[i] != ' '; i++) n += char(tolower(e[i]));
+    for (int i = 8; i < 11 && e[i] != ' '; i++) x += char(tolower(e[i]));
+    return x.empty() ? n : n + "." + x;
+}
+
+std::vector<DirEntry> read_root(const FatVolume &v)
+{
+    std::vector<uint8_t> buf;
+
+    if (v.fat_type == 16) {
+        buf.resize(size_t(v.root_dir_secs) * v.bytes_per_sec);
+        v.read(v.root_dir_sec, v.root_dir_secs, buf.data());
+    } else {
+        std::vector<uint8_t> clus(v.cluster_bytes());
+        for (uint32_t c = v.root_clus, n = 0; v.valid_cluster(c) && n < v.n_clusters; c = v.fat[c], n++) {
+            if (!v.read_cluster(c, clus.data()))
+                break;
+            buf.insert(buf.end(), clus.begin(), clus.end());
+        }
+    }
+
+    std::vector<DirEntry> out;
+    for (size_t i = 0; i + 32 <= buf.size(); i += 32) {
+        const uint8_t *e = &buf[i];
+        if (e[0] == 0x00)
+            break;
+        if (e[0] == 0xE5 || e[11] == 0x0F || (e[11] & 0x18))
+            continue;   // deleted, LFN, volume label or directory
+
+        uint32_t start = rd16(e + 26) | (v.fat_type == 32 ? uint32_t(rd16(e + 20)) << 16 : 0);
+        out.push_back({short_name(e), start, rd32(e + 28)});
+    }
+    return out;
+}
+
+bool is_log_name(const std::string &n)
+{
+    if (n.size() != 9 || n[0] != 'a' || n.compare(5, 4, ".bin") != 0)
+        return false;
+    for (int i = 1; i < 5; i++)
+        if (!isdigit(uint8_t(n[i])))
+            return false;
+    return true;
+}
+
+// A tail sector is accepted if every word is a 12-bit sample. Erased flash
+// reads as 0xFF (fails) or 0x00 (all-zero sectors are rejected as well).
+bool looks_like_samples(const uint8_t *p, size_t n)
+{
+    bool any = false;
+    for (size_t i = 0; i + 1 < n; i += 2) {
+        uint16_t w = rd16(p + i);
+        if (w > 0x0FFF)
+            return false;
+        any |= w != 0;
+    }
+    return any;
+}
+
+struct Salvage {
+    std::vector<uint8_t> data;
+    uint64_t committed = 0;  // bytes covered by the directory entry
+    uint64_t tail = 0;       // bytes recovered after it
+};
+
+Salvage salvage(const FatVolume &v, const DirEntry &d, uint64_t max_tail)
+{
+    Salvage r;
+    if (!v.valid_cluster(d.start))
+        return r;
+
+    const uint32_t cb = v.cluster_bytes();
+    std::vector<uint8_t> clus(cb);
+    std::vector<bool> seen(v.n_clusters + 2);
+
+    uint32_t c = d.start;
+    uint32_t last = c;
+    bool in_chain = true;
+    bool done = false;
+
+    while (!done && v.valid_cluster(c) && !seen[c]) {
+        seen[c] = true;
+        if (!v.read_cluster(c, clus.data()))
+            break;
+        last = c;
+
+        for (uint32_t off = 0; off < cb; off += v.bytes_per_sec) {
+            uint64_t pos = r.data.size();
+            if (pos < d.size) {
+                uint64_t n = std::min<uint64_t>(v.bytes_per_sec, d.size - pos);
+                r.data.insert(r.data.end(), &clus[off], &clus[off] + n);
+                r.committed += n;
+                if (n < v.bytes_per_sec) {
+                    // Partially synced sector: anything past the size is unknown
+                    done = true;
+                    break;
+                }
+                continue;
+            }
+            if (r.tail >= max_tail || !looks_like_samples(&clus[off], v.bytes_per_sec)) {
+                done = true;
+                break;
+            }
+            r.data.insert(r.data.end(), &clus[off], &clus[off] + v.bytes_per_sec);
+            r.tail += v.bytes_per_sec;
+        }
+
+        // Follow the chain while it lasts (the FAT sector may have been
+        // flushed after the last sync), then continue into free clusters.
+        uint32_t next = in_chain ? v.fat[c] : 0;
+        if (in_chain && v.valid_cluster(next)) {
+            c = next;
+            continue;
+        }
+        in_chain = false;
+        c = last + 1;
+        if (!v.valid_cluster(c) || v.fat[c] != 0)
+            break;   // end of volume, or the cluster belongs to another file
+    }
+
+    return r;
+}
+
+// Cut the recording at the first sector that is not samples.
+void trim_tail(Salvage &r, uint32_t sector)
+{
+    for (uint64_t pos = 0; pos < r.data.size(); pos += sector) {
+        uint64_t n = std::min<uint64_t>(sector, r.data.size() - pos);
+        if (!looks_like_samples(&r.data[pos], n)) {
+            r.data.resize(pos);
+            r.committed = std::min<uint64_t>(r.committed, pos);
+            r.tail = pos - r.committed;
+            return;
+        }
+    }
+}
+
+// --bench: build small FAT16 and FAT32 card images in memory, lay out
+// recordings as the logger leaves them after a crash, and check that the
+// salvaged files are the written samples, byte for byte.
+
+void wr16(uint8_t *p, uint32_t v) { p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); }
+void wr32(uint8_t *p, uint32_t v) { wr16(p, v); wr16(p + 2, v >> 16); }
+
+struct TestImage {
+    static constexpr uint32_t SEC = 512;
+    std::vector<uint8_t> b;
+    uint64_t base = 0;
+    uint32_t fat_type, spc, reserved, fat_sz, root_ent, data_sec, n_clusters;
+    uint32_t dir_used = 0;
+
+    TestImage(uint32_t type, uint32_t clusters, uint32_t sec_per_clus, bool mbr)
+        : fat_type(type), spc(sec_per_clus), n_clusters(clusters)
+    {
+        reserved = type == 32 ? 32 : 1;
+        root_ent = type == 32 ? 0 : 512;
+        fat_sz = ((clusters + 2) * (type / 8) + SEC - 1) / SEC;
+        data_sec = reserved + 2 * fat_sz + root_ent * 32 / SEC;
+        uint32_t tot = data_sec + clusters * spc;
+        base = mbr ? 8 * SEC : 0;
+        b.assign(base + uint64_t(tot) * SEC, 0);
+
+        if (mbr) {
+            uint8_t *e = &b[446];
+            e[4] = type == 32 ? 0x0C : 0x06;
+            wr32(e + 8, uint32_t(base / SEC));
+            wr32(e + 12, tot);
+            wr16(&b[510], 0xAA55);
+        }
+        uint8_t *s = &b[base];
+        s[0] = 0xEB;
+        wr16(s + 11, SEC);
+        s[13] = uint8_t(spc);
+        wr16(s + 14, reserved);
+        s[16] = 2;
+        wr16(s + 17, root_ent);
+        wr32(s + 32, tot);
+        if (type == 32) {
+            wr32(s + 36, fat_sz);
+            wr32(s + 44, 2);
+        } else {
+            wr16(s + 22, fat_sz);
+        }
+        wr16(s + 510, 0xAA55);
+
+        set_fat(0, 0x0FFFFFF8);
+        set_fat(1, 0x0FFFFFFF);
+        if (type == 32)
+            set_fat(2, 0x0FFFFFFF);     // root directory
+    }
+
+    uint32_t eoc() const { return fat_type == 32 ? 0x0FFFFFFF : 0xFFFF; }
+
+    void set_fat(uint32_t c, uint32_t v)
+    {
+        for (uint32_t i = 0; i < 2; i++) {
+            uint8_t *fat = &b[base + uint64_t(reserved + i * fat_sz) * SEC];
+            if (fat_type == 32) wr32(fat + c * 4, v);
+            else wr16(fat + c * 2, v);
+        }
+    }
+
+    // Chain clusters [first, last], the last one ending the chain
+    void chain(uint32_t first, uint32_t last)
+    {
+        for (uint32_t c = first; c < last; c++)
+            set_fat(c, c + 1);
+        set_fat(last, eoc());
+    }
+
+    uint8_t *sector(uint32_t first_cluster, uint32_t n)
+    {
+        return &b[base + (uint64_t(data_sec) + uint64_t(first_cluster - 2) * spc + n) * SEC];
+    }
+
+    void add_file(const char *name83, uint32_t start, uint32_t size)
+    {
+        uint8_t *e = fat_type == 32 ? sector(2, 0) : &b[base + uint64_t(data_sec) * SEC - root_ent * 32];
+        e += 32 * dir_used++;
+        memcpy(e, name83, 11);
+        e[11] = 0x20;
+        wr16(e + 20, start >> 16);
+        wr16(e + 26, start);
+        wr32(e + 28, size);
+    }
+};
+
+// n sectors of 12-bit samples from cluster `first` on, as the logger
+// writes them; the same bytes are appended to `expect`
+void write_samples(TestImage &img, uint32_t first, uint32_t n, std::vector<uint8_t> &expect,
+                   uint32_t &seed)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t *p = img.sector(first, i);
+        for (uint32_t j = 0; j < TestImage::SEC; j += 2) {
+            seed = seed * 1664525 + 1013904223;
+            wr16(p + j, 2048 + (seed >> 20) % 801 - 400);
+        }
+        expect.insert(expect.end(), p, p + TestImage::SEC);
+    }
+}
+
+const DirEntry *find(const std::vector<DirEntry> &dir, const char *name)
+{
+    for (const DirEntry &d : dir)
+        if (d.name == name)
+            return &d;
+    return nullptr;
+}
+
+void check_salvage(const char *what, const Salvage &r, const std::vector<uint8_t> &expect,
+                   uint64_t committed, uint64_t tail)
+{
+    bool exact = r.data.size() == expect.size() &&
+                 std::equal(r.data.begin(), r.data.end(), expect.begin());
+    printf("%-34s committed %8llu  tail %8llu  %s\n", what, (unsigned long long)r.committed,
+           (unsigned long long)r.tail, exact ? "byte-exact" : "DIFFERS");
+    check(r.committed == committed, what, double(r.committed), double(committed));
+    check(r.tail == tail, what, double(r.tail), double(tail));
+    check(exact, what, double(r.data.size()), double(expect.size()));
+}
+
+bool mount(FatVolume &v, TestImage &img)
+{
+    FILE *f = fmemopen(img.b.data(), img.b.size(), "rb");
+    if (!f) {
+        perror("fmemopen");
+        return false;
+    }
+    return open_volume(v, f, "image");
+}
+
+int bench()
+{
+    const uint32_t SEC = TestImage::SEC;
+    uint32_t seed = 1;
+
+    {
+        // FAT16, 4 sectors per cluster. A text file in clusters 2-3, then
+        // a0001.bin from cluster 4: the last sync covered 43 sectors, the
+        // FAT chain ends with it, and 22 more sectors reached the card
+        // before the power went; the rest of that cluster is erased.
+        TestImage img(16, 5000, 4, false);
+        std::vector<uint8_t> other, expect;
+        write_samples(img, 2, 8, other, seed);
+        img.chain(2, 3);
+        img.add_file("NOTES   TXT", 2, 8 * SEC);
+
+        write_samples(img, 4, 43 + 22, expect, seed);
+        memset(img.sector(4, 65), 0xFF, 3 * SEC);
+        img.chain(4, 4 + 42 / 4);
+        img.add_file("A0001   BIN", 4, 43 * SEC);
+
+        FatVolume v;
+        std::vector<DirEntry> dir;
+        if (mount(v, img))
+            dir = read_root(v);
+        check(v.fat_type == 16, "FAT16 detected", v.fat_type, 16);
+        const DirEntry *d = find(dir, "a0001.bin");
+        check(d != nullptr, "FAT16 a0001.bin listed");
+        if (d) {
+            check_salvage("FAT16, tail ends at erased sector", salvage(v, *d, UINT64_MAX), expect,
+                          43 * SEC, 22 * SEC);
+            // --max-tail keeps the first whole sectors of the tail
+            std::vector<uint8_t> capped(expect.begin(), expect.begin() + (43 + 5) * SEC);
+            check_salvage("FAT16, --max-tail 5 sectors", salvage(v, *d, 5 * SEC), capped,
+                          43 * SEC, 5 * SEC);
+        }
+        if (v.f)
+            fclose(v.f);
+    }
+
+    {
+        // FAT32 behind an MBR, 1 sector per cluster. a0002.bin from
+        // cluster 3: 100 sectors synced, the FAT flushed 10 clusters
+        // further than the size, and the data runs on into free clusters
+        // until the next file, which also holds samples.
+        TestImage img(32, 66000, 1, true);
+        std::vector<uint8_t> other, expect;
+        write_samples(img, 3, 148, expect, seed);
+        img.chain(3, 112);
+        img.add_file("A0002   BIN", 3, 100 * SEC);
+        write_samples(img, 151, 4, other, seed);
+        img.chain(151, 154);
+        img.add_file("A0003   BIN", 151, 4 * SEC);
+
+        FatVolume v;
+        std::vector<DirEntry> dir;
+        if (mount(v, img))
+            dir = read_root(v);
+        check(v.fat_type == 32, "FAT32 detected", v.fat_type, 32);
+        check(v.base == 8 * SEC, "MBR partition offset", double(v.base), 8 * SEC);
+        const DirEntry *d = find(dir, "a0002.bin");
+        check(d != nullptr, "FAT32 a0002.bin listed");
+        if (d)
+            check_salvage("FAT32, tail ends at the next file", salvage(v, *d, UINT64_MAX), expect,
+                          100 * SEC, 48 * SEC);
+        d = find(dir, "a0003.bin");
+        if (d)
+            check_salvage("FAT32, file behind it unchanged", salvage(v, *d, UINT64_MAX), other,
+                          4 * SEC, 0);
+        if (v.f)
+            fclose(v.f);
+    }
+
+    {
+        // A raw stream: 40 preallocated clusters, all in the chain and the
+        // size, of which 70 sectors were written before the power went.
+        // --trim cuts it after the last sector of samples.
+        TestImage img(16, 5000, 4, false);
+        std::vector<uint8_t> expect;
+        write_samples(img, 2, 70, expect, seed);
+        img.chain(2, 41);
+        img.add_file("A0004   BIN", 2, 160 * SEC);
+
+        FatVolume v;
+        std::vector<DirEntry> dir;
+        if (mount(v, img))
+            dir = read_root(v);
+        const DirEntry *d = find(dir, "a0004.bin");
+        check(d != nullptr, "raw stream listed");
+        if (d) {
+            Salvage r = salvage(v, *d, UINT64_MAX);
+            trim_tail(r, SEC);
+            check_salvage("FAT16 preallocated, --trim", r, expect, 70 * SEC, 0);
+        }
+        if (v.f)
+            fclose(v.f);
+    }
+
+    return check_summary();
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: ae_recover <card.img> [-o outdir] [-f aXXXX.bin] [--max-tail bytes] [--trim] [-n]\n"
+            "  -o DIR        write recovered files into DIR (default .)\n"
+            "  -f NAME       only recover NAME (default: every aXXXX.bin)\n"
+            "  --max-tail N  never append more than N bytes past the last sync\n"
+            "  --trim        also check the committed part (preallocated raw streams)\n"
+            "  -n            report only, do not write files\n"
+            "       ae_recover --bench\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *image = nullptr;
+    std::string outdir = ".";
+    std::string only;
+    uint64_t max_tail = UINT64_MAX;
+    bool dry_run = false;
+    bool trim = false;
+
+    if (argc >= 2 && std::string(argv[1]) == "--bench")
+        return bench();
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-o" && i + 1 < argc) outdir = argv[++i];
+        else if (a == "-f" && i + 1 < argc) only = argv[++i];
+        else if (a == "--max-tail" && i + 1 < argc) max_tail = strtoull(argv[++i], nullptr, 0);
+        else if (a == "-n") dry_run = true;
+        else if (a == "--trim") trim = true;
+        else if (a[0] != '-' && !image) image = argv[i];
+        else { usage(); return 2; }
+    }
+    if (!image) {
+        usage();
+        return 2;
+    }
+
+    FatVolume v;
+    if (!open_volume(v, image))
+        return 1;
+
+    printf("FAT%u, %u clusters of %u bytes\n", v.fat_type, v.n_clusters, v.cluster_bytes());
+
+    int found = 0;
+    for (const DirEntry &d : read_root(v)) {
+        if (only.empty() ? !is_log_name(d.name) : d.name != only)
+            continue;
+        found++;
+
+        if (!v.valid_cluster(d.start)) {
+            printf("%-10s size %10u  never synced, no start cluster\n", d.name.c_str(), d.size);
+            continue;
+        }
+
+        Salvage r = salvage(v, d, max_tail);
+        if (trim)
+            trim_tail(r, v.bytes_per_sec);
+        printf("%-10s size %10u  committed %10llu  recovered tail %10llu\n",
+               d.name.c_str(), d.size,
+               (unsigned long long)r.committed, (unsigned long long)r.tail);
+
+        if (dry_run || r.data.empty())
+            continue;
+
+        std::string path = outdir + "/" + d.name;
+        FILE *o = fopen(path.c_str(), "wb");
+        if (!o || fwrite(r.data.data(), 1, r.data.size(), o) != r.data.size()) {
+            perror(path.c_str());
+            return 1;
+        }
+        fclose(o);
+    }
+
+    if (!found)
+        printf("no matching recordings\n");
+
+    fclose(v.f);
+    return 0;
+}
@@ -0,0 +1,268 @@
+// Replay a recording or a synthetic signal through the firmware pipeline.
+//
+// Samples come from lib/ae_core/replay.c, the same source the firmware
+// uses in place of the ADC with ACQ_SOURCE_SD_REPLAY, and go block by
+// block through acq_pipeline.cpp. Prints FNV-1a digests of the samples,
+// the .sum records and the hits, so two runs (or a host run and the files
+// the board wrote from the same input) can be compared bit for bit, and
+// the pipeline throughput at max speed.
+//
+// usage: ae_replay [options] file.bin | --sine | --square | --bursts | --noise
+//   --seconds N      synthetic length (default 60)
+//   --freq HZ        carrier (default 1000)
+//   --amplitude N    counts
+//   --duty PCT       square duty (default 25)
+//   --every N        samples between bursts (default 4000)
+//   --noise-level N  +-counts of noise
+//   --seed N
+//   --realtime       pace blocks at the sample rate instead of max speed
+//   -o out.bin       write the replayed samples
+//   --sum out.sum    write the .sum sidecar the firmware would write
+//   --expect HEX     exit 1 unless the combined digest matches
+//   --trace out.trc  record the firmware's trace hooks (ae_trace converts it)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+#include "acq_pipeline.h"
+#include "replay.h"
+#include "trace.h"
+
+namespace {
+
+constexpr uint32_t N = ACQ_BLOCK_SAMPLES;
+
+struct Digest {
+    uint64_t h = 1469598103934665603ull;
+    void add(const void *p, size_t n)
+    {
+        auto b = static_cast<const uint8_t *>(p);
+        for (size_t i = 0; i < n; i++)
+            h = (h ^ b[i]) * 1099511628211ull;
+    }
+};
+
+Digest d_samples, d_stats, d_hits, d_onsets;
+uint64_t n_stats, n_hits, n_onsets;
+FILE *sum_out;
+
+uint32_t trace_clock()
+{
+    static const auto t0 = std::chrono::steady_clock::now();
+    return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - t0).count());
+}
+
+int trace_write_file(void *ctx, const void *data, uint32_t bytes)
+{
+    return fwrite(data, 1, bytes, static_cast<FILE *>(ctx)) == bytes ? 0 : -1;
+}
+
+size_t read_file(void *ctx, uint16_t *dst, size_t n)
+{
+    return fread(dst, sizeof(uint16_t), n, static_cast<FILE *>(ctx));
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: ae_replay [--seconds N] [--freq HZ] [--amplitude N] [--duty PCT]\n"
+                    "                 [--every N] [--noise-level N] [--seed N] [--realtime]\n"
+                    "                 [-o out.bin] [--sum out.sum] [--expect HEX] [--trace out.trc]\n"
+                    "                 file.bin | --sine | --square | --bursts | --noise\n");
+    return 2;
+}
+
+} // namespace
+
+void acq_on_stats(const block_stats_t *r)
+{
+    // t_us depends on when the block was replayed; keep it out of the digest
+    block_stats_t c = *r;
+    c.t_us = 0;
+    d_stats.add(&c, sizeof(c));
+    n_stats++;
+    if (sum_out)
+        fwrite(r, sizeof(*r), 1, sum_out);
+}
+
+void acq_on_hit(const acq_hit_t *h)
+{
+    d_hits.add(&h->start, sizeof(h->start));
+    d_hits.add(&h->duration, sizeof(h->duration));
+    d_hits.add(&h->peak, sizeof(h->peak));
+    d_hits.add(&h->counts, sizeof(h->counts));
+    n_hits++;
+}
+
+void acq_on_onset(const acq_onset_t *o)
+{
+    d_onsets.add(&o->at_q8, sizeof(o->at_q8));
+    d_onsets.add(&o->trigger, sizeof(o->trigger));
+    n_onsets++;
+}
+
+int main(int argc, char **argv)
+{
+    replay_config_t cfg;
+    replay_config_default(&cfg, REPLAY_SQUARE);
+    bool have_source = false;
+    std::string path, out_path, sum_path, trace_path;
+    uint32_t seconds = 60;
+    bool realtime = false;
+    bool expect = false;
+    uint64_t expected = 0;
+
+    // Source first so its defaults can be overridden
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        replay_kind_t k = REPLAY_FILE;
+        if (a == "--sine") k = REPLAY_SINE;
+        else if (a == "--square") k = REPLAY_SQUARE;
+        else if (a == "--bursts") k = REPLAY_BURSTS;
+        else if (a == "--noise") k = REPLAY_NOISE;
+        else continue;
+        replay_config_default(&cfg, k);
+        have_source = true;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--sine" || a == "--square" || a == "--bursts" || a == "--noise") continue;
+        else if (a == "--seconds" && more) seconds = uint32_t(atoi(argv[++i]));
+        else if (a == "--freq" && more) cfg.freq_hz = uint32_t(atoi(argv[++i]));
+        else if (a == "--amplitude" && more) cfg.amplitude = uint16_t(atoi(argv[++i]));
+        else if (a == "--duty" && more) cfg.duty_pct = uint8_t(atoi(argv[++i]));
+        else if (a == "--every" && more) cfg.burst_every = uint32_t(atoi(argv[++i]));
+        else if (a == "--noise-level" && more) cfg.noise = uint16_t(atoi(argv[++i]));
+        else if (a == "--seed" && more) cfg.seed = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if (a == "--realtime") realtime = true;
+        else if (a == "-o" && more) out_path = argv[++i];
+        else if (a == "--sum" && more) sum_path = argv[++i];
+        else if (a == "--trace" && more) trace_path = argv[++i];
+        else if (a == "--expect" && more) { expect = true; expected = strtoull(argv[++i], nullptr, 16); }
+        else if (a[0] == '-') return usage();
+        else if (path.empty() && !have_source) { path = a; have_source = true; }
+        else return usage();
+    }
+    if (!have_source)
+        return usage();
+
+    FILE *in = nullptr;
+    if (!path.empty()) {
+        in = fopen(path.c_str(), "rb");
+        if (!in) {
+            perror(path.c_str());
+            return 1;
+        }
+        cfg.kind = REPLAY_FILE;
+        cfg.read = read_file;
+        cfg.ctx = in;
+    }
+
+    FILE *out = nullptr;
+    if (!out_path.empty() && !(out = fopen(out_path.c_str(), "wb"))) {
+        perror(out_path.c_str());
+        return 1;
+    }
+    if (!sum_path.empty()) {
+        if (!(sum_out = fopen(sum_path.c_str(), "wb"))) {
+            perror(sum_path.c_str());
+            return 1;
+        }
+        summary_header_t h{};
+        h.magic = SUMMARY_MAGIC;
+        h.version = SUMMARY_VERSION;
+        h.record_size = sizeof(block_stats_t);
+        h.block_samples = N;
+        h.sample_rate = cfg.sample_rate;
+        fwrite(&h, sizeof(h), 1, sum_out);
+    }
+
+    // Same hooks as on target, timed by the host clock
+    trace_t trace;
+    std::vector<trace_event_t> trace_buf(1 << 16);
+    if (!trace_path.empty()) {
+        trace_init(&trace, trace_buf.data(), uint32_t(trace_buf.size()), nullptr, trace_clock, 1000000);
+        trace_sink = &trace;
+    }
+
+    replay_t r;
+    replay_init(&r, &cfg);
+    acq_pipeline_reset();
+
+    const uint64_t limit = in ? UINT64_MAX : uint64_t(seconds) * cfg.sample_rate;
+    std::vector<uint16_t> buf(N);
+    uint64_t blocks = 0;
+    double busy = 0;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint64_t start_ns = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+
+    while (r.pos + N <= limit && replay_fill(&r, buf.data(), N) == N) {
+        uint64_t t_us = replay_time_us(&r, 0);
+        if (realtime) {
+            uint64_t due_ns = start_ns + t_us * 1000;
+            timespec ts{time_t(due_ns / 1000000000), long(due_ns % 1000000000)};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+        }
+
+        TRACE(TR_BLOCK_PUBLISH, blocks + 1);
+        auto t0 = std::chrono::steady_clock::now();
+        acq_pipeline_push(buf.data(), t_us);
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        TRACE(TR_BLOCK_CONSUME, blocks + 1);
+
+        d_samples.add(buf.data(), N * sizeof(uint16_t));
+        if (out)
+            fwrite(buf.data(), sizeof(uint16_t), N, out);
+        blocks++;
+    }
+    // A partial last block is not recorded by the firmware either
+
+    Digest all;
+    all.add(&d_samples.h, 8);
+    all.add(&d_stats.h, 8);
+    all.add(&d_hits.h, 8);
+
+    printf("%llu blocks (%.1f s), %llu records, %llu hits\n",
+           (unsigned long long)blocks, double(blocks) * N / cfg.sample_rate,
+           (unsigned long long)n_stats, (unsigned long long)n_hits);
+    printf("samples %016llx  stats %016llx  hits %016llx  digest %016llx\n",
+           (unsigned long long)d_samples.h, (unsigned long long)d_stats.h,
+           (unsigned long long)d_hits.h, (unsigned long long)all.h);
+    // Not in the combined digest, which predates the onset picker
+    printf("%llu onsets %016llx\n", (unsigned long long)n_onsets, (unsigned long long)d_onsets.h);
+    if (blocks)
+        printf("pipeline %.2f us/block, %.1f MS/s\n",
+               busy * 1e6 / blocks, double(blocks) * N / busy / 1e6);
+
+    if (!trace_path.empty()) {
+        trace_sink = nullptr;
+        FILE *tf = fopen(trace_path.c_str(), "wb");
+        if (!tf || trace_dump(&trace, trace_write_file, tf) != 0) {
+            perror(trace_path.c_str());
+            return 1;
+        }
+        fclose(tf);
+        uint32_t first;
+        printf("%u trace events in %s\n", trace_count(&trace, &first), trace_path.c_str());
+    }
+
+    if (in) fclose(in);
+    if (out) fclose(out);
+    if (sum_out) fclose(sum_out);
+
+    if (expect && all.h != expected) {
+        printf("FAIL: digest %016llx, expected %016llx\n",
+               (unsigned long long)all.h, (unsigned long long)expected);
+        return 1;
+    }
+    return 0;
+}
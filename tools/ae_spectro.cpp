@@ -0,0 +1,372 @@
+// Spectrogram of a raw recording (spectrogram.cpp).
+//
+// Streams the recording in time tiles, one tile per worker at a time, so
+// memory stays at a few MB whatever the file size. Writes the dB matrix
+// (-o), a downsampled overview image (--image) and full-resolution images
+// of each tile (--tiles DIR). With no output named it writes the overview
+// to file.bin.pgm. The sample rate comes from the aXXXX.sum sidecar when
+// there is one.
+//
+// --bench checks the FFT against a direct DFT and its AVX2 build against
+// the baseline one, times the FFT kernels, then runs a synthetic recording
+// of MSAMPLES Mi samples at 1, 2, 4 and 8 threads: frames/s, speedup, and
+// the same rows at every thread count and tile size.
+//
+// usage: ae_spectro [-n N] [--hop H] [--avg A] [--tile ROWS] [--rate HZ]
+//                   [--full-scale CODES] [--range LO HI] [--width W] [--height H]
+//                   [-j THREADS] [-o matrix.f32] [--image overview.pgm]
+//                   [--tiles DIR] file.bin
+//        ae_spectro --bench [MSAMPLES] [-j THREADS]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "fft.h"
+#include "spectrogram.h"
+#include "tool_util.h"
+
+namespace {
+
+// summary_header_t (lib/ae_core/block_stats.h): "AESM", then sample_rate at byte 12
+constexpr uint32_t SUM_MAGIC = 0x4D534541u;
+constexpr size_t SUM_RATE_OFFSET = 12;
+
+int usage()
+{
+    fprintf(stderr,
+            "usage: ae_spectro [-n N] [--hop H] [--avg A] [--tile ROWS] [--rate HZ]\n"
+            "                  [--full-scale CODES] [--range LO HI] [--width W] [--height H]\n"
+            "                  [-j THREADS] [-o matrix.f32] [--image overview.pgm]\n"
+            "                  [--tiles DIR] file.bin\n"
+            "       ae_spectro --bench [MSAMPLES] [-j THREADS]\n");
+    return 2;
+}
+
+std::string sidecar(const std::string &bin, const char *ext)
+{
+    size_t dot = bin.rfind('.');
+    return (dot == std::string::npos ? bin : bin.substr(0, dot)) + ext;
+}
+
+// Sample rate from aXXXX.sum, 0 if there is none
+double sum_rate(const std::string &bin)
+{
+    FILE *f = fopen(sidecar(bin, ".sum").c_str(), "rb");
+    if (!f)
+        return 0;
+    uint8_t h[32];
+    bool ok = fread(h, sizeof(h), 1, f) == 1;
+    fclose(f);
+    uint32_t magic, rate;
+    memcpy(&magic, h, sizeof(magic));
+    memcpy(&rate, h + SUM_RATE_OFFSET, sizeof(rate));
+    return ok && magic == SUM_MAGIC ? rate : 0;
+}
+
+long max_rss_kb()
+{
+    struct rusage ru {};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+int run(const std::string &path, SpectroConfig cfg, bool rate_given)
+{
+    if (!rate_given) {
+        if (double r = sum_rate(path))
+            cfg.sample_rate = r;
+    }
+    if (access(sidecar(path, ".rat").c_str(), F_OK) == 0)
+        fprintf(stderr, "%s: burst-mode rate changes are not applied, every row is at %.0f S/s\n",
+                path.c_str(), cfg.sample_rate);
+    if (cfg.matrix.empty() && cfg.image.empty() && cfg.tile_dir.empty())
+        cfg.image = path + ".pgm";
+
+    SpectroResult res;
+    if (!spectrogram(path, cfg, res))
+        return 1;
+    printf("%s: %llu samples at %.0f S/s, %llu frames (n %u, hop %u), %llu rows x %u bins "
+           "(%.2f Hz), %u tiles\n",
+           path.c_str(), (unsigned long long)res.samples, cfg.sample_rate,
+           (unsigned long long)res.frames, cfg.n, cfg.hop, (unsigned long long)res.rows, res.bins,
+           cfg.sample_rate / cfg.n, res.tiles);
+    printf("%.3f s on %u threads: %.0f frames/s, %.1f MB/s, %.1f MB working memory\n",
+           res.seconds, res.threads, res.frames / res.seconds,
+           res.samples * 2 / res.seconds / 1e6, res.work_bytes / 1e6);
+    for (const std::string *o : {&cfg.matrix, &cfg.image})
+        if (!o->empty())
+            printf("wrote %s\n", o->c_str());
+    return 0;
+}
+
+// ---- Benchmark ----
+
+struct Lcg {
+    uint32_t x;
+    uint32_t next() { return x = x * 1664525 + 1013904223; }
+    float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+};
+
+void check_fft()
+{
+    Lcg r{3};
+    for (uint32_t n : {8u, 16u, 256u, 1024u, 4096u}) {
+        Fft fft(n);
+        std::vector<float> in(n), p(n / 2 + 1), q(n / 2 + 1);
+        for (float &v : in)
+            v = r.uniform() * 2 - 1;
+        fft.power(in.data(), p.data());
+        fft.power_complex(in.data(), q.data());
+        double worst = 0, worst_c = 0;
+        for (uint32_t k = 0; k <= n / 2; k++) {
+            double re = 0, im = 0;
+            for (uint32_t t = 0; t < n; t++) {
+                re += in[t] * std::cos(2 * M_PI * double(k) * t / n);
+                im -= in[t] * std::sin(2 * M_PI * double(k) * t / n);
+            }
+            double ref = re * re + im * im;
+            worst = std::max(worst, std::fabs(p[k] - ref) / (ref + n));
+            worst_c = std::max(worst_c, std::fabs(q[k] - ref) / (ref + n));
+        }
+        char what[64];
+        snprintf(what, sizeof(what), "FFT-%u real power vs DFT", n);
+        check(worst < 1e-4, what, worst, 1e-4);
+        snprintf(what, sizeof(what), "FFT-%u complex power vs DFT", n);
+        check(worst_c < 1e-4, what, worst_c, 1e-4);
+    }
+
+    // Both builds of the butterfly stages, same input: same bits
+    if (fft_detail::have_avx2()) {
+        const uint32_t m = 2048;
+        std::vector<float> wr(m), wi(m), a(2 * m), b;
+        for (uint32_t h = 1; h < m; h <<= 1)
+            for (uint32_t k = 0; k < h; k++) {
+                wr[h - 1 + k] = float(std::cos(-M_PI * k / h));
+                wi[h - 1 + k] = float(std::sin(-M_PI * k / h));
+            }
+        for (float &v : a)
+            v = r.uniform();
+        b = a;
+        fft_detail::stages_base(a.data(), a.data() + m, m, wr.data(), wi.data());
+        fft_detail::stages_avx2(b.data(), b.data() + m, m, wr.data(), wi.data());
+        check(a == b, "AVX2 stages bit-identical to baseline");
+    }
+}
+
+void bench_fft()
+{
+    const uint32_t n = 1024, frames = 20000;
+    Fft fft(n);
+    std::vector<float> in(n), p(n / 2 + 1);
+    Lcg r{5};
+    for (float &v : in)
+        v = r.uniform();
+    float sink = 0;
+
+    auto time = [&](auto fn) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (uint32_t f = 0; f < frames; f++) {
+            in[f % n] += 1e-3f;
+            fn();
+            sink += p[f % (n / 2)];
+        }
+        return seconds_since(t0) * 1e9 / frames;
+    };
+    double complex_ns = time([&] { fft.power_complex(in.data(), p.data()); });
+    double real_ns = time([&] { fft.power(in.data(), p.data()); });
+    printf("FFT-%u power: complex %u-point %.0f ns/frame, real split %.0f ns/frame (%.1fx), %s\n",
+           n, n, complex_ns, real_ns, complex_ns / real_ns,
+           fft_detail::have_avx2() ? "AVX2" : "baseline");
+
+    // Stage kernels alone on one split-complex buffer
+    const uint32_t m = n / 2;
+    std::vector<float> wr(m), wi(m), re(m), im(m);
+    for (uint32_t h = 1; h < m; h <<= 1)
+        for (uint32_t k = 0; k < h; k++) {
+            wr[h - 1 + k] = float(std::cos(-M_PI * k / h));
+            wi[h - 1 + k] = float(std::sin(-M_PI * k / h));
+        }
+    auto stages = [&](auto fn) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (uint32_t f = 0; f < frames; f++) {
+            std::fill(re.begin(), re.end(), float(f & 7));
+            fn(re.data(), im.data(), m, wr.data(), wi.data());
+            sink += re[f % m];
+        }
+        return seconds_since(t0) * 1e9 / frames;
+    };
+    double base_ns = stages(fft_detail::stages_base);
+    if (fft_detail::have_avx2()) {
+        double avx_ns = stages(fft_detail::stages_avx2);
+        printf("butterfly stages (%u-point): baseline %.0f ns, AVX2 %.0f ns (%.1fx)\n",
+               m, base_ns, avx_ns, base_ns / avx_ns);
+    } else {
+        printf("butterfly stages (%u-point): baseline %.0f ns\n", m, base_ns);
+    }
+    if (sink == 1234.5f)
+        printf(" ");
+}
+
+// Tone of known level on an exact bin, with a little noise; a second tone
+// in alternate 10 s stretches so rows differ over time
+bool write_synthetic(const char *path, uint32_t msamples, double rate, double tone_hz, double amp)
+{
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    std::vector<uint16_t> block(1 << 20);
+    Lcg r{1};
+    uint64_t i = 0;
+    const double w = 2 * M_PI * tone_hz / rate, w2 = 2 * M_PI * 1234.5 / rate;
+    for (uint32_t m = 0; m < msamples; m++) {
+        for (auto &v : block) {
+            double x = 2048 + amp * std::sin(w * double(i)) + (r.uniform() - 0.5f) * 16;
+            if ((i / uint64_t(10 * rate)) & 1)
+                x += 200 * std::sin(w2 * double(i));
+            v = uint16_t(std::lround(x));
+            i++;
+        }
+        if (write(fd, block.data(), block.size() * 2) != ssize_t(block.size() * 2)) {
+            perror(path);
+            ::close(fd);
+            return false;
+        }
+    }
+    ::close(fd);
+    return true;
+}
+
+int bench(uint32_t msamples, unsigned threads)
+{
+    check_fft();
+    bench_fft();
+
+    char path[] = "/tmp/ae_spectro_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    ::close(fd);
+    std::string src = path, matrix = src + ".f32", image = src + ".pgm";
+
+    SpectroConfig cfg;
+    const double rate = cfg.sample_rate, tone = 100.0 * rate / cfg.n, amp = 1000;
+    if (!write_synthetic(path, msamples, rate, tone, amp)) {
+        unlink(path);
+        return 1;
+    }
+
+    // Full outputs once, on every core: the tone's bin and level
+    cfg.matrix = matrix;
+    cfg.image = image;
+    cfg.threads = threads;
+    SpectroResult full;
+    check(spectrogram(src, cfg, full), "spectrogram with outputs");
+    printf("%u Mi samples: %llu frames, %u tiles of %u rows, %.1f MB working memory, "
+           "peak RSS %.1f MB (file %.0f MB)\n",
+           msamples, (unsigned long long)full.frames, full.tiles, cfg.tile_rows,
+           full.work_bytes / 1e6, max_rss_kb() / 1e3, msamples * 2.097152);
+
+    int mf = ::open(matrix.c_str(), O_RDONLY);
+    SpectroHeader h{};
+    std::vector<float> row(full.bins);
+    bool ok = mf >= 0 && pread(mf, &h, sizeof(h), 0) == ssize_t(sizeof(h)) &&
+              memcmp(h.magic, SPECTRO_MAGIC, 4) == 0 && h.rows == full.rows;
+    check(ok, "matrix header");
+    const double want_db = 20 * std::log10(2 * amp / cfg.full_scale);
+    for (uint64_t r : {uint64_t(0), full.rows / 2, full.rows - 1}) {
+        if (!ok || pread(mf, row.data(), row.size() * 4, off_t(sizeof(h) + r * row.size() * 4)) !=
+                       ssize_t(row.size() * 4)) {
+            check(false, "matrix row read");
+            break;
+        }
+        uint32_t peak = uint32_t(std::max_element(row.begin(), row.end()) - row.begin());
+        check(peak == 100, "tone bin", peak, 100);
+        check(std::fabs(row[peak] - want_db) < 0.05, "tone level dBFS", row[peak], want_db);
+    }
+    if (mf >= 0)
+        ::close(mf);
+    unlink(matrix.c_str());
+    unlink(image.c_str());
+
+    // Throughput: transform only, the same rows at every thread count
+    cfg.matrix.clear();
+    cfg.image.clear();
+    std::vector<unsigned> counts = {1, 2, 4, 8};
+    if (threads)
+        counts = {threads};
+    double base = 0;
+    for (unsigned t : counts) {
+        cfg.threads = t;
+        SpectroResult res;
+        spectrogram(src, cfg, res);
+        base = base ? base : res.seconds;
+        printf("%u threads: %.3f s, %.0f frames/s, %.1f MB/s, %.2fx\n", t, res.seconds,
+               res.frames / res.seconds, res.samples * 2 / res.seconds / 1e6, base / res.seconds);
+        check(res.digest == full.digest, "rows independent of the thread count");
+    }
+    cfg.tile_rows = 97;
+    cfg.threads = threads;
+    SpectroResult odd;
+    spectrogram(src, cfg, odd);
+    check(odd.digest == full.digest, "rows independent of the tile size");
+    printf("digest %016llx\n", (unsigned long long)full.digest);
+
+    unlink(path);
+    return check_summary();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    SpectroConfig cfg;
+    cfg.hop = 0;                    // n / 2 unless given
+    bool bench_mode = false, rate_given = false;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--bench") bench_mode = true;
+        else if (a == "-n" && more) cfg.n = uint32_t(atoi(argv[++i]));
+        else if (a == "--hop" && more) cfg.hop = uint32_t(atoi(argv[++i]));
+        else if (a == "--avg" && more) cfg.avg = uint32_t(atoi(argv[++i]));
+        else if (a == "--tile" && more) cfg.tile_rows = uint32_t(atoi(argv[++i]));
+        else if (a == "--rate" && more) cfg.sample_rate = atof(argv[++i]), rate_given = true;
+        else if (a == "--full-scale" && more) cfg.full_scale = atof(argv[++i]);
+        else if (a == "--range" && i + 2 < argc) {
+            cfg.db_lo = float(atof(argv[++i]));
+            cfg.db_hi = float(atof(argv[++i]));
+        }
+        else if (a == "--width" && more) cfg.width = uint32_t(atoi(argv[++i]));
+        else if (a == "--height" && more) cfg.height = uint32_t(atoi(argv[++i]));
+        else if (a == "-j" && more) cfg.threads = unsigned(atoi(argv[++i]));
+        else if (a == "-o" && more) cfg.matrix = argv[++i];
+        else if (a == "--image" && more) cfg.image = argv[++i];
+        else if (a == "--tiles" && more) cfg.tile_dir = argv[++i];
+        else if (a[0] == '-') return usage();
+        else args.push_back(a);
+    }
+
+    if (cfg.hop == 0)
+        cfg.hop = cfg.n / 2;
+    if (bench_mode)
+        return bench(args.empty() ? 64 : uint32_t(atoi(args[0].c_str())), cfg.threads);
+    if (args.size() != 1 || cfg.db_hi <= cfg.db_lo)
+        return usage();
+    return run(args[0], cfg, rate_given);
+}
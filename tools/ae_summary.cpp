@@ -0,0 +1,203 @@
+// Summarise recordings from their aXXXX.sum sidecars.
+//
+// For each file prints duration, range, mean, RMS, clipping and zero-
+// crossing rate; with --every, one row per interval. A .bin without a
+// sidecar (older recordings) is summarised by running the firmware's
+// block_stats kernel over it.
+//
+// usage: ae_summary [--every SEC] [--rate HZ] [--from-bin] file.bin|file.sum ...
+//        ae_summary --bench [MSAMPLES]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "block_stats.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t DEFAULT_BLOCK = 1024;
+constexpr uint32_t DEFAULT_RATE = 4000;
+
+struct Summary {
+    uint32_t block_samples = DEFAULT_BLOCK;
+    uint32_t sample_rate = DEFAULT_RATE;
+    uint32_t cal_crc = 0;
+    std::vector<block_stats_t> blocks;
+};
+
+bool read_sidecar(const std::string &path, Summary &s)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+
+    summary_header_t h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == SUMMARY_MAGIC &&
+              h.record_size == sizeof(block_stats_t);
+    if (ok) {
+        s.block_samples = h.block_samples;
+        s.sample_rate = h.sample_rate;
+        s.cal_crc = h.cal_crc;
+        block_stats_t r;
+        while (fread(&r, sizeof(r), 1, f) == 1)
+            s.blocks.push_back(r);
+    } else {
+        fprintf(stderr, "%s: not a summary sidecar\n", path.c_str());
+    }
+    fclose(f);
+    return ok;
+}
+
+// Same kernel and chaining as the logger, but over the whole .bin
+bool scan_bin(const std::string &path, Summary &s)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+
+    std::vector<uint16_t> buf(s.block_samples);
+    uint16_t center = 0;
+    uint8_t above = BLOCK_STATS_ABOVE_UNKNOWN;
+    size_t n;
+
+    while ((n = fread(buf.data(), sizeof(uint16_t), buf.size(), f)) > 0) {
+        if (s.blocks.empty())
+            center = block_stats_center(buf.data(), uint32_t(n));
+        block_stats_t r{};
+        block_stats_compute(&r, buf.data(), uint32_t(n), center, &above);
+        r.seq = uint32_t(s.blocks.size());
+        r.t_us = uint64_t(r.seq + 1) * s.block_samples * 1000000 / s.sample_rate;
+        center = block_stats_mean(&r, uint32_t(n));
+        s.blocks.push_back(r);
+    }
+    fclose(f);
+    return true;
+}
+
+void print_row(const char *label, const block_stats_t *b, size_t count,
+               uint32_t block_samples, uint32_t rate)
+{
+    uint64_t n = uint64_t(count) * block_samples;
+    if (n == 0)
+        return;
+
+    uint32_t mn = 0xFFFF, mx = 0;
+    uint64_t clipped = 0, zc = 0;
+    double sum = 0, sumsq = 0;
+    for (size_t i = 0; i < count; i++) {
+        mn = std::min<uint32_t>(mn, b[i].min);
+        mx = std::max<uint32_t>(mx, b[i].max);
+        sum += b[i].sum;
+        sumsq += double(b[i].sumsq);
+        clipped += b[i].clipped;
+        zc += b[i].zero_cross;
+    }
+
+    double mean = sum / n;
+    double rms = std::sqrt(sumsq / n);
+    double ac_rms = std::sqrt(std::max(0.0, sumsq / n - mean * mean));
+    double secs = double(n) / rate;
+
+    printf("%-14s %9.2f %5u %5u %8.2f %8.2f %8.2f %8llu %9.1f\n",
+           label, secs, mn, mx, mean, rms, ac_rms,
+           (unsigned long long)clipped, zc / 2.0 / secs);
+}
+
+void summarise(const std::string &name, const Summary &s, double every)
+{
+    printf("%s: %zu blocks of %u samples at %u Hz\n",
+           name.c_str(), s.blocks.size(), s.block_samples, s.sample_rate);
+    if (s.cal_crc)
+        printf("stats computed through ADC table %08x (the .bin has raw codes)\n", s.cal_crc);
+    printf("%-14s %9s %5s %5s %8s %8s %8s %8s %9s\n",
+           "", "seconds", "min", "max", "mean", "rms", "ac rms", "clipped", "zc Hz");
+
+    if (every > 0) {
+        double block_secs = double(s.block_samples) / s.sample_rate;
+        size_t per = std::max<size_t>(1, size_t(every / block_secs + 0.5));
+        for (size_t i = 0; i < s.blocks.size(); i += per) {
+            char label[32];
+            snprintf(label, sizeof(label), "@%.1fs", i * block_secs);
+            print_row(label, &s.blocks[i], std::min(per, s.blocks.size() - i),
+                      s.block_samples, s.sample_rate);
+        }
+    }
+    print_row("total", s.blocks.data(), s.blocks.size(), s.block_samples, s.sample_rate);
+}
+
+int bench(uint32_t msamples)
+{
+    std::vector<uint16_t> data(size_t(msamples) * 1000000);
+    uint32_t x = 1;
+    for (auto &v : data) {
+        x = x * 1664525 + 1013904223;
+        v = uint16_t(x >> 20);
+    }
+
+    block_stats_t r{};
+    uint8_t above = BLOCK_STATS_ABOVE_UNKNOWN;
+    uint64_t check = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t off = 0; off + DEFAULT_BLOCK <= data.size(); off += DEFAULT_BLOCK) {
+        block_stats_compute(&r, &data[off], DEFAULT_BLOCK, 2048, &above);
+        check += r.sum + r.zero_cross;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("block_stats_compute: %u M samples in %.3f s, %.1f MS/s, %.2f ns/sample (check %llu)\n",
+           msamples, secs, data.size() / secs / 1e6, secs * 1e9 / data.size(),
+           (unsigned long long)check);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    double every = 0;
+    uint32_t rate = DEFAULT_RATE;
+    bool from_bin = false;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--every" && i + 1 < argc) every = atof(argv[++i]);
+        else if (a == "--rate" && i + 1 < argc) rate = uint32_t(atoi(argv[++i]));
+        else if (a == "--from-bin") from_bin = true;
+        else if (a == "--bench") return bench(i + 1 < argc ? uint32_t(atoi(argv[++i])) : 64);
+        else if (a[0] == '-') {
+            fprintf(stderr, "usage: ae_summary [--every SEC] [--rate HZ] [--from-bin] file ...\n"
+                            "       ae_summary --bench [MSAMPLES]\n");
+            return 2;
+        }
+        else files.push_back(a);
+    }
+
+    int rc = 0;
+    for (const std::string &path : files) {
+        Summary s;
+        s.sample_rate = rate;
+        std::string sum = with_ext(path, ".sum");
+        bool ok = !from_bin && read_sidecar(sum, s);
+        if (!ok) {
+            s = Summary();
+            s.sample_rate = rate;
+            ok = scan_bin(with_ext(path, ".bin"), s);
+        }
+        if (!ok) {
+            rc = 1;
+            continue;
+        }
+        summarise(path, s, every);
+    }
+    return rc;
+}
@@ -0,0 +1,472 @@
+// Event traces (lib/ae_core/trace.c) to Chrome trace JSON.
+//
+// Reads a dump the firmware saved (aXXXX.trc, trace.trc), a serial log
+// with "trace: " hex lines from the console 't' command (the last dump in
+// the log is used), or a trace from ae_replay --trace. Writes JSON that
+// Perfetto (ui.perfetto.dev) and chrome://tracing open. Interrupt handlers
+// go on an "irq" track and everything else on "main"; ring publish and
+// consume events also become a "ring backlog" counter. A summary of event
+// counts, durations and block intervals goes to stdout.
+//
+// --bench checks the ring (overwrite order, trigger, dump, hex log,
+// timestamp wrap) and the converter, and times one event.
+//
+// usage: ae_trace file.trc|console.log [-o out.json]
+//        ae_trace --bench
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "trace.h"
+#include "tool_util.h"
+
+namespace {
+
+struct Trace {
+    trace_header_t h{};
+    std::vector<trace_event_t> ev;
+};
+
+int hexval(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Bytes of the last complete dump in a console log
+bool parse_log(const std::string &text, std::vector<uint8_t> &out)
+{
+    std::vector<uint8_t> cur, last;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t k = line.find("trace: ");
+        if (k == std::string::npos)
+            continue;
+        std::string hex = line.substr(k + 7);
+        while (!hex.empty() && (hex.back() == '\r' || hex.back() == ' '))
+            hex.pop_back();
+        bool ok = !hex.empty() && hex.size() % 2 == 0;
+        std::vector<uint8_t> bytes;
+        for (size_t i = 0; ok && i < hex.size(); i += 2) {
+            int a = hexval(hex[i]), b = hexval(hex[i + 1]);
+            ok = a >= 0 && b >= 0;
+            bytes.push_back(uint8_t(a << 4 | b));
+        }
+        if (!ok)
+            continue;
+
+        // A header starts a new dump
+        uint32_t magic = 0;
+        if (bytes.size() >= 4)
+            memcpy(&magic, bytes.data(), 4);
+        if (magic == TRACE_MAGIC && cur.size() % sizeof(trace_event_t) == 0) {
+            if (!cur.empty())
+                last = cur;
+            cur.clear();
+        }
+        cur.insert(cur.end(), bytes.begin(), bytes.end());
+    }
+    if (!cur.empty())
+        last = cur;
+    out = last;
+    return !out.empty();
+}
+
+bool decode(const std::vector<uint8_t> &b, Trace &t, std::string &why)
+{
+    if (b.size() < sizeof(trace_header_t)) {
+        why = "no trace header";
+        return false;
+    }
+    memcpy(&t.h, b.data(), sizeof(t.h));
+    if (t.h.magic != TRACE_MAGIC || t.h.version != TRACE_VERSION ||
+        t.h.event_size != sizeof(trace_event_t)) {
+        why = "not a trace, or an unknown version";
+        return false;
+    }
+    size_t have = (b.size() - sizeof(t.h)) / sizeof(trace_event_t);
+    if (have < t.h.events) {
+        why = "truncated: " + std::to_string(have) + " of " + std::to_string(t.h.events) + " events";
+        t.h.events = uint32_t(have);
+    }
+    t.ev.resize(t.h.events);
+    memcpy(t.ev.data(), b.data() + sizeof(t.h), t.ev.size() * sizeof(trace_event_t));
+    return true;
+}
+
+bool load(const std::string &path, Trace &t)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    std::vector<uint8_t> b;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        b.insert(b.end(), chunk, chunk + n);
+    fclose(f);
+
+    uint32_t magic = 0;
+    if (b.size() >= 4)
+        memcpy(&magic, b.data(), 4);
+    if (magic != TRACE_MAGIC) {
+        std::vector<uint8_t> d;
+        if (!parse_log(std::string(b.begin(), b.end()), d)) {
+            fprintf(stderr, "%s: neither a trace dump nor a log with trace: lines\n", path.c_str());
+            return false;
+        }
+        b.swap(d);
+    }
+    std::string why;
+    bool ok = decode(b, t, why);
+    if (!why.empty())
+        fprintf(stderr, "%s: %s\n", path.c_str(), why.c_str());
+    return ok;
+}
+
+// Timestamps in clock ticks from the first event. Events can be a few
+// ticks out of order (an interrupt between claiming a slot and reading the
+// clock), so each step is taken as signed.
+std::vector<int64_t> unwrap(const Trace &t)
+{
+    std::vector<int64_t> ts(t.ev.size());
+    int64_t now = 0;
+    for (size_t i = 0; i < t.ev.size(); i++) {
+        if (i)
+            now += int32_t(t.ev[i].t - t.ev[i - 1].t);
+        ts[i] = now;
+    }
+    return ts;
+}
+
+struct Stat {
+    uint64_t n = 0;
+    double sum = 0, max = 0, min = 1e300;
+    void add(double v)
+    {
+        n++;
+        sum += v;
+        max = std::max(max, v);
+        min = std::min(min, v);
+    }
+};
+
+struct Converted {
+    uint32_t begins = 0, ends = 0, dropped_ends = 0;
+};
+
+Converted to_json(const Trace &t, FILE *out, bool summary)
+{
+    std::vector<int64_t> ts = unwrap(t);
+    double us_per_tick = 1e6 / (t.h.clock_hz ? t.h.clock_hz : 1000000);
+    Converted c;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}},\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"irq\"}}");
+
+    std::vector<Stat> dur(TR_IDS), count(TR_IDS);
+    Stat publish_gap;
+    int64_t last_publish = -1;
+    // Open begins per lane: id and start, to drop ends the ring cut off
+    std::vector<std::pair<uint8_t, int64_t>> open[2];
+    int32_t head = -1, tail = -1;
+
+    for (size_t i = 0; i < t.ev.size(); i++) {
+        const trace_event_t &e = t.ev[i];
+        uint8_t lane = trace_lane(e.id);
+        double us = ts[i] * us_per_tick;
+        const char *name = trace_name(e.id);
+        char label[32];
+        if (e.id == TR_TASK) {
+            snprintf(label, sizeof(label), "task %u", e.arg);
+            name = label;
+        }
+
+        if (e.phase == TRACE_B) {
+            open[lane].push_back({e.id, ts[i]});
+            c.begins++;
+        } else if (e.phase == TRACE_E) {
+            auto &st = open[lane];
+            if (st.empty() || st.back().first != e.id) {
+                c.dropped_ends++;
+                continue;
+            }
+            dur[e.id].add((ts[i] - st.back().second) * us_per_tick);
+            st.pop_back();
+            c.ends++;
+        }
+        if (e.phase != TRACE_E)
+            count[e.id].add(0);
+
+        fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,%s\"args\":{\"arg\":%u}}",
+                name, e.phase == TRACE_B ? "B" : e.phase == TRACE_E ? "E" : "i", us, lane,
+                e.phase == TRACE_I ? "\"s\":\"t\"," : "", e.arg);
+
+        if (e.id == TR_BLOCK_PUBLISH) {
+            head = e.arg;
+            if (last_publish >= 0)
+                publish_gap.add((ts[i] - last_publish) * us_per_tick);
+            last_publish = ts[i];
+        } else if (e.id == TR_BLOCK_CONSUME) {
+            tail = e.arg;
+        }
+        if ((e.id == TR_BLOCK_PUBLISH || e.id == TR_BLOCK_CONSUME) && head >= 0 && tail >= 0)
+            fprintf(out, ",\n{\"name\":\"ring backlog\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"blocks\":%u}}",
+                    us, uint16_t(head - tail));
+    }
+    fprintf(out, "\n]}\n");
+
+    if (!summary)
+        return c;
+    double span = ts.empty() ? 0 : ts.back() * us_per_tick;
+    printf("%zu events over %.3f s, %u overwritten before the dump\n", t.ev.size(), span / 1e6, t.h.lost);
+    printf("%-16s %8s %12s %12s\n", "event", "count", "mean us", "max us");
+    for (uint32_t id = 1; id < TR_IDS; id++) {
+        if (!count[id].n)
+            continue;
+        if (dur[id].n)
+            printf("%-16s %8llu %12.1f %12.1f\n", trace_name(uint8_t(id)),
+                   (unsigned long long)count[id].n, dur[id].sum / dur[id].n, dur[id].max);
+        else
+            printf("%-16s %8llu %12s %12s\n", trace_name(uint8_t(id)),
+                   (unsigned long long)count[id].n, "", "");
+    }
+    if (publish_gap.n)
+        printf("block interval: min %.1f, mean %.1f, max %.1f us\n", publish_gap.min,
+               publish_gap.sum / publish_gap.n, publish_gap.max);
+    if (c.dropped_ends)
+        printf("%u ends without their begin (cut off by the ring)\n", c.dropped_ends);
+    return c;
+}
+
+int convert(const std::string &path, std::string out)
+{
+    Trace t;
+    if (!load(path, t))
+        return 1;
+    if (out.empty()) {
+        size_t dot = path.rfind('.');
+        out = (dot == std::string::npos ? path : path.substr(0, dot)) + ".json";
+    }
+    FILE *f = fopen(out.c_str(), "w");
+    if (!f) {
+        perror(out.c_str());
+        return 1;
+    }
+    to_json(t, f, true);
+    fclose(f);
+    printf("wrote %s\n", out.c_str());
+    return 0;
+}
+
+// ---- Bench ----
+
+volatile uint32_t sim_clock;
+
+uint32_t clock_fn()
+{
+    return sim_clock;
+}
+
+int write_vec(void *ctx, const void *data, uint32_t bytes)
+{
+    auto v = static_cast<std::vector<uint8_t> *>(ctx);
+    auto p = static_cast<const uint8_t *>(data);
+    v->insert(v->end(), p, p + bytes);
+    return 0;
+}
+
+Trace roundtrip(trace_t *tr)
+{
+    std::vector<uint8_t> b;
+    trace_dump(tr, write_vec, &b);
+    Trace t;
+    std::string why;
+    check(decode(b, t, why) && why.empty(), "dump decodes");
+    return t;
+}
+
+// trace_print() output, captured from stdout
+std::string capture_print(trace_t *tr)
+{
+    fflush(stdout);
+    FILE *tmp = tmpfile();
+    int saved = dup(1);
+    dup2(fileno(tmp), 1);
+    trace_print(tr);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    std::string s;
+    rewind(tmp);
+    int ch;
+    while ((ch = fgetc(tmp)) != EOF)
+        s.push_back(char(ch));
+    fclose(tmp);
+    return s;
+}
+
+template <class F>
+double ns_per_event(F &&f, uint64_t n)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; i++)
+        f(i);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+int bench()
+{
+    std::vector<trace_event_t> buf(16);
+    trace_t tr;
+    trace_init(&tr, buf.data(), 16, &sim_clock, nullptr, 1000000);
+
+    // Overwrites the oldest, dumps oldest first
+    for (uint32_t i = 0; i < 40; i++) {
+        sim_clock = 1000 + i;
+        trace_emit(&tr, TR_MARK, TRACE_I, uint16_t(i));
+    }
+    uint32_t first;
+    check(trace_count(&tr, &first) == 16 && first == 24, "ring keeps the last 16", first, 24);
+    Trace t = roundtrip(&tr);
+    bool order = t.ev.size() == 16 && t.h.lost == 24;
+    for (size_t i = 0; order && i < t.ev.size(); i++)
+        order = t.ev[i].arg == 24 + i && t.ev[i].t == 1024 + i;
+    check(order, "dump is oldest first");
+
+    // The console form decodes to the same bytes
+    std::vector<uint8_t> bin, hex;
+    trace_dump(&tr, write_vec, &bin);
+    std::string log = "boot...\r\nStore: 3 writes\n" + capture_print(&tr) + "trace: zz not hex\n";
+    check(parse_log(log, hex) && hex == bin, "hex lines decode to the dump", double(hex.size()), double(bin.size()));
+
+    // A trigger keeps `post` more events, then the ring stops
+    trace_reset(&tr);
+    for (uint32_t i = 0; i < 10; i++)
+        trace_emit(&tr, TR_MARK, TRACE_I, uint16_t(i));
+    trace_trigger(&tr, 5);
+    trace_trigger(&tr, 100);        // ignored
+    for (uint32_t i = 10; i < 30; i++)
+        trace_emit(&tr, TR_MARK, TRACE_I, uint16_t(i));
+    t = roundtrip(&tr);
+    check(tr.stopped && t.ev.size() == 15 && t.ev.back().arg == 14, "trigger keeps 5 more events",
+          t.ev.empty() ? -1 : t.ev.back().arg, 14);
+
+    // A reset clears the trigger and records again
+    trace_reset(&tr);
+    for (uint32_t i = 0; i < 20; i++)
+        trace_emit(&tr, TR_MARK, TRACE_I, uint16_t(i));
+    check(!tr.stopped && !tr.triggered && trace_count(&tr, &first) == 16 && first == 4,
+          "reset clears the trigger", first, 4);
+
+    // Wrap of the 32-bit clock and slightly out-of-order stamps
+    std::vector<trace_event_t> big(256);
+    trace_init(&tr, big.data(), 256, nullptr, clock_fn, 1000000);
+    sim_clock = 0xFFFFFF00u;
+    for (uint32_t i = 0; i < 100; i++) {
+        trace_emit(&tr, TR_MARK, TRACE_I, 0);
+        sim_clock += (i % 7 == 3) ? uint32_t(-2) : 10;     // now and then 2 ticks back
+    }
+    t = roundtrip(&tr);
+    std::vector<int64_t> ts = unwrap(t);
+    check(ts.back() > 0 && ts.back() < 2000, "timestamps unwrap across 2^32", double(ts.back()), 1000);
+
+    // Converter: nesting per lane, ends cut off by the ring are dropped
+    trace_init(&tr, big.data(), 256, &sim_clock, nullptr, 1000000);
+    sim_clock = 0;
+    trace_emit(&tr, TR_F_WRITE, TRACE_E, 2048);     // begin was overwritten
+    for (uint32_t b = 1; b <= 10; b++) {
+        sim_clock += 10;
+        trace_emit(&tr, TR_TASK, TRACE_B, 0);
+        trace_emit(&tr, TR_F_WRITE, TRACE_B, 2048);
+        sim_clock += 50;
+        trace_emit(&tr, TR_DMA_IRQ, TRACE_B, 3);      // interrupt inside the write
+        trace_emit(&tr, TR_BLOCK_PUBLISH, TRACE_I, b);
+        trace_emit(&tr, TR_DMA_IRQ, TRACE_E, 3);
+        sim_clock += 300;
+        trace_emit(&tr, TR_F_WRITE, TRACE_E, 2048);
+        trace_emit(&tr, TR_BLOCK_CONSUME, TRACE_I, b);
+        trace_emit(&tr, TR_TASK, TRACE_E, 0);
+    }
+    t = roundtrip(&tr);
+    FILE *devnull = fopen("/dev/null", "w");
+    Converted c = to_json(t, devnull, false);
+    fclose(devnull);
+    check(c.begins == 30 && c.ends == 30 && c.dropped_ends == 1, "begins and ends pair up",
+          c.begins + c.ends + c.dropped_ends, 61);
+
+    // Cost of one event
+    const uint64_t n = 50000000;
+    std::vector<trace_event_t> ring(1 << 14);
+    trace_init(&tr, ring.data(), uint32_t(ring.size()), &sim_clock, nullptr, 1000000);
+    double t_counter = ns_per_event([&](uint64_t i) { trace_emit(&tr, TR_MARK, TRACE_I, uint16_t(i)); }, n);
+    trace_init(&tr, ring.data(), uint32_t(ring.size()), nullptr, clock_fn, 1000000);
+    double t_fn = ns_per_event([&](uint64_t i) { trace_emit(&tr, TR_MARK, TRACE_I, uint16_t(i)); }, n);
+    trace_sink = &tr;
+    double t_macro = ns_per_event([&](uint64_t i) { TRACE(TR_MARK, i); }, n);
+    trace_sink = nullptr;
+    double t_off = ns_per_event([&](uint64_t i) { TRACE(TR_MARK, i); }, n);
+    tr.stopped = true;
+    trace_sink = &tr;
+    double t_stopped = ns_per_event([&](uint64_t i) { TRACE(TR_MARK, i); }, n);
+    trace_sink = nullptr;
+
+    printf("%-34s %8s\n", "event", "ns");
+    printf("%-34s %8.2f\n", "trace_emit, counter register", t_counter);
+    printf("%-34s %8.2f\n", "trace_emit, clock function", t_fn);
+    printf("%-34s %8.2f\n", "TRACE() with a sink", t_macro);
+    printf("%-34s %8.2f\n", "TRACE() with the ring stopped", t_stopped);
+    printf("%-34s %8.2f\n", "TRACE() without a sink", t_off);
+
+    return check_summary();
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: ae_trace file.trc|console.log [-o out.json]\n"
+                    "       ae_trace --bench\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string path, out;
+    bool bench_mode = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--bench") bench_mode = true;
+        else if (a == "-o" && more) out = argv[++i];
+        else if (!a.empty() && a[0] == '-') return usage();
+        else if (path.empty()) path = a;
+        else return usage();
+    }
+
+    if (bench_mode)
+        return bench();
+    if (path.empty())
+        return usage();
+    return convert(path, out);
+}
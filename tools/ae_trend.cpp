@@ -0,0 +1,416 @@
+// Read, produce and check trend records (aXXXX.trd, lib/ae_core/trend.c).
+//
+// Prints a trend file as a table or CSV. --from-bin reduces a raw
+// recording with the firmware's kernel, as if it had been recorded in
+// trend mode. --bench checks the kernel against a double-precision
+// reference (levels, ASL, bands, interval alignment under DMA timestamp
+// jitter, gaps), then times it against block_stats_compute.
+//
+// usage: ae_trend [--csv] file.trd ...
+//        ae_trend --from-bin [--interval SEC] [--rate HZ] file.bin [-o out.trd]
+//        ae_trend --bench [MSAMPLES]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "block_stats.h"
+#include "trend.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t BLOCK = 1024;
+constexpr uint32_t DEFAULT_RATE = 4000;
+
+void collect(void *ctx, const trend_record_t *r)
+{
+    static_cast<std::vector<trend_record_t> *>(ctx)->push_back(*r);
+}
+
+double asl_db(const trend_record_t &r)
+{
+    return r.asl == TREND_ASL_NONE ? -INFINITY : r.asl / 100.0;
+}
+
+std::string flag_str(uint16_t f)
+{
+    std::string s;
+    if (f & TREND_PARTIAL) s += 'P';
+    if (f & TREND_GAP) s += 'G';
+    if (f & TREND_CLIPPED) s += 'C';
+    return s.empty() ? "-" : s;
+}
+
+int print_file(const std::string &path, bool csv)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        perror(path.c_str());
+        return 1;
+    }
+    trend_header_t h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != TREND_MAGIC || h.record_size != sizeof(trend_record_t)) {
+        fprintf(stderr, "%s: not a trend file\n", path.c_str());
+        fclose(f);
+        return 1;
+    }
+
+    std::vector<trend_record_t> recs;
+    trend_record_t r;
+    while (fread(&r, sizeof(r), 1, f) == 1)
+        recs.push_back(r);
+    fclose(f);
+
+    if (csv) {
+        printf("t_s,samples,mean,rms,peak,asl_db,crest,band0,band1,band2,band3,flags\n");
+        for (const trend_record_t &x : recs)
+            printf("%.6f,%u,%u,%.4f,%u,%.2f,%.3f,%.4f,%.4f,%.4f,%.4f,%u\n",
+                   x.t_us / 1e6, x.samples, x.mean, x.rms / 16.0, x.peak, asl_db(x), x.crest / 256.0,
+                   x.band[0] / 16.0, x.band[1] / 16.0, x.band[2] / 16.0, x.band[3] / 16.0, x.flags);
+        return 0;
+    }
+
+    printf("%s: %zu records of %.3f s at %u Hz, started at %.3f s\n", path.c_str(), recs.size(),
+           h.interval_us / 1e6, h.sample_rate, h.start_us / 1e6);
+    printf("%12s %7s %5s %8s %5s %7s %6s %8s %8s %8s %8s %5s\n", "t s", "samples", "mean", "rms", "peak",
+           "ASL dB", "crest", "hi", "mid", "lo", "low", "flags");
+    for (const trend_record_t &x : recs)
+        printf("%12.3f %7u %5u %8.2f %5u %7.2f %6.2f %8.2f %8.2f %8.2f %8.2f %5s\n",
+               x.t_us / 1e6, x.samples, x.mean, x.rms / 16.0, x.peak, asl_db(x), x.crest / 256.0,
+               x.band[0] / 16.0, x.band[1] / 16.0, x.band[2] / 16.0, x.band[3] / 16.0,
+               flag_str(x.flags).c_str());
+    return 0;
+}
+
+int from_bin(const std::string &path, std::string out, double interval, uint32_t rate)
+{
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in) {
+        perror(path.c_str());
+        return 1;
+    }
+    if (out.empty())
+        out = with_ext(path, ".trd");
+
+    std::vector<trend_record_t> recs;
+    trend_config_t cfg = {uint32_t(interval * 1e6), rate, collect, &recs};
+    trend_t t;
+    trend_init(&t, &cfg);
+
+    // Timestamps as the logger takes them: when each block completed
+    std::vector<uint16_t> buf(BLOCK);
+    uint64_t pos = 0;
+    size_t n;
+    while ((n = fread(buf.data(), sizeof(uint16_t), BLOCK, in)) == BLOCK) {
+        pos += n;
+        trend_push(&t, buf.data(), BLOCK, (pos - 1) * 1000000 / rate);
+    }
+    trend_flush(&t);
+    fclose(in);
+
+    FILE *f = fopen(out.c_str(), "wb");
+    if (!f) {
+        perror(out.c_str());
+        return 1;
+    }
+    trend_header_t h{};
+    h.magic = TREND_MAGIC;
+    h.version = TREND_VERSION;
+    h.record_size = sizeof(trend_record_t);
+    h.interval_us = cfg.interval_us;
+    h.sample_rate = rate;
+    h.start_us = t.start_us;
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(recs.data(), sizeof(trend_record_t), recs.size(), f);
+    fclose(f);
+
+    printf("%s: %llu samples -> %zu records in %s (%zu bytes, %.0fx smaller)\n", path.c_str(),
+           (unsigned long long)pos, recs.size(), out.c_str(), sizeof(h) + recs.size() * sizeof(trend_record_t),
+           double(pos * 2) / double(sizeof(h) + recs.size() * sizeof(trend_record_t)));
+    return 0;
+}
+
+// ---- Checks ----
+
+void check_math()
+{
+    uint32_t x = 1;
+    for (int i = 0; i < 100000; i++) {
+        x = x * 1664525 + 1013904223;
+        uint64_t v = uint64_t(x) * (x >> 7);
+        uint64_t r = trend_isqrt(v);
+        if (!(r * r <= v && (r + 1) * (r + 1) > v)) {
+            check(false, "isqrt", double(r), std::sqrt(double(v)));
+            break;
+        }
+    }
+    for (uint32_t v = 1; v < (1u << 24); v = v * 17 / 16 + 1) {
+        double want = 2000 * std::log10(v / 256.0);
+        if (std::fabs(trend_cdb(v) - want) > 1) {
+            check(false, "centi-dB", trend_cdb(v), want);
+            break;
+        }
+    }
+}
+
+std::vector<trend_record_t> run(const std::vector<uint16_t> &v, uint32_t interval_us, uint64_t t0_us,
+                                uint32_t jitter_us = 0, size_t drop_block = SIZE_MAX, size_t drop_count = 0)
+{
+    std::vector<trend_record_t> recs;
+    trend_config_t cfg = {interval_us, DEFAULT_RATE, collect, &recs};
+    trend_t t;
+    trend_init(&t, &cfg);
+    uint32_t x = 7;
+    for (size_t b = 0; b * BLOCK + BLOCK <= v.size(); b++) {
+        if (b >= drop_block && b < drop_block + drop_count)
+            continue;
+        x = x * 1664525 + 1013904223;
+        uint64_t last = t0_us + ((b + 1) * BLOCK - 1) * 1000000 / DEFAULT_RATE + (jitter_us ? x % jitter_us : 0);
+        trend_push(&t, &v[b * BLOCK], BLOCK, last);
+    }
+    trend_flush(&t);
+    return recs;
+}
+
+std::vector<uint16_t> sine(double seconds, double hz, double amp, uint32_t noise = 0)
+{
+    std::vector<uint16_t> v(size_t(seconds * DEFAULT_RATE));
+    uint32_t x = 1;
+    for (size_t i = 0; i < v.size(); i++) {
+        x = x * 1664525 + 1013904223;
+        double n = noise ? double(x >> 16) / 65536.0 * 2 * noise - noise : 0;
+        v[i] = uint16_t(std::lround(2048 + amp * std::sin(2 * M_PI * hz * double(i) / DEFAULT_RATE) + n));
+    }
+    return v;
+}
+
+void check_levels()
+{
+    const double amp = 1000;
+    const double hz[] = {60, 400, 700, 1500};
+    for (int k = 0; k < 4; k++) {
+        std::vector<uint16_t> v = sine(10, hz[k], amp);
+        auto recs = run(v, 1000000, 0);
+        const trend_record_t &r = recs[3];
+
+        // Sampled peak and rectified mean, not the continuous ones
+        double peak = 0, abs_sum = 0;
+        for (size_t i = 3 * DEFAULT_RATE; i < 4 * DEFAULT_RATE; i++) {
+            peak = std::max(peak, std::fabs(v[i] - 2048.0));
+            abs_sum += std::fabs(v[i] - 2048.0);
+        }
+        double rms = amp / std::sqrt(2), asl = 20 * std::log10(abs_sum / DEFAULT_RATE);
+
+        char what[64];
+        snprintf(what, sizeof(what), "%g Hz rms", hz[k]);
+        check(std::fabs(r.rms / 16.0 - rms) < 1, what, r.rms / 16.0, rms);
+        snprintf(what, sizeof(what), "%g Hz peak", hz[k]);
+        check(std::fabs(r.peak - peak) <= 1, what, r.peak, peak);
+        snprintf(what, sizeof(what), "%g Hz crest", hz[k]);
+        check(std::fabs(r.crest / 256.0 - peak / rms) < 0.01, what, r.crest / 256.0, peak / rms);
+        snprintf(what, sizeof(what), "%g Hz ASL", hz[k]);
+        check(std::fabs(asl_db(r) - asl) < 0.05, what, asl_db(r), asl);
+
+        // Bands partition the energy, and the tone lands in the right one
+        double e = 0, best = 0;
+        int band = 0;
+        for (int b = 0; b < TREND_BANDS; b++) {
+            double x = r.band[b] / 16.0;
+            e += x * x;
+            if (x > best) {
+                best = x;
+                band = b;
+            }
+        }
+        snprintf(what, sizeof(what), "%g Hz band energies add up", hz[k]);
+        check(std::fabs(std::sqrt(e) - r.rms / 16.0) < 0.01 * r.rms / 16.0, what, std::sqrt(e), r.rms / 16.0);
+        const int want_band[] = {3, 2, 1, 0};
+        snprintf(what, sizeof(what), "%g Hz strongest band", hz[k]);
+        check(band == want_band[k], what, band, want_band[k]);
+    }
+}
+
+// Noise and bursts against the same quantities computed in double
+void check_reference()
+{
+    std::vector<uint16_t> v = sine(60, 230, 300, 400);
+    for (size_t s = 5000; s + 400 < v.size(); s += 9000)
+        for (int i = 0; i < 400; i++)
+            v[s + i] = uint16_t(std::clamp(int(v[s + i]) + int(1500 * std::exp(-i / 60.0) * std::sin(i * 0.9)), 0, 4095));
+
+    auto recs = run(v, 1000000, 0);
+    check(recs.size() == 60, "records for 60 s", double(recs.size()), 60);
+
+    size_t pos = 0;
+    double center = 0;
+    for (size_t k = 0; k < recs.size(); k++) {
+        const trend_record_t &r = recs[k];
+        double sum = 0, sumsq = 0, mn = 4095, mx = 0;
+        for (size_t i = pos; i < pos + r.samples; i++) {
+            sum += v[i];
+            sumsq += double(v[i]) * v[i];
+            mn = std::min<double>(mn, v[i]);
+            mx = std::max<double>(mx, v[i]);
+        }
+        double mean = sum / r.samples;
+        double rms = std::sqrt(sumsq / r.samples - mean * mean);
+        if (k == 0) {
+            center = 0;
+            for (size_t i = 0; i < BLOCK; i++)
+                center += v[i];
+            center = std::round(center / BLOCK);
+        }
+        double abs_sum = 0;
+        for (size_t i = pos; i < pos + r.samples; i++)
+            abs_sum += std::fabs(v[i] - center);
+        double asl = 20 * std::log10(abs_sum / r.samples);
+        double peak = std::max(mx - std::round(mean), std::round(mean) - mn);
+
+        if (std::fabs(r.mean - mean) > 0.51 || std::fabs(r.rms / 16.0 - rms) > 1 / 16.0 ||
+            std::fabs(r.peak - peak) > 0 || std::fabs(asl_db(r) - asl) > 0.011) {
+            printf("FAIL: record %zu: mean %u/%.2f rms %.3f/%.3f peak %u/%.0f ASL %.2f/%.2f\n", k, r.mean, mean,
+                   r.rms / 16.0, rms, r.peak, peak, asl_db(r), asl);
+            check_failures++;
+            break;
+        }
+        pos += r.samples;
+        center = r.mean;
+    }
+}
+
+void check_alignment()
+{
+    std::vector<uint16_t> v = sine(30, 50, 500);
+
+    // Started mid-interval, block timestamps late by up to 300 us
+    const uint64_t t0 = 123456789;
+    auto recs = run(v, 1000000, t0, 300);
+    bool aligned = true, full = true;
+    for (size_t k = 0; k < recs.size(); k++) {
+        aligned &= recs[k].t_us % 1000000 == 0;
+        if (k > 0 && k + 1 < recs.size())
+            full &= recs[k].samples == DEFAULT_RATE && !(recs[k].flags & TREND_PARTIAL);
+    }
+    check(aligned, "records on interval boundaries");
+    check(full, "whole intervals have exactly rate samples despite timestamp jitter");
+    check(recs.front().flags & TREND_PARTIAL, "first interval partial");
+    check(recs.front().t_us == t0 - t0 % 1000000, "first interval start", recs.front().t_us, t0 - t0 % 1000000);
+
+    // Ten blocks lost: flagged, timing kept, nothing else touched
+    recs = run(v, 1000000, t0, 0, 40, 10);
+    uint64_t samples = 0;
+    int gaps = 0;
+    aligned = true;
+    for (size_t k = 0; k < recs.size(); k++) {
+        samples += recs[k].samples;
+        gaps += (recs[k].flags & TREND_GAP) != 0;
+        aligned &= recs[k].t_us % 1000000 == 0 && (k == 0 || recs[k].t_us > recs[k - 1].t_us);
+    }
+    uint64_t pushed = (v.size() / BLOCK - 10) * BLOCK;
+    check(samples == pushed, "samples across a gap", double(samples), double(pushed));
+    check(gaps >= 1 && gaps <= 4, "gap flagged on the intervals it touched", gaps, 2);
+    check(aligned, "alignment after a gap");
+
+    // 15 s intervals: 60 kS records
+    recs = run(v, 15000000, 0);
+    check(recs.size() == 2 && recs[0].samples == 15 * DEFAULT_RATE, "15 s intervals",
+          double(recs.size()), 2);
+}
+
+int bench(uint32_t msamples)
+{
+    check_math();
+    check_levels();
+    check_reference();
+    check_alignment();
+    int status = check_summary();
+
+    std::vector<uint16_t> data(size_t(msamples) * 1000000 / BLOCK * BLOCK);
+    uint32_t x = 1;
+    for (auto &v : data) {
+        x = x * 1664525 + 1013904223;
+        v = uint16_t(x >> 20);
+    }
+    const double n = double(data.size());
+    uint64_t check_sum = 0;
+
+    block_stats_t st{};
+    uint8_t above = BLOCK_STATS_ABOVE_UNKNOWN;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t off = 0; off < data.size(); off += BLOCK) {
+        block_stats_compute(&st, &data[off], BLOCK, 2048, &above);
+        check_sum += st.sum;
+    }
+    double base = seconds_since(t0);
+
+    trend_acc_t acc{};
+    trend_acc_reset(&acc, 2048);
+    t0 = std::chrono::steady_clock::now();
+    for (size_t off = 0; off < data.size(); off += BLOCK)
+        trend_accumulate(&acc, &data[off], BLOCK);
+    double kernel = seconds_since(t0);
+    check_sum += acc.sumsq + acc.band_e[0];
+
+    std::vector<trend_record_t> recs;
+    trend_config_t cfg = {1000000, DEFAULT_RATE, collect, &recs};
+    trend_t t;
+    trend_init(&t, &cfg);
+    t0 = std::chrono::steady_clock::now();
+    for (size_t off = 0; off < data.size(); off += BLOCK)
+        trend_push(&t, &data[off], BLOCK, (off + BLOCK - 1) * 1000000 / DEFAULT_RATE);
+    trend_flush(&t);
+    double full = seconds_since(t0);
+
+    printf("%-28s %8.1f MS/s %6.2f ns/sample\n", "block_stats_compute", n / base / 1e6, base * 1e9 / n);
+    printf("%-28s %8.1f MS/s %6.2f ns/sample\n", "trend_accumulate", n / kernel / 1e6, kernel * 1e9 / n);
+    printf("%-28s %8.1f MS/s %6.2f ns/sample, %zu records\n", "trend_push (1 s intervals)", n / full / 1e6,
+           full * 1e9 / n, recs.size());
+    printf("%.1f s of 4 kS/s input: %zu raw bytes -> %zu trend bytes\n", n / DEFAULT_RATE, data.size() * 2,
+           recs.size() * sizeof(trend_record_t));
+    printf("(check %llu)\n", (unsigned long long)(check_sum & 0xFFFF));
+    return status;
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: ae_trend [--csv] file.trd ...\n"
+                    "       ae_trend --from-bin [--interval SEC] [--rate HZ] file.bin [-o out.trd]\n"
+                    "       ae_trend --bench [MSAMPLES]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool csv = false, bin = false;
+    double interval = 1;
+    uint32_t rate = DEFAULT_RATE;
+    std::string out;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--csv") csv = true;
+        else if (a == "--from-bin") bin = true;
+        else if (a == "--interval" && more) interval = atof(argv[++i]);
+        else if (a == "--rate" && more) rate = uint32_t(atoi(argv[++i]));
+        else if (a == "-o" && more) out = argv[++i];
+        else if (a == "--bench") return bench(more ? uint32_t(atoi(argv[++i])) : 64);
+        else if (a[0] == '-') return usage();
+        else files.push_back(a);
+    }
+    if (files.empty() || (bin && interval <= 0))
+        return usage();
+
+    int rc = 0;
+    for (const std::string &f : files)
+        rc |= bin ? from_bin(f, files.size() == 1 ? out : "", interval, rate) : print_file(f, csv);
+    return rc;
+}
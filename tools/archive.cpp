@@ -0,0 +1,621 @@
+#include "archive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tool_util.h"
+#include "worker_pool.h"
+
+namespace {
+
+constexpr char DATA_MAGIC[4] = {'A', 'E', 'A', 'D'};
+constexpr char CHUNK_MAGIC[4] = {'A', 'E', 'A', 'C'};
+constexpr char SESSION_MAGIC[4] = {'A', 'E', 'A', 'S'};
+
+// Frames of one width byte and up to ARCHIVE_FRAME packed deltas: 17-bit
+// zigzag deltas of 16-bit samples, 64-bit accumulator
+constexpr uint32_t MAX_WIDTH = 17;
+
+uint32_t crc32(const uint8_t *p, size_t n)
+{
+    static uint32_t table[256];
+    static const bool init = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)init;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; i++)
+        c = table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+bool read_all(int fd, void *buf, size_t len, uint64_t off)
+{
+    uint8_t *p = static_cast<uint8_t *>(buf);
+    while (len) {
+        ssize_t r = pread(fd, p, len, off_t(off));
+        if (r <= 0)
+            return false;
+        p += r;
+        len -= size_t(r);
+        off += uint64_t(r);
+    }
+    return true;
+}
+
+bool write_all(int fd, const void *buf, size_t len, uint64_t off)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    while (len) {
+        ssize_t w = pwrite(fd, p, len, off_t(off));
+        if (w <= 0)
+            return false;
+        p += w;
+        len -= size_t(w);
+        off += uint64_t(w);
+    }
+    return true;
+}
+
+ArchiveFileHeader file_header(const char magic[4], uint32_t record_size, uint32_t chunk_samples)
+{
+    ArchiveFileHeader h{};
+    memcpy(h.magic, magic, sizeof(h.magic));
+    h.version = ARCHIVE_VERSION;
+    h.record_size = record_size;
+    h.chunk_samples = chunk_samples;
+    return h;
+}
+
+// Opens one of the archive files, writing its header if it is new; the
+// records after the header are read into `out` (a torn last one dropped)
+template <class T>
+int open_file(const std::string &path, const char magic[4], bool create, uint32_t &chunk_samples,
+              std::vector<T> *out)
+{
+    int fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path.c_str());
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    const uint32_t record_size = out ? sizeof(T) : 0;
+    ArchiveFileHeader h;
+    if (st.st_size == 0 && create) {
+        h = file_header(magic, record_size, chunk_samples);
+        if (!write_all(fd, &h, sizeof(h), 0) || fsync(fd) != 0) {
+            perror(path.c_str());
+            ::close(fd);
+            return -1;
+        }
+        st.st_size = sizeof(h);
+    } else if (!read_all(fd, &h, sizeof(h), 0) || memcmp(h.magic, magic, 4) != 0 ||
+               h.version != ARCHIVE_VERSION || h.record_size != record_size) {
+        fprintf(stderr, "%s: not an archive file of this version\n", path.c_str());
+        ::close(fd);
+        return -1;
+    }
+    if (!out) {
+        chunk_samples = h.chunk_samples;
+        return fd;
+    }
+
+    out->resize((uint64_t(st.st_size) - sizeof(h)) / sizeof(T));
+    if (!out->empty() && !read_all(fd, out->data(), out->size() * sizeof(T), sizeof(h))) {
+        perror(path.c_str());
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool append_records(const std::string &path, const void *rec, size_t size, uint64_t index,
+                    size_t n)
+{
+    int fd = ::open(path.c_str(), O_WRONLY);
+    bool ok = fd >= 0 && write_all(fd, rec, size * n, sizeof(ArchiveFileHeader) + index * size) &&
+              fdatasync(fd) == 0;
+    if (!ok)
+        perror(path.c_str());
+    if (fd >= 0)
+        ::close(fd);
+    return ok;
+}
+
+inline uint32_t zigzag(int32_t d) { return (uint32_t(d) << 1) ^ uint32_t(d >> 31); }
+inline int32_t unzigzag(uint32_t z) { return int32_t(z >> 1) ^ -int32_t(z & 1); }
+
+void accumulate(const uint16_t *v, uint64_t n, ArchiveBucket &b)
+{
+    uint16_t mn = b.min, mx = b.max;
+    uint64_t sum = 0, sq = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        uint32_t x = v[i];
+        mn = std::min<uint16_t>(mn, uint16_t(x));
+        mx = std::max<uint16_t>(mx, uint16_t(x));
+        sum += x;
+        sq += x * x;
+    }
+    b.min = mn;
+    b.max = mx;
+    b.sum += sum;
+    b.sumsq += sq;
+    b.count += n;
+}
+
+void merge(ArchiveBucket &a, const ArchiveBucket &b)
+{
+    a.count += b.count;
+    a.min = std::min(a.min, b.min);
+    a.max = std::max(a.max, b.max);
+    a.sum += b.sum;
+    a.sumsq += b.sumsq;
+}
+
+} // namespace
+
+// ---- Codec ----
+
+std::vector<uint8_t> archive_encode(const uint16_t *v, uint32_t n)
+{
+    std::vector<uint8_t> out;
+    if (n == 0)
+        return out;
+    out.reserve(2 + size_t(n) * 3);
+    out.push_back(uint8_t(v[0]));
+    out.push_back(uint8_t(v[0] >> 8));
+
+    uint32_t z[ARCHIVE_FRAME];
+    for (uint32_t i = 1; i < n; i += ARCHIVE_FRAME) {
+        const uint32_t cnt = std::min(ARCHIVE_FRAME, n - i);
+        uint32_t all = 0;
+        for (uint32_t k = 0; k < cnt; k++) {
+            z[k] = zigzag(int32_t(v[i + k]) - int32_t(v[i + k - 1]));
+            all |= z[k];
+        }
+        uint32_t w = 0;
+        while (w < MAX_WIDTH && (all >> w))
+            w++;
+        out.push_back(uint8_t(w));
+
+        uint64_t acc = 0;
+        uint32_t bits = 0;
+        for (uint32_t k = 0; k < cnt; k++) {
+            acc |= uint64_t(z[k]) << bits;
+            bits += w;
+            while (bits >= 8) {
+                out.push_back(uint8_t(acc));
+                acc >>= 8;
+                bits -= 8;
+            }
+        }
+        if (bits)
+            out.push_back(uint8_t(acc));
+    }
+    return out;
+}
+
+bool archive_decode(const uint8_t *p, size_t bytes, uint32_t n, uint16_t *out)
+{
+    if (n == 0)
+        return true;
+    const uint8_t *end = p + bytes;
+    if (bytes < 2)
+        return false;
+    int32_t prev = p[0] | (p[1] << 8);
+    out[0] = uint16_t(prev);
+    p += 2;
+
+    for (uint32_t i = 1; i < n; i += ARCHIVE_FRAME) {
+        const uint32_t cnt = std::min(ARCHIVE_FRAME, n - i);
+        if (p >= end || *p > MAX_WIDTH)
+            return false;
+        const uint32_t w = *p++;
+        const size_t len = (size_t(cnt) * w + 7) / 8;
+        if (size_t(end - p) < len)
+            return false;
+        const uint32_t mask = (1u << w) - 1;
+        uint64_t acc = 0;
+        uint32_t bits = 0;
+        for (uint32_t k = 0; k < cnt; k++) {
+            while (bits < w) {
+                acc |= uint64_t(*p++) << bits;
+                bits += 8;
+            }
+            prev += unzigzag(uint32_t(acc) & mask);
+            acc >>= w;
+            bits -= w;
+            out[i + k] = uint16_t(prev);
+        }
+    }
+    return p == end;
+}
+
+uint64_t archive_sample_at(const ChunkRecord &c, int64_t t_us)
+{
+    if (t_us <= c.t0_us)
+        return 0;
+    if (t_us >= c.t1_us())
+        return c.samples;
+    // Smallest j with floor(j * 1e6 / rate) >= t_us - t0_us
+    uint64_t j = (uint64_t(t_us - c.t0_us) * c.rate + 999999) / 1000000;
+    return std::min<uint64_t>(j, c.samples);
+}
+
+// ---- Archive ----
+
+Archive::~Archive()
+{
+    close();
+}
+
+void Archive::close()
+{
+    if (data_fd_ >= 0)
+        ::close(data_fd_);
+    data_fd_ = -1;
+    chunks_.clear();
+    sessions_.clear();
+    by_t0_.clear();
+    t0_.clear();
+    max_t1_.clear();
+}
+
+bool Archive::open(const std::string &dir, bool create, uint32_t chunk_samples)
+{
+    close();
+    dir_ = dir;
+    if (create && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        perror(dir.c_str());
+        return false;
+    }
+    chunk_samples_ = chunk_samples;
+    data_fd_ = open_file<uint8_t>(dir + "/chunks.dat", DATA_MAGIC, create, chunk_samples_, nullptr);
+    if (data_fd_ < 0 || !load(create)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool Archive::load(bool create)
+{
+    int cfd = open_file(dir_ + "/chunks.idx", CHUNK_MAGIC, create, chunk_samples_, &chunks_);
+    int sfd = cfd < 0 ? -1 : open_file(dir_ + "/sessions.idx", SESSION_MAGIC, create,
+                                        chunk_samples_, &sessions_);
+    if (cfd >= 0)
+        ::close(cfd);
+    if (sfd < 0)
+        return false;
+    ::close(sfd);
+    build_index();
+    return true;
+}
+
+void Archive::build_index()
+{
+    // Committed chunks only: the ranges the session records claim
+    by_t0_.clear();
+    for (const SessionRecord &s : sessions_)
+        for (uint64_t c = s.first_chunk; c < s.first_chunk + s.chunks && c < chunks_.size(); c++)
+            by_t0_.push_back(uint32_t(c));
+    std::sort(by_t0_.begin(), by_t0_.end(), [&](uint32_t a, uint32_t b) {
+        return chunks_[a].t0_us != chunks_[b].t0_us ? chunks_[a].t0_us < chunks_[b].t0_us : a < b;
+    });
+    t0_.resize(by_t0_.size());
+    max_t1_.resize(by_t0_.size());
+    int64_t m = INT64_MIN;
+    for (size_t i = 0; i < by_t0_.size(); i++) {
+        const ChunkRecord &c = chunks_[by_t0_[i]];
+        t0_[i] = c.t0_us;
+        m = std::max(m, c.t1_us());
+        max_t1_[i] = m;
+    }
+}
+
+std::vector<uint32_t> Archive::chunks_in(int64_t from, int64_t to) const
+{
+    std::vector<uint32_t> out;
+    // First chunk that could end after `from`, then every one starting before `to`
+    size_t i = size_t(std::upper_bound(max_t1_.begin(), max_t1_.end(), from) - max_t1_.begin());
+    for (; i < t0_.size() && t0_[i] < to; i++) {
+        const ChunkRecord &c = chunks_[by_t0_[i]];
+        if (archive_sample_at(c, from) < archive_sample_at(c, to))
+            out.push_back(by_t0_[i]);
+    }
+    return out;
+}
+
+bool Archive::decode(uint32_t chunk, std::vector<uint16_t> &out) const
+{
+    const ChunkRecord &c = chunks_[chunk];
+    std::vector<uint8_t> buf(c.bytes);
+    out.resize(c.samples);
+    if (!read_all(data_fd_, buf.data(), buf.size(), c.offset)) {
+        perror((dir_ + "/chunks.dat").c_str());
+        return false;
+    }
+    if (crc32(buf.data(), buf.size()) != c.crc ||
+        !archive_decode(buf.data(), buf.size(), c.samples, out.data())) {
+        fprintf(stderr, "%s: chunk %u is corrupt\n", dir_.c_str(), chunk);
+        return false;
+    }
+    return true;
+}
+
+bool Archive::ingest(const std::vector<TimedRecording> &recs, unsigned threads, IngestStats &st)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    st = IngestStats{};
+
+    // One writer at a time, across processes; another one may have
+    // committed since open()
+    if (flock(data_fd_, LOCK_EX) != 0) {
+        perror((dir_ + "/chunks.dat").c_str());
+        return false;
+    }
+    if (!load(false)) {
+        flock(data_fd_, LOCK_UN);
+        return false;
+    }
+
+    std::unordered_set<uint64_t> known;
+    for (const SessionRecord &s : sessions_)
+        known.insert(s.fingerprint);
+
+    struct Plan {
+        uint32_t rec;
+        uint32_t session;
+        uint64_t first;
+        uint32_t samples;
+        int64_t t0_us;
+        uint32_t rate;
+    };
+    std::vector<Plan> plan;
+    std::vector<SessionRecord> added;
+    std::vector<uint32_t> rec_of;
+    const uint64_t base_chunk = chunks_.size();
+
+    for (uint32_t r = 0; r < recs.size(); r++) {
+        const TimedRecording &rec = recs[r];
+        if (!known.insert(rec.fingerprint).second || rec.segments.empty()) {
+            st.skipped++;
+            continue;
+        }
+        SessionRecord s{};
+        s.t0_us = rec.segments.front().t_us;
+        s.t1_us = rec.end_us();
+        s.fingerprint = rec.fingerprint;
+        s.samples = rec.samples;
+        s.first_chunk = base_chunk + plan.size();
+        s.segments = uint32_t(rec.segments.size());
+        s.raw_bytes = rec.samples * sizeof(uint16_t);
+        std::string name = rec.path.substr(rec.path.rfind('/') + 1);
+        snprintf(s.name, sizeof(s.name), "%s", name.c_str());
+
+        const uint32_t session = uint32_t(sessions_.size() + added.size());
+        for (const TimedSegment &g : rec.segments)
+            for (uint64_t j = 0; j < g.count; j += chunk_samples_) {
+                uint32_t n = uint32_t(std::min<uint64_t>(chunk_samples_, g.count - j));
+                int64_t t = g.t_us + int64_t(j * 1000000 / g.rate);
+                plan.push_back({r, session, g.first + j, n, t, g.rate});
+            }
+        s.chunks = uint32_t(base_chunk + plan.size() - s.first_chunk);
+        added.push_back(s);
+        rec_of.push_back(r);
+        st.raw_bytes += s.raw_bytes;
+    }
+
+    std::vector<int> fds(recs.size(), -1);
+    bool ok = true;
+    for (uint32_t r : rec_of)
+        if ((fds[r] = ::open(recs[r].path.c_str(), O_RDONLY)) < 0) {
+            perror(recs[r].path.c_str());
+            ok = false;
+        }
+
+    struct stat ds {};
+    fstat(data_fd_, &ds);
+    std::atomic<uint64_t> data_end{uint64_t(ds.st_size)};
+    std::atomic<bool> failed{!ok};
+    std::vector<ChunkRecord> out(plan.size());
+    const unsigned t = workers(threads, plan.size());
+
+    std::vector<std::vector<uint16_t>> bufs(t, std::vector<uint16_t>(chunk_samples_));
+    if (ok)
+        parallel_for(plan.size(), 1, t, [&](size_t i, size_t, unsigned w) {
+            if (failed)
+                return;
+            const Plan &p = plan[i];
+            uint16_t *v = bufs[w].data();
+            if (!read_all(fds[p.rec], v, size_t(p.samples) * 2, p.first * 2)) {
+                perror(recs[p.rec].path.c_str());
+                failed = true;
+                return;
+            }
+            ChunkRecord &c = out[i];
+            c.t0_us = p.t0_us;
+            c.first = p.first;
+            c.samples = p.samples;
+            c.session = p.session;
+            c.rate = p.rate;
+            ArchiveBucket b;
+            accumulate(v, p.samples, b);
+            c.min = b.min;
+            c.max = b.max;
+            c.sum = b.sum;
+            c.sumsq = b.sumsq;
+
+            std::vector<uint8_t> z = archive_encode(v, p.samples);
+            c.bytes = uint32_t(z.size());
+            c.crc = crc32(z.data(), z.size());
+            c.offset = data_end.fetch_add(z.size());
+            if (!write_all(data_fd_, z.data(), z.size(), c.offset)) {
+                perror((dir_ + "/chunks.dat").c_str());
+                failed = true;
+            }
+        });
+
+    for (int fd : fds)
+        if (fd >= 0)
+            ::close(fd);
+
+    // Data, then the chunk records, then the session records that commit them
+    ok = !failed && fdatasync(data_fd_) == 0 &&
+         append_records(dir_ + "/chunks.idx", out.data(), sizeof(ChunkRecord), base_chunk,
+                        out.size()) &&
+         append_records(dir_ + "/sessions.idx", added.data(), sizeof(SessionRecord),
+                        sessions_.size(), added.size());
+    flock(data_fd_, LOCK_UN);
+    if (!ok)
+        return false;
+
+    chunks_.insert(chunks_.end(), out.begin(), out.end());
+    sessions_.insert(sessions_.end(), added.begin(), added.end());
+    build_index();
+
+    st.sessions = uint32_t(added.size());
+    st.chunks = out.size();
+    for (const ChunkRecord &c : out)
+        st.stored_bytes += c.bytes;
+    st.threads = t;
+    st.seconds = seconds_since(t0);
+    return true;
+}
+
+bool Archive::read(int64_t from, int64_t to, std::vector<uint16_t> &samples,
+                   std::vector<ArchiveSpan> &spans, unsigned threads, QueryStats &qs) const
+{
+    auto t0 = std::chrono::steady_clock::now();
+    qs = QueryStats{};
+    samples.clear();
+    spans.clear();
+
+    const std::vector<uint32_t> ids = chunks_in(from, to);
+    std::vector<uint64_t> j0(ids.size()), j1(ids.size()), at(ids.size());
+    uint64_t total = 0;
+    for (size_t i = 0; i < ids.size(); i++) {
+        const ChunkRecord &c = chunks_[ids[i]];
+        j0[i] = archive_sample_at(c, from);
+        j1[i] = archive_sample_at(c, to);
+        at[i] = total;
+        total += j1[i] - j0[i];
+
+        // Chunks that continue the previous one's run join its span
+        const int64_t t = c.t0_us + int64_t(j0[i] * 1000000 / c.rate);
+        if (!spans.empty()) {
+            ArchiveSpan &p = spans.back();
+            const int64_t next = p.t0_us + int64_t(p.count * 1000000 / p.rate);
+            if (p.session == c.session && p.rate == c.rate && std::llabs(t - next) <= 1) {
+                p.count += j1[i] - j0[i];
+                continue;
+            }
+        }
+        spans.push_back({t, c.rate, c.session, at[i], j1[i] - j0[i]});
+    }
+    samples.resize(total);
+
+    std::atomic<bool> failed{false};
+    const unsigned t = workers(threads, ids.size());
+    std::vector<std::vector<uint16_t>> bufs(t);
+    parallel_for(ids.size(), 1, t, [&](size_t i, size_t, unsigned w) {
+        if (failed || !decode(ids[i], bufs[w])) {
+            failed = true;
+            return;
+        }
+        std::copy(bufs[w].begin() + j0[i], bufs[w].begin() + j1[i], samples.begin() + at[i]);
+    });
+
+    qs.chunks = qs.decoded = ids.size();
+    qs.samples = total;
+    qs.seconds = seconds_since(t0);
+    return !failed;
+}
+
+bool Archive::aggregate(int64_t from, int64_t to, int64_t every_us,
+                        std::vector<ArchiveBucket> &out, unsigned threads, QueryStats &qs) const
+{
+    auto t0 = std::chrono::steady_clock::now();
+    qs = QueryStats{};
+    out.clear();
+    if (to <= from || every_us <= 0)
+        return true;
+    const uint64_t nb = (uint64_t(to - from) + every_us - 1) / every_us;
+    if (nb > (1u << 24)) {
+        fprintf(stderr, "aggregate: %llu buckets, use a longer interval\n", (unsigned long long)nb);
+        return false;
+    }
+
+    const std::vector<uint32_t> ids = chunks_in(from, to);
+    const unsigned t = workers(threads, ids.size());
+    std::vector<std::vector<ArchiveBucket>> part(t, std::vector<ArchiveBucket>(nb));
+    std::vector<std::vector<uint16_t>> bufs(t);
+    std::atomic<uint64_t> decoded{0};
+    std::atomic<bool> failed{false};
+
+    parallel_for(ids.size(), 1, t, [&](size_t i, size_t, unsigned w) {
+        const ChunkRecord &c = chunks_[ids[i]];
+        const int64_t c0 = std::max(from, c.t0_us), c1 = std::min(to, c.t1_us());
+        uint64_t b = uint64_t(c0 - from) / every_us;
+        const uint64_t b_last = std::min<uint64_t>(nb - 1, uint64_t(c1 - 1 - from) / every_us);
+        bool have = false;
+        for (; b <= b_last && !failed; b++) {
+            const int64_t e0 = from + int64_t(b) * every_us;
+            const int64_t e1 = std::min(to, e0 + every_us);
+            const uint64_t j0 = archive_sample_at(c, e0), j1 = archive_sample_at(c, e1);
+            if (j0 >= j1)
+                continue;
+            ArchiveBucket &dst = part[w][b];
+            if (j0 == 0 && j1 == c.samples) {
+                // Whole chunk in the bucket: its record has the answer
+                ArchiveBucket s;
+                s.count = c.samples;
+                s.min = c.min;
+                s.max = c.max;
+                s.sum = c.sum;
+                s.sumsq = c.sumsq;
+                merge(dst, s);
+                continue;
+            }
+            if (!have) {
+                if (!decode(ids[i], bufs[w])) {
+                    failed = true;
+                    return;
+                }
+                have = true;
+                decoded++;
+            }
+            accumulate(bufs[w].data() + j0, j1 - j0, dst);
+        }
+    });
+
+    out.resize(nb);
+    for (uint64_t b = 0; b < nb; b++) {
+        out[b].t0_us = from + int64_t(b) * every_us;
+        for (unsigned w = 0; w < t; w++)
+            merge(out[b], part[w][b]);
+        qs.samples += out[b].count;
+    }
+    qs.chunks = ids.size();
+    qs.decoded = decoded;
+    qs.seconds = seconds_since(t0);
+    return !failed;
+}
@@ -0,0 +1,175 @@
+// Chunked, compressed store of many recordings on one wall-clock timeline.
+//
+// An archive is a directory of three append-only files:
+//
+//   chunks.dat  ArchiveFileHeader, then compressed chunks back to back
+//   chunks.idx  ArchiveFileHeader, then one ChunkRecord (64 bytes) per chunk
+//   sessions.idx ArchiveFileHeader, then one SessionRecord (128 bytes) per
+//               ingested recording
+//
+// A chunk holds up to chunk_samples evenly spaced samples of one
+// recording: it never spans a gap or a rate change (archive_source.h), so
+// its time column is just (t0_us, rate), kept in its ChunkRecord with the
+// count, min, max, sum and sum of squares of its values and where it
+// came from in the recording. The value column is stored as the first
+// sample and then frames of ARCHIVE_FRAME deltas, zigzag coded and bit
+// packed at the width of the frame's largest one.
+//
+// Ingest compresses chunks on every core; each worker reserves its space
+// at the end of chunks.dat with an atomic add and writes it with pwrite.
+// Once the data is synced the chunk records are appended, then the
+// session records, which commit the ingest: on open, chunk records of a
+// session that has no record yet are ignored, as are bytes of chunks.dat
+// no record points to. A recording whose fingerprint is already in the
+// archive is skipped.
+//
+// Queries work from the time index, the chunk records sorted by t0 with
+// a running max of t1, so finding the chunks of a range is a binary
+// search. Aggregates take whole chunks inside a bucket from their records
+// and decode only the chunks a bucket edge cuts.
+//
+// Times are Unix microseconds.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "archive_source.h"
+
+constexpr uint32_t ARCHIVE_VERSION = 1;
+constexpr uint32_t ARCHIVE_FRAME = 128;                 // samples per bit-packed frame
+constexpr uint32_t ARCHIVE_CHUNK_SAMPLES = 65536;      // default, 16 s at 4 kS/s
+
+struct ArchiveFileHeader {
+    char magic[4];              // "AEAD" chunks.dat, "AEAC" chunks.idx, "AEAS" sessions.idx
+    uint32_t version;
+    uint32_t record_size;       // 0 for chunks.dat
+    uint32_t chunk_samples;     // chunks.dat: at most this many samples per chunk
+    uint8_t reserved[16];
+};
+static_assert(sizeof(ArchiveFileHeader) == 32, "archive header layout");
+
+struct ChunkRecord {
+    int64_t t0_us;              // first sample; sample j at t0_us + j * 1e6 / rate
+    uint64_t first;             // sample index of the first sample in the recording
+    uint64_t offset;            // in chunks.dat
+    uint64_t sum;
+    uint64_t sumsq;
+    uint32_t bytes;             // compressed
+    uint32_t samples;
+    uint32_t session;           // index in sessions.idx
+    uint32_t rate;              // Hz
+    uint16_t min;
+    uint16_t max;
+    uint32_t crc;               // CRC-32 of the compressed bytes
+
+    // One period after the last sample
+    int64_t t1_us() const { return t0_us + int64_t(uint64_t(samples) * 1000000 / rate); }
+};
+static_assert(sizeof(ChunkRecord) == 64, "chunk record layout");
+
+struct SessionRecord {
+    int64_t t0_us;
+    int64_t t1_us;
+    uint64_t fingerprint;       // TimedRecording::fingerprint
+    uint64_t samples;
+    uint64_t first_chunk;       // its chunk records are the `chunks` from here in chunks.idx
+    uint32_t chunks;
+    uint32_t segments;
+    uint64_t raw_bytes;
+    char name[72];              // file name of the recording
+};
+static_assert(sizeof(SessionRecord) == 128, "session record layout");
+
+struct IngestStats {
+    uint32_t sessions = 0;      // added
+    uint32_t skipped = 0;       // already in the archive
+    uint64_t chunks = 0;
+    uint64_t raw_bytes = 0;
+    uint64_t stored_bytes = 0;
+    unsigned threads = 0;
+    double seconds = 0;
+};
+
+struct QueryStats {
+    uint64_t chunks = 0;        // in the range
+    uint64_t decoded = 0;       // of those, decompressed
+    uint64_t samples = 0;       // in the result
+    double seconds = 0;
+};
+
+// A run of evenly spaced samples in a read result
+struct ArchiveSpan {
+    int64_t t0_us;
+    uint32_t rate;
+    uint32_t session;
+    uint64_t offset;            // into the result's samples
+    uint64_t count;
+};
+
+struct ArchiveBucket {
+    int64_t t0_us;
+    uint64_t count = 0;
+    uint16_t min = 0xFFFF;
+    uint16_t max = 0;
+    uint64_t sum = 0;
+    uint64_t sumsq = 0;
+};
+
+class Archive {
+public:
+    Archive() = default;
+    ~Archive();
+    Archive(const Archive &) = delete;
+    Archive &operator=(const Archive &) = delete;
+
+    // Open `dir`, creating an empty archive there when `create` is set
+    // and there is none. chunk_samples only applies to a new archive.
+    bool open(const std::string &dir, bool create = false,
+              uint32_t chunk_samples = ARCHIVE_CHUNK_SAMPLES);
+
+    // Add recordings whose segments are already on wall-clock time
+    // (TimedRecording::anchor). threads == 0 uses every core.
+    bool ingest(const std::vector<TimedRecording> &recs, unsigned threads, IngestStats &st);
+
+    // Chunks with samples in [from, to), in time order
+    std::vector<uint32_t> chunks_in(int64_t from, int64_t to) const;
+
+    // Samples in [from, to), decoded on `threads` cores
+    bool read(int64_t from, int64_t to, std::vector<uint16_t> &samples,
+              std::vector<ArchiveSpan> &spans, unsigned threads, QueryStats &qs) const;
+
+    // count/min/max/sum/sumsq of the samples in each `every_us` bucket
+    // of [from, to)
+    bool aggregate(int64_t from, int64_t to, int64_t every_us, std::vector<ArchiveBucket> &out,
+                   unsigned threads, QueryStats &qs) const;
+
+    // Values of one chunk, CRC checked
+    bool decode(uint32_t chunk, std::vector<uint16_t> &out) const;
+
+    const std::vector<ChunkRecord> &chunks() const { return chunks_; }
+    const std::vector<SessionRecord> &sessions() const { return sessions_; }
+    uint32_t chunk_samples() const { return chunk_samples_; }
+
+private:
+    void close();
+    bool load(bool create);
+    void build_index();
+
+    std::string dir_;
+    int data_fd_ = -1;
+    uint32_t chunk_samples_ = ARCHIVE_CHUNK_SAMPLES;
+    std::vector<ChunkRecord> chunks_;
+    std::vector<SessionRecord> sessions_;
+    std::vector<uint32_t> by_t0_;           // chunk indices sorted by t0_us
+    std::vector<int64_t> t0_;               // t0_us in that order
+    std::vector<int64_t> max_t1_;           // running max of t1_us in that order
+};
+
+// Delta/zigzag/bit-pack coding of one chunk's values
+std::vector<uint8_t> archive_encode(const uint16_t *v, uint32_t n);
+bool archive_decode(const uint8_t *p, size_t bytes, uint32_t n, uint16_t *out);
+
+// First sample at or after t_us of a chunk, in [0, samples]
+uint64_t archive_sample_at(const ChunkRecord &c, int64_t t_us);
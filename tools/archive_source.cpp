@@ -0,0 +1,159 @@
+#include "archive_source.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block_stats.h"
+#include "rate_ctl.h"
+#include "tool_util.h"
+
+namespace {
+
+// FNV-1a over the size and the first and last 64 KiB, as the .lod cache
+uint64_t fingerprint(int fd, uint64_t len)
+{
+    uint64_t h = 1469598103934665603ull ^ len;
+    const size_t edge = 64 * 1024;
+    std::vector<uint8_t> buf(edge);
+    auto mix = [&](uint64_t off, size_t n) {
+        if (pread(fd, buf.data(), n, off_t(off)) != ssize_t(n))
+            return;
+        for (size_t i = 0; i < n; i++)
+            h = (h ^ buf[i]) * 1099511628211ull;
+    };
+    mix(0, size_t(std::min<uint64_t>(len, edge)));
+    if (len > edge) {
+        size_t n = size_t(std::min<uint64_t>(len - edge, edge));
+        mix(len - n, n);
+    }
+    return h;
+}
+
+bool read_sum(const std::string &path, summary_header_t &h, std::vector<uint64_t> &t_us)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == SUMMARY_MAGIC &&
+              h.record_size == sizeof(block_stats_t) && h.block_samples && h.sample_rate;
+    block_stats_t r;
+    while (ok && fread(&r, sizeof(r), 1, f) == 1) {
+        if (r.seq != t_us.size())
+            break;                  // torn tail after a crash
+        t_us.push_back(r.t_us);
+    }
+    if (!ok)
+        fprintf(stderr, "%s: not a summary sidecar, ignored\n", path.c_str());
+    fclose(f);
+    return ok;
+}
+
+bool read_rat(const std::string &path, rate_header_t &h, std::vector<rate_change_t> &ch)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == RATE_MAGIC &&
+              h.record_size == sizeof(rate_change_t) && h.base_rate;
+    rate_change_t r;
+    while (ok && fread(&r, sizeof(r), 1, f) == 1)
+        if (r.rate)
+            ch.push_back(r);
+    if (!ok)
+        fprintf(stderr, "%s: not a rate sidecar, ignored\n", path.c_str());
+    fclose(f);
+    return ok;
+}
+
+int64_t span_us(uint64_t samples, uint32_t rate)
+{
+    return int64_t(samples * 1000000 / rate);
+}
+
+} // namespace
+
+int64_t TimedRecording::end_us() const
+{
+    if (segments.empty())
+        return 0;
+    const TimedSegment &s = segments.back();
+    return s.t_us + span_us(s.count, s.rate);
+}
+
+void TimedRecording::anchor(int64_t t0_us)
+{
+    if (segments.empty())
+        return;
+    const int64_t d = t0_us - segments.front().t_us;
+    for (TimedSegment &s : segments)
+        s.t_us += d;
+}
+
+bool load_recording(const std::string &path, uint32_t rate, TimedRecording &rec)
+{
+    rec = TimedRecording{};
+    rec.path = path;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path.c_str());
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    rec.samples = uint64_t(st.st_size) / sizeof(uint16_t);
+    rec.fingerprint = fingerprint(fd, uint64_t(st.st_size));
+    rec.mtime_us = int64_t(st.st_mtim.tv_sec) * 1000000 + st.st_mtim.tv_nsec / 1000;
+    ::close(fd);
+
+    summary_header_t sh{};
+    std::vector<uint64_t> block_us;
+    rec.has_sum = read_sum(with_ext(path, ".sum"), sh, block_us);
+    rate_header_t rh{};
+    std::vector<rate_change_t> changes;
+    rec.has_rat = read_rat(with_ext(path, ".rat"), rh, changes);
+
+    uint32_t base = rec.has_rat ? rh.base_rate : rec.has_sum ? sh.sample_rate : rate;
+    const uint64_t B = rec.has_sum ? sh.block_samples : rec.has_rat ? rh.block_samples : 0;
+    if (rec.samples == 0)
+        return true;
+
+    TimedSegment cur{0, 0, 0, base};
+    if (!block_us.empty())
+        cur.t_us = int64_t(block_us[0]) - span_us(B - 1, base);
+    auto split = [&](uint64_t at, int64_t t_us, uint32_t r) {
+        cur.count = at - cur.first;
+        if (cur.count)
+            rec.segments.push_back(cur);
+        cur = TimedSegment{at, 0, t_us, r};
+    };
+
+    size_t next = 0;
+    const uint64_t blocks = B ? (rec.samples + B - 1) / B : 0;
+    for (uint64_t k = 0; k < blocks; k++) {
+        const uint64_t b0 = k * B, b1 = std::min(b0 + B, rec.samples);
+        const bool switched = next < changes.size() && changes[next].sample < b1;
+
+        // Where the samples so far put this block's completion, against
+        // where the .sum says it was; a block with a rate change in it
+        // isn't checked
+        if (k > 0 && k < block_us.size() && !switched && b1 - b0 == B) {
+            int64_t want = cur.t_us + span_us(b1 - 1 - cur.first, cur.rate);
+            int64_t got = int64_t(block_us[k]);
+            if (std::llabs(got - want) > span_us(B / 2, cur.rate))
+                split(b0, got - span_us(B - 1, cur.rate), cur.rate);
+        }
+        for (; next < changes.size() && changes[next].sample < b1; next++) {
+            const rate_change_t &c = changes[next];
+            split(c.sample, int64_t(c.t_us) + span_us(1, c.rate), c.rate);
+        }
+    }
+    split(rec.samples, 0, base);
+    return true;
+}
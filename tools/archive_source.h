@@ -0,0 +1,45 @@
+// Sample timing of a raw recording, for the archive (archive.h).
+//
+// A recording is split into segments of evenly spaced samples: a new
+// segment starts at every burst-mode rate change (aXXXX.rat) and wherever
+// the block completion times in aXXXX.sum jump by more than half a block
+// from where the samples before put them (blocks lost to write errors, a
+// stalled ADC). Without sidecars the whole file is one segment at the
+// given rate.
+//
+// Times are microseconds on the board's time_us_64() clock, which starts
+// at boot; anchor() moves them to wall-clock time.
+//
+// Deliberately free of ae_core headers: ae_core's sched.h shadows the
+// system one, which breaks <thread> in the tools that use this.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct TimedSegment {
+    uint64_t first;             // sample index in the recording
+    uint64_t count;
+    int64_t t_us;               // time of sample `first`
+    uint32_t rate;              // Hz
+};
+
+struct TimedRecording {
+    std::string path;
+    uint64_t samples = 0;
+    uint64_t fingerprint = 0;   // FNV-1a of the size and the first and last 64 KiB
+    int64_t mtime_us = 0;       // of the .bin, Unix time
+    bool has_sum = false;       // block times from aXXXX.sum
+    bool has_rat = false;       // rate changes from aXXXX.rat
+    std::vector<TimedSegment> segments;     // cover [0, samples) in order
+
+    // Time just after the last sample
+    int64_t end_us() const;
+    // Shift every segment so that sample 0 is at `t0_us`
+    void anchor(int64_t t0_us);
+};
+
+// Reads aXXXX.bin's size and sidecars; `rate` is used when there is no
+// .sum or .rat header.
+bool load_recording(const std::string &path, uint32_t rate, TimedRecording &rec);
@@ -0,0 +1,432 @@
+// Burst mode (lib/ae_core/rate_ctl.c) on replayed data.
+//
+// The input stands for the analog signal: a recording made at the burst
+// rate, or by default a synthetic one with activity episodes (decaying
+// bursts from lib/ae_core/replay.c, gated on for a few seconds at a time)
+// over noise. The ADC takes every base/burst-th input sample at the base
+// rate and every one at the burst rate, DMA fills the block ring, and the
+// interrupt at each block boundary runs what dma_handler runs: publish,
+// restart after its latency (samples in between wait in the 4-word ADC
+// FIFO), then rate_ctl_boundary() on the published block and, when it
+// asks, the switch: stop, count the lead, new divider, restart. The logger
+// takes blocks and switch records like main.c.
+//
+// The timebase is then rebuilt from the .rat header and records alone and
+// must give every recorded sample its input position exactly; rebuilt
+// without the lead it must not (when any switch had one). Reports the
+// storage saved against recording everything at the burst rate, how much
+// of the activity was sampled at the burst rate, the detection latency,
+// and the cost of the boundary test.
+//
+// usage: burst_sim [--seconds N] [--base HZ] [--burst HZ] [--hold MS]
+//                  [--threshold N] [--latency US] [--seed N] [-o out.bin]
+//                  [file.bin --rate HZ]
+//   -o out.bin writes the recording and its out.rat sidecar
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "acq_source.h"
+#include "rate_ctl.h"
+#include "replay.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t BLOCK_SAMPLES = 1024;        // BUF_SIZE in main.c
+constexpr uint32_t RING_BLOCKS = 8;             // ADC_RING_BLOCKS in main.c
+constexpr uint32_t ADC_FIFO_WORDS = 4;
+constexpr uint32_t SCAN_US = 30;                // rate_ctl_boundary() on the target
+
+uint32_t lcg(uint32_t &s)
+{
+    s = s * 1664525u + 1013904223u;
+    return s >> 8;
+}
+
+struct Options {
+    double seconds = 60;
+    uint32_t base = 4000;
+    uint32_t burst = 100000;
+    uint32_t hold_ms = 2000;
+    uint16_t threshold = 200;
+    uint32_t latency_us = 20;       // block-end interrupt latency, uniform 0..N
+    uint32_t seed = 1;
+    const char *out = nullptr;
+    const char *file = nullptr;
+    uint32_t file_rate = 0;
+};
+
+// Episodes of bursts over noise, at the burst rate: active for 3 s of
+// every 12 s, an 11.3 kHz burst every 200 ms while active
+std::vector<uint16_t> synth_input(const Options &o, uint64_t n)
+{
+    replay_config_t nc, bc;
+    replay_config_default(&nc, REPLAY_NOISE);
+    nc.sample_rate = o.burst;
+    nc.seed = o.seed;
+    replay_config_default(&bc, REPLAY_BURSTS);
+    bc.sample_rate = o.burst;
+    bc.freq_hz = 11300;       // not a multiple of the base rate: no blind sampling phase
+    bc.amplitude = 1000;
+    bc.burst_every = o.burst / 5;
+    bc.burst_len = o.burst / 30;
+    bc.noise = 0;
+
+    replay_t noise, bursts;
+    replay_init(&noise, &nc);
+    replay_init(&bursts, &bc);
+    std::vector<uint16_t> v(n), b(n);
+    replay_fill(&noise, v.data(), uint32_t(n));
+    replay_fill(&bursts, b.data(), uint32_t(n));
+    const uint64_t period = uint64_t(o.burst) * 12, active = uint64_t(o.burst) * 3;
+    for (uint64_t i = 0; i < n; i++) {
+        // Episodes start 4 s in, so the first blocks see a quiet input
+        uint64_t t = i + period - uint64_t(o.burst) * 4;
+        if (t % period < active)
+            v[i] = uint16_t(std::min<int32_t>(4095, std::max<int32_t>(0, v[i] + b[i] - bc.offset)));
+    }
+    return v;
+}
+
+struct Recording {
+    rate_header_t header;
+    std::vector<rate_change_t> changes;
+    std::vector<uint16_t> samples;
+    std::vector<uint64_t> truth;    // input position of each recorded sample
+    uint32_t fifo_overflows = 0;
+    uint32_t max_lead = 0;
+    uint32_t switches = 0;
+    uint32_t bursts = 0;
+};
+
+// The firmware's acquisition, one event at a time in input-sample ticks
+Recording acquire(const Options &o, const std::vector<uint16_t> &in, uint32_t seed)
+{
+    Recording rec;
+    const double tick_us = 1e6 / o.burst;
+    const uint32_t ratio = o.burst / o.base;
+
+    rate_ctl_config_t cfg = {};
+    cfg.base_rate = o.base;
+    cfg.burst_rate = o.burst;
+    cfg.hold_us = o.hold_ms * 1000;
+    cfg.threshold = o.threshold;
+    cfg.adc_clk_hz = 48000000;
+    cfg.block_samples = BLOCK_SAMPLES;
+    rate_ctl_t rc;
+    rate_ctl_init(&rc, &cfg);
+    rate_ctl_header(&rc, &rec.header);
+
+    std::vector<uint16_t> mem(RING_BLOCKS * BLOCK_SAMPLES);
+    std::vector<uint64_t> mem_truth(RING_BLOCKS * BLOCK_SAMPLES);
+    acq_ring_t ring;
+    acq_ring_init(&ring, mem.data(), RING_BLOCKS, BLOCK_SAMPLES);
+
+    const uint64_t NONE = ~0ull;
+    uint64_t next_sample = 0;       // tick of the next conversion
+    uint32_t period = ratio;
+    uint32_t filled = 0;            // samples DMA put into the head block
+    bool dma_on = true;
+    std::vector<std::pair<uint16_t, uint64_t>> fifo;
+    uint64_t irq_tick = NONE, switch_tick = NONE;
+    uint32_t switch_rate = 0;
+
+    auto put = [&](uint16_t v, uint64_t t) {
+        size_t i = (ring.head & (RING_BLOCKS - 1)) * BLOCK_SAMPLES + filled;
+        mem[i] = v;
+        mem_truth[i] = t;
+        filled++;
+    };
+    auto logger = [&] {
+        while (acq_ring_backlog(&ring)) {
+            size_t i = (ring.tail & (RING_BLOCKS - 1)) * BLOCK_SAMPLES;
+            rec.samples.insert(rec.samples.end(), &mem[i], &mem[i] + BLOCK_SAMPLES);
+            rec.truth.insert(rec.truth.end(), &mem_truth[i], &mem_truth[i] + BLOCK_SAMPLES);
+            ring.tail++;
+            rate_change_t r;
+            while (rate_ctl_next(&rc, ring.tail, &r))
+                rec.changes.push_back(r);
+        }
+    };
+
+    while (true) {
+        uint64_t t = std::min({next_sample, irq_tick, switch_tick});
+        if (t >= in.size())
+            break;
+
+        if (t == next_sample) {
+            // A conversion; a sample on the tick of an event lands before it
+            if (dma_on) {
+                put(in[t], t);
+                if (filled == BLOCK_SAMPLES) {
+                    dma_on = false;
+                    irq_tick = t + 1 + uint64_t(lcg(seed) % (o.latency_us + 1) / tick_us);
+                }
+            } else {
+                fifo.emplace_back(in[t], t);
+                if (fifo.size() > ADC_FIFO_WORDS)
+                    rec.fifo_overflows++;
+            }
+            next_sample += period;
+        } else if (t == irq_tick) {
+            // dma_handler: publish, restart, drain the FIFO, then the test
+            irq_tick = NONE;
+            acq_ring_publish(&ring, uint64_t(t * tick_us));
+            filled = 0;
+            dma_on = true;
+            for (auto &s : fifo)
+                put(s.first, s.second);
+            fifo.clear();
+            uint32_t last = ring.head - 1;
+            uint32_t rate = rate_ctl_boundary(&rc, acq_ring_block(&ring, last),
+                                              acq_ring_time(&ring, last));
+            if (rate) {
+                switch_rate = rate;
+                switch_tick = t + uint64_t(SCAN_US / tick_us);
+            }
+            logger();
+        } else {
+            // The switch: the lead is what the block holds at the old rate
+            switch_tick = NONE;
+            rec.max_lead = std::max(rec.max_lead, filled);
+            rec.switches++;
+            rate_ctl_switched(&rc, switch_rate, ring.head, uint16_t(filled), uint64_t(t * tick_us));
+            period = switch_rate == o.burst ? 1 : ratio;
+            next_sample = t + period;
+        }
+    }
+    logger();
+    rec.bursts = rc.bursts;
+    check(rc.lost == 0, "no switch records lost", rc.lost, 0);
+    return rec;
+}
+
+// What a reader does: input position (in ticks of the burst rate) of each
+// sample from the header and the records only
+std::vector<uint64_t> rebuild(const rate_header_t &h, const std::vector<rate_change_t> &ch,
+                              uint64_t n, bool use_lead)
+{
+    std::vector<uint64_t> t(n);
+    const double tick_us = 1e6 / h.burst_rate;
+    uint64_t seg_sample = 0, seg_tick = 0;
+    uint32_t period = h.burst_rate / h.base_rate;
+    size_t k = 0;
+    for (uint64_t s = 0; s < n; s++) {
+        while (k < ch.size()) {
+            uint64_t at = use_lead ? ch[k].sample : uint64_t(ch[k].block) * h.block_samples;
+            if (at > s)
+                break;
+            period = h.burst_rate / ch[k].rate;
+            seg_sample = at;
+            seg_tick = uint64_t(ch[k].t_us / tick_us + 0.5) + period;
+            k++;
+        }
+        t[s] = seg_tick + (s - seg_sample) * period;
+    }
+    return t;
+}
+
+void write_outputs(const char *out, const Recording &r)
+{
+    FILE *f = fopen(out, "wb");
+    if (!f) {
+        perror(out);
+        return;
+    }
+    fwrite(r.samples.data(), 2, r.samples.size(), f);
+    fclose(f);
+
+    std::string rat = out;
+    size_t dot = rat.rfind('.');
+    rat = (dot == std::string::npos ? rat : rat.substr(0, dot)) + ".rat";
+    f = fopen(rat.c_str(), "wb");
+    if (!f) {
+        perror(rat.c_str());
+        return;
+    }
+    fwrite(&r.header, sizeof(r.header), 1, f);
+    fwrite(r.changes.data(), sizeof(rate_change_t), r.changes.size(), f);
+    fclose(f);
+    printf("wrote %s and %s\n", out, rat.c_str());
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "--seconds" && more) o.seconds = atof(argv[++i]);
+        else if (a == "--base" && more) o.base = uint32_t(atoi(argv[++i]));
+        else if (a == "--burst" && more) o.burst = uint32_t(atoi(argv[++i]));
+        else if (a == "--hold" && more) o.hold_ms = uint32_t(atoi(argv[++i]));
+        else if (a == "--threshold" && more) o.threshold = uint16_t(atoi(argv[++i]));
+        else if (a == "--latency" && more) o.latency_us = uint32_t(atoi(argv[++i]));
+        else if (a == "--seed" && more) o.seed = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if (a == "--rate" && more) o.file_rate = uint32_t(atoi(argv[++i]));
+        else if (a == "-o" && more) o.out = argv[++i];
+        else if (a[0] != '-' && !o.file) o.file = argv[i];
+        else {
+            fprintf(stderr, "usage: burst_sim [--seconds N] [--base HZ] [--burst HZ] [--hold MS]\n"
+                            "                 [--threshold N] [--latency US] [--seed N] [-o out.bin]\n"
+                            "                 [file.bin --rate HZ]\n");
+            return 2;
+        }
+    }
+    if (o.file) {
+        if (!o.file_rate) {
+            fprintf(stderr, "burst_sim: --rate gives the sample rate of %s\n", o.file);
+            return 2;
+        }
+        o.burst = o.file_rate;
+    }
+    if (o.base == 0 || o.burst <= o.base || o.burst % o.base || 1000000 % o.burst) {
+        fprintf(stderr, "burst_sim: the burst rate must be a multiple of the base rate and "
+                        "divide 1 MHz\n");
+        return 2;
+    }
+
+    std::vector<uint16_t> in;
+    if (o.file) {
+        FILE *f = fopen(o.file, "rb");
+        if (!f) {
+            perror(o.file);
+            return 1;
+        }
+        uint16_t buf[4096];
+        size_t got;
+        while ((got = fread(buf, 2, 4096, f)) > 0)
+            in.insert(in.end(), buf, buf + got);
+        fclose(f);
+    } else {
+        in = synth_input(o, uint64_t(o.seconds * o.burst));
+    }
+    printf("%s: %.1f s at %u S/s; base %u S/s, hold %u ms, threshold %u, IRQ latency 0..%u us\n",
+           o.file ? o.file : "synthetic episodes", double(in.size()) / o.burst, o.burst, o.base,
+           o.hold_ms, o.threshold, o.latency_us);
+
+    auto t0 = std::chrono::steady_clock::now();
+    Recording r = acquire(o, in, o.seed);
+    double sim_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Timebase from the sidecar alone
+    std::vector<uint64_t> t = rebuild(r.header, r.changes, r.samples.size(), true);
+    uint64_t wrong = 0;
+    for (size_t i = 0; i < t.size(); i++)
+        wrong += t[i] != r.truth[i];
+    std::vector<uint64_t> t_nolead = rebuild(r.header, r.changes, r.samples.size(), false);
+    uint64_t wrong_nolead = 0;
+    for (size_t i = 0; i < t.size(); i++)
+        wrong_nolead += t_nolead[i] != r.truth[i];
+
+    // Activity: input samples away from the quiet level by the threshold,
+    // and whether the ADC was at the burst rate when they came
+    std::vector<uint8_t> fast(in.size(), 0);
+    for (size_t k = 0; k < r.changes.size(); k++) {
+        if (r.changes[k].rate != o.burst)
+            continue;
+        uint64_t from = t[r.changes[k].sample];
+        uint64_t to = k + 1 < r.changes.size() ? t[r.changes[k + 1].sample] : in.size();
+        std::fill(fast.begin() + from, fast.begin() + std::min<uint64_t>(to, in.size()), 1);
+    }
+    double level = 0;
+    for (uint16_t v : in)
+        level += v;
+    const int32_t quiet = int32_t(level / std::max<size_t>(in.size(), 1) + 0.5);
+    uint64_t active = 0, caught = 0;
+    double lat_sum = 0, lat_max = 0;
+    uint32_t episodes = 0;
+    bool was_active = false;
+    uint64_t last_active = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        bool a = in[i] > quiet + o.threshold || in[i] + o.threshold < quiet;
+        if (!a)
+            continue;
+        active++;
+        caught += fast[i];
+        // A new episode after more than the hold time of quiet
+        bool starts = !was_active || (i - last_active) * 1e3 / o.burst > o.hold_ms;
+        if (starts) {
+            size_t j = i;
+            while (j < in.size() && !fast[j])
+                j++;
+            double ms = (j - i) * 1e3 / o.burst;
+            lat_sum += ms;
+            lat_max = std::max(lat_max, ms);
+            episodes++;
+        }
+        was_active = true;
+        last_active = i;
+    }
+
+    uint64_t all_fast = in.size();
+    printf("\n%llu samples recorded, %llu at %u S/s would be: %.1f %% of the storage\n",
+           (unsigned long long)r.samples.size(), (unsigned long long)all_fast, o.burst,
+           100.0 * r.samples.size() / all_fast);
+    printf("%u switches (%u up), largest lead %u samples, %u ADC FIFO overflows\n", r.switches,
+           r.bursts, r.max_lead, r.fifo_overflows);
+    printf("activity: %llu input samples, %.1f %% of them at the burst rate\n",
+           (unsigned long long)active, active ? 100.0 * caught / active : 0.0);
+    printf("detection: %u episodes, latency mean %.0f ms, max %.0f ms (a base-rate block is %.0f ms)\n",
+           episodes, episodes ? lat_sum / episodes : 0.0, lat_max, BLOCK_SAMPLES * 1e3 / o.base);
+    printf("timebase from the .rat: %llu of %llu samples misplaced (%llu without the lead)\n",
+           (unsigned long long)wrong, (unsigned long long)t.size(),
+           (unsigned long long)wrong_nolead);
+    printf("simulated %.1f s of input in %.2f s\n", double(in.size()) / o.burst, sim_s);
+
+    check(wrong == 0, "timebase rebuilt exactly from the records", double(wrong), 0);
+    if (r.max_lead > 0)
+        check(wrong_nolead > 0, "the lead matters", double(wrong_nolead), 1);
+    check(r.fifo_overflows == 0 || o.latency_us * o.burst >= ADC_FIFO_WORDS * 1000000ull,
+          "ADC FIFO within its 4 words", r.fifo_overflows, 0);
+    check(r.changes.size() == r.switches || r.changes.size() + 1 == r.switches,
+          "every switch recorded", double(r.changes.size()), r.switches);
+    for (size_t k = 1; k < r.changes.size(); k++)
+        if (r.changes[k].sample <= r.changes[k - 1].sample) {
+            check(false, "records in sample order", double(k), 0);
+            break;
+        }
+    if (!o.file) {
+        // Synthetic episodes are long and loud: the mode has to earn its keep
+        check(r.bursts > 0, "bursts detected", r.bursts, 1);
+        check(active && caught * 10 >= active * 8, "80 % of the activity at the burst rate",
+              100.0 * caught / std::max<uint64_t>(active, 1), 80);
+        check(r.samples.size() * 2 < all_fast, "under half the storage of the burst rate",
+              double(r.samples.size()), all_fast / 2.0);
+        check(lat_max <= 2 * BLOCK_SAMPLES * 1e3 / o.base, "detected within two base-rate blocks",
+              lat_max, 2 * BLOCK_SAMPLES * 1e3 / o.base);
+    }
+
+    // Cost of the test in the interrupt, per block
+    {
+        rate_ctl_config_t cfg = {o.base, o.burst, o.hold_ms * 1000, o.threshold, 48000000,
+                                 BLOCK_SAMPLES};
+        rate_ctl_t rc;
+        rate_ctl_init(&rc, &cfg);
+        const uint32_t reps = 20000;
+        uint64_t sink = 0;
+        auto b0 = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < reps; i++) {
+            size_t at = size_t(i % 64) * BLOCK_SAMPLES % (in.size() - BLOCK_SAMPLES);
+            sink += rate_ctl_boundary(&rc, &in[at], uint64_t(i) * 1000);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - b0)
+                        .count() / reps;
+        printf("rate_ctl_boundary: %.0f ns per block on the host (%llu)\n", ns,
+               (unsigned long long)(sink & 1));
+    }
+
+    if (o.out)
+        write_outputs(o.out, r);
+
+    printf("\n");
+    return check_summary();
+}
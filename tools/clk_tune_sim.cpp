@@ -0,0 +1,367 @@
+// Drive the SD clock tuner (lib/ae_core/clk_tune.h) against SdCardSim with
+// bit errors injected on the wires, and check where it settles.
+//
+// Each card has a clock limit: at or below it the wires are clean (or at
+// a floor rate), above it the bit error rate grows tenfold per MHz, from
+// 1e-7 just past the limit to at most 1e-2. The tuner only sees what the
+// firmware sees: bad R1s, rejected blocks, read CRC16 mismatches and
+// differing bytes in the read-back.
+//
+// The scenarios cover the climb, the back-off, a failing bus, the sdclk.bin
+// table (stored clocks, cloned card images, eviction) and the run-time
+// downshift. The sweep tunes cards with limits from 3 to 27 MHz and counts
+// how often the probe picks the highest clean step, a lower one, or an
+// unsafe one, and where the run-time monitor ends up after 5000 writes.
+//
+// usage: clk_tune_sim [--sweep SEEDS] [--busy-us N]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "clk_tune.h"
+#include "sd_card_sim.h"
+#include "sd_proto.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t SCRATCH_LBA = 2048;
+constexpr uint32_t SCRATCH_BLOCKS = 4;   // as the firmware's sdclk.tmp
+
+struct Card {
+    double limit_hz = 1e12;              // clean up to here
+    double floor_ber = 0;                // at or below the limit
+    uint8_t cid_tag = 0;                 // makes the CID differ between cards
+
+    double ber(double hz) const
+    {
+        if (hz <= limit_hz)
+            return floor_ber;
+        return std::min(1e-2, 1e-7 * std::pow(10.0, (hz - limit_hz) / 1e6));
+    }
+};
+
+struct SimBus {
+    SdCardSim card{SCRATCH_LBA + 64};
+    Card model;
+    double clk_hz = 4e6;
+    double now_us = 0;
+    uint64_t seed = 1;
+    sd_transport_t t{};
+
+    void set_clock(uint32_t hz)
+    {
+        clk_hz = hz;
+        card.set_bit_error_rate(model.ber(hz), seed++);
+    }
+};
+
+void bus_select(void *ctx, bool on)
+{
+    static_cast<SimBus *>(ctx)->card.select(on);
+}
+
+void bus_xfer_start(void *ctx, const uint8_t *tx, uint8_t *rx, uint32_t len, bool crc)
+{
+    auto *b = static_cast<SimBus *>(ctx);
+    (void)crc;
+    const double byte_us = 8e6 / b->clk_hz;
+    for (uint32_t i = 0; i < len; i++) {
+        b->now_us += byte_us;
+        b->card.now_us = b->now_us;
+        uint8_t in = b->card.exchange(tx ? tx[i] : 0xFF);
+        if (rx)
+            rx[i] = in;
+    }
+}
+
+bool bus_xfer_busy(void *) { return false; }
+
+uint16_t bus_xfer_crc(void *) { return 0; }
+
+struct Bench {
+    SimBus bus;
+    uint32_t busy_us;
+    std::vector<uint8_t> scratch = std::vector<uint8_t>(2 * SD_BLOCK_SIZE);
+
+    Bench(const Card &c, uint32_t busy, uint64_t seed) : busy_us(busy)
+    {
+        bus.model = c;
+        bus.seed = seed;
+        bus.card.busy_us = busy;
+        uint8_t id[15] = {0x03, 'S', 'D', 'A', 'E', 'S', 'I', 'M', 0x10, 0, 0, 0, 0, 0x01, 0x4A};
+        id[12] = c.cid_tag;
+        bus.card.set_cid(id);
+        bus.t = {&bus, bus_select, bus_xfer_start, bus_xfer_busy, bus_xfer_crc};
+        bus.set_clock(4000000);
+    }
+
+    uint32_t probe(uint32_t rounds)
+    {
+        return clk_tune_probe(&bus.t, true, SCRATCH_LBA, SCRATCH_BLOCKS, rounds,
+                              uint32_t(bus.seed * 0x9E3779B9u), scratch.data());
+    }
+};
+
+struct Tuned {
+    clk_tune_state_t state;
+    uint32_t hz;
+    double ms;                           // simulated bus time
+    bool crc_off;                        // card left as FatFs expects it
+};
+
+// What card_tune() does after f_mount, at the mount clock (ladder[0])
+Tuned tune(Bench &b, clk_tune_t &t, const clk_tune_config_t &cfg, uint32_t stored_hz)
+{
+    const double t0 = b.bus.now_us;
+    b.bus.set_clock(cfg.ladder[0]);
+    clk_tune_init(&t, &cfg, stored_hz);
+    uint32_t hz, rounds;
+    clk_tune_state_t st = CLK_TUNE_FAILED;
+    if (clk_tune_crc(&b.bus.t, true)) {
+        while ((st = clk_tune_next(&t, &hz, &rounds)) == CLK_TUNE_PROBE) {
+            b.bus.set_clock(hz);
+            clk_tune_result(&t, b.probe(rounds));
+        }
+        b.bus.set_clock(cfg.ladder[0]);
+        clk_tune_crc(&b.bus.t, false);
+    }
+    b.bus.set_clock(clk_tune_hz(&t));
+    return {st, clk_tune_hz(&t), (b.bus.now_us - t0) / 1e3, !b.bus.card.crc_on};
+}
+
+// Highest ladder step the card runs clean at
+uint32_t safe_hz(const clk_tune_config_t &cfg, const Card &c)
+{
+    uint32_t hz = cfg.ladder[0];
+    for (uint32_t i = 0; i < cfg.steps; i++)
+        if (c.ber(cfg.ladder[i]) == 0)
+            hz = cfg.ladder[i];
+    return hz;
+}
+
+// Recording: one single-block write per op, as the store notes each one
+uint32_t run_writes(Bench &b, clk_tune_t &t, uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++) {
+        bool ok = clk_tune_probe(&b.bus.t, true, SCRATCH_LBA, 1, 1, i, b.scratch.data()) == 0;
+        if (uint32_t hz = clk_tune_note(&t, ok))
+            b.bus.set_clock(hz);
+    }
+    return clk_tune_hz(&t);
+}
+
+void scenario(const char *name, const Card &c, uint32_t stored, uint32_t want_hz,
+              clk_tune_state_t want_state, uint32_t busy_us)
+{
+    clk_tune_config_t cfg;
+    clk_tune_config_default(&cfg);
+    Bench b(c, busy_us, 7);
+    clk_tune_t t;
+    Tuned r = tune(b, t, cfg, stored);
+    printf("%-26s %6.1f MHz  %-6s %3u probes %4u rounds %3u errors %8.1f ms\n", name,
+           r.hz / 1e6, r.state == CLK_TUNE_DONE ? "done" : "failed", t.probes, t.rounds,
+           t.probe_errors, r.ms);
+    check(r.state == want_state, name, "state", r.state, want_state);
+    check(r.hz == want_hz, name, "clock", r.hz, want_hz);
+    check(r.crc_off, name, "CRC checks off again for FatFs");
+    if (stored && r.hz == stored)
+        check(t.probes == 1, name, "a stored clock that still works costs one probe", t.probes, 1);
+}
+
+void scenarios(uint32_t busy_us)
+{
+    printf("%-26s %10s  %-6s %10s %11s %10s %11s\n", "scenario", "clock", "state", "probes",
+           "rounds", "errors", "time");
+    Card clean;
+    scenario("clean wires", clean, 0, 25000000, CLK_TUNE_DONE, busy_us);
+
+    Card c14;
+    c14.limit_hz = 14e6;
+    scenario("limit 14 MHz", c14, 0, 12000000, CLK_TUNE_DONE, busy_us);
+
+    Card c9;
+    c9.limit_hz = 9e6;
+    scenario("limit 9 MHz", c9, 0, 8000000, CLK_TUNE_DONE, busy_us);
+
+    Card bad;
+    bad.limit_hz = 0;
+    scenario("bad wiring", bad, 0, 4000000, CLK_TUNE_FAILED, busy_us);
+
+    scenario("stored 12, limit 14", c14, 12000000, 12000000, CLK_TUNE_DONE, busy_us);
+    scenario("stored 20, limit 14", c14, 20000000, 12000000, CLK_TUNE_DONE, busy_us);
+    scenario("stored 13.3 (off ladder)", c14, 13333333, 12000000, CLK_TUNE_DONE, busy_us);
+
+    // Rare errors at the tuned clock: the probe passes, the store's writes don't
+    const char *name = "run-time downshift";
+    {
+        clk_tune_config_t cfg;
+        clk_tune_config_default(&cfg);
+        Bench b(clean, busy_us, 11);
+        clk_tune_t t;
+        Tuned r = tune(b, t, cfg, 0);
+        check(r.hz == 25000000, name, "tuned clock", r.hz, 25000000);
+
+        b.bus.model.limit_hz = 21.5e6;   // the card warms up: 3e-4 at 25 MHz
+        b.bus.set_clock(r.hz);
+        uint32_t hz = run_writes(b, t, 2000);
+        printf("%-26s %6.1f MHz  after 2000 writes, %u downshifts, %u write errors\n", name,
+               hz / 1e6, t.downshifts, t.write_errors);
+        check(hz == 20000000, name, "settles at the highest clean step", hz, 20000000);
+        check(t.downshifts == 1, name, "one step down", t.downshifts, 1);
+    }
+
+    name = "run-time quiet";
+    {
+        clk_tune_config_t cfg;
+        clk_tune_config_default(&cfg);
+        Card c = clean;
+        c.floor_ber = 1e-9;
+        Bench b(c, busy_us, 13);
+        clk_tune_t t;
+        tune(b, t, cfg, 0);
+        uint32_t hz = run_writes(b, t, 5000);
+        printf("%-26s %6.1f MHz  after 5000 writes at 1e-9, %u downshifts, %u write errors\n",
+               name, hz / 1e6, t.downshifts, t.write_errors);
+        check(t.downshifts == 0, name, "isolated errors don't step down", t.downshifts, 0);
+    }
+
+    name = "CID";
+    {
+        Bench b(clean, busy_us, 17);
+        uint8_t cid[16];
+        check(clk_tune_read_cid(&b.bus.t, cid) && memcmp(cid, b.bus.card.cid, 16) == 0, name,
+              "CMD10 reads the card's CID");
+        b.bus.model.floor_ber = 1e-2;
+        b.bus.set_clock(4000000);
+        uint32_t bad_reads = 0;
+        for (int i = 0; i < 200; i++)
+            bad_reads += clk_tune_read_cid(&b.bus.t, cid) && memcmp(cid, b.bus.card.cid, 16) != 0;
+        check(bad_reads == 0, name, "a corrupted CID is never accepted", bad_reads, 0);
+    }
+}
+
+void table_checks()
+{
+    const char *name = "sdclk.bin";
+    clk_tune_table_t tab;
+    clk_tune_table_init(&tab);
+    check(clk_tune_table_valid(&tab), name, "empty table valid");
+
+    auto cid_of = [](uint8_t tag, uint8_t *cid) {
+        memset(cid, 0, 16);
+        cid[0] = 0x03;
+        cid[12] = tag;
+        cid[15] = uint8_t(sd_crc7(cid, 15) << 1 | 1);
+    };
+
+    uint8_t a[16], b[16];
+    cid_of(1, a);
+    cid_of(2, b);
+    clk_tune_table_put(&tab, a, 20000000, 0);
+    check(clk_tune_table_find(&tab, a) == 20000000, name, "stored clock found");
+    check(clk_tune_table_find(&tab, b) == 0, name, "a cloned image on another card retunes");
+
+    clk_tune_table_put(&tab, a, 16000000, 1);
+    uint32_t used = 0;
+    for (const auto &e : tab.e)
+        used += e.hz != 0;
+    check(used == 1 && clk_tune_table_find(&tab, a) == 16000000, name,
+          "a downshift replaces the card's entry", used, 1);
+
+    // Through the bytes of the file, and a flipped bit
+    uint8_t file[sizeof(tab)];
+    memcpy(file, &tab, sizeof(tab));
+    clk_tune_table_t back;
+    memcpy(&back, file, sizeof(back));
+    check(clk_tune_table_valid(&back) && clk_tune_table_find(&back, a) == 16000000, name,
+          "file round trip");
+    file[sizeof(clk_tune_header_t) + 17] ^= 0x04;
+    memcpy(&back, file, sizeof(back));
+    check(!clk_tune_table_valid(&back), name, "a damaged file is rejected");
+
+    // The least recently tuned card makes room
+    for (uint8_t k = 2; k < 2 + CLK_TUNE_SLOTS; k++) {
+        uint8_t c[16];
+        cid_of(k, c);
+        clk_tune_table_put(&tab, c, 4000000u * k, 0);
+    }
+    uint8_t newest[16];
+    cid_of(1 + CLK_TUNE_SLOTS, newest);
+    check(clk_tune_table_find(&tab, a) == 0, name, "oldest entry evicted");
+    check(clk_tune_table_find(&tab, newest) == 4000000u * (1 + CLK_TUNE_SLOTS), name,
+          "newest entry kept");
+}
+
+void sweep(uint32_t seeds, uint32_t busy_us)
+{
+    clk_tune_config_t cfg;
+    clk_tune_config_default(&cfg);
+
+    printf("\nSweep, %u cards per limit: tuned clock vs the highest clean step\n", seeds);
+    printf("%8s %8s %6s %6s %6s %10s %18s\n", "limit", "clean", "equal", "lower", "unsafe",
+           "tune ms", "unsafe after 5000");
+    uint32_t unsafe_total = 0, unsafe_left = 0, lower_total = 0, runs = 0;
+    for (uint32_t mhz = 3; mhz <= 27; mhz++) {
+        Card c;
+        c.limit_hz = mhz * 1e6 + 0.5e6;
+        const uint32_t safe = safe_hz(cfg, c);
+        uint32_t equal = 0, lower = 0, unsafe = 0, left = 0;
+        double ms = 0;
+        for (uint32_t s = 0; s < seeds; s++) {
+            Bench b(c, busy_us, 1000 * mhz + s);
+            clk_tune_t t;
+            Tuned r = tune(b, t, cfg, 0);
+            ms += r.ms;
+            if (r.hz == safe) {
+                equal++;
+            } else if (r.hz < safe) {
+                lower++;
+            } else {
+                unsafe++;
+                left += run_writes(b, t, 5000) > safe;
+            }
+        }
+        printf("%6.1f M %6.1f M %6u %6u %6u %10.1f %18u\n", c.limit_hz / 1e6, safe / 1e6, equal,
+               lower, unsafe, ms / seeds, left);
+        unsafe_total += unsafe;
+        unsafe_left += left;
+        lower_total += lower;
+        runs += seeds;
+    }
+    printf("%u runs: %u below the clean step, %u unsafe after the probe, %u still unsafe "
+           "after 5000 writes\n",
+           runs, lower_total, unsafe_total, unsafe_left);
+    check(unsafe_left == 0, "sweep", "run-time monitor fixes every unsafe pick", unsafe_left, 0);
+    check(lower_total * 20 <= runs, "sweep", "at most 5% of cards tuned low", lower_total,
+          runs / 20.0);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint32_t seeds = 10;
+    uint32_t busy_us = 500;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--sweep" && i + 1 < argc) seeds = uint32_t(atoi(argv[++i]));
+        else if (a == "--busy-us" && i + 1 < argc) busy_us = uint32_t(atoi(argv[++i]));
+        else {
+            fprintf(stderr, "usage: clk_tune_sim [--sweep SEEDS] [--busy-us N]\n");
+            return 2;
+        }
+    }
+
+    scenarios(busy_us);
+    table_checks();
+    if (seeds)
+        sweep(seeds, busy_us);
+
+    return check_summary();
+}
@@ -0,0 +1,279 @@
+// Drive the capture schedule (lib/ae_core/duty.h) with a simulated clock
+// and a model of the board, and check that the windows start on time.
+//
+// The model stands in for what the firmware does on each action: waking
+// from sleep costs the clock restart, and the timer that ends the sleep
+// runs `err_ppm` off the clock the engine reads; warm-up is the card
+// mount or file open, with the spread of the scenario; the first sample
+// comes one sample period after the capture starts; shutdown closes the
+// files. Sleeps shorter than DEEP_MIN_US stay in light sleep (WFE) and
+// end exactly on time.
+//
+// The scenarios cover steady warm-ups, a first warm-up slower than the
+// guess, slow outliers, a sleep timed by a low-power oscillator (with the
+// ppm allowance, and without it, where the lead has to learn the drift), a
+// missing card, windows that overrun their interval, and a limited number
+// of windows. Every recorded window must
+// start on the grid of its interval.
+//
+// usage: duty_sim [--hours N] [--window-s N] [--interval-s N] [--mah N] [--seed N]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "duty.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint64_t DEEP_MIN_US = 20000;         // as the firmware's DUTY_DEEP_MIN_US
+constexpr uint32_t FIRST_SAMPLE_US = 250 + 40;  // one period at 4 kHz, plus acq_start()
+
+struct Scenario {
+    const char *name = "";
+    uint32_t windows = 0;                       // cfg.windows
+    uint64_t interval_us = 0;                   // 0: from the command line
+    uint32_t sleep_ppm = 0;                     // cfg.sleep_ppm
+    double err_ppm = 0;                         // sleep timer against the engine's clock
+    double err_wander_ppm = 0;                  // per sleep, uniform +-
+    std::function<uint32_t(std::mt19937 &, uint32_t)> warmup;   // (rng, window) -> us
+    bool card = true;
+    uint32_t shutdown_min_us = 60000, shutdown_max_us = 150000;
+};
+
+struct Result {
+    duty_t d;
+    uint64_t now;
+    uint64_t first_start;
+    uint32_t off_grid = 0;
+    uint64_t wait_us = 0;
+    uint32_t expected = 0;                      // grid windows that start before the end
+};
+
+uint32_t uniform(std::mt19937 &rng, uint32_t lo, uint32_t hi)
+{
+    return std::uniform_int_distribution<uint32_t>(lo, hi)(rng);
+}
+
+Result run(const Scenario &sc, const duty_config_t &base, uint64_t end_us, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    duty_config_t cfg = base;
+    cfg.windows = sc.windows;
+    cfg.sleep_ppm = sc.sleep_ppm;
+    if (sc.interval_us)
+        cfg.interval_us = sc.interval_us;
+
+    Result r{};
+    r.now = 0;
+    duty_init(&r.d, &cfg, r.now);
+    r.first_start = r.d.cur.start_at_us;
+
+    while (r.now < end_us) {
+        uint64_t at;
+        duty_state_t state = duty_state(&r.d);
+        switch (duty_next(&r.d, r.now, &at)) {
+        case DUTY_IDLE: {
+            uint64_t dt = at - r.now;
+            if (state == DUTY_SLEEP && dt >= DEEP_MIN_US) {
+                double err = sc.err_ppm;
+                if (sc.err_wander_ppm)
+                    err += std::uniform_real_distribution<double>(-sc.err_wander_ppm,
+                                                                  sc.err_wander_ppm)(rng);
+                r.now += uint64_t(double(dt) * (1 + err * 1e-6)) + uniform(rng, 800, 1500);
+            } else {
+                r.now = at + uniform(rng, 2, 10);
+            }
+            break;
+        }
+        case DUTY_POWER_UP:
+            r.now += sc.warmup(rng, r.d.cur.index);
+            duty_ready(&r.d, r.now, sc.card);
+            break;
+        case DUTY_START: {
+            r.now += FIRST_SAMPLE_US;
+            uint64_t start_at = r.d.cur.start_at_us;
+            duty_started(&r.d, r.now, true);
+            if ((start_at - r.first_start) % cfg.interval_us)
+                r.off_grid++;
+            r.wait_us += r.d.cur.wait_us;
+            break;
+        }
+        case DUTY_STOP:
+            r.now += uniform(rng, sc.shutdown_min_us, sc.shutdown_max_us);
+            duty_stopped(&r.d, r.now);
+            break;
+        case DUTY_FINISHED:
+            r.now = end_us;
+            break;
+        }
+    }
+
+    if (end_us > r.first_start)
+        r.expected = uint32_t((end_us - r.first_start - 1) / cfg.interval_us + 1);
+    if (cfg.windows && r.expected > cfg.windows)
+        r.expected = cfg.windows;
+    return r;
+}
+
+void print_header()
+{
+    printf("%-22s %5s %4s %6s %5s %8s %8s %8s %8s %7s %7s %7s %6s\n", "scenario", "wins",
+           "late", "missed", "gave", "wake ms", "warm ms", "start us", "wait ms", "capt %",
+           "sleep %", "avg uA", "days");
+}
+
+void print_row(const Scenario &sc, const Result &r, uint32_t mah)
+{
+    const duty_t &d = r.d;
+    uint32_t ua = duty_avg_ua(&d, r.now);
+    double wait_ms = d.windows ? double(r.wait_us) / d.windows / 1000 : 0;
+    printf("%-22s %5lu %4lu %6lu %5lu %8.2f %8.1f %8ld %8.1f %7.3f %7.3f %7lu %6.1f\n", sc.name,
+           (unsigned long)d.windows, (unsigned long)d.late, (unsigned long)d.missed,
+           (unsigned long)d.failed, d.max_wake_late_us / 1000.0, d.max_warmup_us / 1000.0,
+           (long)d.max_start_late_us, wait_ms, duty_ppm(&d, DUTY_CAPTURE, r.now) / 1e4,
+           duty_ppm(&d, DUTY_SLEEP, r.now) / 1e4, (unsigned long)ua,
+           ua ? mah * 1000.0 / ua / 24 : 0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    uint32_t hours = 24;
+    uint32_t window_s = 10;
+    uint32_t interval_s = 15 * 60;
+    uint32_t mah = 2000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--hours" && i + 1 < argc) hours = uint32_t(atoi(argv[++i]));
+        else if (a == "--window-s" && i + 1 < argc) window_s = uint32_t(atoi(argv[++i]));
+        else if (a == "--interval-s" && i + 1 < argc) interval_s = uint32_t(atoi(argv[++i]));
+        else if (a == "--mah" && i + 1 < argc) mah = uint32_t(atoi(argv[++i]));
+        else if (a == "--seed" && i + 1 < argc) seed = uint32_t(atoi(argv[++i]));
+        else {
+            fprintf(stderr, "usage: duty_sim [--hours N] [--window-s N] [--interval-s N] "
+                            "[--mah N] [--seed N]\n");
+            return 2;
+        }
+    }
+    if (!hours || !window_s || interval_s <= window_s) {
+        fprintf(stderr, "need hours > 0 and interval > window > 0\n");
+        return 2;
+    }
+
+    duty_config_t base;
+    duty_config_default(&base);
+    base.window_us = window_s * 1000000u;
+    base.interval_us = uint64_t(interval_s) * 1000000;
+    const uint64_t end_us = uint64_t(hours) * 3600 * 1000000;
+
+    // Card mounted: the file open and its preallocation
+    auto steady = [](std::mt19937 &rng, uint32_t) { return uniform(rng, 60000, 120000); };
+    // Card powered off between windows: power-up, mount, clock confirmation
+    auto remount = [](std::mt19937 &rng, uint32_t) { return uniform(rng, 320000, 450000); };
+    // The preallocation searches further as the card fills; now and then much further
+    auto outliers = [](std::mt19937 &rng, uint32_t w) {
+        uint32_t us = 80000 + 2000 * w + uniform(rng, 0, 40000);
+        return uniform(rng, 0, 19) == 0 ? us * 3 : us;
+    };
+
+    Scenario scenarios[8];
+    scenarios[0].name = "steady";
+    scenarios[0].warmup = steady;
+    scenarios[1].name = "remount";
+    scenarios[1].warmup = remount;
+    scenarios[2].name = "slow outliers";
+    scenarios[2].warmup = outliers;
+    scenarios[3].name = "lposc sleep";
+    scenarios[3].warmup = steady;
+    scenarios[3].sleep_ppm = 20000;
+    scenarios[3].err_ppm = 15000;
+    scenarios[3].err_wander_ppm = 2000;
+    scenarios[4].name = "lposc, no allowance";
+    scenarios[4].warmup = steady;
+    scenarios[4].err_ppm = 15000;
+    scenarios[4].err_wander_ppm = 2000;
+    scenarios[5].name = "no card";
+    scenarios[5].warmup = [](std::mt19937 &, uint32_t) { return 3u * 250000; };
+    scenarios[5].card = false;
+    scenarios[6].name = "overrun";
+    scenarios[6].warmup = steady;
+    scenarios[6].interval_us = base.window_us + 1500000;
+    scenarios[6].shutdown_min_us = 1500000;
+    scenarios[6].shutdown_max_us = 2500000;
+    scenarios[7].name = "5 windows";
+    scenarios[7].warmup = steady;
+    scenarios[7].windows = 5;
+
+    printf("%u s every %u s for %u h, %u mAh\n\n", window_s, interval_s, hours, mah);
+    print_header();
+    for (const Scenario &sc : scenarios) {
+        Result r = run(sc, base, end_us, seed);
+        print_row(sc, r, mah);
+        const duty_t &d = r.d;
+        const std::string name = sc.name;
+
+        check(r.off_grid == 0, sc.name, "window off the grid", r.off_grid, 0);
+        check(d.max_start_late_us >= 0, sc.name, "window started early", d.max_start_late_us, 0);
+
+        if (name == "steady" || name == "lposc sleep" || name == "5 windows") {
+            check(d.windows == r.expected, sc.name, "windows", d.windows, r.expected);
+            check(d.late == 0, sc.name, "late windows", d.late, 0);
+            check(d.missed == 0, sc.name, "missed windows", d.missed, 0);
+        }
+        if (name == "steady") {
+            // Waiting is the lead's price: the margin and the spread of the warm-up
+            double wait_ms = d.windows ? double(r.wait_us) / d.windows / 1000 : 0;
+            check(wait_ms < 300, sc.name, "mean wait ms", wait_ms, 300);
+            // Awake for the window and at most 2 s around it
+            const uint32_t ppm = uint32_t(1000000 - (base.window_us + 2000000ull) * 1000000 /
+                                                        base.interval_us);
+            check(duty_ppm(&d, DUTY_SLEEP, r.now) > ppm, sc.name, "sleep ppm",
+                  duty_ppm(&d, DUTY_SLEEP, r.now), ppm);
+        }
+        if (name == "remount") {
+            // Only the first warm-up is slower than the initial guess
+            check(d.late <= 1, sc.name, "late windows", d.late, 1);
+            check(d.windows == r.expected, sc.name, "windows", d.windows, r.expected);
+        }
+        if (name == "slow outliers")
+            check(d.late * 10 <= d.windows, sc.name, "late windows", d.late, d.windows / 10);
+        if (name == "lposc, no allowance") {
+            // The first sleep overslept (or made late) costs one window,
+            // then the peak carries the drift
+            check(d.late + d.missed <= 2, sc.name, "late + missed windows", d.late + d.missed, 2);
+            check(d.windows + d.missed == r.expected, sc.name, "windows + missed",
+                  d.windows + d.missed, r.expected);
+        }
+        if (name == "no card") {
+            check(d.windows == 0, sc.name, "windows", d.windows, 0);
+            check(d.failed == r.expected, sc.name, "given up", d.failed, r.expected);
+            // The failed warm-ups must not stretch the lead
+            const uint32_t lead = base.warmup_us + base.warmup_us / 8 + base.margin_us;
+            check(duty_lead_us(&d, 0) == lead, sc.name, "lead", duty_lead_us(&d, 0), lead);
+        }
+        if (name == "overrun") {
+            check(d.missed > 0, sc.name, "missed windows", d.missed, 1);
+            check(d.late == 0, sc.name, "late windows", d.late, 0);
+            check(d.windows + d.missed + 1 >= r.expected, sc.name, "windows + missed",
+                  d.windows + d.missed, r.expected);
+        }
+        if (name == "5 windows")
+            check(d.finished, sc.name, "finished", d.finished, 1);
+    }
+
+    // One window on the engine directly: the report the firmware prints
+    printf("\n");
+    Result r = run(scenarios[0], base, base.interval_us * 2, seed);
+    duty_print_window(&r.d.last);
+    duty_print_stats(&r.d, r.now);
+
+    return check_summary();
+}
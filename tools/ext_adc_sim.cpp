@@ -0,0 +1,515 @@
+// External ADC source (ext_adc.pio, lib/ae_core/ext_adc.c, acq_source.h)
+// against a software ADC.
+//
+// Three levels:
+//
+//   timing   ext_adc_timing() for a set of parts and rates: the sample
+//            period, SCK, the ADC's conversion time and output delay are
+//            all met, and no smaller divider would have met them.
+//   wire     the PIO program run cycle by cycle against a model of the
+//            ADC (code latched on CNV rising, MSB out after CNV falls, next
+//            bit out after each SCK fall, each after the part's output
+//            delay). Every decoded word must be the code the ADC latched.
+//            With the input synchronizer left in, or the wrong bit count,
+//            it must not be.
+//   ring     sample by sample at the real rate: the 8-word RX FIFO (the
+//            state machine stalls when it is full), DMA into the block
+//            ring, the block-end interrupt with its latency, the same
+//            acq_ring_publish() as dma_handler, and a logger writing
+//            blocks at card speed. Every block the logger takes must hold
+//            consecutive samples, and every sample must be in a block, in
+//            an overrun or still in flight.
+//
+// usage: ext_adc_sim [--seconds N] [--seed N] [--verbose]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "acq_source.h"
+#include "ext_adc.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t SYS_HZ = 150000000;          // RP2350 default clk_sys
+constexpr uint32_t BLOCK_SAMPLES = 1024;        // BUF_SIZE in main.c
+constexpr uint32_t RING_BLOCKS = 8;             // ADC_RING_BLOCKS in main.c
+
+uint32_t lcg(uint32_t &s)
+{
+    s = s * 1664525u + 1013904223u;
+    return s >> 8;
+}
+
+// ---- timing ----
+
+struct Part {
+    const char *name;
+    uint32_t sample_rate;
+    uint8_t bits;
+    uint32_t tconv_ns;
+    uint32_t sck_max_hz;
+    uint32_t tdsdo_ns;
+    bool feasible;
+};
+
+// Brute force over the same constraints, for the smallest divider
+bool meets(const ext_adc_config_t &c, uint32_t div)
+{
+    uint64_t per = uint64_t(div) * c.sample_rate;
+    uint64_t cycles = (c.sys_hz + per / 2) / per;
+    uint64_t overhead = EXT_ADC_FIXED_CYCLES + EXT_ADC_BIT_CYCLES * c.bits;
+    if (cycles < overhead)
+        return false;
+    double pio_ns = 1e9 * div / c.sys_hz;
+    return (cycles - overhead + 2) * pio_ns >= c.tconv_ns - 1 &&
+           c.sys_hz / (div * EXT_ADC_BIT_CYCLES) <= c.sck_max_hz && 2 * pio_ns >= c.tdsdo_ns;
+}
+
+ext_adc_config_t config(const Part &p)
+{
+    ext_adc_config_t c = {};
+    c.sys_hz = SYS_HZ;
+    c.sample_rate = p.sample_rate;
+    c.bits = p.bits;
+    c.tconv_ns = p.tconv_ns;
+    c.sck_max_hz = p.sck_max_hz;
+    c.tdsdo_ns = p.tdsdo_ns;
+    return c;
+}
+
+void timing_table(const std::vector<Part> &parts)
+{
+    printf("%-22s %8s %5s %9s %7s %9s %7s %6s %6s\n", "part", "rate", "div", "cycles", "ppm",
+           "sck_hz", "conv", "setup", "fifo");
+    for (const Part &p : parts) {
+        ext_adc_config_t c = config(p);
+        ext_adc_timing_t t;
+        int r = ext_adc_timing(&c, &t);
+        if (r != 0) {
+            printf("%-22s %8u  no timing\n", p.name, p.sample_rate);
+            check(!p.feasible, p.name, "timing found", r, 0);
+            continue;
+        }
+        printf("%-22s %8u %5u %9u %+7d %9u %5uns %4uns %4uus\n", p.name, t.sample_rate, t.div,
+               t.cycles, t.rate_error_ppm, t.sck_hz, t.conv_ns, t.setup_ns, t.fifo_us);
+        check(p.feasible, p.name, "no timing expected", r, -1);
+        check(t.cycles == t.conv_loops + EXT_ADC_FIXED_CYCLES + EXT_ADC_BIT_CYCLES * p.bits,
+              p.name, "loop length", t.cycles, t.conv_loops);
+        check(t.conv_ns >= p.tconv_ns, p.name, "conversion time", t.conv_ns, p.tconv_ns);
+        check(t.sck_hz <= p.sck_max_hz, p.name, "SCK limit", t.sck_hz, p.sck_max_hz);
+        double exact = double(SYS_HZ) / (double(t.div) * t.cycles);
+        double ppm = (exact - p.sample_rate) * 1e6 / p.sample_rate;
+        check(std::fabs(ppm) <= 0.5e6 / t.cycles + 1, p.name, "rate within half a cycle", ppm,
+              0.5e6 / t.cycles);
+        check(std::fabs(ppm - t.rate_error_ppm) <= 1, p.name, "reported error", t.rate_error_ppm,
+              ppm);
+        for (uint32_t d = 1; d < t.div; d++)
+            if (meets(c, d)) {
+                check(false, p.name, "a smaller divider meets the limits", d, t.div);
+                break;
+            }
+    }
+}
+
+// ---- wire ----
+
+// The ADC, driven by the pin levels the state machine puts out, in ns
+struct AdcModel {
+    uint8_t bits;
+    double tconv_ns, tdsdo_ns;
+    bool cnv = false, sck = false;
+    uint16_t latched = 0;           // code of the conversion in progress or done
+    uint16_t shift = 0;             // what is left to shift out
+    double conv_done = 0;
+    uint32_t aborted = 0;           // CNV fell before the conversion was done
+    std::vector<std::pair<double, int>> sdo;   // (time valid from, level)
+
+    void drive(double t, int level) { sdo.emplace_back(t + tdsdo_ns, level); }
+    int sdo_at(double t) const
+    {
+        int v = 0;
+        for (auto it = sdo.rbegin(); it != sdo.rend(); ++it)
+            if (it->first <= t) {
+                v = it->second;
+                break;
+            }
+        return v;
+    }
+
+    void pins(double t, bool cnv_now, bool sck_now, uint16_t input)
+    {
+        if (cnv_now && !cnv) {
+            latched = input;
+            conv_done = t + tconv_ns;
+            drive(t, 0);                        // SDO high-Z while converting
+        }
+        if (!cnv_now && cnv) {
+            if (t < conv_done)
+                aborted++;
+            shift = latched;
+            drive(t, (shift >> (bits - 1)) & 1);
+        }
+        if (!cnv_now && !sck_now && sck) {
+            shift = uint16_t(shift << 1);
+            drive(t, (shift >> (bits - 1)) & 1);
+        }
+        cnv = cnv_now;
+        sck = sck_now;
+        // Only the recent past is ever read back
+        if (sdo.size() > 64)
+            sdo.erase(sdo.begin(), sdo.begin() + 32);
+    }
+};
+
+struct WireResult {
+    uint32_t words = 0, errors = 0, aborted = 0;
+};
+
+// ext_adc.pio, one instruction at a time. Pin levels change at the start of
+// an instruction; `in` reads SDO as it was sync_clocks system clocks before.
+WireResult run_wire(const ext_adc_timing_t &t, uint8_t adc_bits, uint8_t prog_bits,
+                    double tconv_ns, double tdsdo_ns, int sync_clocks, uint32_t samples,
+                    uint32_t seed)
+{
+    AdcModel adc;
+    adc.bits = adc_bits;
+    adc.tconv_ns = tconv_ns;
+    adc.tdsdo_ns = tdsdo_ns;
+    const double clk_ns = 1e9 / SYS_HZ;
+    const double cyc_ns = clk_ns * t.div;
+    const uint16_t mask = uint16_t((1u << adc_bits) - 1);
+
+    WireResult r;
+    std::vector<uint16_t> codes;
+    uint32_t isr = 0, isr_count = 0;
+    uint32_t y = t.conv_loops, osr = prog_bits - 1, x = 0;
+    double now = 0;
+    uint16_t input = 0;
+    enum { MOV_XY, CONV, MOV_XOSR, IN, JMP_BIT } pc = MOV_XY;
+
+    auto exec = [&](bool cnv, bool sck, int delay) {
+        if (cnv && !adc.cnv) {
+            input = uint16_t(lcg(seed) & mask);
+            codes.push_back(input);
+        }
+        adc.pins(now, cnv, sck, input);
+        return now + (1 + delay) * cyc_ns;
+    };
+
+    while (r.words < samples) {
+        double next;
+        switch (pc) {
+        case MOV_XY:
+            next = exec(true, false, 0);
+            x = y;
+            pc = CONV;
+            break;
+        case CONV:
+            next = exec(true, false, 0);
+            pc = x-- ? CONV : MOV_XOSR;
+            break;
+        case MOV_XOSR:
+            next = exec(false, false, 1);
+            x = osr;
+            pc = IN;
+            break;
+        case IN:
+            next = exec(false, true, 1);
+            isr = (isr << 1) | uint32_t(adc.sdo_at(now - sync_clocks * clk_ns));
+            if (++isr_count == prog_bits) {            // autopush
+                uint16_t want = codes[r.words];
+                if (uint16_t(isr & mask) != want)
+                    r.errors++;
+                r.words++;
+                isr = 0;
+                isr_count = 0;
+            }
+            pc = JMP_BIT;
+            break;
+        default:
+            next = exec(false, false, 1);
+            pc = x-- ? IN : MOV_XY;
+            break;
+        }
+        now = next;
+    }
+    r.aborted = adc.aborted;
+    return r;
+}
+
+void wire_tests(uint32_t seed)
+{
+    struct Case {
+        const char *name;
+        Part part;
+        uint8_t prog_bits;
+        int sync_clocks;
+        bool clean;
+    } cases[] = {
+        {"16b 1MS/s", {"", 1000000, 16, 500, 40000000, 10, true}, 16, 0, true},
+        {"14b 500kS/s", {"", 500000, 14, 1000, 20000000, 15, true}, 14, 0, true},
+        {"12b 4kS/s", {"", 4000, 12, 2000, 1000000, 40, true}, 12, 0, true},
+        {"16b 1MS/s sync", {"", 1000000, 16, 500, 40000000, 10, true}, 16, 2, false},
+        {"16b 1MS/s 15 bits", {"", 1000000, 16, 500, 40000000, 10, true}, 15, 0, false},
+    };
+
+    printf("\n%-20s %8s %8s %8s\n", "wire", "words", "errors", "aborted");
+    for (const Case &k : cases) {
+        ext_adc_config_t c = config(k.part);
+        ext_adc_timing_t t;
+        if (ext_adc_timing(&c, &t) != 0) {
+            check(false, k.name, "timing", -1, 0);
+            continue;
+        }
+        uint32_t n = k.part.sample_rate < 10000 ? 200 : 5000;
+        WireResult r = run_wire(t, k.part.bits, k.prog_bits, k.part.tconv_ns, k.part.tdsdo_ns,
+                                k.sync_clocks, n, seed);
+        printf("%-20s %8u %8u %8u\n", k.name, r.words, r.errors, r.aborted);
+        check(r.aborted == 0, k.name, "conversions completed", r.aborted, 0);
+        if (k.clean)
+            check(r.errors == 0, k.name, "every word is the latched code", r.errors, 0);
+        else
+            check(r.errors > n / 2, k.name, "misread words detected", r.errors, n / 2);
+    }
+}
+
+// ---- ring ----
+
+struct RingScenario {
+    const char *name;
+    uint32_t sample_rate;
+    double irq_us, irq_jitter_us;   // block-end interrupt latency: base + uniform jitter
+    double irq_spike_us;            // ...and now and then this long (flash, critical section)
+    double card_mb_s;               // logger's sustained write rate
+    double card_stall_ms;           // occasional card busy time
+    double card_stall_every_s;
+};
+
+struct RingResult {
+    uint64_t samples = 0;           // converted
+    uint64_t consumed = 0;          // in blocks the logger took
+    uint64_t stalls = 0;            // state machine stopped on a full FIFO
+    double stall_us = 0;
+    uint32_t overruns = 0;
+    uint32_t blocks = 0;
+    uint32_t bad_blocks = 0;        // not consecutive inside, or wrong distance to the last
+    uint32_t peak_backlog = 0;
+    uint32_t fifo_peak = 0;
+    double worst_irq_us = 0;
+    double host_s = 0;
+};
+
+RingResult run_ring(const RingScenario &s, double seconds, uint32_t seed, bool verbose)
+{
+    RingResult res;
+    std::vector<uint16_t> mem(RING_BLOCKS * BLOCK_SAMPLES);
+    acq_ring_t ring;
+    acq_ring_init(&ring, mem.data(), RING_BLOCKS, BLOCK_SAMPLES);
+
+    const double period_us = 1e6 / s.sample_rate;
+    const double block_us = period_us * BLOCK_SAMPLES;
+    const double spike_every_us = 50000;
+    auto uniform = [&] { return lcg(seed) / double(1u << 24); };
+
+    uint16_t *dst = acq_ring_block(&ring, ring.head);
+    uint32_t dma_left = BLOCK_SAMPLES;
+    bool dma_on = true;
+    double irq_at = 0;              // when the pending interrupt runs
+    uint32_t fifo[EXT_ADC_FIFO_WORDS];
+    uint32_t fifo_n = 0;
+
+    double card_free = 0;
+    double next_card_stall = s.card_stall_every_s * 1e6 * (0.5 + uniform());
+    double next_spike = spike_every_us * uniform();
+    bool have_last = false;
+    uint64_t last_first = 0;
+    uint32_t last_overruns = 0;
+    std::vector<uint64_t> first_sample(RING_BLOCKS);    // sample index at each slot's start
+    std::vector<uint32_t> overruns_at(RING_BLOCKS);     // ring.overruns when it was published
+    uint64_t block_first = 0;
+
+    const uint64_t total = uint64_t(seconds * s.sample_rate);
+    double shift_us = 0;            // accumulated state machine stall
+    auto t0 = std::chrono::steady_clock::now();
+
+    auto consume = [&](double now) {
+        while (acq_ring_backlog(&ring) && card_free <= now) {
+            uint32_t slot = ring.tail & (RING_BLOCKS - 1);
+            const uint16_t *b = acq_ring_block(&ring, ring.tail);
+            uint64_t first = first_sample[slot];
+            bool ok = b[0] == uint16_t(first);
+            for (uint32_t i = 1; i < BLOCK_SAMPLES; i++)
+                ok &= uint16_t(b[i] - b[i - 1]) == 1;
+            // Blocks lost to overruns between the two publishes sit between them
+            uint32_t lost = overruns_at[slot] - last_overruns;
+            if (have_last && first != last_first + uint64_t(BLOCK_SAMPLES) * (1 + lost))
+                ok = false;
+            if (have_last && first <= last_first)
+                ok = false;
+            last_overruns = overruns_at[slot];
+            if (!ok)
+                res.bad_blocks++;
+            have_last = true;
+            last_first = first;
+            res.consumed += BLOCK_SAMPLES;
+            res.blocks++;
+
+            double write_us = BLOCK_SAMPLES * 2 / s.card_mb_s;
+            double start = std::max(card_free, acq_ring_time(&ring, ring.tail) + 0.0);
+            if (s.card_stall_ms > 0 && start >= next_card_stall) {
+                write_us += s.card_stall_ms * 1000;
+                next_card_stall += s.card_stall_every_s * 1e6 * (0.5 + uniform());
+            }
+            card_free = start + write_us;
+            ring.tail++;
+        }
+    };
+
+    // The interrupt handler: publish, restart the channel, drain the FIFO
+    auto irq = [&](double now) {
+        if (acq_ring_publish(&ring, uint64_t(now)))
+            overruns_at[(ring.head - 1) & (RING_BLOCKS - 1)] = ring.overruns;
+        res.peak_backlog = std::max(res.peak_backlog, acq_ring_backlog(&ring));
+        dst = acq_ring_block(&ring, ring.head);
+        dma_left = BLOCK_SAMPLES;
+        dma_on = true;
+        first_sample[ring.head & (RING_BLOCKS - 1)] = block_first;
+        for (uint32_t i = 0; i < fifo_n; i++) {
+            *dst++ = uint16_t(fifo[i]);
+            dma_left--;
+        }
+        fifo_n = 0;
+    };
+
+    first_sample[0] = 0;
+    for (uint64_t i = 0; i < total; i++) {
+        double now = i * period_us + shift_us;
+        if (!dma_on && irq_at <= now)
+            irq(irq_at);
+        consume(now);
+
+        if (!dma_on && fifo_n == EXT_ADC_FIFO_WORDS) {
+            // The state machine holds on its autopush until DMA reads
+            res.stalls++;
+            res.stall_us += irq_at - now;
+            shift_us += irq_at - now;
+            now = irq_at;
+            irq(irq_at);
+        }
+
+        if (dma_on) {
+            if (dma_left == BLOCK_SAMPLES)
+                block_first = i;
+            *dst++ = uint16_t(i);
+            if (--dma_left == 0) {
+                dma_on = false;
+                double lat = s.irq_us + s.irq_jitter_us * uniform();
+                if (s.irq_spike_us > 0 && now >= next_spike) {
+                    lat += s.irq_spike_us;
+                    next_spike += spike_every_us * (0.5 + uniform());
+                }
+                irq_at = now + lat;
+                res.worst_irq_us = std::max(res.worst_irq_us, lat);
+                block_first = i + 1;
+            }
+        } else {
+            fifo[fifo_n++] = uint32_t(i);
+            res.fifo_peak = std::max(res.fifo_peak, fifo_n);
+        }
+        res.samples++;
+    }
+    res.overruns = ring.overruns;
+    res.host_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Samples still in the ring, the current block or the FIFO
+    uint64_t in_flight = uint64_t(acq_ring_backlog(&ring)) * BLOCK_SAMPLES +
+                         (BLOCK_SAMPLES - dma_left) * dma_on + fifo_n +
+                         (dma_on ? 0 : BLOCK_SAMPLES);
+    uint64_t accounted = res.consumed + uint64_t(res.overruns) * BLOCK_SAMPLES + in_flight;
+    check(accounted == res.samples, s.name, "every sample consumed, overrun or in flight",
+          double(accounted), double(res.samples));
+    if (verbose)
+        printf("  %s: block %.0f us, %llu in flight\n", s.name, block_us,
+               (unsigned long long)in_flight);
+    return res;
+}
+
+void ring_tests(double seconds, uint32_t seed, bool verbose)
+{
+    // fifo_us at 1 MS/s is 8 us: the block-end interrupt must be served
+    // within it or the sample clock slips
+    RingScenario scenarios[] = {
+        {"4kS/s", 4000, 2, 3, 0, 0.5, 120, 5},
+        {"1MS/s", 1000000, 1.5, 2, 0, 4, 0, 0},
+        {"1MS/s spikes", 1000000, 1.5, 2, 4, 4, 0, 0},
+        {"1MS/s slow irq", 1000000, 1.5, 2, 12, 4, 0, 0},
+        {"1MS/s card", 1000000, 1.5, 2, 0, 2.5, 20, 0.5},
+    };
+
+    printf("\n%-16s %10s %7s %6s %6s %6s %7s %7s %8s %9s\n", "ring", "samples", "blocks",
+           "overr", "bad", "peak", "fifo", "stalls", "irq_us", "host_MS/s");
+    for (const RingScenario &s : scenarios) {
+        double secs = s.sample_rate < 100000 ? seconds * 100 : seconds;
+        RingResult r = run_ring(s, secs, seed, verbose);
+        printf("%-16s %10llu %7u %6u %6u %6u %7u %7llu %8.1f %9.1f\n", s.name,
+               (unsigned long long)r.samples, r.blocks, r.overruns, r.bad_blocks,
+               r.peak_backlog, r.fifo_peak, (unsigned long long)r.stalls, r.worst_irq_us,
+               r.samples / r.host_s / 1e6);
+        check(r.bad_blocks == 0, s.name, "blocks consecutive and in order", r.bad_blocks, 0);
+        check(r.blocks > 0, s.name, "blocks consumed", r.blocks, 1);
+
+        double fifo_us = EXT_ADC_FIFO_WORDS * 1e6 / s.sample_rate;
+        double worst = s.irq_us + s.irq_jitter_us + s.irq_spike_us;
+        if (worst < fifo_us)
+            check(r.stalls == 0, s.name, "no stalls inside the FIFO budget", double(r.stalls), 0);
+        else
+            check(r.stalls > 0, s.name, "stalls past the FIFO budget", double(r.stalls), 1);
+        if (s.card_stall_ms == 0 && s.card_mb_s * 1e6 > 2.0 * s.sample_rate * 1.1)
+            check(r.overruns == 0, s.name, "no overruns with a fast card", r.overruns, 0);
+        if (s.card_stall_ms * 1000 > RING_BLOCKS * BLOCK_SAMPLES * 1e6 / s.sample_rate)
+            check(r.overruns > 0, s.name, "stalls longer than the ring overrun", r.overruns, 1);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    double seconds = 5;
+    uint32_t seed = 1;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--seconds" && i + 1 < argc) seconds = atof(argv[++i]);
+        else if (a == "--seed" && i + 1 < argc) seed = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if (a == "--verbose") verbose = true;
+        else {
+            fprintf(stderr, "usage: ext_adc_sim [--seconds N] [--seed N] [--verbose]\n");
+            return 2;
+        }
+    }
+
+    printf("clk_sys %u Hz, blocks of %u samples, ring of %u\n\n", SYS_HZ, BLOCK_SAMPLES,
+           RING_BLOCKS);
+    std::vector<Part> parts = {
+        {"AD4000 16b 1MS/s", 1000000, 16, 500, 40000000, 10, true},
+        {"AD4000 16b 2MS/s", 2000000, 16, 290, 75000000, 6, false},
+        {"AD7980 16b 1MS/s", 1000000, 16, 710, 40000000, 10, false},
+        {"14b 500kS/s 20MHz", 500000, 14, 1000, 20000000, 15, true},
+        {"12b 4kS/s", 4000, 12, 2000, 1000000, 40, true},
+        {"16b 100kS/s 1MHz", 100000, 16, 1000, 1000000, 40, false},
+    };
+    timing_table(parts);
+    wire_tests(seed);
+    ring_tests(seconds, seed, verbose);
+
+    printf("\n");
+    return check_summary();
+}
@@ -0,0 +1,213 @@
+// Radix-2 FFT for the host tools: power spectra of short real frames.
+//
+// Twiddles and the bit-reversal permutation are computed once per size.
+// Each stage has its own contiguous twiddle table, split into re and im
+// arrays, so the butterflies of a stage are plain element-wise loops over
+// split (re[], im[]) data and vectorise: 4 wide on the x86-64 baseline, 8
+// wide in the AVX2 build of the same loop, picked at run time. Neither
+// build has FMA, so both do the same roundings per element and give
+// bit-identical results.
+//
+// power() transforms n real samples as n/2 complex ones (even samples in
+// re, odd in im) and splits the result into the spectrum of the real
+// frame, which is half the work of a complex n-point transform. The bit
+// reversal is folded into that load.
+//
+// transform() is the complex n-point transform on interleaved data.
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace fft_detail {
+
+// One group of butterflies: a += w b, b = a - w b over h points. The
+// arrays never overlap; restrict on the parameters (not on locals in the
+// caller's loops) is what lets GCC vectorise without versioning.
+inline __attribute__((always_inline)) void butterflies(
+    float *__restrict ar, float *__restrict ai, float *__restrict br, float *__restrict bi,
+    const float *__restrict cr, const float *__restrict ci, uint32_t h)
+{
+    for (uint32_t k = 0; k < h; k++) {
+        float tr = br[k] * cr[k] - bi[k] * ci[k];
+        float ti = br[k] * ci[k] + bi[k] * cr[k];
+        br[k] = ar[k] - tr;
+        bi[k] = ai[k] - ti;
+        ar[k] += tr;
+        ai[k] += ti;
+    }
+}
+
+// Stages with half-length h >= 4 of a split-complex transform of size m
+// whose first two stages are done; twiddles of stage h at wr/wi + h - 1.
+inline __attribute__((always_inline)) void stages(float *re, float *im, uint32_t m,
+                                                  const float *wr, const float *wi)
+{
+    for (uint32_t h = 4; h < m; h <<= 1)
+        for (uint32_t s = 0; s < m; s += 2 * h)
+            butterflies(re + s, im + s, re + s + h, im + s + h, wr + h - 1, wi + h - 1, h);
+}
+
+inline void stages_base(float *re, float *im, uint32_t m, const float *wr, const float *wi)
+{
+    stages(re, im, m, wr, wi);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+inline void stages_avx2(float *re, float *im, uint32_t m, const float *wr, const float *wi)
+{
+    stages(re, im, m, wr, wi);
+}
+
+inline bool have_avx2() { return __builtin_cpu_supports("avx2"); }
+#else
+inline void stages_avx2(float *re, float *im, uint32_t m, const float *wr, const float *wi)
+{
+    stages(re, im, m, wr, wi);
+}
+
+inline bool have_avx2() { return false; }
+#endif
+
+} // namespace fft_detail
+
+class Fft {
+public:
+    explicit Fft(uint32_t n)
+        : n_(n), wr_(n), wi_(n), rev_(n), half_rev_(n / 2), pr_(n / 2 + 1), pi_(n / 2 + 1),
+          re_(n / 2 + 1), im_(n / 2 + 1), buf_(2 * size_t(n))
+    {
+        bit_reverse(rev_, n);
+        bit_reverse(half_rev_, n / 2);
+        // Stage with half-length h: w^k = exp(-2 pi i k / 2h), k < h
+        for (uint32_t h = 1; h < n; h <<= 1)
+            for (uint32_t k = 0; k < h; k++) {
+                double a = -M_PI * k / h;
+                wr_[h - 1 + k] = float(std::cos(a));
+                wi_[h - 1 + k] = float(std::sin(a));
+            }
+        // Real split: exp(-2 pi i k / n), k <= n/2
+        for (uint32_t k = 0; k <= n / 2; k++) {
+            double a = -2 * M_PI * k / n;
+            pr_[k] = float(std::cos(a));
+            pi_[k] = float(std::sin(a));
+        }
+    }
+
+    uint32_t size() const { return n_; }
+
+    // In place, x = n interleaved (re, im) pairs
+    void transform(float *x) const
+    {
+        for (uint32_t i = 0; i < n_; i++)
+            if (rev_[i] > i) {
+                std::swap(x[2 * i], x[2 * rev_[i]]);
+                std::swap(x[2 * i + 1], x[2 * rev_[i] + 1]);
+            }
+        for (uint32_t h = 1; h < n_; h <<= 1) {
+            const float *cr = wr_.data() + h - 1, *ci = wi_.data() + h - 1;
+            for (uint32_t s = 0; s < n_; s += 2 * h) {
+                float *a = x + 2 * s, *b = x + 2 * (s + h);
+                for (uint32_t k = 0; k < h; k++) {
+                    float br = b[2 * k] * cr[k] - b[2 * k + 1] * ci[k];
+                    float bi = b[2 * k] * ci[k] + b[2 * k + 1] * cr[k];
+                    b[2 * k] = a[2 * k] - br;
+                    b[2 * k + 1] = a[2 * k + 1] - bi;
+                    a[2 * k] += br;
+                    a[2 * k + 1] += bi;
+                }
+            }
+        }
+    }
+
+    // |X[k]|^2 for k = 0..n/2 of n real samples (windowed by the caller)
+    void power(const float *in, float *out)
+    {
+        const uint32_t m = n_ / 2;
+        if (m < 4) {
+            power_complex(in, out);
+            return;
+        }
+        float *re = re_.data(), *im = im_.data();
+        for (uint32_t j = 0; j < m; j++) {
+            re[half_rev_[j]] = in[2 * j];
+            im[half_rev_[j]] = in[2 * j + 1];
+        }
+        // Stages h = 1 and 2 as one radix-4 pass: twiddles 1 and -i only
+        for (uint32_t s = 0; s < m; s += 4) {
+            float r0 = re[s] + re[s + 1], i0 = im[s] + im[s + 1];
+            float r1 = re[s] - re[s + 1], i1 = im[s] - im[s + 1];
+            float r2 = re[s + 2] + re[s + 3], i2 = im[s + 2] + im[s + 3];
+            float r3 = re[s + 2] - re[s + 3], i3 = im[s + 2] - im[s + 3];
+            re[s] = r0 + r2;
+            im[s] = i0 + i2;
+            re[s + 2] = r0 - r2;
+            im[s + 2] = i0 - i2;
+            re[s + 1] = r1 + i3;        // r1 + (-i)(r3 + i i3)
+            im[s + 1] = i1 - r3;
+            re[s + 3] = r1 - i3;
+            im[s + 3] = i1 + r3;
+        }
+        static const bool avx2 = fft_detail::have_avx2();
+        if (avx2)
+            fft_detail::stages_avx2(re, im, m, wr_.data(), wi_.data());
+        else
+            fft_detail::stages_base(re, im, m, wr_.data(), wi_.data());
+        split(out);
+    }
+
+    // power() through the complex n-point transform of the zero-padded
+    // frame: the reference for checks and benchmarks
+    void power_complex(const float *in, float *out)
+    {
+        for (uint32_t i = 0; i < n_; i++) {
+            buf_[2 * i] = in[i];
+            buf_[2 * i + 1] = 0;
+        }
+        transform(buf_.data());
+        for (uint32_t k = 0; k <= n_ / 2; k++)
+            out[k] = buf_[2 * k] * buf_[2 * k] + buf_[2 * k + 1] * buf_[2 * k + 1];
+    }
+
+private:
+    static void bit_reverse(std::vector<uint32_t> &rev, uint32_t n)
+    {
+        uint32_t bits = 0;
+        while ((1u << bits) < n)
+            bits++;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t r = 0;
+            for (uint32_t b = 0; b < bits; b++)
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            rev[i] = r;
+        }
+    }
+
+    // Z = transform of z[j] = x[2j] + i x[2j+1]; with Zc = conj(Z[m-k]):
+    //   X[k] = (Z[k] + Zc) / 2 + w^k (Z[k] - Zc) / 2i,  w = exp(-2 pi i / n)
+    void split(float *out) const
+    {
+        const uint32_t m = n_ / 2;
+        const float *re = re_.data(), *im = im_.data();
+        out[0] = (re[0] + im[0]) * (re[0] + im[0]);
+        out[m] = (re[0] - im[0]) * (re[0] - im[0]);
+        for (uint32_t k = 1; k < m; k++) {
+            float a = re[k], b = im[k], c = re[m - k], d = im[m - k];
+            float er = 0.5f * (a + c), ei = 0.5f * (b - d);
+            float or_ = 0.5f * (b + d), oi = -0.5f * (a - c);
+            float xr = er + pr_[k] * or_ - pi_[k] * oi;
+            float xi = ei + pr_[k] * oi + pi_[k] * or_;
+            out[k] = xr * xr + xi * xi;
+        }
+    }
+
+    uint32_t n_;
+    std::vector<float> wr_, wi_;            // stage twiddles, stage h at h - 1
+    std::vector<uint32_t> rev_, half_rev_;  // bit reversal for n and n/2
+    std::vector<float> pr_, pi_;            // real split twiddles
+    std::vector<float> re_, im_;            // n/2-point split-complex work area
+    std::vector<float> buf_;                // n-point interleaved work area
+};
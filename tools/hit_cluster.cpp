@@ -0,0 +1,416 @@
+#include "hit_cluster.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#include "fft.h"
+#include "worker_pool.h"
+
+const char *const feature_names[FEATURE_DIM] = {
+    "log_peak", "log_duration", "log_counts", "log_rise",
+    "log_energy", "log_ra", "log_avg_freq", "centroid",
+    "band0", "band1", "band2", "band3", "band4", "band5", "band6", "band7",
+    "band8", "band9", "band10", "band11", "band12", "band13", "band14", "band15",
+};
+
+namespace {
+
+// Rows per tile of the O(n^2) passes: 2048 * 96 B stays in L2 while a
+// block of ROW_BLOCK rows (in L1) is compared against it
+constexpr size_t TILE = 2048;
+constexpr size_t ROW_BLOCK = 32;
+constexpr size_t POINT_CHUNK = 4096;
+
+constexpr uint32_t BINS_PER_BAND = HIT_WINDOW / 2 / FEATURE_BANDS;
+static_assert(BINS_PER_BAND > 0, "more bands than FFT bins");
+
+uint64_t splitmix(uint64_t &s)
+{
+    uint64_t z = (s += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+double uniform(uint64_t &s)
+{
+    return double(splitmix(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void features_of(const HitRecord &h, const int16_t *w, uint32_t rate, const float *hann,
+                 Fft &fft, float *frame, float *power, Feature &f)
+{
+    double energy = 0;
+    for (uint32_t i = 0; i < HIT_WINDOW; i++) {
+        energy += double(w[i]) * w[i];
+        frame[i] = w[i] * hann[i];
+    }
+    fft.power(frame, power);
+
+    // Spectrum above DC, below Nyquist
+    double total = 0, moment = 0;
+    float band[FEATURE_BANDS] = {};
+    for (uint32_t k = 1; k <= FEATURE_BANDS * BINS_PER_BAND; k++) {
+        total += power[k];
+        moment += double(k) * power[k];
+        band[(k - 1) / BINS_PER_BAND] += power[k];
+    }
+
+    double peak = std::max<double>(h.peak, 1);
+    double dur = std::max<double>(h.duration, 1);
+    f.v[0] = float(std::log10(peak));
+    f.v[1] = float(std::log10(dur));
+    f.v[2] = float(std::log10(double(h.counts) + 1));
+    f.v[3] = float(std::log10(double(h.rise) + 1));
+    f.v[4] = float(std::log10(energy + 1));
+    f.v[5] = float(std::log10((double(h.rise) + 1) / peak));
+    f.v[6] = float(std::log10(double(h.counts) * rate / dur + 1));
+    f.v[7] = total > 0 ? float(moment / total / (FEATURE_BANDS * BINS_PER_BAND)) : 0;
+    for (uint32_t b = 0; b < FEATURE_BANDS; b++)
+        f.v[FEATURE_PARAMS + b] = float(std::log10((total > 0 ? band[b] / total : 0) + 1e-4));
+}
+
+// Concurrent union-find, roots linked towards the lower index
+uint32_t find(std::atomic<uint32_t> *p, uint32_t x)
+{
+    for (;;) {
+        uint32_t q = p[x].load(std::memory_order_relaxed);
+        if (q == x)
+            return x;
+        uint32_t g = p[q].load(std::memory_order_relaxed);
+        if (g != q)
+            p[x].compare_exchange_weak(q, g, std::memory_order_relaxed);
+        x = g;
+    }
+}
+
+void unite(std::atomic<uint32_t> *p, uint32_t a, uint32_t b)
+{
+    for (;;) {
+        a = find(p, a);
+        b = find(p, b);
+        if (a == b)
+            return;
+        if (a < b)
+            std::swap(a, b);
+        uint32_t expect = a;
+        if (p[a].compare_exchange_strong(expect, b, std::memory_order_relaxed))
+            return;
+    }
+}
+
+} // namespace
+
+__attribute__((optimize("no-tree-vectorize")))
+float dist2_scalar(const Feature &a, const Feature &b)
+{
+    float s = 0;
+    for (uint32_t k = 0; k < FEATURE_DIM; k++) {
+        float d = a.v[k] - b.v[k];
+        s += d * d;
+    }
+    return s;
+}
+
+void build_features(const HitSet &set, FeatureRows &rows, unsigned threads)
+{
+    const size_t n = set.hits.size();
+    rows.assign(n, Feature{});
+    std::vector<float> hann(HIT_WINDOW);
+    for (uint32_t i = 0; i < HIT_WINDOW; i++)
+        hann[i] = float(0.5 - 0.5 * std::cos(2 * M_PI * i / HIT_WINDOW));
+
+    constexpr size_t chunk = 256;
+    unsigned t = workers(threads, n, chunk);
+    std::vector<Fft> fft(t, Fft(HIT_WINDOW));
+    std::vector<std::vector<float>> frame(t, std::vector<float>(HIT_WINDOW));
+    std::vector<std::vector<float>> power(t, std::vector<float>(HIT_WINDOW / 2 + 1));
+
+    parallel_for(n, chunk, t, [&](size_t b, size_t e, unsigned w) {
+        for (size_t i = b; i < e; i++)
+            features_of(set.hits[i], set.wave(i), set.sample_rate, hann.data(), fft[w],
+                        frame[w].data(), power[w].data(), rows[i]);
+    });
+}
+
+void normalize(FeatureRows &rows)
+{
+    const size_t n = rows.size();
+    if (n == 0)
+        return;
+    for (uint32_t k = 0; k < FEATURE_DIM; k++) {
+        double sum = 0, sq = 0;
+        for (const Feature &f : rows) {
+            sum += f.v[k];
+            sq += double(f.v[k]) * f.v[k];
+        }
+        double mean = sum / n;
+        double sd = std::sqrt(std::max(0.0, sq / n - mean * mean));
+        double w = k < FEATURE_PARAMS ? 1.0 : std::sqrt(double(FEATURE_PARAMS) / FEATURE_BANDS);
+        float scale = sd > 1e-9 ? float(w / sd) : 0.0f;
+        for (Feature &f : rows)
+            f.v[k] = (f.v[k] - float(mean)) * scale;
+    }
+}
+
+namespace {
+
+Clustering lloyd(const FeatureRows &x, uint32_t k, uint32_t max_iter, uint64_t &rng,
+                 unsigned threads)
+{
+    const size_t n = x.size();
+    Clustering c;
+    c.clusters = k;
+    c.label.assign(n, 0);
+    c.centroids.resize(k);
+
+    // k-means++: each next centre drawn with probability ~ d^2
+    std::vector<float> d2(n, std::numeric_limits<float>::max());
+    c.centroids[0] = x[splitmix(rng) % n];
+    for (uint32_t j = 1; j <= k; j++) {
+        const Feature &ctr = c.centroids[j - 1];
+        parallel_for(n, POINT_CHUNK, threads, [&](size_t b, size_t e, unsigned) {
+            for (size_t i = b; i < e; i++)
+                d2[i] = std::min(d2[i], dist2(x[i], ctr));
+        });
+        if (j == k)
+            break;
+        double total = 0;
+        for (float v : d2)
+            total += v;
+        double r = uniform(rng) * total;
+        size_t pick = n - 1;
+        for (size_t i = 0; i < n; i++) {
+            r -= d2[i];
+            if (r < 0) {
+                pick = i;
+                break;
+            }
+        }
+        c.centroids[j] = x[pick];
+    }
+
+    // Lloyd: per-chunk partial sums, reduced in chunk order so the result
+    // doesn't depend on the thread count
+    const size_t chunks = (n + POINT_CHUNK - 1) / POINT_CHUNK;
+    std::vector<double> part(chunks * k * FEATURE_DIM);
+    std::vector<uint32_t> part_n(chunks * k);
+    std::vector<double> part_e(chunks);
+    std::vector<uint64_t> part_moved(chunks);
+    for (c.iterations = 0; c.iterations < max_iter;) {
+        c.iterations++;
+        parallel_for(n, POINT_CHUNK, threads, [&](size_t b, size_t e, unsigned) {
+            size_t ch = b / POINT_CHUNK;
+            double *sum = &part[ch * k * FEATURE_DIM];
+            uint32_t *cnt = &part_n[ch * k];
+            std::fill(sum, sum + k * FEATURE_DIM, 0.0);
+            std::fill(cnt, cnt + k, 0u);
+            double err = 0;
+            uint64_t moved = 0;
+            for (size_t i = b; i < e; i++) {
+                uint32_t best = 0;
+                float bd = dist2(x[i], c.centroids[0]);
+                for (uint32_t j = 1; j < k; j++) {
+                    float d = dist2(x[i], c.centroids[j]);
+                    if (d < bd) {
+                        bd = d;
+                        best = j;
+                    }
+                }
+                moved += uint32_t(c.label[i]) != best;
+                c.label[i] = int32_t(best);
+                d2[i] = bd;
+                err += bd;
+                cnt[best]++;
+                for (uint32_t f = 0; f < FEATURE_DIM; f++)
+                    sum[best * FEATURE_DIM + f] += x[i].v[f];
+            }
+            part_e[ch] = err;
+            part_moved[ch] = moved;
+        });
+
+        uint64_t moved = 0;
+        c.inertia = 0;
+        std::vector<double> sum(size_t(k) * FEATURE_DIM, 0.0);
+        std::vector<uint64_t> cnt(k, 0);
+        for (size_t ch = 0; ch < chunks; ch++) {
+            moved += part_moved[ch];
+            c.inertia += part_e[ch];
+            for (uint32_t j = 0; j < k; j++) {
+                cnt[j] += part_n[ch * k + j];
+                for (uint32_t f = 0; f < FEATURE_DIM; f++)
+                    sum[j * FEATURE_DIM + f] += part[(ch * k + j) * FEATURE_DIM + f];
+            }
+        }
+        if (c.iterations > 1 && moved == 0)
+            break;
+
+        for (uint32_t j = 0; j < k; j++) {
+            if (cnt[j] == 0) {
+                // Empty: restart it on the worst-fitting row
+                size_t far = size_t(std::max_element(d2.begin(), d2.end()) - d2.begin());
+                c.centroids[j] = x[far];
+                d2[far] = 0;
+                continue;
+            }
+            for (uint32_t f = 0; f < FEATURE_DIM; f++)
+                c.centroids[j].v[f] = float(sum[j * FEATURE_DIM + f] / double(cnt[j]));
+        }
+    }
+    return c;
+}
+
+} // namespace
+
+Clustering kmeans(const FeatureRows &x, uint32_t k, uint32_t max_iter, uint32_t restarts,
+                  uint64_t seed, unsigned threads)
+{
+    k = uint32_t(std::min<size_t>(k, x.size()));
+    if (k == 0)
+        return Clustering{};
+    uint64_t rng = seed;
+    Clustering best = lloyd(x, k, max_iter, rng, threads);
+    for (uint32_t r = 1; r < restarts; r++) {
+        Clustering c = lloyd(x, k, max_iter, rng, threads);
+        if (c.inertia < best.inertia)
+            best = std::move(c);
+    }
+    return best;
+}
+
+Clustering dbscan(const FeatureRows &x, float eps, uint32_t min_pts, unsigned threads)
+{
+    const size_t n = x.size();
+    const float e2 = eps * eps;
+    Clustering c;
+    c.label.assign(n, CLUSTER_NOISE);
+
+    // Neighbour counts, self included
+    std::vector<uint32_t> count(n, 0);
+    parallel_for(n, ROW_BLOCK, threads, [&](size_t b, size_t e, unsigned) {
+        for (size_t t0 = 0; t0 < n; t0 += TILE) {
+            size_t t1 = std::min(n, t0 + TILE);
+            for (size_t i = b; i < e; i++) {
+                uint32_t m = 0;
+                for (size_t j = t0; j < t1; j++)
+                    m += dist2(x[i], x[j]) <= e2;
+                count[i] += m;
+            }
+        }
+    });
+    std::vector<uint8_t> core(n);
+    for (size_t i = 0; i < n; i++)
+        core[i] = count[i] >= min_pts;
+
+    // Connect cores within eps: upper triangle only, so later row blocks
+    // are cheaper and chunks are handed out dynamically
+    std::vector<std::atomic<uint32_t>> parent(n);
+    for (size_t i = 0; i < n; i++)
+        parent[i].store(uint32_t(i), std::memory_order_relaxed);
+    parallel_for(n, ROW_BLOCK, threads, [&](size_t b, size_t e, unsigned) {
+        for (size_t t0 = b; t0 < n; t0 += TILE) {
+            size_t t1 = std::min(n, t0 + TILE);
+            for (size_t i = b; i < e; i++) {
+                if (!core[i])
+                    continue;
+                for (size_t j = std::max(t0, i + 1); j < t1; j++)
+                    if (core[j] && dist2(x[i], x[j]) <= e2)
+                        unite(parent.data(), uint32_t(i), uint32_t(j));
+            }
+        }
+    });
+
+    // Border rows join their nearest core
+    std::vector<uint32_t> owner(n, UINT32_MAX);
+    parallel_for(n, ROW_BLOCK, threads, [&](size_t b, size_t e, unsigned) {
+        for (size_t i = b; i < e; i++) {
+            if (core[i]) {
+                owner[i] = find(parent.data(), uint32_t(i));
+                continue;
+            }
+            float bd = e2;
+            uint32_t best = UINT32_MAX;
+            for (size_t j = 0; j < n; j++) {
+                if (!core[j])
+                    continue;
+                float d = dist2(x[i], x[j]);
+                if (d <= bd && (d < bd || best == UINT32_MAX)) {
+                    bd = d;
+                    best = uint32_t(j);
+                }
+            }
+            if (best != UINT32_MAX)
+                owner[i] = best;
+        }
+    });
+
+    // Cluster ids in order of each cluster's first row
+    std::vector<int32_t> id(n, CLUSTER_NOISE);
+    for (size_t i = 0; i < n; i++) {
+        if (owner[i] == UINT32_MAX)
+            continue;
+        uint32_t r = core[i] ? owner[i] : find(parent.data(), owner[i]);
+        if (id[r] == CLUSTER_NOISE)
+            id[r] = int32_t(c.clusters++);
+        c.label[i] = id[r];
+    }
+    return c;
+}
+
+void knn(const FeatureRows &x, const uint32_t *queries, size_t nq, uint32_t k,
+         std::vector<Neighbour> &out, unsigned threads)
+{
+    const size_t n = x.size();
+    const Neighbour none{UINT32_MAX, std::numeric_limits<float>::infinity()};
+    out.assign(nq * k, none);
+    if (k == 0)
+        return;
+
+    // A block of queries against one tile at a time; each keeps a sorted
+    // top-k list and only inserts below its current worst
+    parallel_for(nq, ROW_BLOCK, threads, [&](size_t b, size_t e, unsigned) {
+        for (size_t t0 = 0; t0 < n; t0 += TILE) {
+            size_t t1 = std::min(n, t0 + TILE);
+            for (size_t q = b; q < e; q++) {
+                const Feature &xq = x[queries[q]];
+                Neighbour *top = &out[q * k];
+                float worst = top[k - 1].d2;
+                for (size_t j = t0; j < t1; j++) {
+                    float d = dist2(xq, x[j]);
+                    if (d >= worst || j == queries[q])
+                        continue;
+                    uint32_t p = k - 1;
+                    while (p > 0 && top[p - 1].d2 > d) {
+                        top[p] = top[p - 1];
+                        p--;
+                    }
+                    top[p] = Neighbour{uint32_t(j), d};
+                    worst = top[k - 1].d2;
+                }
+            }
+        }
+    });
+}
+
+float dbscan_eps(const FeatureRows &x, uint32_t min_pts, unsigned threads)
+{
+    const size_t n = x.size();
+    if (n < 2 || min_pts < 2)
+        return 0.5f;
+    uint32_t k = uint32_t(std::min<size_t>(min_pts - 1, n - 1));
+    size_t m = std::min<size_t>(n, 4096);
+    std::vector<uint32_t> q(m);
+    for (size_t i = 0; i < m; i++)
+        q[i] = uint32_t(i * n / m);
+    std::vector<Neighbour> nb;
+    knn(x, q.data(), m, k, nb, threads);
+
+    std::vector<float> kd(m);
+    for (size_t i = 0; i < m; i++)
+        kd[i] = nb[i * k + k - 1].d2;
+    size_t p95 = m * 95 / 100;
+    std::nth_element(kd.begin(), kd.begin() + p95, kd.end());
+    return 1.25f * std::sqrt(kd[p95]);
+}
@@ -0,0 +1,91 @@
+// Feature vectors, clustering and similarity search over AE hits.
+//
+// Every hit becomes one FEATURE_DIM-float row: classic AE parameters
+// (peak, duration, counts, rise, energy, RA, average frequency, spectral
+// centroid) and the shape of its spectrum in FEATURE_BANDS bands. Rows are
+// 32-byte aligned and padded to whole 8-float vectors, stored contiguously,
+// so a distance is three vector subtract/multiply-adds and every algorithm
+// below streams tiles of rows that stay in cache while a block of other
+// rows is compared against them.
+//
+// All of it runs on `threads` workers (0 = all cores) handing out chunks
+// through parallel_for() (worker_pool.h) and gives the same result for any
+// thread count.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hit_extract.h"
+
+constexpr uint32_t FEATURE_PARAMS = 8;
+constexpr uint32_t FEATURE_BANDS = 16;
+constexpr uint32_t FEATURE_DIM = FEATURE_PARAMS + FEATURE_BANDS;
+static_assert(FEATURE_DIM % 8 == 0, "rows are whole 8-float vectors");
+
+struct alignas(32) Feature {
+    float v[FEATURE_DIM];
+};
+using FeatureRows = std::vector<Feature>;
+
+extern const char *const feature_names[FEATURE_DIM];
+
+// Raw features of every hit in set.
+void build_features(const HitSet &set, FeatureRows &rows, unsigned threads);
+
+// Column z-scores; the band columns are scaled so that together they
+// weigh as much as the AE parameters.
+void normalize(FeatureRows &rows);
+
+typedef float v8f __attribute__((vector_size(32), aligned(32), may_alias));
+
+inline float dist2(const Feature &a, const Feature &b)
+{
+    const v8f *x = reinterpret_cast<const v8f *>(a.v);
+    const v8f *y = reinterpret_cast<const v8f *>(b.v);
+    v8f d = x[0] - y[0];
+    v8f s = d * d;
+    for (uint32_t k = 1; k < FEATURE_DIM / 8; k++) {
+        d = x[k] - y[k];
+        s += d * d;
+    }
+    return (s[0] + s[4]) + (s[1] + s[5]) + (s[2] + s[6]) + (s[3] + s[7]);
+}
+
+// Plain loop, not vectorised: the benchmark's reference.
+float dist2_scalar(const Feature &a, const Feature &b);
+
+constexpr int32_t CLUSTER_NOISE = -1;
+
+struct Clustering {
+    std::vector<int32_t> label;         // per row, CLUSTER_NOISE or 0..clusters-1
+    uint32_t clusters = 0;
+    uint32_t iterations = 0;            // k-means only
+    double inertia = 0;                 // k-means: sum of squared distances
+    FeatureRows centroids;              // k-means only
+};
+
+// Lloyd's k-means from `restarts` k-means++ starts; the one with the
+// lowest inertia wins.
+Clustering kmeans(const FeatureRows &x, uint32_t k, uint32_t max_iter, uint32_t restarts,
+                  uint64_t seed, unsigned threads);
+
+// DBSCAN: core rows have >= min_pts rows (themselves included) within eps,
+// connected cores form clusters, border rows join their nearest core.
+Clustering dbscan(const FeatureRows &x, float eps, uint32_t min_pts, unsigned threads);
+
+// eps for dbscan(): 1.25 times the distance to the min_pts-th neighbour
+// (self included) that 95% of a sample of the rows are within, so the
+// sparsest 5% may end up as border or noise.
+float dbscan_eps(const FeatureRows &x, uint32_t min_pts, unsigned threads);
+
+struct Neighbour {
+    uint32_t index;
+    float d2;
+};
+
+// The k nearest rows of x to each x[queries[q]] (the query itself
+// excluded), nearest first, in out[q * k .. q * k + k).
+void knn(const FeatureRows &x, const uint32_t *queries, size_t nq, uint32_t k,
+         std::vector<Neighbour> &out, unsigned threads);
@@ -0,0 +1,106 @@
+#include "hit_extract.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "acq_pipeline.h"
+#include "ae_pipeline.hpp"
+
+namespace {
+
+struct Collect {
+    std::vector<ae::Hit> *out;
+    void operator()(const ae::Hit &h) const { out->push_back(h); }
+};
+
+using Detect = ae::Pipeline<
+    ae::DcBlock<ACQ_BLOCK_SAMPLES>,
+    ae::HitDetector<ACQ_HIT_DEFINITION_US, Collect>,
+    ae::Discard>;
+
+// Window of HIT_WINDOW samples from start - HIT_PRETRIGGER, less the mean
+// of the pretrigger samples (zero-padded past either end of the file)
+void cut(const uint16_t *s, size_t n, const ae::Hit &h, int16_t *w)
+{
+    int64_t first = int64_t(h.start) - HIT_PRETRIGGER;
+    int64_t pre0 = std::max<int64_t>(first, 0);
+    int64_t sum = 0, cnt = int64_t(h.start) - pre0;
+    for (int64_t k = pre0; k < int64_t(h.start); k++)
+        sum += s[k];
+    int32_t base = cnt ? int32_t(sum / cnt) : 2048;
+
+    for (uint32_t i = 0; i < HIT_WINDOW; i++) {
+        int64_t k = first + i;
+        w[i] = k >= 0 && size_t(k) < n ? int16_t(int32_t(s[k]) - base) : 0;
+    }
+}
+
+} // namespace
+
+uint16_t hit_threshold()
+{
+    return ACQ_HIT_THRESHOLD;
+}
+
+bool extract_hits(const std::string &path, HitSet &set)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path.c_str());
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    size_t n = size_t(st.st_size) / sizeof(uint16_t);
+    if (n < ACQ_BLOCK_SAMPLES) {
+        close(fd);
+        set.files.push_back(path);
+        return true;
+    }
+    void *map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path.c_str());
+        return false;
+    }
+    madvise(map, size_t(st.st_size), MADV_SEQUENTIAL);
+    auto s = static_cast<const uint16_t *>(map);
+
+    std::vector<ae::Hit> found;
+    Detect p(ae::DcBlock<ACQ_BLOCK_SAMPLES>{},
+             ae::HitDetector<ACQ_HIT_DEFINITION_US, Collect>(Collect{&found}, ACQ_HIT_THRESHOLD),
+             ae::Discard{});
+    ae::MemorySource<ACQ_BLOCK_SAMPLES, ACQ_SAMPLE_RATE> src(s, n);
+    ae::drain(src, p);
+
+    uint32_t file = uint32_t(set.files.size());
+    set.files.push_back(path);
+    set.sample_rate = ACQ_SAMPLE_RATE;
+    size_t base = set.waves.size();
+    set.waves.resize(base + found.size() * HIT_WINDOW);
+    for (size_t i = 0; i < found.size(); i++) {
+        const ae::Hit &h = found[i];
+        int16_t *w = &set.waves[base + i * HIT_WINDOW];
+        cut(s, n, h, w);
+
+        // Rise time: first sample at the peak, within the hit
+        uint32_t end = std::min<uint32_t>(HIT_WINDOW, HIT_PRETRIGGER + h.duration);
+        uint16_t rise = 0, best = 0;
+        for (uint32_t k = HIT_PRETRIGGER; k < end; k++) {
+            uint16_t a = uint16_t(w[k] < 0 ? -w[k] : w[k]);
+            if (a > best) {
+                best = a;
+                rise = uint16_t(k - HIT_PRETRIGGER);
+            }
+        }
+        set.hits.push_back(HitRecord{file, h.start, h.duration, h.peak, h.counts, rise});
+    }
+    munmap(map, size_t(st.st_size));
+    return true;
+}
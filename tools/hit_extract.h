@@ -0,0 +1,41 @@
+// AE hits and their waveforms from raw recordings.
+//
+// Hits are found by the firmware's own stages (ae_pipeline DcBlock >
+// HitDetector with ACQ_HIT_THRESHOLD and ACQ_HIT_DEFINITION_US), so the
+// host sees the hits the board counted. Each keeps a fixed window of
+// samples around its first threshold crossing for feature extraction.
+//
+// Deliberately free of ae_core headers: ae_core's sched.h shadows the
+// system one, which breaks <thread> in the tools that use this.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr uint32_t HIT_PRETRIGGER = 32;     // samples kept before the first crossing
+constexpr uint32_t HIT_WINDOW = 256;        // samples per waveform, a power of two
+
+struct HitRecord {
+    uint32_t file;          // index into HitSet::files
+    uint64_t start;         // sample of the first threshold crossing
+    uint32_t duration;      // samples, first to last crossing
+    uint16_t peak;          // counts
+    uint16_t counts;        // threshold crossings
+    uint16_t rise;          // samples from start to peak
+};
+
+struct HitSet {
+    uint32_t sample_rate = 4000;
+    std::vector<std::string> files;
+    std::vector<HitRecord> hits;
+    std::vector<int16_t> waves;     // HIT_WINDOW samples per hit, baseline removed
+
+    const int16_t *wave(size_t i) const { return &waves[i * HIT_WINDOW]; }
+};
+
+// Appends the hits of one .bin; false if it can't be read.
+bool extract_hits(const std::string &path, HitSet &set);
+
+// Firmware hit threshold, for tools that build hits themselves
+uint16_t hit_threshold();
@@ -0,0 +1,328 @@
+#include "lod_pyramid.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "worker_pool.h"
+
+namespace {
+
+constexpr char LOD_MAGIC[4] = {'A', 'E', 'L', 'D'};
+constexpr uint32_t LOD_VERSION = 1;
+
+// Levels up to this one are built per chunk in parallel; the few entries
+// above are merged serially. 32 * 4^7 = 512 Ki samples (1 MiB) per chunk.
+constexpr uint32_t LOD_CHUNK_LEVEL = 7;
+
+struct LodHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t src_size;
+    int64_t src_mtime_ns;
+    uint64_t fingerprint;
+    uint32_t base;
+    uint32_t fanout;
+    uint32_t levels;
+    uint32_t reserved;
+    uint64_t offset[LOD_MAX_LEVELS];
+    uint64_t count[LOD_MAX_LEVELS];
+};
+
+struct Mapping {
+    const uint8_t *data = nullptr;
+    size_t len = 0;
+    struct stat st {};
+};
+
+bool map_file(const std::string &path, Mapping &m)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    bool ok = fstat(fd, &m.st) == 0;
+    m.len = ok ? size_t(m.st.st_size) : 0;
+    if (ok && m.len) {
+        void *p = mmap(nullptr, m.len, PROT_READ, MAP_SHARED, fd, 0);
+        ok = p != MAP_FAILED;
+        m.data = ok ? static_cast<const uint8_t *>(p) : nullptr;
+        if (ok)
+            madvise(p, m.len, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+    return ok;
+}
+
+void unmap(const void *p, size_t len)
+{
+    if (p && len)
+        munmap(const_cast<void *>(p), len);
+}
+
+int64_t mtime_ns(const struct stat &st)
+{
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// FNV-1a over the size and the first and last 64 KiB
+uint64_t fingerprint(const uint8_t *p, size_t len)
+{
+    uint64_t h = 1469598103934665603ull ^ len;
+    auto mix = [&](const uint8_t *b, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            h = (h ^ b[i]) * 1099511628211ull;
+    };
+    const size_t edge = 64 * 1024;
+    mix(p, std::min(len, edge));
+    if (len > edge)
+        mix(p + len - std::min(len - edge, edge), std::min(len - edge, edge));
+    return h;
+}
+
+uint64_t div_up(uint64_t a, uint64_t b) { return (a + b - 1) / b; }
+
+void level0(const uint16_t *s, uint64_t first, uint64_t last, LodEntry *out)
+{
+    for (uint64_t b = first / LOD_BASE; b * LOD_BASE < last; b++) {
+        uint64_t e = std::min<uint64_t>((b + 1) * LOD_BASE, last);
+        uint16_t mn = 0xFFFF, mx = 0;
+        for (uint64_t i = b * LOD_BASE; i < e; i++) {
+            mn = std::min(mn, s[i]);
+            mx = std::max(mx, s[i]);
+        }
+        out[b] = {mn, mx};
+    }
+}
+
+void merge_level(const LodEntry *below, uint64_t below_count,
+                 uint64_t first, uint64_t last, LodEntry *out)
+{
+    for (uint64_t i = first; i < last; i++) {
+        uint64_t c0 = i * LOD_FANOUT;
+        uint64_t c1 = std::min<uint64_t>(c0 + LOD_FANOUT, below_count);
+        LodEntry e{0xFFFF, 0};
+        for (uint64_t c = c0; c < c1; c++) {
+            e.min = std::min(e.min, below[c].min);
+            e.max = std::max(e.max, below[c].max);
+        }
+        out[i] = e;
+    }
+}
+
+} // namespace
+
+LodPyramid::~LodPyramid()
+{
+    close();
+}
+
+void LodPyramid::close()
+{
+    unmap(src_, src_len_);
+    unmap(lod_, lod_len_);
+    src_ = nullptr;
+    lod_ = nullptr;
+    src_len_ = lod_len_ = 0;
+    levels_ = 0;
+    samples_ = 0;
+}
+
+bool LodPyramid::build(const std::string &source, const std::string &cache_path, unsigned threads)
+{
+    std::string cache = cache_path.empty() ? default_cache(source) : cache_path;
+
+    Mapping src;
+    if (!map_file(source, src)) {
+        perror(source.c_str());
+        return false;
+    }
+    const uint16_t *s = reinterpret_cast<const uint16_t *>(src.data);
+    const uint64_t n = src.len / sizeof(uint16_t);
+
+    LodHeader h{};
+    memcpy(h.magic, LOD_MAGIC, sizeof(h.magic));
+    h.version = LOD_VERSION;
+    h.src_size = src.len;
+    h.src_mtime_ns = mtime_ns(src.st);
+    h.fingerprint = fingerprint(src.data, src.len);
+    h.base = LOD_BASE;
+    h.fanout = LOD_FANOUT;
+
+    uint64_t off = (sizeof(h) + 63) & ~uint64_t(63);
+    for (uint64_t c = div_up(n, LOD_BASE); c > 0 && h.levels < LOD_MAX_LEVELS;
+         c = c > 1 ? div_up(c, LOD_FANOUT) : 0) {
+        h.offset[h.levels] = off;
+        h.count[h.levels] = c;
+        off += c * sizeof(LodEntry);
+        h.levels++;
+    }
+
+    std::string tmp = cache + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, off_t(off)) != 0) {
+        perror(tmp.c_str());
+        unmap(src.data, src.len);
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, off, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        perror(tmp.c_str());
+        unmap(src.data, src.len);
+        return false;
+    }
+    uint8_t *out = static_cast<uint8_t *>(map);
+    auto level = [&](uint32_t l) { return reinterpret_cast<LodEntry *>(out + h.offset[l]); };
+
+    // Parallel part: independent chunks aligned to the chunk level bucket
+    const uint32_t top = h.levels ? std::min(LOD_CHUNK_LEVEL, h.levels - 1) : 0;
+    uint64_t chunk = LOD_BASE;
+    for (uint32_t l = 0; l < top; l++)
+        chunk *= LOD_FANOUT;
+    const uint64_t chunks = div_up(n, chunk);
+
+    parallel_for(size_t(chunks), 1, threads, [&](size_t c, size_t, unsigned) {
+        uint64_t s0 = c * chunk;
+        uint64_t s1 = std::min(s0 + chunk, n);
+        level0(s, s0, s1, level(0));
+
+        uint64_t size = LOD_BASE;
+        for (uint32_t l = 1; l <= top; l++) {
+            size *= LOD_FANOUT;
+            merge_level(level(l - 1), h.count[l - 1], s0 / size, div_up(s1, size), level(l));
+        }
+    });
+
+    for (uint32_t l = top + 1; l < h.levels; l++)
+        merge_level(level(l - 1), h.count[l - 1], 0, h.count[l], level(l));
+
+    memcpy(out, &h, sizeof(h));
+    msync(map, off, MS_SYNC);
+    munmap(map, off);
+    unmap(src.data, src.len);
+
+    // Readers never see a half-written cache
+    if (rename(tmp.c_str(), cache.c_str()) != 0) {
+        perror(cache.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool LodPyramid::open(const std::string &source, const std::string &cache_path, unsigned threads)
+{
+    std::string cache = cache_path.empty() ? default_cache(source) : cache_path;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        close();
+
+        Mapping src, lod;
+        if (!map_file(source, src)) {
+            perror(source.c_str());
+            return false;
+        }
+        src_ = reinterpret_cast<const uint16_t *>(src.data);
+        src_len_ = src.len;
+        samples_ = src.len / sizeof(uint16_t);
+
+        bool valid = map_file(cache, lod) && lod.len >= sizeof(LodHeader);
+        lod_ = lod.data;
+        lod_len_ = lod.len;
+
+        if (valid) {
+            const LodHeader *h = reinterpret_cast<const LodHeader *>(lod.data);
+            valid = memcmp(h->magic, LOD_MAGIC, sizeof(h->magic)) == 0 &&
+                    h->version == LOD_VERSION && h->base == LOD_BASE &&
+                    h->fanout == LOD_FANOUT && h->levels <= LOD_MAX_LEVELS &&
+                    h->src_size == src.len && h->src_mtime_ns == mtime_ns(src.st) &&
+                    h->fingerprint == fingerprint(src.data, src.len);
+            for (uint32_t l = 0; valid && l < h->levels; l++)
+                valid = h->offset[l] + h->count[l] * sizeof(LodEntry) <= lod.len;
+
+            if (valid) {
+                levels_ = h->levels;
+                for (uint32_t l = 0; l < levels_; l++) {
+                    level_[l] = reinterpret_cast<const LodEntry *>(lod.data + h->offset[l]);
+                    count_[l] = h->count[l];
+                }
+                return true;
+            }
+        }
+
+        if (attempt == 0 && !build(source, cache, threads))
+            break;
+    }
+    close();
+    return false;
+}
+
+// Exact min/max of [p0, p1): whole buckets at `lvl`, the partial ones at
+// either end from the finer levels, the last < LOD_BASE samples raw.
+LodEntry LodPyramid::envelope(uint64_t p0, uint64_t p1, int lvl) const
+{
+    LodEntry e{0xFFFF, 0};
+    if (p0 >= p1)
+        return e;
+    if (lvl < 0) {
+        for (uint64_t k = p0; k < p1; k++) {
+            e.min = std::min(e.min, src_[k]);
+            e.max = std::max(e.max, src_[k]);
+        }
+        return e;
+    }
+
+    uint64_t size = LOD_BASE;
+    for (int l = 0; l < lvl; l++)
+        size *= LOD_FANOUT;
+    uint64_t b0 = div_up(p0, size);
+    uint64_t b1 = p1 == samples_ ? count_[lvl] : p1 / size;
+    if (b0 >= b1)
+        return envelope(p0, p1, lvl - 1);
+
+    const LodEntry *L = level_[lvl];
+    for (uint64_t b = b0; b < b1; b++) {
+        e.min = std::min(e.min, L[b].min);
+        e.max = std::max(e.max, L[b].max);
+    }
+    for (LodEntry side : {envelope(p0, b0 * size, lvl - 1),
+                          envelope(std::min(b1 * size, p1), p1, lvl - 1)}) {
+        e.min = std::min(e.min, side.min);
+        e.max = std::max(e.max, side.max);
+    }
+    return e;
+}
+
+std::vector<LodEntry> LodPyramid::query(uint64_t first, uint64_t last, uint32_t pixels) const
+{
+    std::vector<LodEntry> out;
+    last = std::min(last, samples_);
+    if (first >= last || pixels == 0)
+        return out;
+    out.resize(pixels);
+
+    const double w = double(last - first) / pixels;
+
+    // Coarsest level whose bucket is no wider than a pixel
+    int lvl = -1;
+    uint64_t size = LOD_BASE;
+    for (uint32_t l = 0; l < levels_ && size <= w; l++, size *= LOD_FANOUT)
+        lvl = int(l);
+    last_level_ = lvl;
+
+    for (uint32_t i = 0; i < pixels; i++) {
+        uint64_t p0 = first + uint64_t(i * w);
+        uint64_t p1 = std::min(last, std::max(p0 + 1, first + uint64_t((i + 1) * w)));
+        if (p0 >= last)
+            p0 = last - 1;
+        out[i] = envelope(p0, p1, lvl);
+    }
+    return out;
+}
@@ -0,0 +1,66 @@
+// Level-of-detail min/max pyramid over a raw uint16 recording.
+//
+// Level 0 holds the min/max of every LOD_BASE samples, each higher level
+// merges LOD_FANOUT entries of the one below. A query for N pixels over a
+// sample range picks the coarsest level whose bucket still fits in one
+// pixel, so it touches O(N * LOD_FANOUT * levels) entries at worst,
+// whatever the file length. Column edges that split a bucket are filled in
+// from the finer levels and finally the samples themselves, so every column
+// is the exact min/max of its sample range.
+//
+// The pyramid is cached in "<source>.lod" and rebuilt when the source's
+// size, mtime or content fingerprint change.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr uint32_t LOD_BASE = 32;
+constexpr uint32_t LOD_FANOUT = 4;
+constexpr uint32_t LOD_MAX_LEVELS = 24;
+
+struct LodEntry {
+    uint16_t min;
+    uint16_t max;
+};
+
+class LodPyramid {
+public:
+    LodPyramid() = default;
+    ~LodPyramid();
+    LodPyramid(const LodPyramid &) = delete;
+    LodPyramid &operator=(const LodPyramid &) = delete;
+
+    // Open the cache for `source`, building it first if missing or stale.
+    // threads == 0 uses every core.
+    bool open(const std::string &source, const std::string &cache = "", unsigned threads = 0);
+
+    // Rebuild the cache unconditionally.
+    static bool build(const std::string &source, const std::string &cache, unsigned threads = 0);
+
+    // Min/max envelope of samples [first, last) in `pixels` columns.
+    std::vector<LodEntry> query(uint64_t first, uint64_t last, uint32_t pixels) const;
+
+    uint64_t samples() const { return samples_; }
+    uint32_t levels() const { return levels_; }
+    // Level used by the last query (-1 = raw samples)
+    int last_level() const { return last_level_; }
+
+    static std::string default_cache(const std::string &source) { return source + ".lod"; }
+
+private:
+    void close();
+    LodEntry envelope(uint64_t p0, uint64_t p1, int lvl) const;
+
+    const uint16_t *src_ = nullptr;
+    size_t src_len_ = 0;
+    const uint8_t *lod_ = nullptr;
+    size_t lod_len_ = 0;
+
+    uint64_t samples_ = 0;
+    uint32_t levels_ = 0;
+    const LodEntry *level_[LOD_MAX_LEVELS] = {};
+    uint64_t count_[LOD_MAX_LEVELS] = {};
+    mutable int last_level_ = -1;
+};
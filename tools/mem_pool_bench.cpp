@@ -0,0 +1,189 @@
+// Checks and benchmarks for the firmware buffer pool (lib/ae_core/mem_pool.c).
+//
+// Runs the pool on host memory laid out like the firmware's: main SRAM
+// plus two small scratch banks. Checks alignment, DMA ring alignment,
+// exhaustion, per-mode reset and peak accounting, replays the firmware's
+// plot/log mode switches, then times allocation and mode reset against
+// malloc/free.
+//
+// usage: mem_pool_bench [--iterations N]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mem_pool.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t MAIN_BYTES = 16 * 1024;
+constexpr uint32_t SCRATCH_BYTES = 1024;
+
+alignas(4096) uint8_t mem_main[MAIN_BYTES];
+alignas(8) uint8_t mem_scratch_x[SCRATCH_BYTES];
+alignas(8) uint8_t mem_scratch_y[SCRATCH_BYTES];
+
+const char *const mode_names[MEM_MODES] = {"plot", "log", nullptr, nullptr};
+
+void setup(mem_pool_t &p)
+{
+    mem_pool_init(&p);
+    mem_pool_add_bank(&p, MEM_MAIN, "main", mem_main, sizeof(mem_main));
+    mem_pool_add_bank(&p, MEM_SCRATCH_X, "scratch_x", mem_scratch_x, sizeof(mem_scratch_x));
+    mem_pool_add_bank(&p, MEM_SCRATCH_Y, "scratch_y", mem_scratch_y, sizeof(mem_scratch_y));
+}
+
+bool in_bank(const void *ptr, const uint8_t *base, uint32_t size)
+{
+    auto p = static_cast<const uint8_t *>(ptr);
+    return p >= base && p < base + size;
+}
+
+void test_arena()
+{
+    alignas(64) static uint8_t buf[256];
+    arena_t a;
+    arena_init(&a, "t", buf + 1, 255);      // deliberately misaligned base
+
+    void *p1 = arena_alloc(&a, 3, 1);
+    check(p1 == buf + 1, "first byte allocation at base");
+    void *p2 = arena_alloc(&a, 16, 16);
+    check((uintptr_t(p2) & 15) == 0, "16-byte alignment");
+    check(arena_alloc(&a, 8, 3) == nullptr, "non power of two alignment rejected");
+    check(a.failures == 1, "failure counted");
+
+    uint32_t mark = arena_mark(&a);
+    check(arena_alloc(&a, 300, 1) == nullptr, "oversize allocation rejected");
+    check(arena_mark(&a) == mark, "failed allocation leaves arena unchanged");
+    void *p3 = arena_alloc(&a, 64, 64);
+    check(p3 && (uintptr_t(p3) & 63) == 0, "64-byte alignment");
+    arena_release(&a, mark);
+    check(arena_alloc(&a, 64, 64) == p3, "release reuses memory");
+    check(a.peak >= a.used, "peak covers use");
+
+    // Fill exactly
+    arena_release(&a, 0);
+    check(arena_alloc(&a, 255, 1) == buf + 1, "whole arena");
+    check(arena_alloc(&a, 1, 1) == nullptr, "full arena");
+}
+
+void test_pool()
+{
+    mem_pool_t p;
+    setup(p);
+
+    // Permanent allocation survives mode switches
+    void *fixed = mem_alloc(&p, MEM_SCRATCH_Y, 100, 4);
+    mem_pool_seal(&p);
+
+    mem_mode_enter(&p, 0);
+    void *plot = mem_alloc(&p, MEM_MAIN, 1000, 4);
+    check(in_bank(plot, mem_main, MAIN_BYTES), "main allocation in main bank");
+
+    mem_mode_enter(&p, 1);
+    uint16_t *ring = static_cast<uint16_t *>(mem_alloc_ring(&p, MEM_MAIN, 4096));
+    check(ring == reinterpret_cast<uint16_t *>(mem_main), "log mode reuses plot memory");
+    check((uintptr_t(ring) & 4095) == 0, "ring aligned to its size");
+    check(mem_alloc_ring(&p, MEM_MAIN, 3000) == nullptr, "ring size must be a power of two");
+
+    void *sx = mem_alloc(&p, MEM_SCRATCH_X, 512, 8);
+    check(in_bank(sx, mem_scratch_x, SCRATCH_BYTES), "scratch_x allocation in scratch_x");
+    check(mem_alloc(&p, MEM_SCRATCH_X, 600, 8) == nullptr, "scratch_x exhausted");
+
+    void *sy = mem_alloc(&p, MEM_SCRATCH_Y, 16, 4);
+    check(sy && static_cast<uint8_t *>(sy) >= static_cast<uint8_t *>(fixed) + 100,
+          "mode allocation above permanent one");
+
+    // Ring placed after an odd-sized buffer gets padded to its alignment
+    mem_alloc(&p, MEM_MAIN, 10, 1);
+    void *ring2 = mem_alloc_ring(&p, MEM_MAIN, 2048);
+    check(ring2 && (uintptr_t(ring2) & 2047) == 0, "second ring aligned after padding");
+
+    mem_mode_enter(&p, 0);
+    check(p.bank[MEM_MAIN].used == 0 && p.bank[MEM_SCRATCH_X].used == 0, "mode switch resets banks");
+    check(p.bank[MEM_SCRATCH_Y].used == 100, "mode switch keeps permanent part");
+    check(p.mode_peak[0][MEM_MAIN] == 1000, "plot mode peak");
+    check(p.mode_peak[1][MEM_MAIN] == 4096 + 10 + (2048 - 10) + 2048, "log mode peak");
+    check(p.mode_peak[1][MEM_SCRATCH_Y] == 16, "peak above permanent part");
+}
+
+// The firmware's sequence: boot into plot, record, back to plot, repeatedly
+void test_firmware_modes()
+{
+    mem_pool_t p;
+    setup(p);
+    mem_pool_seal(&p);
+    mem_mode_enter(&p, 0);
+
+    for (int rec = 0; rec < 3; rec++) {
+        mem_mode_enter(&p, 1);
+        void *ring = mem_alloc(&p, MEM_MAIN, 8 * 1024 * sizeof(uint16_t), 4);
+        void *sector = mem_alloc(&p, MEM_SCRATCH_X, 512, 8);
+        check(ring && sector, "firmware log buffers fit");
+        mem_mode_enter(&p, 0);
+    }
+    mem_pool_print(&p, mode_names);
+}
+
+void bench(uint32_t iterations)
+{
+    mem_pool_t p;
+    setup(p);
+    mem_pool_seal(&p);
+
+    constexpr int PER_MODE = 8;
+    uintptr_t check_sum = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        mem_mode_enter(&p, uint8_t(i & 1));
+        for (int k = 0; k < PER_MODE; k++)
+            check_sum += uintptr_t(mem_alloc(&p, MEM_MAIN, 64 + 32 * k, 8));
+    }
+    double pool = seconds_since(t0);
+
+    std::vector<void *> ptrs(PER_MODE);
+    t0 = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (int k = 0; k < PER_MODE; k++) {
+            ptrs[k] = malloc(64 + 32 * k);
+            check_sum += uintptr_t(ptrs[k]);
+        }
+        for (void *q : ptrs)
+            free(q);
+    }
+    double heap = seconds_since(t0);
+
+    double n = double(iterations) * PER_MODE;
+    printf("mem_alloc + mode reset: %6.2f ns/alloc\n", pool * 1e9 / n);
+    printf("malloc + free:          %6.2f ns/alloc\n", heap * 1e9 / n);
+    printf("(check %llu)\n", (unsigned long long)(check_sum & 0xFFFF));
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = 10000000;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--iterations" && i + 1 < argc) iterations = uint32_t(atoi(argv[++i]));
+        else {
+            fprintf(stderr, "usage: mem_pool_bench [--iterations N]\n");
+            return 2;
+        }
+    }
+
+    test_arena();
+    test_pool();
+    test_firmware_modes();
+    int status = check_summary();
+
+    bench(iterations);
+    return status;
+}
@@ -0,0 +1,172 @@
+#include "onset_batch.h"
+
+#include <cstring>
+
+#include "acq_pipeline.h"
+#include "ae_pipeline.hpp"
+
+namespace {
+
+constexpr uint32_t EDGE = ONSET_AIC_EDGE;
+
+// log2(v) for v > 0 without libm, so the loop vectorises: v = 2^e m,
+// ln m = 2 atanh((m - 1) / (m + 1)) to the t^9 term, error under 1e-6.
+// Below 2^-40 is clamped on the bit pattern, which orders like the value.
+inline __attribute__((always_inline)) float log2_fast(float v)
+{
+    int32_t b;
+    memcpy(&b, &v, sizeof(b));
+    b = b > 0x2B800000 ? b : 0x2B800000;
+    const float e = float((b >> 23) - 127);
+    b = (b & 0x007FFFFF) | 0x3F800000;
+    float m;
+    memcpy(&m, &b, sizeof(m));
+    const float t = (m - 1) / (m + 1), t2 = t * t;
+    const float ln_m = 2 * t * (1 + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7 + t2 * (1.0f / 9)))));
+    return e + 1.44269504f * ln_m;
+}
+
+// AIC(k) for k in [lo, hi] from prefix sums of x and x^2 over n samples;
+// inv[m] = 1 / m^2 turns the sums into variances without a division
+inline __attribute__((always_inline)) void aic_kernel(const double *__restrict p1,
+                                                      const double *__restrict p2,
+                                                      const float *__restrict inv,
+                                                      float *__restrict aic, uint32_t lo,
+                                                      uint32_t hi, uint32_t n)
+{
+    const double t1 = p1[n], t2 = p2[n];
+    for (int32_t k = int32_t(lo); k <= int32_t(hi); k++) {
+        const int32_t m = int32_t(n) - k;
+        const double a = double(k), b = double(m);
+        const double s1 = p1[k], s2 = p2[k], r1 = t1 - s1, r2 = t2 - s2;
+        const float v1 = float(a * s2 - s1 * s1) * inv[k];
+        const float v2 = float(b * r2 - r1 * r1) * inv[m];
+        aic[k] = float(a) * log2_fast(v1) + float(b) * log2_fast(v2);
+    }
+}
+
+void aic_base(const double *p1, const double *p2, const float *inv, float *aic, uint32_t lo,
+              uint32_t hi, uint32_t n)
+{
+    aic_kernel(p1, p2, inv, aic, lo, hi, n);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+void aic_avx2(const double *p1, const double *p2, const float *inv, float *aic, uint32_t lo,
+              uint32_t hi, uint32_t n)
+{
+    aic_kernel(p1, p2, inv, aic, lo, hi, n);
+}
+
+bool have_avx2() { return __builtin_cpu_supports("avx2"); }
+#else
+void aic_avx2(const double *p1, const double *p2, const float *inv, float *aic, uint32_t lo,
+              uint32_t hi, uint32_t n)
+{
+    aic_kernel(p1, p2, inv, aic, lo, hi, n);
+}
+
+bool have_avx2() { return false; }
+#endif
+
+struct Collect {
+    std::vector<uint64_t> *out;
+    void operator()(const ae::Onset &o) const { out->push_back(o.trigger); }
+};
+
+} // namespace
+
+double AicPicker::pick(const int16_t *x, uint32_t n)
+{
+    static const bool avx2 = have_avx2();
+    if (!prefix(x, n))
+        return -1;
+    (avx2 ? aic_avx2 : aic_base)(p1_.data(), p2_.data(), inv_.data(), aic_.data(), EDGE, n - EDGE, n);
+    return finish(n);
+}
+
+double AicPicker::pick_base(const int16_t *x, uint32_t n)
+{
+    if (!prefix(x, n))
+        return -1;
+    aic_base(p1_.data(), p2_.data(), inv_.data(), aic_.data(), EDGE, n - EDGE, n);
+    return finish(n);
+}
+
+// Sums of x and x^2 less x[0], in integers (a one-cycle dependency
+// chain) and then as doubles, exact below 2^53: any window of 12-bit
+// samples
+bool AicPicker::prefix(const int16_t *x, uint32_t n)
+{
+    if (n <= 2 * EDGE)
+        return false;
+    p1_.resize(n + 1);
+    p2_.resize(n + 1);
+    aic_.resize(n + 1);
+    for (size_t m = inv_.size(); m <= n; m++)
+        inv_.push_back(m ? float(1.0 / (double(m) * double(m))) : 0.0f);
+    const int32_t base = x[0];
+    int64_t s1 = 0, s2 = 0;
+    p1_[0] = p2_[0] = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        const int32_t v = x[k] - base;
+        s1 += v;
+        s2 += int64_t(v) * v;
+        p1_[k + 1] = double(s1);
+        p2_[k + 1] = double(s2);
+    }
+    return true;
+}
+
+// Earliest least AIC, and the vertex of the parabola through it and its
+// neighbours
+double AicPicker::finish(uint32_t n)
+{
+    uint32_t best = EDGE;
+    for (uint32_t k = EDGE + 1; k <= n - EDGE; k++)
+        if (aic_[k] < aic_[best])
+            best = k;
+    double frac = 0;
+    if (best > EDGE && best < n - EDGE) {
+        const double a = aic_[best - 1], b = aic_[best], c = aic_[best + 1];
+        const double den = a - 2 * b + c;
+        if (den > 0)
+            frac = std::clamp(0.5 * (a - c) / den, -0.5, 0.5);
+    }
+    return best + frac;
+}
+
+std::vector<OnsetPick> pick_onsets(const uint16_t *s, size_t n, const OnsetBatchConfig &cfg)
+{
+    constexpr uint32_t N = ACQ_BLOCK_SAMPLES;
+    using Picker = ae::OnsetPicker<N, ACQ_ONSET_WINDOW, ACQ_ONSET_POST, Collect>;
+
+    std::vector<uint64_t> cand;
+    ae::Pipeline<ae::DcBlock<N>, Picker, ae::Discard> p(ae::DcBlock<N>{}, Picker(Collect{&cand}),
+                                                      ae::Discard{});
+    p.stage<1>().set_refine(false);
+    p.reset();
+    ae::MemorySource<N, ACQ_SAMPLE_RATE> src(s, n);
+    ae::drain(src, p);
+
+    std::vector<OnsetPick> out;
+    out.reserve(cand.size());
+    AicPicker aic;
+    std::vector<int16_t> w(cfg.window);
+    for (uint64_t c : cand) {
+        OnsetPick o{c, double(c), false};
+        const uint64_t e = std::min<uint64_t>(c + cfg.post, n);
+        const uint64_t s0 = e > cfg.window ? e - cfg.window : 0;
+        const uint32_t len = uint32_t(e - s0);
+        for (uint32_t i = 0; i < len; i++)
+            w[i] = int16_t(s[s0 + i]);
+        double k = cfg.refine ? aic.pick(w.data(), len) : -1;
+        if (k >= 0) {
+            o.at = double(s0) + k;
+            o.refined = true;
+        }
+        out.push_back(o);
+    }
+    return out;
+}
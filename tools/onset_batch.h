@@ -0,0 +1,45 @@
+// Arrival picking on the host, in batch over whole recordings.
+//
+// Candidates come from the board's own stages (DcBlock > OnsetPicker with
+// refinement off, lib/ae_core/onset.h), so the host starts from exactly
+// the candidates the board found. Each is then refined by AIC in float,
+// over a window that may be longer than the board's: the variances from
+// exact double prefix sums, the logs and the criterion in one loop GCC
+// vectorises, 8 floats wide with AVX2 where the CPU has it (chosen at
+// run time, as in fft.h).
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct OnsetPick {
+    uint64_t trigger;       // sample index of the STA/LTA candidate
+    double at;              // arrival, sample index
+    bool refined;           // false if the window was too short for AIC
+};
+
+struct OnsetBatchConfig {
+    uint32_t window = 256;  // AIC window, samples
+    uint32_t post = 64;     // of which after the candidate
+    bool refine = true;
+};
+
+class AicPicker {
+public:
+    // Arrival in x[0..n) in samples from x[0]; -1 unless n > 16
+    double pick(const int16_t *x, uint32_t n);
+
+    // Same on the baseline vector unit, for the checks
+    double pick_base(const int16_t *x, uint32_t n);
+
+private:
+    bool prefix(const int16_t *x, uint32_t n);
+    double finish(uint32_t n);
+
+    std::vector<double> p1_, p2_;
+    std::vector<float> aic_, inv_;
+};
+
+// Candidates and arrivals in raw codes s[0..n), in sample order
+std::vector<OnsetPick> pick_onsets(const uint16_t *s, size_t n, const OnsetBatchConfig &cfg);
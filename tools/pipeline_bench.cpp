@@ -0,0 +1,267 @@
+// Host run of the firmware acquisition pipeline, plus stage benchmarks.
+//
+// Builds the firmware's acq_pipeline.cpp unchanged and feeds it a synthetic
+// recording (DC + noise with decaying 500 Hz bursts at known positions).
+// Checks that the stats stage matches block_stats_compute run directly and
+// that every burst comes out as exactly one hit starting where it was
+// injected, and as one onset picked within a sample of it. Then again with
+// the blocks pushed as burst mode does, part of the recording at 100 kS/s,
+// checking the hit and onset times against that timebase. Then times a few
+// stage compositions built from the same templates.
+//
+// usage: pipeline_bench [--seconds N]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "acq_pipeline.h"
+#include "ae_pipeline.hpp"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t N = ACQ_BLOCK_SAMPLES;
+constexpr uint32_t RATE = ACQ_SAMPLE_RATE;
+constexpr uint32_t BURST_EVERY = 2917;        // samples, not a block multiple
+constexpr double BURST_AMPLITUDE = 800;
+constexpr uint32_t FAST_RATE = 100000;        // rate_ctl burst rate
+
+std::vector<block_stats_t> stats_out;
+std::vector<acq_hit_t> hits_out;
+std::vector<acq_onset_t> onsets_out;
+
+std::vector<uint16_t> make_recording(uint32_t seconds, std::vector<uint64_t> &bursts)
+{
+    std::vector<uint16_t> v(size_t(seconds) * RATE / N * N);
+    uint32_t x = 1;
+    for (size_t i = 0; i < v.size(); i++) {
+        x = x * 1664525 + 1013904223;
+        v[i] = uint16_t(2048 + int(x >> 27) - 16);
+    }
+    for (size_t s = 1000; s + 200 < v.size(); s += BURST_EVERY) {
+        bursts.push_back(s);
+        for (int k = 0; k < 200; k++) {
+            double a = BURST_AMPLITUDE * std::exp(-k / 20.0) * std::sin(2 * M_PI * 500 * k / RATE + M_PI / 2);
+            v[s + k] = uint16_t(int(v[s + k]) + int(std::lround(a)));
+        }
+    }
+    return v;
+}
+
+// Rate switches of the burst mode check: the first sample at `rate`
+struct Switch {
+    uint64_t sample;
+    uint32_t rate;
+};
+
+// Time of sample s, the first at switches[0].rate from t0_us
+double sample_time(const std::vector<Switch> &switches, double t0_us, uint64_t s)
+{
+    double t = t0_us;
+    uint64_t at = 0;
+    uint32_t rate = switches[0].rate;
+    for (size_t k = 1; k < switches.size() && switches[k].sample <= s; k++) {
+        t += double(switches[k].sample - at) * 1000000 / rate;
+        at = switches[k].sample;
+        rate = switches[k].rate;
+    }
+    return t + double(s - at) * 1000000 / rate;
+}
+
+template <class P>
+void time_pipeline(const char *name, P &p, const std::vector<uint16_t> &v)
+{
+    p.reset();
+    ae::MemorySource<N, RATE> src(v.data(), v.size());
+    auto t0 = std::chrono::steady_clock::now();
+    uint32_t blocks = ae::drain(src, p);
+    double secs = seconds_since(t0);
+    double samples = double(blocks) * N;
+    printf("%-34s %8.1f MS/s %6.2f ns/sample %7.2f us/block\n",
+           name, samples / secs / 1e6, secs * 1e9 / samples, secs * 1e6 / blocks);
+}
+
+struct Count {
+    uint64_t n = 0;
+    template <class T> void operator()(const T &) { n++; }
+};
+
+} // namespace
+
+void acq_on_stats(const block_stats_t *r) { stats_out.push_back(*r); }
+void acq_on_hit(const acq_hit_t *h) { hits_out.push_back(*h); }
+void acq_on_onset(const acq_onset_t *o) { onsets_out.push_back(*o); }
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = 600;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--seconds" && i + 1 < argc) seconds = uint32_t(atoi(argv[++i]));
+        else {
+            fprintf(stderr, "usage: pipeline_bench [--seconds N]\n");
+            return 2;
+        }
+    }
+
+    std::vector<uint64_t> bursts;
+    std::vector<uint16_t> v = make_recording(seconds, bursts);
+    bool failed = false;
+
+    // ---- Firmware pipeline, as linked into adc_sdcard ----
+    acq_pipeline_reset();
+    const uint64_t t0_us = 1000000;
+    for (size_t off = 0; off < v.size(); off += N)
+        acq_pipeline_push(&v[off], t0_us + (off + N - 1) * 1000000 / RATE);
+
+    uint16_t center = block_stats_center(v.data(), N);
+    uint8_t above = BLOCK_STATS_ABOVE_UNKNOWN;
+    for (size_t b = 0; b < stats_out.size(); b++) {
+        block_stats_t r{};
+        block_stats_compute(&r, &v[b * N], N, center, &above);
+        center = block_stats_mean(&r, N);
+        if (r.sum != stats_out[b].sum || r.zero_cross != stats_out[b].zero_cross || stats_out[b].seq != b) {
+            printf("FAIL: stats record %zu differs\n", b);
+            failed = true;
+            break;
+        }
+    }
+
+    size_t matched = 0;
+    for (const acq_hit_t &h : hits_out) {
+        if (matched < bursts.size() && h.start >= bursts[matched] && h.start <= bursts[matched] + 2 &&
+            h.t_us == t0_us + h.start * 1000000 / RATE)
+            matched++;
+        else {
+            printf("FAIL: unexpected hit at sample %llu\n", (unsigned long long)h.start);
+            failed = true;
+            break;
+        }
+    }
+    printf("%zu blocks, %zu stats records, %zu hits for %zu bursts\n",
+           v.size() / N, stats_out.size(), hits_out.size(), bursts.size());
+    if (matched != bursts.size() && !failed) {
+        printf("FAIL: %zu bursts missed\n", bursts.size() - matched);
+        failed = true;
+    }
+
+    // Onsets: one per burst, refined to within a sample, timed from the
+    // stamp of the block they were picked in
+    size_t picked = 0;
+    for (const acq_onset_t &o : onsets_out) {
+        const double at = double(o.at_q8) / (1 << ONSET_FRAC_BITS);
+        const double want_us = t0_us + at * 1000000 / RATE;
+        if (picked < bursts.size() && o.refined && std::fabs(at - double(bursts[picked])) <= 1 &&
+            std::fabs(double(o.t_us) - want_us) <= 1)
+            picked++;
+        else {
+            printf("FAIL: unexpected onset at sample %.2f\n", at);
+            failed = true;
+            break;
+        }
+    }
+    printf("%zu onsets for %zu bursts\n", onsets_out.size(), bursts.size());
+    if (picked != bursts.size() && !failed) {
+        printf("FAIL: %zu bursts without an onset\n", bursts.size() - picked);
+        failed = true;
+    }
+
+    // ---- Burst mode: blocks taken at another rate ----
+    // At FAST_RATE from block 1 on, which picks the first burst's onset
+    // from the block before; back at RATE 900 samples into block 3, with
+    // the second burst in that lead
+    if (v.size() >= 5 * N) {
+        const std::vector<Switch> switches = {{0, RATE}, {N, FAST_RATE}, {3 * N + 900, RATE}};
+        acq_pipeline_reset();
+        hits_out.clear();
+        onsets_out.clear();
+        for (size_t off = 0; off < v.size(); off += N) {
+            uint32_t rate = RATE, lead = 0, lead_rate = RATE;
+            for (const Switch &w : switches) {
+                if (w.sample <= off) {
+                    rate = lead_rate = w.rate;
+                } else if (w.sample < off + N) {
+                    lead = uint32_t(w.sample - off);
+                    lead_rate = rate;
+                    rate = w.rate;
+                }
+            }
+            const double t_us = sample_time(switches, t0_us, off + N - 1);
+            acq_pipeline_push_rate(&v[off], uint64_t(std::llround(t_us)), rate, uint16_t(lead), lead_rate);
+        }
+
+        size_t fast_hits = 0, fast_onsets = 0;
+        for (const acq_hit_t &h : hits_out) {
+            const double want_us = sample_time(switches, t0_us, h.start);
+            if (fast_hits < bursts.size() && h.start >= bursts[fast_hits] &&
+                h.start <= bursts[fast_hits] + 2 && std::fabs(double(h.t_us) - want_us) <= 2)
+                fast_hits++;
+            else {
+                printf("FAIL: burst mode hit at sample %llu, %llu us, want %.1f us\n",
+                       (unsigned long long)h.start, (unsigned long long)h.t_us, want_us);
+                failed = true;
+                break;
+            }
+        }
+        for (const acq_onset_t &o : onsets_out) {
+            const double at = double(o.at_q8) / (1 << ONSET_FRAC_BITS);
+            const uint64_t whole = o.at_q8 >> ONSET_FRAC_BITS;
+            const double t = sample_time(switches, t0_us, whole);
+            const double want_us = t + (sample_time(switches, t0_us, whole + 1) - t) * (at - double(whole));
+            if (fast_onsets < bursts.size() && std::fabs(at - double(bursts[fast_onsets])) <= 1 &&
+                std::fabs(double(o.t_us) - want_us) <= 2)
+                fast_onsets++;
+            else {
+                printf("FAIL: burst mode onset at sample %.2f, %llu us, want %.1f us\n", at,
+                       (unsigned long long)o.t_us, want_us);
+                failed = true;
+                break;
+            }
+        }
+        printf("burst mode: %zu hits, %zu onsets for %zu bursts\n", hits_out.size(),
+               onsets_out.size(), bursts.size());
+        if ((fast_hits != bursts.size() || fast_onsets != bursts.size()) && !failed) {
+            printf("FAIL: burst mode missed %zu hits, %zu onsets\n", bursts.size() - fast_hits,
+                   bursts.size() - fast_onsets);
+            failed = true;
+        }
+    }
+
+    // ---- Stage compositions ----
+    Count count;
+    auto on_stats = [&](const block_stats_t &) { count.n++; };
+    auto on_hit = [&](const ae::Hit &) { count.n++; };
+    auto on_onset = [&](const ae::Onset &) { count.n++; };
+    using Picker = ae::OnsetPicker<N, ACQ_ONSET_WINDOW, ACQ_ONSET_POST, decltype(on_onset)>;
+
+    ae::Pipeline<ae::BlockStats<N, decltype(on_stats)>, ae::Discard> stats_only{
+        ae::BlockStats<N, decltype(on_stats)>(on_stats), ae::Discard()};
+    time_pipeline("BlockStats", stats_only, v);
+
+    ae::Pipeline<ae::DcBlock<N>, ae::HitDetector<ACQ_HIT_DEFINITION_US, decltype(on_hit)>, ae::Discard> hits{
+        ae::DcBlock<N>(), ae::HitDetector<ACQ_HIT_DEFINITION_US, decltype(on_hit)>(on_hit), ae::Discard()};
+    time_pipeline("DcBlock > HitDetector", hits, v);
+
+    ae::Pipeline<ae::DcBlock<N>, Picker, ae::Discard> onsets{ae::DcBlock<N>(), Picker(on_onset), ae::Discard()};
+    time_pipeline("DcBlock > OnsetPicker", onsets, v);
+
+    ae::Pipeline<ae::BlockStats<N, decltype(on_stats)>, ae::DcBlock<N>, Picker,
+                 ae::HitDetector<ACQ_HIT_DEFINITION_US, decltype(on_hit)>, ae::Discard> full{
+        ae::BlockStats<N, decltype(on_stats)>(on_stats), ae::DcBlock<N>(), Picker(on_onset),
+        ae::HitDetector<ACQ_HIT_DEFINITION_US, decltype(on_hit)>(on_hit), ae::Discard()};
+    time_pipeline("firmware chain", full, v);
+
+    ae::Pipeline<ae::DcBlock<N>, ae::Decimate<int16_t, N, 4>,
+                 ae::HitDetector<ACQ_HIT_DEFINITION_US, decltype(on_hit)>, ae::Call<Count>> decimated{
+        ae::DcBlock<N>(), ae::Decimate<int16_t, N, 4>(),
+        ae::HitDetector<ACQ_HIT_DEFINITION_US, decltype(on_hit)>(on_hit), ae::Call<Count>()};
+    time_pipeline("DcBlock > Decimate<4> > HitDetector", decimated, v);
+
+    printf("(%llu callbacks)\n", (unsigned long long)count.n);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+#include "sd_card_sim.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "sd_proto.h"
+
+namespace {
+constexpr uint8_t R1_IDLE = 0x01;
+constexpr uint8_t R1_ILLEGAL = 0x04;
+constexpr uint8_t R1_CRC = 0x08;
+constexpr uint8_t R1_PARAM = 0x40;
+
+constexpr uint8_t DATA_ACCEPTED = 0xE5;
+constexpr uint8_t DATA_CRC_ERROR = 0xEB;
+} // namespace
+
+SdCardSim::SdCardSim(uint32_t blocks, bool hc)
+    : mem(size_t(blocks) * SD_BLOCK_SIZE), high_capacity(hc)
+{
+    const uint8_t id[15] = {0x03, 'S', 'D', 'A', 'E', 'S', 'I', 'M', 0x10,
+                            0x12, 0x34, 0x56, 0x78, 0x01, 0x4A};
+    set_cid(id);
+}
+
+void SdCardSim::set_cid(const uint8_t *id15)
+{
+    memcpy(cid, id15, 15);
+    cid[15] = uint8_t(sd_crc7(cid, 15) << 1 | 1);
+}
+
+void SdCardSim::set_bit_error_rate(double ber, uint64_t seed)
+{
+    ber_ = ber;
+    rng_.seed(seed);
+    clean_bits_ = 0;
+    if (ber_ > 0) {
+        std::uniform_real_distribution<double> u(0, 1);
+        clean_bits_ = uint64_t(std::log(1 - u(rng_)) / std::log1p(-ber_));
+    }
+}
+
+// A byte through the wire: the gaps between flipped bits are geometric
+uint8_t SdCardSim::wire(uint8_t b)
+{
+    if (ber_ <= 0)
+        return b;
+    std::uniform_real_distribution<double> u(0, 1);
+    while (clean_bits_ < 8) {
+        b ^= uint8_t(0x80 >> clean_bits_);
+        bit_errors++;
+        clean_bits_ += 1 + uint64_t(std::log(1 - u(rng_)) / std::log1p(-ber_));
+    }
+    clean_bits_ -= 8;
+    return b;
+}
+
+void SdCardSim::send_data(const uint8_t *p, uint32_t len)
+{
+    out_.push_back(0x00);
+    out_.push_back(0xFF);
+    out_.push_back(0xFE);
+    out_.insert(out_.end(), p, p + len);
+    uint16_t crc = sd_crc16(0, p, len);
+    out_.push_back(uint8_t(crc >> 8));
+    out_.push_back(uint8_t(crc));
+}
+
+void SdCardSim::select(bool on)
+{
+    selected_ = on;
+}
+
+uint32_t SdCardSim::address(uint32_t arg) const
+{
+    return high_capacity ? arg : arg / SD_BLOCK_SIZE;
+}
+
+uint8_t SdCardSim::exchange(uint8_t mosi)
+{
+    if (!selected_)
+        return 0xFF;
+    mosi = wire(mosi);
+
+    uint8_t miso = 0xFF;
+    if (!out_.empty()) {
+        miso = out_.front();
+        out_.pop_front();
+    } else if (now_us < busy_until_) {
+        miso = 0x00;
+    }
+    miso = wire(miso);
+    bool busy = now_us < busy_until_;
+
+    switch (mode_) {
+    case Mode::Idle:
+        if ((mosi & 0xC0) == 0x40 && out_.empty() && !busy) {
+            cmd_[0] = mosi;
+            cmd_len_ = 1;
+            mode_ = Mode::Cmd;
+        }
+        break;
+    case Mode::Cmd:
+        cmd_[cmd_len_++] = mosi;
+        if (cmd_len_ == sizeof(cmd_))
+            command();
+        break;
+    case Mode::MultiWrite:
+        if (busy || !out_.empty())
+            break;
+        if (mosi == 0xFC) {
+            block_.clear();
+            after_block_ = Mode::MultiWrite;
+            mode_ = Mode::RxBlock;
+        } else if (mosi == 0xFD) {
+            busy_until_ = now_us + busy_us;
+            mode_ = Mode::Idle;
+            out_.push_back(0xFF);   // Nbr
+        }
+        break;
+    case Mode::SingleWrite:
+        if (mosi == 0xFE) {
+            block_.clear();
+            after_block_ = Mode::Idle;
+            mode_ = Mode::RxBlock;
+        }
+        break;
+    case Mode::RxBlock:
+        block_.push_back(mosi);
+        if (block_.size() == SD_BLOCK_SIZE + 2)
+            block_received();
+        break;
+    }
+
+    return miso;
+}
+
+void SdCardSim::command()
+{
+    commands++;
+    mode_ = Mode::Idle;
+
+    for (uint32_t i = 0; i < ncr; i++)
+        out_.push_back(0xFF);
+
+    if (uint8_t((sd_crc7(cmd_, 5) << 1) | 1) != cmd_[5]) {
+        out_.push_back(R1_CRC);
+        return;
+    }
+
+    uint8_t idx = cmd_[0] & 0x3F;
+    uint32_t arg = uint32_t(cmd_[1]) << 24 | cmd_[2] << 16 | cmd_[3] << 8 | cmd_[4];
+    bool in_range = address(arg) < mem.size() / SD_BLOCK_SIZE;
+
+    if (app_cmd_) {
+        app_cmd_ = false;
+        if (idx == 23) {
+            pre_erase = arg;
+            out_.push_back(0x00);
+        } else {
+            out_.push_back(R1_ILLEGAL);
+        }
+        return;
+    }
+
+    switch (idx) {
+    case 0:
+        out_.push_back(R1_IDLE);
+        break;
+    case 10:
+        send_data(cid, sizeof(cid));
+        break;
+    case 12:
+        out_.push_back(0x00);
+        busy_until_ = now_us + busy_us;
+        break;
+    case 13:
+        out_.push_back(0x00);
+        out_.push_back(0x00);
+        break;
+    case 17: {
+        if (!in_range) {
+            out_.push_back(R1_PARAM);
+            break;
+        }
+        send_data(&mem[size_t(address(arg)) * SD_BLOCK_SIZE], SD_BLOCK_SIZE);
+        break;
+    }
+    case 24:
+    case 25:
+        if (!in_range) {
+            out_.push_back(R1_PARAM);
+            break;
+        }
+        out_.push_back(0x00);
+        wr_addr_ = address(arg);
+        mode_ = idx == 24 ? Mode::SingleWrite : Mode::MultiWrite;
+        break;
+    case 55:
+        out_.push_back(0x00);
+        app_cmd_ = true;
+        break;
+    case 59:
+        out_.push_back(0x00);
+        crc_on = arg & 1;
+        break;
+    default:
+        out_.push_back(R1_ILLEGAL);
+        break;
+    }
+}
+
+void SdCardSim::block_received()
+{
+    uint16_t crc = uint16_t(block_[SD_BLOCK_SIZE] << 8 | block_[SD_BLOCK_SIZE + 1]);
+    bool ok = sd_crc16(0, block_.data(), SD_BLOCK_SIZE) == crc;
+    if (corrupt_block && blocks_written + crc_errors + 1 == corrupt_block)
+        ok = false;
+
+    if (ok && size_t(wr_addr_ + 1) * SD_BLOCK_SIZE <= mem.size()) {
+        memcpy(&mem[size_t(wr_addr_) * SD_BLOCK_SIZE], block_.data(), SD_BLOCK_SIZE);
+        wr_addr_++;
+        blocks_written++;
+        out_.push_back(DATA_ACCEPTED);
+        busy_until_ = now_us + busy_us;
+        mode_ = after_block_;
+    } else {
+        crc_errors++;
+        out_.push_back(DATA_CRC_ERROR);
+        // A rejected block in CMD25 still expects the stop token
+        mode_ = after_block_;
+    }
+}
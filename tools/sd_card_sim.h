@@ -0,0 +1,73 @@
+// Byte-level model of an SD card in SPI mode, standing in for the real
+// card when the sd_proto state machine runs on a PC.
+//
+// Supported: CMD10, CMD12, CMD13, CMD17, CMD24, CMD25 (+ACMD23), CMD55,
+// CMD59. CRC7 and CRC16 are always checked, as after CMD59; crc_on only
+// records what the host asked for. Programming busy
+// lasts busy_us of simulated time, during which MISO reads 0x00; the bus
+// sets now_us before clocking bytes. Bit errors on the wires can be
+// injected at a given rate, for the clock tuner (tools/clk_tune_sim).
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <vector>
+
+class SdCardSim {
+public:
+    explicit SdCardSim(uint32_t blocks, bool high_capacity = true);
+
+    void select(bool on);
+    uint8_t exchange(uint8_t mosi);
+
+    std::vector<uint8_t> mem;
+    bool high_capacity;
+    uint8_t cid[16];             // CMD10; set_cid() fixes up the CRC7
+
+    void set_cid(const uint8_t *id15);
+
+    double now_us = 0;           // simulated time, advanced by the bus
+
+    uint32_t ncr = 1;            // bytes before R1
+    uint32_t busy_us = 100;      // programming time per block
+    bool crc_on = false;         // last CMD59 argument
+
+    // fault injection: corrupt the CRC check of this block number (0 = off)
+    uint32_t corrupt_block = 0;
+
+    // fault injection: flip each bit on MOSI and on MISO with this
+    // probability, from a fixed seed
+    void set_bit_error_rate(double ber, uint64_t seed = 1);
+
+    // statistics
+    uint32_t blocks_written = 0;
+    uint32_t crc_errors = 0;
+    uint32_t commands = 0;
+    uint32_t pre_erase = 0;      // last ACMD23 argument
+    uint64_t bit_errors = 0;     // bits flipped
+
+private:
+    enum class Mode { Idle, Cmd, MultiWrite, SingleWrite, RxBlock };
+
+    void command();
+    void block_received();
+    uint32_t address(uint32_t arg) const;
+    uint8_t wire(uint8_t b);
+    void send_data(const uint8_t *p, uint32_t len);
+
+    Mode mode_ = Mode::Idle;
+    Mode after_block_ = Mode::Idle;
+    bool selected_ = false;
+    bool app_cmd_ = false;
+    uint8_t cmd_[6] = {};
+    uint32_t cmd_len_ = 0;
+    std::vector<uint8_t> block_;
+    uint32_t wr_addr_ = 0;       // next block to write
+    double busy_until_ = 0;
+    std::deque<uint8_t> out_;
+
+    double ber_ = 0;
+    std::mt19937_64 rng_;
+    uint64_t clean_bits_ = 0;    // bits before the next flip
+};
@@ -0,0 +1,169 @@
+// Drive the sd_proto multi-block writer against SdCardSim on a simulated
+// bus clock, the way the logger does (2048-byte buffers = 4 blocks), and
+// check that the card ends up with exactly the data that was sent.
+//
+// The transport completes each transfer at once and advances the simulated
+// clock by len * 8 / f_spi. Card programming time is --busy-us per block.
+// Reports the modelled throughput at each bus clock; the firmware-side
+// measurement is test/sd_dma_write_main.c.
+//
+// usage: sd_mbw_sim [--mb N] [--busy-us N] [--corrupt-block N]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sd_card_sim.h"
+#include "sd_proto.h"
+
+namespace {
+
+struct SimBus {
+    SdCardSim *card = nullptr;
+    double clk_hz = 0;
+    double now_us = 0;
+    uint16_t crc = 0;
+    uint64_t bus_bytes = 0;
+    sd_transport_t t{};
+
+    uint64_t now() const { return uint64_t(now_us); }
+};
+
+void bus_select(void *ctx, bool on)
+{
+    static_cast<SimBus *>(ctx)->card->select(on);
+}
+
+void bus_xfer_start(void *ctx, const uint8_t *tx, uint8_t *rx, uint32_t len, bool crc)
+{
+    auto *b = static_cast<SimBus *>(ctx);
+    const double byte_us = 8e6 / b->clk_hz;
+    for (uint32_t i = 0; i < len; i++) {
+        b->now_us += byte_us;
+        b->card->now_us = b->now_us;
+        uint8_t out = tx ? tx[i] : 0xFF;
+        uint8_t in = b->card->exchange(out);
+        if (rx)
+            rx[i] = in;
+    }
+    b->crc = crc ? sd_crc16(0, tx, len) : 0;
+    b->bus_bytes += len;
+}
+
+bool bus_xfer_busy(void *) { return false; }
+
+uint16_t bus_xfer_crc(void *ctx) { return static_cast<SimBus *>(ctx)->crc; }
+
+struct Result {
+    sd_status_t status;
+    double seconds;
+    uint64_t bus_bytes;
+    uint32_t busy_polls;
+    bool verified;
+};
+
+Result run(uint32_t clk_hz, uint32_t bytes, uint32_t busy_us, uint32_t corrupt_block)
+{
+    const uint32_t buf_bytes = 2048;
+    const uint32_t blocks = bytes / SD_BLOCK_SIZE;
+    const uint32_t start_lba = 1024;
+
+    SdCardSim card(start_lba + blocks + 64);
+    card.busy_us = busy_us;
+    card.corrupt_block = corrupt_block;
+
+    SimBus bus;
+    bus.card = &card;
+    bus.clk_hz = clk_hz;
+    bus.t = {&bus, bus_select, bus_xfer_start, bus_xfer_busy, bus_xfer_crc};
+
+    std::vector<uint8_t> data(bytes);
+    uint32_t x = 12345;
+    for (auto &b : data) {
+        x = x * 1103515245 + 12345;
+        b = uint8_t(x >> 16);
+    }
+
+    sd_mbw_t w;
+    sd_mbw_init(&w, &bus.t, true);
+
+    // Idle time between polls: the main loop has other work to do
+    auto wait = [&](sd_status_t st) {
+        if (st == SD_BUSY)
+            bus.now_us += SD_BUSY_POLL_US;
+    };
+
+    sd_status_t st = sd_mbw_start(&w, start_lba, blocks, bus.now());
+    while (st == SD_BUSY) {
+        wait(st);
+        st = sd_mbw_poll(&w, bus.now());
+    }
+
+    for (uint32_t off = 0; st == SD_OK && off < bytes; off += buf_bytes) {
+        st = sd_mbw_write(&w, &data[off], buf_bytes / SD_BLOCK_SIZE, bus.now());
+        while (st == SD_BUSY || (st == SD_OK && !sd_mbw_idle(&w))) {
+            wait(st);
+            st = sd_mbw_poll(&w, bus.now());
+        }
+    }
+
+    // On a rejected block the writer has already closed the transaction
+    if (st == SD_OK) {
+        st = sd_mbw_stop(&w, bus.now());
+        while (st == SD_BUSY) {
+            wait(st);
+            st = sd_mbw_poll(&w, bus.now());
+        }
+    }
+
+    Result r;
+    r.status = st;
+    r.seconds = bus.now_us / 1e6;
+    r.bus_bytes = bus.bus_bytes;
+    r.busy_polls = w.busy_polls;
+    r.verified = st == SD_OK && card.pre_erase == blocks &&
+                 memcmp(&card.mem[size_t(start_lba) * SD_BLOCK_SIZE], data.data(), bytes) == 0;
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint32_t mb = 4;
+    uint32_t busy_us = 100;
+    uint32_t corrupt_block = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--mb" && i + 1 < argc) mb = uint32_t(atoi(argv[++i]));
+        else if (a == "--busy-us" && i + 1 < argc) busy_us = uint32_t(atoi(argv[++i]));
+        else if (a == "--corrupt-block" && i + 1 < argc) corrupt_block = uint32_t(atoi(argv[++i]));
+        else {
+            fprintf(stderr, "usage: sd_mbw_sim [--mb N] [--busy-us N] [--corrupt-block N]\n");
+            return 2;
+        }
+    }
+
+    const uint32_t clocks[] = {4000000, 12500000, 25000000};
+    bool ok = true;
+
+    printf("%u MiB in 2048-byte buffers, %u us programming per block\n", mb, busy_us);
+    printf("%10s %8s %10s %10s %12s %s\n", "f_spi", "status", "MB/s", "overhead", "busy polls", "data");
+
+    for (uint32_t clk : clocks) {
+        Result r = run(clk, mb << 20, busy_us, corrupt_block);
+        double mbps = (mb << 20) / r.seconds / 1e6;
+        double overhead = double(r.bus_bytes) / (mb << 20) - 1.0;
+        printf("%7.1f MHz %8d %10.3f %9.2f%% %12u %s\n",
+               clk / 1e6, int(r.status), mbps, overhead * 100, r.busy_polls,
+               r.verified ? "ok" : r.status != SD_OK ? "rejected" : "MISMATCH");
+
+        // With --corrupt-block the writer must report the CRC error instead
+        ok &= corrupt_block ? r.status == SD_ERR_CRC : r.verified;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+#include "spectrogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fft.h"
+#include "worker_pool.h"
+
+namespace {
+
+constexpr float DB_MIN = -200;
+
+uint64_t div_up(uint64_t a, uint64_t b) { return (a + b - 1) / b; }
+
+bool read_all(int fd, void *buf, size_t len, uint64_t off)
+{
+    uint8_t *p = static_cast<uint8_t *>(buf);
+    while (len) {
+        ssize_t r = pread(fd, p, len, off_t(off));
+        if (r <= 0)
+            return false;
+        p += r;
+        len -= size_t(r);
+        off += uint64_t(r);
+    }
+    return true;
+}
+
+bool write_all(int fd, const void *buf, size_t len, uint64_t off)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    while (len) {
+        ssize_t w = pwrite(fd, p, len, off_t(off));
+        if (w <= 0)
+            return false;
+        p += w;
+        len -= size_t(w);
+        off += uint64_t(w);
+    }
+    return true;
+}
+
+// FNV-1a over the row's 64-bit words, then mixed with its index so rows
+// can be summed in any order
+uint64_t row_hash(uint64_t r, const float *row, uint32_t bins)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (uint32_t k = 0; k < bins; k += 2) {
+        uint64_t w = 0;
+        memcpy(&w, row + k, (bins - k > 1 ? 2 : 1) * sizeof(float));
+        h = (h ^ w) * 1099511628211ull;
+    }
+    h ^= r * 0x9E3779B97F4A7C15ull;
+    h = (h ^ (h >> 31)) * 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 29);
+}
+
+// row = 10 log10(max(acc * scale, 1e-20)) without libm, so the loop
+// vectorises: x = 2^e m, ln m = 2 atanh((m - 1) / (m + 1)) to the t^9
+// term. Error under 1e-4 dB. The floor is clamped on the bit pattern,
+// which orders like the value for x >= 0.
+void to_db(const float *__restrict acc, float scale, float *__restrict row, uint32_t bins)
+{
+    const int32_t floor_bits = 0x1E3CE508;      // 1e-20f
+    for (uint32_t k = 0; k < bins; k++) {
+        float x = acc[k] * scale;
+        int32_t b;
+        memcpy(&b, &x, sizeof(b));
+        b = b > floor_bits ? b : floor_bits;
+        const float e = float((b >> 23) - 127);
+        b = (b & 0x007FFFFF) | 0x3F800000;
+        float m;
+        memcpy(&m, &b, sizeof(m));
+        const float t = (m - 1) / (m + 1), t2 = t * t;
+        const float ln_m = 2 * t * (1 + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7 + t2 * (1.0f / 9)))));
+        row[k] = 4.3429448f * (e * 0.69314718f + ln_m);
+    }
+}
+
+uint8_t pixel(float db, float lo, float hi)
+{
+    float v = (db - lo) / (hi - lo) * 255.0f + 0.5f;
+    return uint8_t(std::clamp(v, 0.0f, 255.0f));
+}
+
+bool write_pgm(const std::string &path, uint32_t w, uint32_t h, const std::vector<uint8_t> &px)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        perror(path.c_str());
+        return false;
+    }
+    fprintf(f, "P5\n%u %u\n255\n", w, h);
+    bool ok = fwrite(px.data(), 1, px.size(), f) == px.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+        perror(path.c_str());
+    return ok;
+}
+
+// Columns x `height` dB values, column-major, to a PGM with Nyquist on top
+std::vector<uint8_t> image_of(const float *v, uint32_t cols, uint32_t height, float lo, float hi)
+{
+    std::vector<uint8_t> px(size_t(cols) * height);
+    for (uint32_t c = 0; c < cols; c++)
+        for (uint32_t y = 0; y < height; y++)
+            px[size_t(height - 1 - y) * cols + c] = pixel(v[size_t(c) * height + y], lo, hi);
+    return px;
+}
+
+// Max over the bins of each of `height` frequency rows
+void pool_bins(const float *row, uint32_t bins, uint32_t height, float *out)
+{
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t k0 = uint32_t(uint64_t(y) * bins / height);
+        uint32_t k1 = std::max(k0 + 1, uint32_t(uint64_t(y + 1) * bins / height));
+        float m = DB_MIN;
+        for (uint32_t k = k0; k < k1; k++)
+            m = std::max(m, row[k]);
+        out[y] = std::max(out[y], m);
+    }
+}
+
+} // namespace
+
+bool spectrogram(const std::string &source, const SpectroConfig &cfg, SpectroResult &res)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    res = SpectroResult{};
+
+    const uint32_t n = cfg.n, hop = cfg.hop, avg = std::max(1u, cfg.avg);
+    if (n < 8 || (n & (n - 1)) || hop == 0 || cfg.tile_rows == 0) {
+        fprintf(stderr, "spectrogram: n must be a power of two >= 8, hop and tile rows > 0\n");
+        return false;
+    }
+
+    int fd = ::open(source.c_str(), O_RDONLY);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(source.c_str());
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    // A recording that won't stay cached anyway shouldn't push everything
+    // else out of the page cache on its way through
+    const bool drop = uint64_t(st.st_size) > uint64_t(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE) / 2;
+
+    const uint32_t bins = n / 2 + 1;
+    const uint64_t samples = uint64_t(st.st_size) / sizeof(uint16_t);
+    const uint64_t frames = samples >= n ? (samples - n) / hop + 1 : 0;
+    const uint64_t rows = frames / avg;
+    const uint32_t R = cfg.tile_rows;
+    const uint32_t tiles = uint32_t(div_up(rows, R));
+    const uint32_t H = cfg.height ? std::min(cfg.height, bins) : std::min(bins, 512u);
+    const uint32_t W = uint32_t(std::max<uint64_t>(1, std::min<uint64_t>(cfg.width, rows)));
+
+    const unsigned t = workers(cfg.threads, tiles);
+
+    res.samples = samples;
+    res.frames = rows * avg;
+    res.rows = rows;
+    res.bins = bins;
+    res.tiles = tiles;
+    res.threads = t;
+
+    int out = -1;
+    const uint64_t row_bytes = uint64_t(bins) * sizeof(float);
+    if (!cfg.matrix.empty()) {
+        SpectroHeader h{};
+        memcpy(h.magic, SPECTRO_MAGIC, sizeof(h.magic));
+        h.version = SPECTRO_VERSION;
+        h.n = n;
+        h.hop = hop;
+        h.avg = avg;
+        h.bins = bins;
+        h.rows = rows;
+        h.sample_rate = cfg.sample_rate;
+        h.full_scale = cfg.full_scale;
+        out = ::open(cfg.matrix.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0 || !write_all(out, &h, sizeof(h), 0) ||
+            ftruncate(out, off_t(sizeof(h) + rows * row_bytes)) != 0) {
+            perror(cfg.matrix.c_str());
+            if (out >= 0)
+                ::close(out);
+            ::close(fd);
+            return false;
+        }
+    }
+
+    // Periodic Hann; 0 dB is a sine of full_scale codes peak-to-peak
+    std::vector<float> hann(n);
+    double wsum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        hann[i] = float(0.5 - 0.5 * std::cos(2 * M_PI * i / n));
+        wsum += hann[i];
+    }
+    const double ref = std::pow(cfg.full_scale / 2 * wsum / 2, 2);
+    const float scale = float(1.0 / (ref * avg));
+
+    const size_t span = size_t(uint64_t(R) * avg - 1) * hop + n;
+    std::vector<float> overview(size_t(W) * H, DB_MIN);
+    std::mutex overview_lock;
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> digest{0};
+
+    // Buffers of each worker
+    struct Scratch {
+        Fft fft;
+        std::vector<uint16_t> in;
+        std::vector<float> frame, power, acc, block, cols, tile_px;
+    };
+    std::vector<Scratch> scratch(t, Scratch{Fft(n), std::vector<uint16_t>(span), std::vector<float>(n),
+                                            std::vector<float>(bins), std::vector<float>(bins),
+                                            std::vector<float>(size_t(R) * bins), {}, {}});
+
+    parallel_for(tiles, 1, t, [&](size_t tile, size_t, unsigned id) {
+        if (failed)
+            return;
+        Fft &fft = scratch[id].fft;
+        std::vector<uint16_t> &in = scratch[id].in;
+        std::vector<float> &frame = scratch[id].frame, &power = scratch[id].power, &acc = scratch[id].acc;
+        std::vector<float> &block = scratch[id].block, &cols = scratch[id].cols;
+        std::vector<float> &tile_px = scratch[id].tile_px;
+        uint64_t sum = 0;
+
+        const uint64_t r0 = uint64_t(tile) * R, r1 = std::min(r0 + R, rows);
+        const uint64_t s0 = r0 * avg * hop;
+        const size_t len = size_t((r1 * avg - 1) * hop + n - s0);
+        if (!read_all(fd, in.data(), len * sizeof(uint16_t), s0 * sizeof(uint16_t))) {
+            perror(source.c_str());
+            failed = true;
+            return;
+        }
+
+        for (uint64_t r = r0; r < r1; r++) {
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (uint32_t a = 0; a < avg; a++) {
+                const uint16_t *s = in.data() + ((r * avg + a) * hop - s0);
+                uint64_t total = 0;
+                for (uint32_t i = 0; i < n; i++)
+                    total += s[i];
+                const float mean = float(total) / n;
+                for (uint32_t i = 0; i < n; i++)
+                    frame[i] = (float(s[i]) - mean) * hann[i];
+                fft.power(frame.data(), power.data());
+                for (uint32_t k = 0; k < bins; k++)
+                    acc[k] += power[k];
+            }
+            float *row = block.data() + (r - r0) * bins;
+            to_db(acc.data(), scale, row, bins);
+            sum += row_hash(r, row, bins);
+        }
+        // Done with these samples; the next tile only shares n - hop of them
+        if (drop)
+            posix_fadvise(fd, off_t(s0 * sizeof(uint16_t)), off_t(len * sizeof(uint16_t)),
+                          POSIX_FADV_DONTNEED);
+
+        if (out >= 0 && !write_all(out, block.data(), size_t((r1 - r0) * row_bytes),
+                                   sizeof(SpectroHeader) + r0 * row_bytes)) {
+            perror(cfg.matrix.c_str());
+            failed = true;
+            return;
+        }
+
+        if (!cfg.image.empty()) {
+            const uint32_t c0 = uint32_t(r0 * W / rows), c1 = uint32_t((r1 - 1) * W / rows);
+            cols.assign(size_t(c1 - c0 + 1) * H, DB_MIN);
+            for (uint64_t r = r0; r < r1; r++)
+                pool_bins(block.data() + (r - r0) * bins, bins, H,
+                          cols.data() + size_t(r * W / rows - c0) * H);
+            std::lock_guard<std::mutex> lock(overview_lock);
+            float *o = overview.data() + size_t(c0) * H;
+            for (size_t i = 0; i < cols.size(); i++)
+                o[i] = std::max(o[i], cols[i]);
+        }
+
+        if (!cfg.tile_dir.empty()) {
+            const uint32_t w = uint32_t(r1 - r0);
+            tile_px.assign(size_t(w) * H, DB_MIN);
+            for (uint32_t c = 0; c < w; c++)
+                pool_bins(block.data() + size_t(c) * bins, bins, H, tile_px.data() + size_t(c) * H);
+            char name[32];
+            snprintf(name, sizeof(name), "/tile_%05zu.pgm", tile);
+            if (!write_pgm(cfg.tile_dir + name, w, H,
+                           image_of(tile_px.data(), w, H, cfg.db_lo, cfg.db_hi))) {
+                failed = true;
+                return;
+            }
+        }
+        digest += sum;
+    });
+
+    ::close(fd);
+    if (out >= 0 && ::close(out) != 0 && !failed) {
+        perror(cfg.matrix.c_str());
+        failed = true;
+    }
+    if (!failed && !cfg.image.empty() && rows)
+        failed = !write_pgm(cfg.image, W, H, image_of(overview.data(), W, H, cfg.db_lo, cfg.db_hi));
+
+    res.digest = digest;
+    res.work_bytes = t * (span * sizeof(uint16_t) + (size_t(R) + 3) * row_bytes + n * sizeof(float)) +
+                     overview.size() * sizeof(float);
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return !failed;
+}
@@ -0,0 +1,74 @@
+// Short-time Fourier transform of a raw uint16 recording, streamed in time
+// tiles on a thread pool.
+//
+// Frame f is the n samples from f * hop, less their mean, Hann windowed.
+// Row r of the spectrogram is the mean power of frames [r * avg, r * avg +
+// avg), in dB relative to a full-scale sine, for bins 0..n/2. Rows are
+// computed in tiles of tile_rows; a worker reads one tile's samples with
+// pread, transforms it, writes its rows to the matrix file at their offset
+// and merges them into the overview image. Memory is one tile per worker
+// plus the overview, whatever the recording length, and pages of the
+// recording are dropped from the page cache once read, so files larger
+// than RAM stream through.
+//
+// Outputs (each optional):
+//   matrix   SpectroHeader, then rows x bins float32 dB, row-major
+//   image    8-bit PGM overview: one column per `width`-th of the rows,
+//            `height` frequency rows (Nyquist at the top), each pixel the
+//            max over the rows and bins it covers; db_lo..db_hi is black..white
+//   tile_dir tile_NNNNN.pgm per tile at full row resolution, same scale
+//
+// Rows don't depend on the tiling or the thread count, so neither do the
+// outputs or the digest.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+constexpr char SPECTRO_MAGIC[4] = {'A', 'E', 'S', 'P'};
+constexpr uint32_t SPECTRO_VERSION = 1;
+
+struct SpectroHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n;                 // FFT length
+    uint32_t hop;               // samples between frames
+    uint32_t avg;               // frames per row
+    uint32_t bins;              // n / 2 + 1 floats per row
+    uint64_t rows;
+    double sample_rate;         // bin k is k * sample_rate / n Hz
+    double full_scale;          // codes peak-to-peak of a 0 dB sine
+    uint8_t reserved[16];
+};
+static_assert(sizeof(SpectroHeader) == 64, "matrix header layout");
+
+struct SpectroConfig {
+    uint32_t n = 1024;
+    uint32_t hop = 512;
+    uint32_t avg = 1;
+    uint32_t tile_rows = 256;
+    double sample_rate = 4000;
+    double full_scale = 4096;   // 12-bit ADC
+    uint32_t width = 2000;      // overview columns (at most one per row)
+    uint32_t height = 0;        // overview frequency rows, 0 = min(bins, 512)
+    float db_lo = -110;
+    float db_hi = 0;
+    unsigned threads = 0;       // 0 = every core
+    std::string matrix;
+    std::string image;
+    std::string tile_dir;
+};
+
+struct SpectroResult {
+    uint64_t samples = 0;
+    uint64_t frames = 0;        // transformed: rows * avg
+    uint64_t rows = 0;
+    uint32_t bins = 0;
+    uint32_t tiles = 0;
+    unsigned threads = 0;
+    double seconds = 0;
+    size_t work_bytes = 0;      // tile buffers and overview
+    uint64_t digest = 0;        // sum over rows of a hash of (index, row)
+};
+
+bool spectrogram(const std::string &source, const SpectroConfig &cfg, SpectroResult &res);
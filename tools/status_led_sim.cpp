@@ -0,0 +1,218 @@
+// Status LED engine (lib/ae_core/status_led.c) on a simulated clock.
+//
+// Plays a session through the engine: boot, idle, recording with two
+// buffer overruns, a card error. The poll timer runs at LED_FRAME_US with
+// jitter plus bursts of extra polls, and start() stands in for the DMA
+// transfer. Checks that no frame starts before the previous one has been
+// shifted out and latched, that steady states cost one frame, that the
+// animations have their period, duty and brightness bounds, and that an
+// alert gives way to the base state when it expires. --trace prints the
+// frames of one state.
+//
+// usage: status_led_sim [--trace recording|overrun|card-error|boot|idle] [--seconds N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "status_led.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t PIXELS = 2;
+
+struct Frame {
+    uint64_t t_us;
+    uint32_t word;
+};
+
+struct Wire {
+    std::vector<Frame> frames;
+    uint64_t now = 0;
+    uint64_t early = 0;        // starts before the previous frame latched
+};
+
+void wire_start(void *ctx, const uint32_t *words, uint32_t n)
+{
+    Wire *w = static_cast<Wire *>(ctx);
+    if (!w->frames.empty() && w->now < w->frames.back().t_us + led_frame_time_us(n))
+        w->early++;
+    w->frames.push_back(Frame{w->now, words[0]});
+}
+
+uint32_t channel(uint32_t w, int c)
+{
+    return (w >> (24 - 8 * c)) & 0xFF;
+}
+
+// Word shown at t_us: the last frame started at or before it
+uint32_t shown_at(const Wire &w, uint64_t t_us)
+{
+    uint32_t word = 0;
+    for (const Frame &f : w.frames) {
+        if (f.t_us > t_us)
+            break;
+        word = f.word;
+    }
+    return word;
+}
+
+struct Step {
+    uint64_t at_us;
+    bool alert;
+    led_state_t state;
+    uint32_t hold_us;
+};
+
+int simulate()
+{
+    const std::vector<Step> script = {
+        {0, false, LED_BOOT, 0},
+        {400000, false, LED_IDLE, 0},
+        {2000000, false, LED_RECORDING, 0},
+        {5000000, true, LED_OVERRUN, 500000},
+        {5300000, true, LED_OVERRUN, 500000},    // restarts the hold
+        {8000000, false, LED_CARD_ERROR, 0},
+        {11000000, false, LED_IDLE, 0},
+    };
+    const uint64_t end_us = 12000000;
+
+    Wire w;
+    status_led_t led;
+    status_led_init(&led, PIXELS, wire_start, &w);
+
+    uint32_t rng = 1;
+    size_t next_step = 0;
+    uint64_t next_poll = 0;
+    for (w.now = 0; w.now < end_us; w.now += 50) {
+        while (next_step < script.size() && script[next_step].at_us <= w.now) {
+            const Step &s = script[next_step++];
+            if (s.alert)
+                status_led_alert(&led, s.state, s.hold_us);
+            else
+                status_led_set(&led, s.state);
+        }
+        if (w.now >= next_poll) {
+            status_led_poll(&led, w.now);
+            rng = rng * 1664525 + 1013904223;
+            next_poll = w.now + LED_FRAME_US - 3000 + (rng >> 16) % 6000;
+            // Now and then a burst of polls right behind the last one
+            if ((rng >> 8) % 16 == 0)
+                for (int k = 1; k <= 5; k++)
+                    status_led_poll(&led, w.now + k * 50);
+        }
+    }
+
+    printf("%u polls, %u frames, %u polls inside the latch window\n", led.polls, led.frames, led.busy);
+    check(w.early == 0, "no frame before the previous one latched", double(w.early), 0);
+
+    auto frames_between = [&](uint64_t a, uint64_t b) {
+        size_t n = 0;
+        for (const Frame &f : w.frames)
+            n += f.t_us >= a && f.t_us < b;
+        return n;
+    };
+    check(frames_between(0, 400000) == 1, "boot: one frame", double(frames_between(0, 400000)), 1);
+    check(frames_between(400000, 2000000) == 1, "idle: one frame", double(frames_between(400000, 2000000)), 1);
+    check(shown_at(w, 1000000) == led_word(0, LED_LEVEL / 4, 0), "idle is dim green");
+
+    // Recording: red only, 4..LED_LEVEL, darkest at entry, brightest 1 s later
+    uint32_t lo = 255, hi = 0;
+    for (uint64_t t = 2100000; t < 5000000; t += 1000) {
+        uint32_t v = shown_at(w, t);
+        check(channel(v, 1) == 0 && channel(v, 2) == 0, "recording is red only", v, 0);
+        lo = std::min(lo, channel(v, 0));
+        hi = std::max(hi, channel(v, 0));
+    }
+    check(lo <= 8 && hi >= LED_LEVEL - 4, "recording breathes 4..LED_LEVEL", lo, hi);
+    check(channel(shown_at(w, 3010000), 0) >= LED_LEVEL - 4, "recording brightest 1 s in",
+          channel(shown_at(w, 3010000), 0), LED_LEVEL);
+
+    // Overrun: amber flicker while held; the second alert extends it
+    uint32_t amber = 0, samples = 0;
+    for (uint64_t t = 5000000 + LED_FRAME_US; t < 5800000 - LED_FRAME_US; t += 1000) {
+        uint32_t v = shown_at(w, t);
+        samples++;
+        amber += v == led_word(LED_LEVEL, LED_LEVEL / 2, 0);
+        check(v == 0 || v == led_word(LED_LEVEL, LED_LEVEL / 2, 0), "overrun shows amber or off", v, 0);
+    }
+    check(amber > samples * 35 / 100 && amber < samples * 65 / 100, "overrun duty about 50%",
+          double(amber) / samples, 0.5);
+    uint32_t after = shown_at(w, 5900000);
+    check(channel(after, 0) > 0 && channel(after, 1) == 0, "back to recording after the alert", after, 0);
+
+    // Card error: two 100 ms blinks a second
+    uint32_t on = 0;
+    samples = 0;
+    for (uint64_t t = 8100000; t < 11000000; t += 1000, samples++)
+        on += shown_at(w, t) == led_word(LED_LEVEL, 0, 0);
+    check(on > samples * 15 / 100 && on < samples * 25 / 100, "card error on 20% of the time",
+          double(on) / samples, 0.2);
+
+    for (const Frame &f : w.frames)
+        for (int c = 0; c < 3; c++)
+            check(channel(f.word, c) <= LED_LEVEL, "channel above LED_LEVEL", channel(f.word, c), LED_LEVEL);
+
+    // What a poll costs the timer interrupt on this machine
+    status_led_set(&led, LED_RECORDING);
+    auto t0 = std::chrono::steady_clock::now();
+    const uint32_t polls = 1000000;
+    for (uint32_t i = 0; i < polls; i++) {
+        w.now = end_us + uint64_t(i) * LED_FRAME_US;
+        status_led_poll(&led, w.now);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / polls;
+    printf("status_led_poll: %.0f ns per call (host), frame on the wire %u us\n", ns,
+           led_frame_time_us(PIXELS));
+
+    return check_summary();
+}
+
+int trace(const std::string &name, double seconds)
+{
+    static const char *const names[LED_STATES] = {
+        "off", "boot", "idle", "recording", "overrun", "card-error",
+    };
+    int state = -1;
+    for (int s = 0; s < LED_STATES; s++)
+        if (name == names[s])
+            state = s;
+    if (state < 0) {
+        fprintf(stderr, "unknown state %s\n", name.c_str());
+        return 2;
+    }
+
+    uint32_t last = 1;
+    for (uint32_t t = 0; t < uint32_t(seconds * 1000); t += LED_FRAME_US / 1000) {
+        uint32_t px[PIXELS];
+        led_frame(led_state_t(state), t, px, PIXELS);
+        if (px[0] != last)
+            printf("%6u ms  r %3u g %3u b %3u\n", t, channel(px[0], 0), channel(px[0], 1), channel(px[0], 2));
+        last = px[0];
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string name;
+    double seconds = 2;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--trace" && i + 1 < argc) name = argv[++i];
+        else if (a == "--seconds" && i + 1 < argc) seconds = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: status_led_sim [--trace recording|overrun|card-error|boot|idle] [--seconds N]\n");
+            return 2;
+        }
+    }
+    return name.empty() ? simulate() : trace(name, seconds);
+}
@@ -0,0 +1,391 @@
+// Storage error path (lib/ae_core/store.c) against a failing disk.
+//
+// FaultDisk stands in for FatFs on the SD card: it appends to a file in
+// RAM and fails writes the way the card and FatFs do. The failures are
+// transient CRC/SPI errors that leave a partial block, a FIL that stays in
+// error until it is reopened, bus desyncs that only a remount clears, card
+// dropouts (no answer at all, then a card that needs initialising again)
+// and a file position whose writes keep failing, and syncs that fail.
+// Every operation costs simulated time. The logger loop is the one in
+// main.c: a ring of ADC_RING_BLOCKS blocks filled every BUF_PERIOD by "DMA"
+// while the logger, woken every millisecond, drains it through store_push()
+// and syncs every SYNC_EVERY blocks.
+//
+// For every scenario the file plus the gap records must account for every
+// acquired block, in order and bit-exact, and the producer must never find
+// the ring full. Each scenario also has its own checks.
+//
+// usage: store_sim [--seconds N] [--seed N] [--verbose]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "store.h"
+#include "tool_util.h"
+
+namespace {
+
+constexpr uint32_t BLOCK_SAMPLES = 1024;
+constexpr uint32_t BLOCK_BYTES = BLOCK_SAMPLES * 2;
+constexpr uint64_t BUF_PERIOD_US = 256000;      // 1024 samples at 4 kS/s
+constexpr uint32_t RING_BLOCKS = 8;             // ADC_RING_BLOCKS in main.c
+constexpr uint64_t TICK_US = 1000;              // LOG_TICK_US
+constexpr uint32_t SYNC_EVERY = 4;              // ~1 s, SYNC_POLICY_1S
+
+// Error codes as FatFs returns them
+constexpr int FR_DISK_ERR = 1;
+constexpr int FR_INT_ERR = 2;
+constexpr int FR_NOT_READY = 3;
+
+struct Faults {
+    double transient = 0;           // per write
+    double desync = 0;              // per write: fails until remounted
+    uint64_t gone_from_us = 0;      // card doesn't answer in [from, until)
+    uint64_t gone_until_us = 0;
+    int64_t bad_block = -1;         // file block whose writes fail...
+    uint32_t bad_writes = 0;        // ...this many times
+    double sync_fail = 0;           // per sync: fails and leaves the FIL in error
+};
+
+struct FaultDisk {
+    Faults f;
+    std::vector<uint16_t> file;
+    bool fil_error = false;         // FatFs: FIL aborted, until reopened
+    bool desynced = false;          // bus lost: until remounted
+    uint64_t now = 0;
+    uint64_t cost = 0;              // time taken by the last operation
+    uint32_t rng = 1;
+
+    double uniform()
+    {
+        rng = rng * 1664525u + 1013904223u;
+        return (rng >> 8) / double(1u << 24);
+    }
+    // A card that dropped out comes back uninitialised
+    bool gone()
+    {
+        bool g = now >= f.gone_from_us && now < f.gone_until_us;
+        desynced |= g;
+        return g;
+    }
+
+    int write(const void *data, uint32_t bytes)
+    {
+        uint32_t n = bytes / 2;
+        if (gone()) {
+            cost = 250000;          // pico_fatfs gives up after its timeout
+            return FR_NOT_READY;
+        }
+        if (fil_error || desynced) {
+            cost = 10;
+            return FR_INT_ERR;
+        }
+        if (f.bad_block >= 0 && f.bad_writes && file.size() / BLOCK_SAMPLES == uint64_t(f.bad_block)) {
+            f.bad_writes--;
+            cost = 50000;
+            fil_error = true;
+            return FR_DISK_ERR;
+        }
+        double u = uniform();
+        if (u < f.transient + f.desync) {
+            // Part of the block made it before the error
+            const uint16_t *s = static_cast<const uint16_t *>(data);
+            file.insert(file.end(), s, s + n / 2);
+            cost = 20000;
+            fil_error = true;
+            desynced = u < f.desync;
+            return FR_DISK_ERR;
+        }
+        const uint16_t *s = static_cast<const uint16_t *>(data);
+        file.insert(file.end(), s, s + n);
+        cost = 3000 + uint64_t(uniform() * 6000);
+        return 0;
+    }
+
+    int sync()
+    {
+        if (gone()) {
+            cost = 250000;
+            return FR_NOT_READY;
+        }
+        if (fil_error || desynced) {
+            cost = 10;
+            return FR_INT_ERR;
+        }
+        if (f.sync_fail > 0 && uniform() < f.sync_fail) {
+            cost = 20000;
+            fil_error = true;
+            return FR_DISK_ERR;
+        }
+        cost = 15000;
+        return 0;
+    }
+
+    int recover(store_recover_t level, uint64_t good_bytes)
+    {
+        if (level == STORE_REMOUNT) {
+            cost = 150000;          // recovery clocks, f_mount, FAT scan
+            if (gone())
+                return FR_NOT_READY;
+            desynced = false;
+        } else {
+            cost = 5000;
+            if (gone() || desynced)
+                return FR_DISK_ERR;
+        }
+        fil_error = false;
+        file.resize(good_bytes / 2);        // f_lseek + f_truncate
+        return 0;
+    }
+};
+
+int disk_write(void *ctx, const void *data, uint32_t bytes)
+{
+    return static_cast<FaultDisk *>(ctx)->write(data, bytes);
+}
+
+int disk_recover(void *ctx, store_recover_t level, uint64_t good_bytes)
+{
+    return static_cast<FaultDisk *>(ctx)->recover(level, good_bytes);
+}
+
+std::vector<store_gap_t> gap_records;
+
+void on_gap(void *ctx, const store_gap_t *g)
+{
+    (void)ctx;
+    gap_records.push_back(*g);
+}
+
+// Sample k of acquired block b
+uint16_t sample(uint32_t b, uint32_t k)
+{
+    uint32_t h = (b * 2654435761u) ^ (k * 40503u);
+    return uint16_t((h >> 7) & 0x0FFF);
+}
+
+struct Result {
+    store_t st;
+    uint32_t acquired = 0;
+    uint32_t overruns = 0;          // ring full at DMA completion
+    uint64_t longest_call_us = 0;   // one store_push, the logger is stuck that long
+    uint32_t written_after_fault = 0;
+    bool accounted = true;
+};
+
+Result run(const char *name, const Faults &faults, double seconds, uint32_t seed, bool verbose)
+{
+    FaultDisk disk;
+    disk.f = faults;
+    disk.rng = seed;
+    gap_records.clear();
+
+    store_config_t cfg = {};
+    cfg.write = disk_write;
+    cfg.recover = disk_recover;
+    cfg.gap = on_gap;
+    cfg.ctx = &disk;
+    cfg.block_bytes = BLOCK_BYTES;
+    cfg.retry_us = 20000;
+    cfg.retry_max_us = 500000;
+    cfg.max_attempts = 4;
+    cfg.remount_after = 3;
+    cfg.drop_backlog = RING_BLOCKS - 2;
+
+    Result res;
+    store_init(&res.st, &cfg);
+
+    std::vector<uint16_t> ring(RING_BLOCKS * BLOCK_SAMPLES);
+    std::vector<uint64_t> ring_time(RING_BLOCKS);
+    std::vector<uint32_t> ring_seq(RING_BLOCKS);
+    uint32_t head = 0, tail = 0;
+    uint64_t next_done = BUF_PERIOD_US;
+    const uint64_t end_us = uint64_t(seconds * 1e6);
+
+    // DMA completions up to disk.now; a full ring loses the block
+    auto produce = [&]() {
+        while (next_done <= disk.now && next_done <= end_us) {
+            uint32_t b = res.acquired++;
+            if (head + 1 - tail < RING_BLOCKS) {
+                uint32_t slot = head & (RING_BLOCKS - 1);
+                for (uint32_t k = 0; k < BLOCK_SAMPLES; k++)
+                    ring[slot * BLOCK_SAMPLES + k] = sample(b, k);
+                ring_time[slot] = next_done;
+                ring_seq[slot] = b;
+                head++;
+            } else {
+                res.overruns++;
+            }
+            next_done += BUF_PERIOD_US;
+        }
+    };
+
+    for (disk.now = 0; disk.now < end_us + 4 * BUF_PERIOD_US; disk.now += TICK_US) {
+        produce();
+        // logging_write_buffer() until nothing more can be done this tick
+        while (tail != head) {
+            uint32_t slot = tail & (RING_BLOCKS - 1);
+            if (ring_seq[slot] != res.st.block) {
+                res.accounted = false;      // ring and store out of step
+                break;
+            }
+            disk.cost = 0;
+            store_action_t a = store_push(&res.st, &ring[slot * BLOCK_SAMPLES], ring_time[slot],
+                                          head - tail, disk.now);
+            res.longest_call_us = std::max(res.longest_call_us, disk.cost);
+            disk.now += disk.cost;
+            if (a == STORE_WAIT) {
+                produce();
+                break;
+            }
+            if (a == STORE_WRITTEN && faults.gone_until_us && disk.now > faults.gone_until_us)
+                res.written_after_fault++;
+            if (a == STORE_WRITTEN && res.st.writes % SYNC_EVERY == 0) {
+                disk.cost = 0;
+                int r = disk.sync();
+                disk.now += disk.cost;
+                if (r != 0)
+                    store_sync_failed(&res.st, r, disk.now);
+            }
+            tail++;
+            produce();
+        }
+    }
+    store_finish(&res.st);
+
+    // The file and the gap records together must be the acquired blocks
+    size_t gi = 0;
+    uint32_t fb = 0;
+    uint32_t lost = 0;
+    for (uint32_t b = 0; b < res.acquired && res.accounted; b++) {
+        if (gi < gap_records.size() && b >= gap_records[gi].block &&
+            b < gap_records[gi].block + gap_records[gi].blocks) {
+            if (b == gap_records[gi].block && gap_records[gi].file_block != fb)
+                res.accounted = false;
+            lost++;
+            if (b + 1 == gap_records[gi].block + gap_records[gi].blocks)
+                gi++;
+            continue;
+        }
+        if ((fb + 1) * size_t(BLOCK_SAMPLES) > disk.file.size()) {
+            res.accounted = false;
+            break;
+        }
+        for (uint32_t k = 0; k < BLOCK_SAMPLES; k++)
+            if (disk.file[fb * BLOCK_SAMPLES + k] != sample(b, k))
+                res.accounted = false;
+        fb++;
+    }
+    if (fb * size_t(BLOCK_SAMPLES) != disk.file.size() || gi != gap_records.size() ||
+        lost != res.st.dropped)
+        res.accounted = false;
+
+    const store_t &s = res.st;
+    printf("%-12s %6lu %6lu %6lu %6lu %6lu %6lu %6lu %5lu %5lu %8.1f\n", name,
+           (unsigned long)res.acquired, (unsigned long)s.writes, (unsigned long)s.errors,
+           (unsigned long)s.retries, (unsigned long)s.reopens, (unsigned long)s.remounts,
+           (unsigned long)s.dropped, (unsigned long)s.gaps, (unsigned long)s.backlog_peak,
+           res.longest_call_us / 1000.0);
+    if (verbose)
+        for (const store_gap_t &g : gap_records)
+            printf("    gap: blocks %lu..%lu (%lu), file block %lu, t %.3f s, error %ld\n",
+                   (unsigned long)g.block, (unsigned long)(g.block + g.blocks - 1),
+                   (unsigned long)g.blocks, (unsigned long)g.file_block, g.t_us / 1e6,
+                   (long)g.error);
+
+    check(res.accounted, name, "file + gap records == acquired blocks");
+    check(res.overruns == 0, name, "ring never full at DMA completion", res.overruns, 0);
+    check(s.writes + s.dropped == res.acquired, name, "every block written or dropped",
+          s.writes + s.dropped, res.acquired);
+    return res;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    double seconds = 600;
+    uint32_t seed = 1;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--seconds" && i + 1 < argc) seconds = atof(argv[++i]);
+        else if (a == "--seed" && i + 1 < argc) seed = uint32_t(strtoul(argv[++i], nullptr, 0));
+        else if (a == "--verbose") verbose = true;
+        else {
+            fprintf(stderr, "usage: store_sim [--seconds N] [--seed N] [--verbose]\n");
+            return 2;
+        }
+    }
+    if (seconds < 60) {
+        fprintf(stderr, "store_sim: --seconds must be at least 60 (the dropouts start at 20 s)\n");
+        return 2;
+    }
+
+    printf("%.0f s per scenario, blocks of %u samples every %.0f ms, ring of %u\n\n", seconds,
+           BLOCK_SAMPLES, BUF_PERIOD_US / 1000.0, RING_BLOCKS);
+    printf("%-12s %6s %6s %6s %6s %6s %6s %6s %5s %5s %8s\n", "scenario", "blocks", "writes",
+           "errors", "retry", "reopen", "remnt", "lost", "gaps", "peak", "stall_ms");
+
+    Faults clean;
+    Result r = run("clean", clean, seconds, seed, verbose);
+    check(r.st.errors == 0 && r.st.gaps == 0, "clean", "no errors, no gaps", r.st.errors, 0);
+
+    Faults transient;
+    transient.transient = 0.02;
+    r = run("transient", transient, seconds, seed, verbose);
+    check(r.st.errors > 0, "transient", "faults were injected", r.st.errors, 1);
+    check(r.st.dropped == 0, "transient", "nothing lost", r.st.dropped, 0);
+    check(r.st.reopens >= r.st.errors, "transient", "every failed write reopens the file",
+          r.st.reopens, r.st.errors);
+
+    Faults desync;
+    desync.desync = 0.01;
+    r = run("desync", desync, seconds, seed, verbose);
+    check(r.st.remounts > 0, "desync", "remounted", r.st.remounts, 1);
+    check(r.st.dropped == 0, "desync", "nothing lost", r.st.dropped, 0);
+
+    Faults short_drop;
+    short_drop.gone_from_us = 20000000;
+    short_drop.gone_until_us = 20500000;
+    r = run("dropout 0.5s", short_drop, seconds, seed, verbose);
+    check(r.st.remounts > 0, "dropout 0.5s", "remounted", r.st.remounts, 1);
+    check(r.written_after_fault > 0, "dropout 0.5s", "recording resumed", r.written_after_fault, 1);
+
+    Faults long_drop;
+    long_drop.gone_from_us = 20000000;
+    long_drop.gone_until_us = 25000000;
+    r = run("dropout 5s", long_drop, seconds, seed, verbose);
+    check(r.st.gaps == 1, "dropout 5s", "one gap record", r.st.gaps, 1);
+    check(r.st.dropped >= 14 && r.st.dropped <= 26, "dropout 5s", "about 5 s of blocks lost",
+          r.st.dropped, 20);
+    check(r.written_after_fault > 0, "dropout 5s", "recording resumed", r.written_after_fault, 1);
+
+    // Ten failures at one position: at least two blocks given up after
+    // max_attempts each, more if the backoff lets the backlog build up
+    Faults bad;
+    bad.bad_block = 100;
+    bad.bad_writes = 10;
+    r = run("bad block", bad, seconds, seed, verbose);
+    check(r.st.dropped >= 2 && r.st.gaps == 1, "bad block", "blocks lost in one gap",
+          r.st.dropped, 2);
+    check(r.st.errors == 10, "bad block", "every injected failure seen", r.st.errors, 10);
+
+    // A failed sync is recovered like a failed write, before the next block
+    Faults sync_fail;
+    sync_fail.sync_fail = 0.05;
+    r = run("sync fail", sync_fail, seconds, seed, verbose);
+    check(r.st.sync_errors > 0, "sync fail", "faults were injected", r.st.sync_errors, 1);
+    check(r.st.errors == 0, "sync fail", "no write after a failed sync fails", r.st.errors, 0);
+    check(r.st.reopens >= r.st.sync_errors, "sync fail", "every failed sync reopens the file",
+          r.st.reopens, r.st.sync_errors);
+    check(r.st.dropped == 0, "sync fail", "nothing lost", r.st.dropped, 0);
+
+    printf("\n");
+    return check_summary();
+}
@@ -0,0 +1,51 @@
+// Helpers shared by the host tools.
+//
+// The self-checking tools (--bench, or the simulators on their own) count
+// failed check()s and end with check_summary(), whose result is main()'s
+// exit status.
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+inline double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// path with its extension (if any) replaced by ext, e.g. ".sum".
+inline std::string with_ext(const std::string &path, const char *ext)
+{
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + ext;
+    return path.substr(0, dot) + ext;
+}
+
+inline int check_failures = 0;
+
+inline void check(bool ok, const char *what, double got = 0, double want = 0)
+{
+    if (!ok) {
+        printf("FAIL: %s (got %g, expected %g)\n", what, got, want);
+        check_failures++;
+    }
+}
+
+// The same for a check of one scenario of a simulation.
+inline void check(bool ok, const char *scenario, const char *what, double got = 0, double want = 0)
+{
+    if (!ok) {
+        printf("FAIL: %s: %s (got %g, expected %g)\n", scenario, what, got, want);
+        check_failures++;
+    }
+}
+
+// Prints the verdict; 0 if every check passed.
+inline int check_summary()
+{
+    printf(check_failures ? "%d checks FAILED\n" : "all checks passed\n", check_failures);
+    return check_failures ? 1 : 0;
+}
@@ -0,0 +1,43 @@
+// Worker pool for the host tools.
+//
+// parallel_for() hands out chunks of an index range through an atomic
+// counter, so uneven chunks balance themselves; the calling thread is
+// worker 0. Kept out of tool_util.h: <thread> cannot be included next to
+// ae_core, whose sched.h shadows the system one.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Workers parallel_for() uses for n items in chunks of `chunk`; threads == 0
+// means every core.
+inline unsigned workers(unsigned threads, size_t n, size_t chunk = 1)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunks = (n + chunk - 1) / chunk;
+    return unsigned(std::max<size_t>(1, std::min<size_t>(threads, chunks)));
+}
+
+// fn(begin, end, worker) over [0, n) in chunks, worker < workers().
+template <class Fn>
+void parallel_for(size_t n, size_t chunk, unsigned threads, Fn fn)
+{
+    unsigned t = workers(threads, n, chunk);
+    size_t chunks = (n + chunk - 1) / chunk;
+    std::atomic<size_t> next{0};
+    auto worker = [&](unsigned id) {
+        for (size_t c; (c = next++) < chunks;)
+            fn(c * chunk, std::min(n, (c + 1) * chunk), id);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < t; w++)
+        pool.emplace_back(worker, w);
+    worker(0);
+    for (auto &th : pool)
+        th.join();
+}